@@ -0,0 +1,876 @@
+/*
+	Benchmark.m
+	NDTrie
+
+	Measures NDTrie on seeded synthetic corpora and the bundled sample files, every measurement is written to
+	stdout as one JSON object a line so runs can be kept and compared. Options are read with NSUserDefaults, for
+	example
+
+		NDTrieBenchmark -keys 200000 -seed 7 -runs 5 -corpora uniform,zipf -variants compressed -samples ~/ndtrie
+
+	keys		the number of keys in each synthetic corpus, default 100000
+	seed		the seed for the corpora and the order of operations, default 1
+	runs		how many times each measurement is repeated after a warm up run that is not reported, default 3
+	corpora		comma separated, any of uniform, zipf, prefix, unicode, sample, default all of them
+	variants	comma separated, any of plain, compressed, default both
+	samples		the directory containing sample_file_xml.plist and sample_file_binary.plist, default the directory
+				this file was compiled from
+ */
+
+#import <Foundation/Foundation.h>
+#import "NDTrie.h"
+#include <mach/mach_time.h>
+#include <dispatch/dispatch.h>
+#include <malloc/malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*
+	splitmix64, used instead of random() so a seed gives the same corpus on every platform
+ */
+struct benchmarkRandom
+{
+	uint64_t		state;
+};
+
+struct latencySamples
+{
+	uint64_t		* ticks;
+	NSUInteger		count,
+					capacity;
+};
+
+static uint64_t nextRandom( struct benchmarkRandom * aRandom );
+static NSUInteger nextRandomBelow( struct benchmarkRandom * aRandom, NSUInteger aLimit );
+static double * createZipfTable( NSUInteger aCount, double anExponent );
+static NSUInteger nextZipf( struct benchmarkRandom * aRandom, const double * aTable, NSUInteger aCount );
+
+static NSArray * uniformCorpus( NSUInteger aCount, uint64_t aSeed );
+static NSArray * zipfCorpus( NSUInteger aCount, uint64_t aSeed );
+static NSArray * sharedPrefixCorpus( NSUInteger aCount, uint64_t aSeed );
+static NSArray * unicodeCorpus( NSUInteger aCount, uint64_t aSeed );
+static NSArray * sampleCorpus( NSString * aDirectory );
+static NSArray * shuffledArray( NSArray * anArray, uint64_t aSeed );
+static NSArray * missingKeys( NSArray * aKeys, uint64_t aSeed );
+
+static double secondsForTicks( uint64_t aTicks );
+static void addSample( struct latencySamples * aSamples, uint64_t aTicks );
+static NSDictionary * latencySummary( struct latencySamples * aSamples );
+static size_t heapBytesInUse( void );
+static size_t peakResidentBytes( void );
+static void report( NSDictionary * aRecord );
+static void reportMeasurement( NSString * aCorpus, NSString * aVariant, NSString * aBenchmark, NSUInteger aRun, NSUInteger anOperations, uint64_t aTicks, NSDictionary * anExtra );
+
+static void benchmarkCorpus( NSString * aCorpus, NSArray * aKeys, NSString * aVariant, NSDictionary * aSettings );
+#if NDTrieUseDispatch
+static void benchmarkConcurrentReads( NSString * aCorpus, NSArray * aKeys, NSString * aVariant, NSDictionary * aSettings );
+#endif
+static void benchmarkSampleFiles( NSString * aDirectory, NSDictionary * aSettings );
+
+int main (int argc, const char * argv[])
+{
+	@autoreleasepool
+	{
+		NSUserDefaults		* theDefaults = [NSUserDefaults standardUserDefaults];
+		[theDefaults registerDefaults:[NSDictionary dictionaryWithObjectsAndKeys:
+									   [NSNumber numberWithInteger:100000], @"keys",
+									   [NSNumber numberWithInteger:1], @"seed",
+									   [NSNumber numberWithInteger:3], @"runs",
+									   @"uniform,zipf,prefix,unicode,sample", @"corpora",
+									   @"plain,compressed", @"variants",
+									   [[NSString stringWithUTF8String:__FILE__] stringByDeletingLastPathComponent], @"samples",
+									   nil]];
+
+		NSUInteger			theKeyCount = (NSUInteger)[theDefaults integerForKey:@"keys"];
+		uint64_t			theSeed = (uint64_t)[theDefaults integerForKey:@"seed"];
+		NSString			* theSamples = [[theDefaults stringForKey:@"samples"] stringByExpandingTildeInPath];
+		NSDictionary		* theSettings = [NSDictionary dictionaryWithObjectsAndKeys:
+											 [NSNumber numberWithUnsignedInteger:theKeyCount], @"keys",
+											 [NSNumber numberWithUnsignedLongLong:theSeed], @"seed",
+											 [NSNumber numberWithInteger:[theDefaults integerForKey:@"runs"]], @"runs",
+											 nil];
+
+		report( [NSDictionary dictionaryWithObjectsAndKeys:
+				 @"environment", @"benchmark",
+				 [[NSDate date] description], @"date",
+				 [[NSProcessInfo processInfo] operatingSystemVersionString], @"os",
+				 [NSNumber numberWithUnsignedInteger:[[NSProcessInfo processInfo] activeProcessorCount]], @"cores",
+				 [NSNumber numberWithInt:NDTrieUseNodeArena], @"NDTrieUseNodeArena",
+				 [NSNumber numberWithInt:NDTrieUseInlineChildKeys], @"NDTrieUseInlineChildKeys",
+				 [NSNumber numberWithInt:NDTrieUseDispatch], @"NDTrieUseDispatch",
+				 theSettings, @"settings",
+				 nil] );
+
+		for( NSString * theCorpus in [[theDefaults stringForKey:@"corpora"] componentsSeparatedByString:@","] )
+		{
+			@autoreleasepool
+			{
+				NSArray		* theKeys = nil;
+				if( [theCorpus isEqualToString:@"uniform"] )
+					theKeys = uniformCorpus( theKeyCount, theSeed );
+				else if( [theCorpus isEqualToString:@"zipf"] )
+					theKeys = zipfCorpus( theKeyCount, theSeed );
+				else if( [theCorpus isEqualToString:@"prefix"] )
+					theKeys = sharedPrefixCorpus( theKeyCount, theSeed );
+				else if( [theCorpus isEqualToString:@"unicode"] )
+					theKeys = unicodeCorpus( theKeyCount, theSeed );
+				else if( [theCorpus isEqualToString:@"sample"] )
+				{
+					theKeys = sampleCorpus( theSamples );
+					benchmarkSampleFiles( theSamples, theSettings );
+				}
+				else
+				{
+					fprintf( stderr, "unknown corpus %s\n", [theCorpus UTF8String] );
+					return 1;
+				}
+
+				for( NSString * theVariant in [[theDefaults stringForKey:@"variants"] componentsSeparatedByString:@","] )
+				{
+					benchmarkCorpus( theCorpus, theKeys, theVariant, theSettings );
+#if NDTrieUseDispatch
+					benchmarkConcurrentReads( theCorpus, theKeys, theVariant, theSettings );
+#endif
+				}
+			}
+		}
+
+		report( [NSDictionary dictionaryWithObjectsAndKeys:
+				 @"process", @"benchmark",
+				 [NSNumber numberWithUnsignedLongLong:peakResidentBytes()], @"peakResidentBytes",
+				 nil] );
+	}
+	return 0;
+}
+
+#pragma mark - measurements
+
+/*
+	every measurement is made runs+1 times and the first is thrown away, the order of the keys for each run comes from
+	the seed so two runs of the benchmark do the same work
+ */
+void benchmarkCorpus( NSString * aCorpus, NSArray * aKeys, NSString * aVariant, NSDictionary * aSettings )
+{
+	NDTrieOptions		theOptions = [aVariant isEqualToString:@"compressed"] ? NDTriePathCompression : 0;
+	uint64_t			theSeed = [[aSettings objectForKey:@"seed"] unsignedLongLongValue];
+	NSUInteger			theRuns = [[aSettings objectForKey:@"runs"] unsignedIntegerValue],
+						theCount = aKeys.count;
+	NSArray				* theLookups = shuffledArray( aKeys, theSeed+1 ),
+						* theMisses = missingKeys( aKeys, theSeed+2 ),
+						* theRemovals = shuffledArray( aKeys, theSeed+3 );
+	NSMutableArray		* thePrefixes = [NSMutableArray arrayWithCapacity:theCount/10+1],
+						* theHalves = [NSMutableArray arrayWithCapacity:theCount];
+	NSRegularExpression	* theExpression = [NSRegularExpression regularExpressionWithPattern:@"^(?:[a-m]+[n-z]+)+$" options:0 error:NULL];
+	BOOL (^thePredicate)(id,BOOL*) = ^BOOL(id anObject, BOOL * aStop){
+		return [theExpression numberOfMatchesInString:anObject options:0 range:NSMakeRange(0,[anObject length])] > 0;
+	};
+	NSString			* theDirectory = NSTemporaryDirectory();
+	NSString			* theBinaryPath = [theDirectory stringByAppendingPathComponent:[NSString stringWithFormat:@"NDTrieBenchmark-%d.trie", getpid()]],
+						* theWordListPath = [theDirectory stringByAppendingPathComponent:[NSString stringWithFormat:@"NDTrieBenchmark-%d.txt", getpid()]],
+						* thePListPath = [theDirectory stringByAppendingPathComponent:[NSString stringWithFormat:@"NDTrieBenchmark-%d.plist", getpid()]];
+
+	/* prefixes of one to three characters of random keys, short enough to have a lot of matches */
+	for( NSUInteger i = 0; i < theCount/10+1 && i < theLookups.count; i++ )
+	{
+		NSString	* theKey = [theLookups objectAtIndex:i];
+		NSUInteger	theLength = 1 + i%3;
+		[thePrefixes addObject:[theKey substringToIndex:[theKey rangeOfComposedCharacterSequencesForRange:NSMakeRange(0, theLength < theKey.length ? theLength : theKey.length)].length]];
+	}
+
+	/* the first half of every key, a lookup that is mostly searching the children of each node */
+	for( NSString * theKey in theLookups )
+		[theHalves addObject:[theKey substringToIndex:[theKey rangeOfComposedCharacterSequencesForRange:NSMakeRange(0, (theKey.length+1)/2)].length]];
+
+	[[[aKeys componentsJoinedByString:@"\n"] stringByAppendingString:@"\n"] writeToFile:theWordListPath atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+
+	for( NSUInteger theRun = 0; theRun <= theRuns; theRun++ )
+	{
+		@autoreleasepool
+		{
+			NSUInteger				theReportRun = theRun - 1;			// run 0 is the warm up
+			uint64_t				theStart;
+			size_t					theHeapBefore = heapBytesInUse();
+			NDMutableTrie			* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions];
+			struct latencySamples	theSamples = { NULL, 0, 0 };
+
+			/* build a key at a time */
+			theStart = mach_absolute_time();
+			for( NSString * theKey in aKeys )
+				[theTrie addString:theKey];
+			uint64_t				theTicks = mach_absolute_time() - theStart;
+			size_t					theHeapAfter = heapBytesInUse();
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"build", theReportRun, theCount, theTicks, [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithDouble:theHeapAfter > theHeapBefore ? (double)(theHeapAfter - theHeapBefore)/theCount : 0.0], @"bytesPerKey", nil] );
+
+			/* build from the whole array */
+			theStart = mach_absolute_time();
+			NDTrie					* theBulkTrie = [[NDTrie alloc] initWithOptions:theOptions array:aKeys];
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"build-bulk", theReportRun, theCount, theTicks, nil );
+			[theBulkTrie release];
+
+			/* the same again with the subtrees built on every core */
+			theStart = mach_absolute_time();
+			NDTrie					* theConcurrentTrie = [[NDTrie alloc] initWithOptions:theOptions|NDTrieConcurrentBuild array:aKeys];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theConcurrentTrie.count == theCount, @"concurrent build has %lu of %lu", (unsigned long)theConcurrentTrie.count, (unsigned long)theCount );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"build-concurrent", theReportRun, theCount, theTicks, nil );
+			[theConcurrentTrie release];
+
+			/* objectForKey: for every key in random order, each timed on its own for the percentiles */
+			theStart = mach_absolute_time();
+			for( NSString * theKey in theLookups )
+			{
+				uint64_t	theLookupStart = mach_absolute_time();
+				id			theObject = [theTrie objectForKey:theKey];
+				addSample( &theSamples, mach_absolute_time() - theLookupStart );
+				NSCAssert( theObject != nil, @"lookup of %@ failed", theKey );
+			}
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"lookup", theReportRun, theCount, theTicks, latencySummary( &theSamples ) );
+
+			theSamples.count = 0;
+			theStart = mach_absolute_time();
+			for( NSString * theKey in theMisses )
+			{
+				uint64_t	theLookupStart = mach_absolute_time();
+				id			theObject = [theTrie objectForKey:theKey];
+				addSample( &theSamples, mach_absolute_time() - theLookupStart );
+				NSCAssert( theObject == nil, @"found %@ which is not in the corpus", theKey );
+			}
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"lookup-miss", theReportRun, theMisses.count, theTicks, latencySummary( &theSamples ) );
+
+			/* objectsForKeys:notFoundMarker: with the same keys in batches of 256, each batch timed for the percentiles */
+			theSamples.count = 0;
+			theStart = mach_absolute_time();
+			for( NSUInteger i = 0; i < theCount; i += 256 )
+			{
+				@autoreleasepool
+				{
+					NSArray		* theBatch = [theLookups subarrayWithRange:NSMakeRange( i, theCount-i < 256 ? theCount-i : 256 )];
+					uint64_t	theBatchStart = mach_absolute_time();
+					NSArray		* theObjects = [theTrie objectsForKeys:theBatch notFoundMarker:[NSNull null]];
+					addSample( &theSamples, mach_absolute_time() - theBatchStart );
+					NSCAssert( ![theObjects containsObject:[NSNull null]], @"batch lookup failed" );
+				}
+			}
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"lookup-batch", theReportRun, theCount, theTicks, latencySummary( &theSamples ) );
+
+			/* everyObjectForKeyWithPrefix:, how many strings came back is reported so the query size is known */
+			NSUInteger				theMatches = 0;
+			theSamples.count = 0;
+			theStart = mach_absolute_time();
+			for( NSString * thePrefix in thePrefixes )
+			{
+				@autoreleasepool
+				{
+					uint64_t	thePrefixStart = mach_absolute_time();
+					theMatches += [[theTrie everyObjectForKeyWithPrefix:thePrefix] count];
+					addSample( &theSamples, mach_absolute_time() - thePrefixStart );
+				}
+			}
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+			{
+				NSMutableDictionary	* theExtra = [NSMutableDictionary dictionaryWithDictionary:latencySummary( &theSamples )];
+				[theExtra setObject:[NSNumber numberWithUnsignedInteger:theMatches] forKey:@"matches"];
+				reportMeasurement( aCorpus, aVariant, @"prefix", theReportRun, thePrefixes.count, theTicks, theExtra );
+			}
+
+			NSUInteger				theContained = 0;
+			theStart = mach_absolute_time();
+			for( NSString * theHalf in theHalves )
+				theContained += [theTrie containsObjectForKeyWithPrefix:theHalf] ? 1 : 0;
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theContained == theHalves.count, @"found %lu of %lu prefixes", (unsigned long)theContained, (unsigned long)theHalves.count );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"prefix-contains", theReportRun, theHalves.count, theTicks, nil );
+
+			/* typing keys a character at a time, asking for every completion after each, from scratch and with a session */
+			NSArray					* theTyped = [theLookups subarrayWithRange:NSMakeRange( 0, theCount/100+1 < theCount ? theCount/100+1 : theCount )];
+			NSUInteger				theKeystrokes = 0,
+									theCompletions = 0;
+			theStart = mach_absolute_time();
+			for( NSString * theKey in theTyped )
+			{
+				@autoreleasepool
+				{
+					for( NSUInteger i = 1; i <= theKey.length; i++ )
+						theCompletions += [[theTrie everyObjectForKeyWithPrefix:[theKey substringToIndex:i]] count];
+					theKeystrokes += theKey.length;
+				}
+			}
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"typeahead", theReportRun, theKeystrokes, theTicks, [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:theCompletions] forKey:@"matches"] );
+
+			NDTrieCompletionSession	* theSession = [[NDTrieCompletionSession alloc] initWithTrie:theTrie];
+			theCompletions = 0;
+			theStart = mach_absolute_time();
+			for( NSString * theKey in theTyped )
+			{
+				@autoreleasepool
+				{
+					[theSession reset];
+					for( NSUInteger i = 0; i < theKey.length; i++ )
+					{
+						unichar		theCharacter = [theKey characterAtIndex:i];
+						[theSession appendCharacters:&theCharacter length:1];
+						theCompletions += [[theSession everyObject] count];
+					}
+				}
+			}
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"typeahead-session", theReportRun, theKeystrokes, theTicks, [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:theCompletions] forKey:@"matches"] );
+			[theSession release];
+
+			/* fast enumeration of everything */
+			NSUInteger				theEnumerated = 0;
+			theStart = mach_absolute_time();
+			for( NSString * theKey in theTrie )
+				theEnumerated++;
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theEnumerated == theCount, @"enumerated %lu of %lu", (unsigned long)theEnumerated, (unsigned long)theCount );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"enumerate", theReportRun, theEnumerated, theTicks, nil );
+
+			/* a predicate costly enough to be worth spreading over every core, on the calling thread and then concurrently */
+			theStart = mach_absolute_time();
+			NSArray					* theFiltered = [theTrie everyObjectPassingTest:thePredicate];
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"filter", theReportRun, theCount, theTicks, [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:theFiltered.count] forKey:@"matches"] );
+
+			theStart = mach_absolute_time();
+			NSArray					* theConcurrentFiltered = [theTrie everyObjectWithOptions:NSEnumerationConcurrent passingTest:thePredicate];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( [theConcurrentFiltered isEqualToArray:theFiltered], @"the concurrent filter gave different strings" );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"filter-concurrent", theReportRun, theCount, theTicks, [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:theConcurrentFiltered.count] forKey:@"matches"] );
+
+			/* a copy shares the nodes of the trie, so should take the same time for any size */
+			theStart = mach_absolute_time();
+			NDMutableTrie			* theCopy = [theTrie mutableCopy];
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"copy", theReportRun, 1, theTicks, nil );
+
+			/* the first changes to a copy are the ones that copy the nodes it shares */
+			NDMutableTrie			* theChanged = [theTrie mutableCopy];
+			NSUInteger				theChanges = theMisses.count < 1000 ? theMisses.count : 1000;
+			theStart = mach_absolute_time();
+			for( NSUInteger i = 0; i < theChanges; i++ )
+				[theChanged addString:[theMisses objectAtIndex:i]];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theChanged.count == theCount + theChanges, @"the changed copy has %lu keys", (unsigned long)theChanged.count );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"copy-change", theReportRun, theChanges, theTicks, nil );
+			[theChanged release];
+
+			/* remove every key in random order from the copy */
+			theStart = mach_absolute_time();
+			for( NSString * theKey in theRemovals )
+				[theCopy removeObjectForKey:theKey];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theCopy.count == 0, @"%lu keys left after removing them all", (unsigned long)theCopy.count );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"remove", theReportRun, theCount, theTicks, nil );
+			[theCopy release];
+
+			/* write the binary form and map it back in, then the text forms */
+			theStart = mach_absolute_time();
+			BOOL					theWritten = [theTrie writeBinaryToFile:theBinaryPath atomically:NO];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theWritten, @"failed to write %@", theBinaryPath );
+			NSNumber				* theFileSize = [[[NSFileManager defaultManager] attributesOfItemAtPath:theBinaryPath error:NULL] objectForKey:NSFileSize];
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"save-binary", theReportRun, theCount, theTicks, [NSDictionary dictionaryWithObject:theFileSize forKey:@"bytes"] );
+
+			theStart = mach_absolute_time();
+			NDTrie					* theMappedTrie = [[NDTrie alloc] initWithMappedContentsOfFile:theBinaryPath];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theMappedTrie.count == theCount, @"mapped trie has %lu of %lu", (unsigned long)theMappedTrie.count, (unsigned long)theCount );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"load-mapped", theReportRun, theCount, theTicks, [NSDictionary dictionaryWithObject:theFileSize forKey:@"bytes"] );
+
+			theSamples.count = 0;
+			theStart = mach_absolute_time();
+			for( NSString * theKey in theLookups )
+			{
+				uint64_t	theLookupStart = mach_absolute_time();
+				id			theObject = [theMappedTrie objectForKey:theKey];
+				addSample( &theSamples, mach_absolute_time() - theLookupStart );
+				NSCAssert( theObject != nil, @"mapped lookup of %@ failed", theKey );
+			}
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"lookup-mapped", theReportRun, theCount, theTicks, latencySummary( &theSamples ) );
+			[theMappedTrie release];
+
+			theStart = mach_absolute_time();
+			NDTrie					* theWordListTrie = [[NDTrie alloc] initWithOptions:theOptions contentsOfWordListFile:theWordListPath progress:nil];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theWordListTrie.count == theCount, @"word list trie has %lu of %lu", (unsigned long)theWordListTrie.count, (unsigned long)theCount );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"load-wordlist", theReportRun, theCount, theTicks, nil );
+			[theWordListTrie release];
+
+			[theTrie writeToFile:thePListPath atomically:NO];
+			theStart = mach_absolute_time();
+			NDTrie					* thePListTrie = [[NDTrie alloc] initWithContentsOfFile:thePListPath];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( thePListTrie.count == theCount, @"plist trie has %lu of %lu", (unsigned long)thePListTrie.count, (unsigned long)theCount );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"load-plist", theReportRun, theCount, theTicks, nil );
+			[thePListTrie release];
+
+			/* take out every other key and put it back, what is freed should be reused */
+			theStart = mach_absolute_time();
+			for( NSUInteger i = 0; i < theCount; i += 2 )
+				[theTrie removeObjectForKey:[theLookups objectAtIndex:i]];
+			for( NSUInteger i = 0; i < theCount; i += 2 )
+				[theTrie addString:[theLookups objectAtIndex:i]];
+			theTicks = mach_absolute_time() - theStart;
+			NSCAssert( theTrie.count == theCount, @"%lu of %lu keys after removing and adding them again", (unsigned long)theTrie.count, (unsigned long)theCount );
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"churn", theReportRun, (theCount+1)/2*2, theTicks, nil );
+
+			free( theSamples.ticks );
+			theStart = mach_absolute_time();
+			[theTrie release];
+			theTicks = mach_absolute_time() - theStart;
+			if( theRun > 0 )
+				reportMeasurement( aCorpus, aVariant, @"teardown", theReportRun, theCount, theTicks, nil );
+		}
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:theBinaryPath error:NULL];
+	[[NSFileManager defaultManager] removeItemAtPath:theWordListPath error:NULL];
+	[[NSFileManager defaultManager] removeItemAtPath:thePListPath error:NULL];
+	report( [NSDictionary dictionaryWithObjectsAndKeys:
+			 aCorpus, @"corpus",
+			 aVariant, @"variant",
+			 @"memory", @"benchmark",
+			 [NSNumber numberWithUnsignedLongLong:peakResidentBytes()], @"peakResidentBytes",
+			 nil] );
+}
+
+#if NDTrieUseDispatch
+/*
+	containsObjectForKey: from one reader and then twice as many up to the number of cores, each reading every key,
+	while a writer removes or adds a key every millisecond, with a lock around every read and change compared to a
+	trie created with NDTrieConcurrentReads
+ */
+void benchmarkConcurrentReads( NSString * aCorpus, NSArray * aKeys, NSString * aVariant, NSDictionary * aSettings )
+{
+	NDTrieOptions		theOptions = [aVariant isEqualToString:@"compressed"] ? NDTriePathCompression : 0;
+	uint64_t			theSeed = [[aSettings objectForKey:@"seed"] unsignedLongLongValue];
+	NSUInteger			theRuns = [[aSettings objectForKey:@"runs"] unsignedIntegerValue],
+						theCount = aKeys.count,
+						theCoreCount = [[NSProcessInfo processInfo] activeProcessorCount];
+	NSArray				* theLookups = shuffledArray( aKeys, theSeed+4 );
+
+	for( NSUInteger theReaders = 1; theReaders <= theCoreCount; theReaders *= 2 )
+	{
+		for( NSUInteger t = 0; t < 2; t++ )
+		{
+			for( NSUInteger theRun = 0; theRun <= theRuns; theRun++ )
+			{
+				@autoreleasepool
+				{
+					NDMutableTrie			* theTrie = [[NDMutableTrie alloc] initWithOptions:t == 0 ? theOptions : theOptions|NDTrieConcurrentReads array:aKeys];
+					NSLock					* theLock = t == 0 ? [[NSLock alloc] init] : nil;
+					dispatch_group_t		theReaderGroup = dispatch_group_create(),
+											theWriterGroup = dispatch_group_create();
+					__block volatile BOOL	theDone = NO;
+
+					dispatch_group_async( theWriterGroup, dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_DEFAULT, 0 ), ^{
+						for( NSUInteger i = 0; !theDone; i++ )
+						{
+							@autoreleasepool
+							{
+								NSString	* theKey = [theLookups objectAtIndex:(i/2)%theCount];
+								[theLock lock];
+								if( i%2 == 0 )
+									[theTrie removeObjectForKey:theKey];
+								else
+									[theTrie addString:theKey];
+								[theLock unlock];
+							}
+							usleep( 1000 );
+						}
+					});
+
+					uint64_t				theStart = mach_absolute_time();
+					for( NSUInteger r = 0; r < theReaders; r++ )
+					{
+						dispatch_group_async( theReaderGroup, dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_DEFAULT, 0 ), ^{
+							for( NSUInteger i = 0; i < theCount; i++ )
+							{
+								NSString	* theKey = [theLookups objectAtIndex:(i+r*7919)%theCount];
+								[theLock lock];
+								[theTrie containsObjectForKey:theKey];
+								[theLock unlock];
+							}
+						});
+					}
+					dispatch_group_wait( theReaderGroup, DISPATCH_TIME_FOREVER );
+					uint64_t				theTicks = mach_absolute_time() - theStart;
+
+					theDone = YES;
+					dispatch_group_wait( theWriterGroup, DISPATCH_TIME_FOREVER );
+					dispatch_release( theWriterGroup );
+					dispatch_release( theReaderGroup );
+					if( theRun > 0 )
+						reportMeasurement( aCorpus, aVariant, t == 0 ? @"read-locked" : @"read-concurrent", theRun-1, theReaders*theCount, theTicks, [NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:theReaders] forKey:@"readers"] );
+					[theLock release];
+					[theTrie release];
+				}
+			}
+		}
+	}
+}
+#endif
+
+/*
+	the bundled plists are loaded as they are, the XML one goes through the streaming parser and the binary one
+	through NSArray
+ */
+void benchmarkSampleFiles( NSString * aDirectory, NSDictionary * aSettings )
+{
+	NSUInteger		theRuns = [[aSettings objectForKey:@"runs"] unsignedIntegerValue];
+	for( NSString * theName in [NSArray arrayWithObjects:@"sample_file_xml.plist", @"sample_file_binary.plist", nil] )
+	{
+		NSString		* thePath = [aDirectory stringByAppendingPathComponent:theName];
+		for( NSUInteger theRun = 0; theRun <= theRuns; theRun++ )
+		{
+			@autoreleasepool
+			{
+				uint64_t	theStart = mach_absolute_time();
+				NDTrie		* theTrie = [[NDTrie alloc] initWithContentsOfFile:thePath];
+				uint64_t	theTicks = mach_absolute_time() - theStart;
+				NSCAssert( theTrie.count > 0, @"failed to load %@", thePath );
+				if( theRun > 0 )
+					reportMeasurement( @"sample", theName, @"load-sample", theRun-1, theTrie.count, theTicks, nil );
+				[theTrie release];
+			}
+		}
+	}
+}
+
+#pragma mark - corpora
+
+/* lowercase ASCII keys, every length from 3 to 16 as likely as any other */
+NSArray * uniformCorpus( NSUInteger aCount, uint64_t aSeed )
+{
+	struct benchmarkRandom	theRandom = { aSeed };
+	NSMutableSet			* theKeys = [NSMutableSet setWithCapacity:aCount];
+	while( theKeys.count < aCount )
+	{
+		unichar			theCharacters[16];
+		NSUInteger		theLength = 3 + nextRandomBelow( &theRandom, 14 );
+		for( NSUInteger i = 0; i < theLength; i++ )
+			theCharacters[i] = 'a' + nextRandomBelow( &theRandom, 26 );
+		[theKeys addObject:[NSString stringWithCharacters:theCharacters length:theLength]];
+	}
+	return [[theKeys allObjects] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+/*
+	one to three words from a vocabulary of 2000 made up words picked with a Zipf distribution, so like natural
+	language a few words start a large part of the keys
+ */
+NSArray * zipfCorpus( NSUInteger aCount, uint64_t aSeed )
+{
+	const NSUInteger		kVocabularyCount = 2000;
+	struct benchmarkRandom	theRandom = { aSeed };
+	NSMutableArray			* theVocabulary = [NSMutableArray arrayWithCapacity:kVocabularyCount];
+	NSMutableSet			* theKeys = [NSMutableSet setWithCapacity:aCount];
+	double					* theTable = createZipfTable( kVocabularyCount, 1.0 );
+
+	while( theVocabulary.count < kVocabularyCount )
+	{
+		unichar			theCharacters[8];
+		NSUInteger		theLength = 2 + nextRandomBelow( &theRandom, 6 );
+		for( NSUInteger i = 0; i < theLength; i++ )
+			theCharacters[i] = 'a' + nextRandomBelow( &theRandom, 26 );
+		NSString		* theWord = [NSString stringWithCharacters:theCharacters length:theLength];
+		if( ![theVocabulary containsObject:theWord] )
+			[theVocabulary addObject:theWord];
+	}
+
+	/* there are only so many one and two word keys, give up rather than loop forever on an impossible count */
+	for( NSUInteger theAttempts = 0; theKeys.count < aCount && theAttempts < aCount*20; theAttempts++ )
+	{
+		NSMutableString	* theKey = [NSMutableString string];
+		NSUInteger		theWordCount = 1 + nextRandomBelow( &theRandom, 3 );
+		for( NSUInteger i = 0; i < theWordCount; i++ )
+			[theKey appendString:[theVocabulary objectAtIndex:nextZipf( &theRandom, theTable, kVocabularyCount )]];
+		[theKeys addObject:theKey];
+	}
+	free( theTable );
+	return [[theKeys allObjects] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+/*
+	keys that all start with one of eight long heads and then branch through three levels of path components, the
+	worst case for a trie without path compression
+ */
+NSArray * sharedPrefixCorpus( NSUInteger aCount, uint64_t aSeed )
+{
+	struct benchmarkRandom	theRandom = { aSeed };
+	NSMutableArray			* theHeads = [NSMutableArray arrayWithCapacity:8],
+							* theComponents = [NSMutableArray arrayWithCapacity:16];
+	NSMutableSet			* theKeys = [NSMutableSet setWithCapacity:aCount];
+
+	for( NSUInteger i = 0; i < 8; i++ )
+		[theHeads addObject:[NSString stringWithFormat:@"com.example.application%lu.module.component.resources.", (unsigned long)i]];
+	for( NSUInteger i = 0; i < 16; i++ )
+	{
+		unichar			theCharacters[8];
+		for( NSUInteger j = 0; j < 8; j++ )
+			theCharacters[j] = 'a' + nextRandomBelow( &theRandom, 26 );
+		[theComponents addObject:[NSString stringWithCharacters:theCharacters length:8]];
+	}
+
+	while( theKeys.count < aCount )
+	{
+		NSMutableString	* theKey = [NSMutableString stringWithString:[theHeads objectAtIndex:nextRandomBelow( &theRandom, theHeads.count )]];
+		unichar			theTail[8];
+		NSUInteger		theTailLength = 4 + nextRandomBelow( &theRandom, 5 );
+		for( NSUInteger i = 0; i < 3; i++ )
+		{
+			[theKey appendString:[theComponents objectAtIndex:nextRandomBelow( &theRandom, theComponents.count )]];
+			[theKey appendString:@"/"];
+		}
+		for( NSUInteger i = 0; i < theTailLength; i++ )
+			theTail[i] = 'a' + nextRandomBelow( &theRandom, 26 );
+		[theKey appendString:[NSString stringWithCharacters:theTail length:theTailLength]];
+		[theKeys addObject:theKey];
+	}
+	return [[theKeys allObjects] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+/*
+	a mix of CJK, Cyrillic, accented Latin and emoji, the emoji are surrogate pairs so a key can be two units a
+	character, which is what a trie of UTF-16 units sees
+ */
+NSArray * unicodeCorpus( NSUInteger aCount, uint64_t aSeed )
+{
+	static const unichar	kAccented[] = { 0xE0, 0xE1, 0xE2, 0xE4, 0xE7, 0xE8, 0xE9, 0xEA, 0xEB, 0xEE, 0xEF, 0xF1, 0xF4, 0xF6, 0xF8, 0xF9, 0xFA, 0xFC };
+	struct benchmarkRandom	theRandom = { aSeed };
+	NSMutableSet			* theKeys = [NSMutableSet setWithCapacity:aCount];
+
+	while( theKeys.count < aCount )
+	{
+		unichar			theCharacters[24];
+		NSUInteger		theLength = 0;
+		switch( nextRandomBelow( &theRandom, 4 ) )
+		{
+		case 0:
+			for( NSUInteger i = 2 + nextRandomBelow( &theRandom, 5 ); i > 0; i-- )
+				theCharacters[theLength++] = 0x4E00 + nextRandomBelow( &theRandom, 20902 );
+			break;
+		case 1:
+			for( NSUInteger i = 4 + nextRandomBelow( &theRandom, 9 ); i > 0; i-- )
+				theCharacters[theLength++] = 0x0430 + nextRandomBelow( &theRandom, 32 );
+			break;
+		case 2:
+			for( NSUInteger i = 4 + nextRandomBelow( &theRandom, 9 ); i > 0; i-- )
+				theCharacters[theLength++] = nextRandomBelow( &theRandom, 3 ) == 0 ? kAccented[nextRandomBelow( &theRandom, sizeof(kAccented)/sizeof(*kAccented) )] : 'a' + nextRandomBelow( &theRandom, 26 );
+			break;
+		default:
+			for( NSUInteger i = 1 + nextRandomBelow( &theRandom, 4 ); i > 0; i-- )
+			{
+				uint32_t	theCodePoint = 0x1F600 + (uint32_t)nextRandomBelow( &theRandom, 80 ) - 0x10000;
+				theCharacters[theLength++] = 0xD800 + (theCodePoint >> 10);
+				theCharacters[theLength++] = 0xDC00 + (theCodePoint & 0x3FF);
+			}
+			break;
+		}
+		[theKeys addObject:[NSString stringWithCharacters:theCharacters length:theLength]];
+	}
+	return [[theKeys allObjects] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+NSArray * sampleCorpus( NSString * aDirectory )
+{
+	NSString		* thePath = [aDirectory stringByAppendingPathComponent:@"sample_file_xml.plist"];
+	NSArray			* theWords = [NSArray arrayWithContentsOfFile:thePath];
+	if( theWords == nil )
+	{
+		fprintf( stderr, "could not read %s, use -samples to give the directory of the sample files\n", [thePath UTF8String] );
+		exit( 1 );
+	}
+	return [[[NSSet setWithArray:theWords] allObjects] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+/* Fisher-Yates with the benchmark random numbers */
+NSArray * shuffledArray( NSArray * anArray, uint64_t aSeed )
+{
+	struct benchmarkRandom	theRandom = { aSeed };
+	NSMutableArray			* theResult = [NSMutableArray arrayWithArray:anArray];
+	for( NSUInteger i = theResult.count; i > 1; i-- )
+		[theResult exchangeObjectAtIndex:i-1 withObjectAtIndex:nextRandomBelow( &theRandom, i )];
+	return theResult;
+}
+
+/* keys that go as deep as the real ones before they miss, made by changing the last character of each key */
+NSArray * missingKeys( NSArray * aKeys, uint64_t aSeed )
+{
+	NSSet					* theKeys = [NSSet setWithArray:aKeys];
+	NSMutableArray			* theResult = [NSMutableArray arrayWithCapacity:aKeys.count];
+	for( NSString * theKey in shuffledArray( aKeys, aSeed ) )
+	{
+		NSString	* theMiss = [[theKey substringToIndex:theKey.length-1] stringByAppendingString:@"~"];
+		if( ![theKeys containsObject:theMiss] )
+			[theResult addObject:theMiss];
+	}
+	return theResult;
+}
+
+#pragma mark - random numbers
+
+uint64_t nextRandom( struct benchmarkRandom * aRandom )
+{
+	uint64_t		theResult = (aRandom->state += 0x9E3779B97F4A7C15ULL);
+	theResult = (theResult ^ (theResult >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	theResult = (theResult ^ (theResult >> 27)) * 0x94D049BB133111EBULL;
+	return theResult ^ (theResult >> 31);
+}
+
+NSUInteger nextRandomBelow( struct benchmarkRandom * aRandom, NSUInteger aLimit )
+{
+	return (NSUInteger)(nextRandom( aRandom ) % aLimit);
+}
+
+/* the cumulative distribution of ranks 1 to aCount */
+double * createZipfTable( NSUInteger aCount, double anExponent )
+{
+	double			* theTable = (double*)malloc( aCount*sizeof(double) ),
+					theTotal = 0.0;
+	NSCAssert( theTable != NULL, @"failed to allocate the zipf table" );
+	for( NSUInteger i = 0; i < aCount; i++ )
+		theTable[i] = (theTotal += 1.0/pow( (double)(i+1), anExponent ));
+	for( NSUInteger i = 0; i < aCount; i++ )
+		theTable[i] /= theTotal;
+	return theTable;
+}
+
+NSUInteger nextZipf( struct benchmarkRandom * aRandom, const double * aTable, NSUInteger aCount )
+{
+	double			theValue = (double)(nextRandom( aRandom ) >> 11) / (double)(1ULL << 53);
+	NSUInteger		theLow = 0,
+					theHigh = aCount-1;
+	while( theLow < theHigh )
+	{
+		NSUInteger	theMiddle = (theLow + theHigh)/2;
+		if( aTable[theMiddle] < theValue )
+			theLow = theMiddle+1;
+		else
+			theHigh = theMiddle;
+	}
+	return theLow;
+}
+
+#pragma mark - reporting
+
+double secondsForTicks( uint64_t aTicks )
+{
+	static mach_timebase_info_data_t	theTimebase = { 0, 0 };
+	if( theTimebase.denom == 0 )
+		mach_timebase_info( &theTimebase );
+	return (double)aTicks * theTimebase.numer / theTimebase.denom / 1e9;
+}
+
+void addSample( struct latencySamples * aSamples, uint64_t aTicks )
+{
+	if( aSamples->count == aSamples->capacity )
+	{
+		aSamples->capacity = aSamples->capacity > 0 ? aSamples->capacity*2 : 1024;
+		aSamples->ticks = (uint64_t*)realloc( aSamples->ticks, aSamples->capacity*sizeof(uint64_t) );
+		NSCAssert( aSamples->ticks != NULL, @"failed to allocate latency samples" );
+	}
+	aSamples->ticks[aSamples->count++] = aTicks;
+}
+
+static int _compareTicks( const void * aLeft, const void * aRight )
+{
+	uint64_t	theLeft = *(const uint64_t*)aLeft,
+				theRight = *(const uint64_t*)aRight;
+	return theLeft < theRight ? -1 : theLeft > theRight;
+}
+
+/*
+	nearest rank percentiles in nanoseconds, each sample includes the cost of reading the clock which is about the
+	same for every run so still fine for comparing them
+ */
+NSDictionary * latencySummary( struct latencySamples * aSamples )
+{
+	NSMutableDictionary		* theResult = [NSMutableDictionary dictionary];
+	if( aSamples->count > 0 )
+	{
+		const double	kPercentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+		NSString		* const kNames[] = { @"p50ns", @"p90ns", @"p99ns", @"p999ns" };
+		qsort( aSamples->ticks, aSamples->count, sizeof(uint64_t), _compareTicks );
+		for( NSUInteger i = 0; i < sizeof(kPercentiles)/sizeof(*kPercentiles); i++ )
+		{
+			NSUInteger	theRank = (NSUInteger)ceil( kPercentiles[i]/100.0*aSamples->count );
+			[theResult setObject:[NSNumber numberWithDouble:secondsForTicks( aSamples->ticks[theRank > 0 ? theRank-1 : 0] )*1e9] forKey:kNames[i]];
+		}
+		[theResult setObject:[NSNumber numberWithDouble:secondsForTicks( aSamples->ticks[aSamples->count-1] )*1e9] forKey:@"maxns"];
+	}
+	return theResult;
+}
+
+size_t heapBytesInUse( void )
+{
+	malloc_statistics_t		theStatistics;
+	malloc_zone_statistics( NULL, &theStatistics );
+	return theStatistics.size_in_use;
+}
+
+size_t peakResidentBytes( void )
+{
+	struct rusage	theUsage;
+	getrusage( RUSAGE_SELF, &theUsage );
+#ifdef __APPLE__
+	return (size_t)theUsage.ru_maxrss;
+#else
+	return (size_t)theUsage.ru_maxrss*1024;
+#endif
+}
+
+void report( NSDictionary * aRecord )
+{
+	NSError		* theError = nil;
+	NSData		* theData = [NSJSONSerialization dataWithJSONObject:aRecord options:0 error:&theError];
+	NSCAssert( theData != nil, @"failed to report %@: %@", aRecord, theError );
+	fwrite( [theData bytes], 1, [theData length], stdout );
+	fputc( '\n', stdout );
+	fflush( stdout );
+}
+
+void reportMeasurement( NSString * aCorpus, NSString * aVariant, NSString * aBenchmark, NSUInteger aRun, NSUInteger anOperations, uint64_t aTicks, NSDictionary * anExtra )
+{
+	double					theSeconds = secondsForTicks( aTicks );
+	NSMutableDictionary		* theRecord = [NSMutableDictionary dictionaryWithDictionary:anExtra];
+	[theRecord setObject:aCorpus forKey:@"corpus"];
+	[theRecord setObject:aVariant forKey:@"variant"];
+	[theRecord setObject:aBenchmark forKey:@"benchmark"];
+	[theRecord setObject:[NSNumber numberWithUnsignedInteger:aRun] forKey:@"run"];
+	[theRecord setObject:[NSNumber numberWithUnsignedInteger:anOperations] forKey:@"operations"];
+	[theRecord setObject:[NSNumber numberWithDouble:theSeconds] forKey:@"seconds"];
+	[theRecord setObject:[NSNumber numberWithDouble:theSeconds > 0.0 ? anOperations/theSeconds : 0.0] forKey:@"operationsPerSecond"];
+	report( theRecord );
+}
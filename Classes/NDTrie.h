@@ -24,7 +24,7 @@
  */
 /*!
 	@header NDTrie
-	@abstract Declares the interface for the classes <tt>NDTrie</tt> and <tt>NDMutableTrie</tt>.
+	@abstract Declares the interface for the classes <tt>NDTrie</tt>, <tt>NDMutableTrie</tt> and <tt>NDTrieCompletionSession</tt>.
 
 	@author Nathan Day
 	@date Thursday September 17 2009
@@ -36,6 +36,108 @@
 #define NDFastEnumerationAvailable
 #endif
 
+/*
+	Set NDTrieUseNodeArena to 0 to allocate every node and child array with malloc instead of from the tries own arena,
+	this is only really useful for comparing the two allocators.
+ */
+#ifndef NDTrieUseNodeArena
+#define NDTrieUseNodeArena 1
+#endif
+
+/*
+	Set NDTrieUseInlineChildKeys to 0 to search for children by looking at the key of each child node instead of the
+	copy of the keys kept with the child array, again only really useful for comparing the two.
+ */
+#ifndef NDTrieUseInlineChildKeys
+#define NDTrieUseInlineChildKeys 1
+#endif
+
+/*
+	NDTrieUseDispatch is set when Grand Central Dispatch is available, without it the option NDTrieConcurrentBuild is
+	ignored and every build is done on the calling thread.
+ */
+#ifndef NDTrieUseDispatch
+#if TARGET_OS_EMBEDDED || TARGET_OS_IPHONE || MAC_OS_X_VERSION_10_6 <= MAC_OS_X_VERSION_MAX_ALLOWED
+#define NDTrieUseDispatch 1
+#else
+#define NDTrieUseDispatch 0
+#endif
+#endif
+
+/*
+	Set NDTrieCollectCounters to 1 to count lookups, the nodes they visit, child array resizes and the size of
+	enumerations for every trie in the process, see +[NDTrie counters]. The counters are relaxed atomic adds so cost
+	little, but they are still left out unless asked for.
+ */
+#ifndef NDTrieCollectCounters
+#define NDTrieCollectCounters 0
+#endif
+
+/*!
+	@const NDTrieStatisticsNodeCountKey The number of nodes including the root, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsObjectCountKey The number of objects, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsNodeBytesKey The bytes taken by the nodes themselves, not including their children, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsChildSlotBytesAllocatedKey The bytes allocated for child arrays, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsChildSlotBytesUsedKey The bytes of child arrays in use, the difference from <tt>NDTrieStatisticsChildSlotBytesAllocatedKey</tt> is the room left for growth, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsDirectIndexBytesKey The bytes used by the lookup tables of nodes with many children, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsRunBytesKey The bytes used by the runs of path compressed nodes, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsTotalBytesKey All the memory the nodes are taking up, including memory freed by removals waiting to be reused, for a mapped trie the size of the file, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsMaxDepthKey The depth of the deepest node, the root is at depth 0, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsDepthHistogramKey An <tt>NSArray</tt> of <tt>NSNumber</tt>s, the number of nodes at each depth.
+	@const NDTrieStatisticsFanoutHistogramKey An <tt>NSArray</tt> of <tt>NSNumber</tt>s, the number of nodes with each number of children, the last entry counts every node with 256 or more.
+	@const NDTrieStatisticsSingleChildChainCountKey The number of chains of nodes with one child and no object, path compression removes these, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsSingleChildChainNodeCountKey The number of nodes in those chains, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsLongestSingleChildChainKey The number of nodes in the longest chain, an <tt>NSNumber</tt>.
+	@const NDTrieStatisticsSharedNodeCountKey The number of nodes shared with copies of the trie, for a trie from <tt>-[NDTrie compactedTrie]</tt> the number of nodes reached by more than one path, an <tt>NSNumber</tt>.
+ */
+extern NSString * const NDTrieStatisticsNodeCountKey;
+extern NSString * const NDTrieStatisticsObjectCountKey;
+extern NSString * const NDTrieStatisticsNodeBytesKey;
+extern NSString * const NDTrieStatisticsChildSlotBytesAllocatedKey;
+extern NSString * const NDTrieStatisticsChildSlotBytesUsedKey;
+extern NSString * const NDTrieStatisticsDirectIndexBytesKey;
+extern NSString * const NDTrieStatisticsRunBytesKey;
+extern NSString * const NDTrieStatisticsTotalBytesKey;
+extern NSString * const NDTrieStatisticsMaxDepthKey;
+extern NSString * const NDTrieStatisticsDepthHistogramKey;
+extern NSString * const NDTrieStatisticsFanoutHistogramKey;
+extern NSString * const NDTrieStatisticsSingleChildChainCountKey;
+extern NSString * const NDTrieStatisticsSingleChildChainNodeCountKey;
+extern NSString * const NDTrieStatisticsLongestSingleChildChainKey;
+extern NSString * const NDTrieStatisticsSharedNodeCountKey;
+
+/*!
+	@enum NDTrieOptions
+	@abstract Options used when creating a trie with <tt>-[NDTrie initWithOptions:]</tt>.
+	@constant NDTrieCaseInsensitive Keys are handled in a case insensitive way.
+	@constant NDTriePathCompression Chains of nodes with a single child are collapsed into one node (a radix or Patricia trie), which uses a lot less memory and fewer nodes per lookup for tries of long keys with few common prefixes, at the cost of having to split and merge nodes as keys are added and removed.
+	@constant NDTrieConcurrentBuild The initialisers that take an array, a dictionary or c arrays of keys build the subtrees under each first character of the keys at the same time on every core, the trie built is the same as without this option. Only worth while for large numbers of keys, small builds are done on the calling thread regardless.
+	@constant NDTrieConcurrentReads Only for <tt>NDMutableTrie</tt>, any number of threads can read the trie without taking a lock while another thread changes it. The trie keeps two copies of its nodes, readers use one while a change is made to the other, the two are then swapped and once the last reader of the old copy has finished the change is made to it as well. Lookups never wait, changes wait for readers that started before them and take twice as long, and the nodes take twice the memory. Changes from more than one thread are done one at a time. Every lookup a reader makes from within one read, such as from the block of an enumeration, sees the same copy, and changing the trie from within a read raises an <tt>NSGenericException</tt> rather than wait for the read to finish. Enumerators and fast enumeration walk a copy that shares the nodes of the copy being read, taking it costs a reference to each child of the root rather than a copy of every object, and while it is in use a change copies any node it shares before changing it.
+ */
+enum
+{
+	NDTrieCaseInsensitive = 1 << 0,
+	NDTriePathCompression = 1 << 1,
+	NDTrieConcurrentBuild = 1 << 2,
+	NDTrieConcurrentReads = 1 << 3
+};
+typedef NSUInteger NDTrieOptions;
+
+/*!
+	@enum NDTrieMatchOptions
+	@abstract Which matches <tt>-[NDTrie enumerateMatchesInString:options:usingBlock:]</tt> reports.
+	@constant NDTrieMatchAll Every occurrence of every key, including keys that overlap or are inside other keys, in the order they end and longest first for the same end.
+	@constant NDTrieMatchLeftmostLongest Matches that do not overlap, from the start of the string the match that starts first is reported, the longest if more than one starts there, and the search carries on after it, the way a tokenizer would split the string.
+	@constant NDTrieMatchLongestPrefix Only the longest key the string starts with, if there is one.
+ */
+enum
+{
+	NDTrieMatchAll = 0,
+	NDTrieMatchLeftmostLongest = 1,
+	NDTrieMatchLongestPrefix = 2
+};
+typedef NSUInteger NDTrieMatchOptions;
+
 /*!
 	@class NDTrie
 	@abstract An immutable trie implemented in Objective-C
@@ -105,6 +207,22 @@
 	@param url A file url to a property list file generated from a <tt>NDTrie</tt> or <tt>NSArray</tt>
  */
 + (id)trieWithContentsOfURL:(NSURL *)url;
+/*!
+	@method trieWithMappedContentsOfFile:
+	@abstract Create a trie from a binary file without parsing it.
+	@discussion See <tt>-[NDTrie initWithMappedContentsOfURL:]</tt>.
+	@param path A path to a file written by <tt>-[NDTrie writeBinaryToFile:atomically:]</tt>
+	@result The trie or <tt>nil</tt> if the file could not be mapped or is not a valid binary trie file.
+ */
++ (id)trieWithMappedContentsOfFile:(NSString *)path;
+/*!
+	@method trieWithMappedContentsOfURL:
+	@abstract Create a trie from a binary file without parsing it.
+	@discussion See <tt>-[NDTrie initWithMappedContentsOfURL:]</tt>.
+	@param url A file url to a file written by <tt>-[NDTrie writeBinaryToURL:atomically:]</tt>
+	@result The trie or <tt>nil</tt> if the file could not be mapped or is not a valid binary trie file.
+ */
++ (id)trieWithMappedContentsOfURL:(NSURL *)url;
 /*!
 	@method trieWithStrings:count:
 	@abstract Create a new trie with the content sof a c array.
@@ -139,7 +257,7 @@
 /*!
 	@method initWithTrie:
 	@abstract Initialise a trie with the contents of another <tt>NDTrie</tt>.
-	@discussion The trie will contain the strings contained within <tt><i>anotherTrie</i></tt>.
+	@discussion The trie will contain the strings contained within <tt><i>anotherTrie</i></tt>. The two tries share their nodes until one of them is changed, a change then copies just the nodes on the way to the key it changes, so initialising a trie this way, or with <tt>mutableCopy</tt>, takes the same time however many strings <tt><i>anotherTrie</i></tt> contains.
 	@param array An array of strings.
  */
 - (id)initWithTrie:(NDTrie *)anotherTrie;
@@ -171,6 +289,42 @@
 	@param url A file url to a property list file generated from a <tt>NDTrie</tt> or <tt>NSArray</tt>
  */
 - (id)initWithContentsOfURL:(NSURL *)url;
+/*!
+	@method initWithOptions:contentsOfWordListFile:progress:
+	@abstract Initialise a trie with the lines of a text file.
+	@discussion See <tt>-[NDTrie initWithOptions:contentsOfWordListURL:progress:]</tt>.
+	@param options A combination of <tt>NDTrieOptions</tt>.
+	@param path A path to a UTF-8 text file with one key per line.
+	@param progress An optional block called as the file is read.
+	@result The trie or <tt>nil</tt> if the file could not be opened.
+ */
+- (id)initWithOptions:(NDTrieOptions)options contentsOfWordListFile:(NSString *)path progress:(void (^)(unsigned long long bytesRead, unsigned long long totalBytes, BOOL *stop))progress;
+/*!
+	@method initWithOptions:contentsOfWordListURL:progress:
+	@abstract Initialise a trie with the lines of a text file.
+	@discussion Every line of the file is a key, and the object for the key, optionally followed by a tab and a weight for the key, like <tt>/usr/share/dict/words</tt> or a two column tab separated file. Lines can end with <tt>\n</tt> or <tt>\r\n</tt> and empty lines are skipped. The file is read a buffer at a time and each key is added as it is read, with no property list or array in between, so the memory used does not depend on the size of the file. If a line is not UTF-8 or its weight is not a finite number the exception <tt>NSInvalidArgumentException</tt> is thrown.
+	@param options A combination of <tt>NDTrieOptions</tt>.
+	@param url A file url to a UTF-8 text file with one key per line.
+	@param progress An optional block of the form <code>^(unsigned long long bytesRead, unsigned long long totalBytes, BOOL *stop)</code> called after each buffer is read, setting <tt>*stop</tt> to <tt>YES</tt> stops reading and leaves the trie with the keys read so far.
+	@result The trie or <tt>nil</tt> if the file could not be opened.
+ */
+- (id)initWithOptions:(NDTrieOptions)options contentsOfWordListURL:(NSURL *)url progress:(void (^)(unsigned long long bytesRead, unsigned long long totalBytes, BOOL *stop))progress;
+/*!
+	@method initWithMappedContentsOfFile:
+	@abstract Initialise a trie from a binary file without parsing it.
+	@discussion See <tt>-[NDTrie initWithMappedContentsOfURL:]</tt>.
+	@param path A path to a file written by <tt>-[NDTrie writeBinaryToFile:atomically:]</tt>
+	@result The trie or <tt>nil</tt> if the file could not be mapped or is not a valid binary trie file.
+ */
+- (id)initWithMappedContentsOfFile:(NSString *)path;
+/*!
+	@method initWithMappedContentsOfURL:
+	@abstract Initialise a trie from a binary file without parsing it.
+	@discussion The file is mapped into memory and the returned trie answers lookups, prefix searches and enumerations straight from the mapped pages, so there is nothing to parse. Every node is checked once as the file is opened, a file that has been cut short or damaged, or that points anywhere outside of itself, is turned down rather than trusted. The case insensitivity and path compression of the trie that wrote the file are kept. The objects of the trie are always strings, a new string is created each time an object is returned. For <tt>NDMutableTrie</tt> the contents of the file are copied into the new trie, which is faster than <tt>initWithContentsOfURL:</tt> but not free. The file should not be changed while the trie exists.
+	@param url A file url to a file written by <tt>-[NDTrie writeBinaryToURL:atomically:]</tt>
+	@result The trie or <tt>nil</tt> if the file could not be mapped or is not a valid binary trie file.
+ */
+- (id)initWithMappedContentsOfURL:(NSURL *)url;
 /*!
 	@method initWithStrings:count:
 	@abstract Initialise a trie with a c array.
@@ -212,6 +366,39 @@
 	@param caseInsensitive Determines if key are handled in a case insensitive way or not.
  */
 - (id)initWithCaseInsensitive:(BOOL)caseInsensitive;
+/*!
+	@method initWithOptions:
+	@abstract Initialise a trie.
+	@discussion The trie will be created empty, this is the designated initializer.
+	@param options A combination of <tt>NDTrieOptions</tt>.
+ */
+- (id)initWithOptions:(NDTrieOptions)options;
+/*!
+	@method initWithOptions:array:
+	@abstract Initialise a trie with the contents of an <tt>NSArray</tt>.
+	@discussion The trie will contain the strings contained within <tt><i>array</i></tt>, duplicates strings are allowed but only one will be added.
+	@param options A combination of <tt>NDTrieOptions</tt>.
+	@param array An array of strings, if an object within the array is not an <tt>NSString</tt> then the exception <tt>NSInvalidArgumentException</tt> is thrown.
+ */
+- (id)initWithOptions:(NDTrieOptions)options array:(NSArray *)array;
+/*!
+	@method initWithOptions:dictionary:
+	@abstract Initialise a trie with the contents of an <tt>NSDictionary</tt>.
+	@discussion The trie will contain the objects and keys contained within <tt><i>dictionary</i></tt>.
+	@param options A combination of <tt>NDTrieOptions</tt>.
+	@param dictionary An dictionary of objects and keys, if a key within the dictionary is not an <tt>NSString</tt> then the exception <tt>NSInvalidArgumentException</tt> is thrown.
+ */
+- (id)initWithOptions:(NDTrieOptions)options dictionary:(NSDictionary *)dictionary;
+/*!
+	@method initWithOptions:objects:forKeys:count:
+	@abstract Initialize a trie with the contents of of a c array.
+	@discussion Initializes a trie that includes a given number of objects and keys from a given C arrays. The keys are sorted and the trie is built in one pass, keys that are already in order skip the sort, so this is the quickest way to load a large list of words.
+	@param options A combination of <tt>NDTrieOptions</tt>.
+	@param objects a c array of objects
+	@param keys a c array of <tt>NSString</tt>s
+	@param count The number of objects and keys
+ */
+- (id)initWithOptions:(NDTrieOptions)options objects:(id *)objects forKeys:(NSString **)keys count:(NSUInteger)count;
 /*!
 	@method initWithWithCaseInsensitive:array:
 	@abstract Initialise a trie with the contents of an <tt>NSArray</tt>.
@@ -302,7 +489,34 @@
  */
 - (NSUInteger)count;
 
+/*!
+	@method statistics
+	@abstract Describe how a trie is laid out and what it costs.
+	@discussion Walks every node of the receiver once and returns a dictionary with the keys <tt>NDTrieStatisticsNodeCountKey</tt>, <tt>NDTrieStatisticsObjectCountKey</tt>, <tt>NDTrieStatisticsNodeBytesKey</tt>, <tt>NDTrieStatisticsChildSlotBytesAllocatedKey</tt>, <tt>NDTrieStatisticsChildSlotBytesUsedKey</tt>, <tt>NDTrieStatisticsDirectIndexBytesKey</tt>, <tt>NDTrieStatisticsRunBytesKey</tt>, <tt>NDTrieStatisticsTotalBytesKey</tt>, <tt>NDTrieStatisticsMaxDepthKey</tt>, <tt>NDTrieStatisticsDepthHistogramKey</tt>, <tt>NDTrieStatisticsFanoutHistogramKey</tt>, <tt>NDTrieStatisticsSingleChildChainCountKey</tt>, <tt>NDTrieStatisticsSingleChildChainNodeCountKey</tt>, <tt>NDTrieStatisticsLongestSingleChildChainKey</tt> and <tt>NDTrieStatisticsSharedNodeCountKey</tt>. The dictionary only contains property list types so can be written out as is.
+ */
+- (NSDictionary *)statistics;
+
+#if NDTrieCollectCounters
+/*!
+	@method counters
+	@abstract The counters kept when NDTrieCollectCounters is set.
+	@discussion Returns a dictionary of <tt>NSNumber</tt>s for every trie in the process since the counters were last reset, <tt>lookups</tt> is the number of lookups made by any method that does not change a trie, <tt>lookupNodesVisited</tt> the total number of nodes they went through and <tt>lookupMaxNodesVisited</tt> the most any one lookup went through, <tt>childArrayResizes</tt> the number of times a child array was moved to a new size, <tt>enumerations</tt> and <tt>objectsEnumerated</tt> the number of arrays and enumerators of objects returned and their total size, and <tt>enumerationSizes</tt> an array where the entry at index <i>i</i> is the number of enumerations of less than 2<sup><i>i</i></sup> objects but not less than 2<sup><i>i</i>-1</sup>.
+ */
++ (NSDictionary *)counters;
+/*!
+	@method resetCounters
+	@abstract Set every counter back to zero.
+ */
++ (void)resetCounters;
+#endif
+
 - (BOOL)isCaseInsensitive;
+/*!
+	@method isPathCompressed
+	@abstract Test if chains of single child nodes are collapsed.
+	@discussion Returns <tt>YES</tt> if the receiver was created with the option <tt>NDTriePathCompression</tt>, copies of a trie keep the same layout.
+ */
+- (BOOL)isPathCompressed;
 
 /*!
 	@method containsObjectForKey:
@@ -329,6 +543,78 @@
 	@result The found object or nil if no objects is found.
  */
 - (id)objectForKey:(NSString *)key;
+
+/*!
+	@method containsObjectForCharacters:length:
+	@abstract test if trie contains a string given as UTF-16 characters
+	@discussion The same as <tt>containsObjectForKey:</tt> but for callers that already have the characters of the string and so can avoid creating an <tt>NSString</tt>.
+	@param characters The UTF-16 characters of the string to test for.
+	@param length The number of characters in <tt><i>characters</i></tt>.
+	@result Returns <tt>YES</tt> if the recieve contains the string.
+ */
+- (BOOL)containsObjectForCharacters:(const unichar *)characters length:(NSUInteger)length;
+/*!
+	@method containsObjectForKeyWithPrefixCharacters:length:
+	@abstract Test if a trie contains any strings with a prefix given as UTF-16 characters
+	@discussion The same as <tt>containsObjectForKeyWithPrefix:</tt> but for callers that already have the characters of the prefix.
+	@param characters The UTF-16 characters of the prefix to test for.
+	@param length The number of characters in <tt><i>characters</i></tt>.
+	@result Returns <tt>YES</tt> if the recieve contains at least one string with the prefix.
+ */
+- (BOOL)containsObjectForKeyWithPrefixCharacters:(const unichar *)characters length:(NSUInteger)length;
+/*!
+	@method objectForCharacters:length:
+	@abstract Find an object for a key given as UTF-16 characters.
+	@discussion The same as <tt>objectForKey:</tt> but for callers that already have the characters of the key.
+	@param characters The UTF-16 characters of the key to search for.
+	@param length The number of characters in <tt><i>characters</i></tt>.
+	@result The found object or nil if no objects is found.
+ */
+- (id)objectForCharacters:(const unichar *)characters length:(NSUInteger)length;
+/*!
+	@method containsObjectForUTF8String:length:
+	@abstract test if trie contains a string given as UTF-8 bytes
+	@discussion The same as <tt>containsObjectForKey:</tt> but for callers that have the string as UTF-8, for example straight from a network buffer. Bytes that are not valid UTF-8 are never found.
+	@param bytes The UTF-8 bytes of the string to test for, they do not need to be null terminated.
+	@param length The number of bytes in <tt><i>bytes</i></tt>.
+	@result Returns <tt>YES</tt> if the recieve contains the string.
+ */
+- (BOOL)containsObjectForUTF8String:(const char *)bytes length:(NSUInteger)length;
+/*!
+	@method containsObjectForKeyWithPrefixUTF8String:length:
+	@abstract Test if a trie contains any strings with a prefix given as UTF-8 bytes
+	@discussion The same as <tt>containsObjectForKeyWithPrefix:</tt> but for a prefix in UTF-8.
+	@param bytes The UTF-8 bytes of the prefix to test for, they do not need to be null terminated.
+	@param length The number of bytes in <tt><i>bytes</i></tt>.
+	@result Returns <tt>YES</tt> if the recieve contains at least one string with the prefix.
+ */
+- (BOOL)containsObjectForKeyWithPrefixUTF8String:(const char *)bytes length:(NSUInteger)length;
+/*!
+	@method objectForUTF8String:length:
+	@abstract Find an object for a key given as UTF-8 bytes.
+	@discussion The same as <tt>objectForKey:</tt> but for a key in UTF-8.
+	@param bytes The UTF-8 bytes of the key to search for, they do not need to be null terminated.
+	@param length The number of bytes in <tt><i>bytes</i></tt>.
+	@result The found object or nil if no objects is found.
+ */
+- (id)objectForUTF8String:(const char *)bytes length:(NSUInteger)length;
+/*!
+	@method objectsForKeys:notFoundMarker:
+	@abstract Find the objects for many keys at once.
+	@discussion Gives the same objects as calling <tt>objectForKey:</tt> with each key, but the keys are sorted first and the trie is walked once, so the nodes for the prefix a key shares with the key before it are not looked up again. Worth using once there are more than a handful of keys to look up.
+	@param keys An array of <tt>NSString</tt> keys.
+	@param marker The object put in the result for keys that are not found, must not be nil, <tt>[NSNull null]</tt> is the usual choice.
+	@result An array with one object for each key, in the same order as <tt><i>keys</i></tt>.
+ */
+- (NSArray *)objectsForKeys:(NSArray *)keys notFoundMarker:(id)marker;
+/*!
+	@method containsObjectsForKeys:
+	@abstract Test for many keys at once.
+	@discussion The batch version of <tt>containsObjectForKey:</tt>, the keys are looked up the same way as <tt>objectsForKeys:notFoundMarker:</tt>.
+	@param keys An array of <tt>NSString</tt> keys.
+	@result The indexes within <tt><i>keys</i></tt> of every key the receiver contains.
+ */
+- (NSIndexSet *)containsObjectsForKeys:(NSArray *)keys;
 /*!
 	@method everyObject
 	@abstract return every string from a trie.
@@ -342,6 +628,59 @@
 	@param prefix The prefix to search for.
  */
 - (NSArray *)everyObjectForKeyWithPrefix:(NSString *)prefix;
+/*!
+	@method everyObjectForKeyWithPrefix:limit:resumeToken:
+	@abstract Find the strings with a given prefix a page at a time.
+	@discussion Returns no more than <tt><i>limit</i></tt> objects with the prefix <tt><i>prefix</i></tt>, in key order. On return <tt><i>token</i></tt> is set to an opaque token for the next page, or <tt>nil</tt> if there are no more objects. Pass the token back with the same prefix to get the next page, the next page starts straight after the last key returned without going over the earlier objects again. Tokens remain valid if the receiver is changed between pages, objects added before the token are not returned and objects removed are not returned.
+	@param prefix The prefix to search for, <tt>nil</tt> or an empty string for every object.
+	@param limit The most objects to return.
+	@param token Pointer to a token, for the first page the token should be <tt>nil</tt>. Can be <tt>NULL</tt> if you only want the first page.
+	@result An <tt>NSArray</tt> of no more than <tt><i>limit</i></tt> objects.
+ */
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)prefix limit:(NSUInteger)limit resumeToken:(id *)token;
+/*!
+	@method countOfObjectsForKeyWithPrefix:
+	@abstract Get the number of strings with a given prefix.
+	@discussion Each node keeps a count of the objects below it so this only costs as much as looking up the prefix.
+	@param prefix The prefix to count, <tt>nil</tt> or an empty string for every object.
+	@result The number of objects whose key has the prefix <tt><i>prefix</i></tt>.
+ */
+- (NSUInteger)countOfObjectsForKeyWithPrefix:(NSString *)prefix;
+/*!
+	@method everyObjectForKey:maxEditDistance:
+	@abstract Get every object whose key is close to a key.
+	@discussion Returns the objects of every key within <tt><i>distance</i></tt> insertions, deletions or substitutions of <tt><i>key</i></tt>, the Levenshtein distance, to cope with typing mistakes. The trie is walked once and a whole subtree is skipped as soon as none of its keys can be close enough. Case is ignored if the receiver is case insensitive.
+	@param key The key to look for, if <tt>nil</tt> the exception <tt>NSInvalidArgumentException</tt> is thrown.
+	@param distance The largest number of edits allowed.
+	@result The objects found, closest first, objects at the same distance are in key order.
+ */
+- (NSArray *)everyObjectForKey:(NSString *)key maxEditDistance:(NSUInteger)distance;
+/*!
+	@method everyObjectForKeyWithPrefix:maxEditDistance:
+	@abstract Get every object with a key that starts with something close to a prefix.
+	@discussion The same as <tt>everyObjectForKey:maxEditDistance:</tt> except that a key is found if any prefix of it is within <tt><i>distance</i></tt> edits of <tt><i>prefix</i></tt>, the distance of a key being that of its closest prefix, so with a distance of 0 this returns the same objects as <tt>everyObjectForKeyWithPrefix:</tt>.
+	@param prefix The prefix to look for, if <tt>nil</tt> the exception <tt>NSInvalidArgumentException</tt> is thrown.
+	@param distance The largest number of edits allowed.
+	@result The objects found, closest first, objects at the same distance are in key order.
+ */
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)prefix maxEditDistance:(NSUInteger)distance;
+/*!
+	@method topObjects:forKeyWithPrefix:
+	@abstract Find the heaviest objects with a given prefix.
+	@discussion Returns up to <tt><i>count</i></tt> objects whose keys have the prefix <tt><i>prefix</i></tt>, in order of the weight given to them with <tt>-[NDMutableTrie setObject:forKey:weight:]</tt>, heaviest first, which is what you want for type-ahead. Only the parts of the trie that could contain one of the objects are looked at, so the time taken depends on <tt><i>count</i></tt> and not on how many objects have the prefix. The order of objects with the same weight is indeterminate.
+	@param count The most objects to return.
+	@param prefix The prefix to search for, <tt>nil</tt> or an empty string to search the whole trie.
+	@result An <tt>NSArray</tt> of no more than <tt><i>count</i></tt> objects.
+ */
+- (NSArray *)topObjects:(NSUInteger)count forKeyWithPrefix:(NSString *)prefix;
+/*!
+	@method weightForKey:
+	@abstract Get the weight of a key.
+	@discussion Returns the weight set with <tt>-[NDMutableTrie setObject:forKey:weight:]</tt>, keys added any other way have a weight of 0.
+	@param key The key to get the weight for, the key is a complete match.
+	@result The weight or 0 if the key is not in the receiver.
+ */
+- (double)weightForKey:(NSString *)key;
 
 /*!
 	@method getObjects:count:
@@ -355,7 +694,7 @@
 /*!
 	@method objectEnumerator
 	@abstract Returns an enumerator object that lets you access each object in the receiver.
-	@discussion Returns an enumerator object that lets you access each object in the receiver, in an indeterminate order.
+	@discussion Returns an enumerator object that lets you access each object in the receiver, in an indeterminate order. Objects are found as they are asked for, so the enumerator costs the same however many objects the receiver contains. If the receiver is a <tt>NDMutableTrie</tt> it must not be changed while the enumerator is in use, the enumerator throws <tt>NSGenericException</tt> if it is.
 	@result An enumerator object that lets you access each object in the receiver.
  */
 - (NSEnumerator *)objectEnumerator;
@@ -363,7 +702,7 @@
 /*!
 	@method objectEnumeratorForKeyWithPrefix:
 	@abstract Returns an enumerator object that lets you access each object in the receiver.
-	@discussion Returns an enumerator object that lets you access each object in the receiver whose key has the prefix <tt><i>prefix</i></tt>, in an indeterminate order.
+	@discussion Returns an enumerator object that lets you access each object in the receiver whose key has the prefix <tt><i>prefix</i></tt>, in an indeterminate order. As with <tt>objectEnumerator</tt> the receiver must not be changed while the enumerator is in use.
 	@param prefix The prefix to search for.
 	@result An enumerator object that lets you access each object in the receiver.
  */
@@ -429,6 +768,59 @@
 	@result Returns <tt>YES</tt> if Successful
  */
 - (BOOL)writeToURL:(NSURL *)url atomically:(BOOL)atomically;
+/*!
+	@method writeBinaryToFile:atomically:
+	@abstract write a trie out to a binary file.
+	@discussion See <tt>-[NDTrie writeBinaryToURL:atomically:]</tt>.
+	@param path The output file path
+	@param atomically If YES, the trie is written to an auxiliary file, and then the auxiliary file is renamed to path. If NO, the trie is written directly to path.
+	@result Returns <tt>YES</tt> if Successful
+ */
+- (BOOL)writeBinaryToFile:(NSString *)path atomically:(BOOL)atomically;
+/*!
+	@method writeBinaryToURL:atomically:
+	@abstract write a trie out to a binary file.
+	@discussion The outputed file holds the nodes of the trie, along with the weights of the objects, and can be read with <tt>-[NDTrie initWithMappedContentsOfURL:]</tt> without any parsing. Every object has to be an <tt>NSString</tt>. The file is in the byte order of the machine that wrote it.
+	@param url The output file url
+	@param atomically If YES, the trie is written to an auxiliary file, and then the auxiliary file is renamed to path. If NO, the trie is written directly to path.
+	@result Returns <tt>YES</tt> if Successful, <tt>NO</tt> if an object is not a string or the file could not be written.
+ */
+- (BOOL)writeBinaryToURL:(NSURL *)url atomically:(BOOL)atomically;
+
+/*!
+	@method compactedTrie
+	@abstract Get an immutable copy of the trie in the least memory.
+	@discussion The copy is a minimal acyclic word graph, every part of the trie that is the same as another part, the same keys below it with the same objects and weights, is kept only once, so endings like "ing", "tion" and "ness" shared by many keys take up the space of one. An object that is the same string as its key is not kept at all, a new string is made from the key each time it is returned, so a trie of strings added with <tt>-[NDMutableTrie addString:]</tt> or <tt>-[NDTrie initWithArray:]</tt> typically takes a tenth of the memory or less. Other objects are retained and stop the part of the trie above them being shared with anything else, so tries of such objects gain little. Inside the copy each character is a node of its own whatever the options of the receiver. Every method that reads a trie works on the copy and lookups take about as long, enumeration makes the string for each key as it goes and <tt>-[NDTrie enumerateMatchesInString:options:usingBlock:]</tt> compiles its automaton from an ordinary copy of the trie that is then thrown away. Sending <tt>mutableCopy</tt> to the copy gives back an ordinary <tt>NDMutableTrie</tt>.
+	@result An immutable <tt>NDTrie</tt> with the same keys, objects and weights as the receiver.
+ */
+- (NDTrie *)compactedTrie;
+
+/*!
+	@method trieByUnioningTrie:mergePolicy:
+	@abstract Get a trie of the keys of the receiver and another trie.
+	@discussion The result is a mutable copy of the receiver sent <tt>-[NDMutableTrie unionTrie:mergePolicy:]</tt>, it shares every node the merge leaves alone with the receiver and those of <tt><i>trie</i></tt> it adopts whole, so it costs time and memory in proportion to where the two tries differ rather than to their size.
+	@param trie The trie whose keys are added.
+	@param policy Called for each key in both tries with the key and the objects of the receiver and of <tt><i>trie</i></tt>, returns the object to keep or <tt>nil</tt> to leave the key out, may be <tt>nil</tt> to keep the object of <tt><i>trie</i></tt>.
+	@result An <tt>NDMutableTrie</tt> with the options of the receiver.
+ */
+- (NDTrie *)trieByUnioningTrie:(NDTrie *)trie mergePolicy:(id (^)(NSString * key, id object, id otherObject))policy;
+/*!
+	@method trieByIntersectingTrie:mergePolicy:
+	@abstract Get a trie of the keys common to the receiver and another trie.
+	@discussion The result is a mutable copy of the receiver sent <tt>-[NDMutableTrie intersectTrie:mergePolicy:]</tt>.
+	@param trie The trie whose keys are kept.
+	@param policy Called for each key in both tries with the key and the objects of the receiver and of <tt><i>trie</i></tt>, returns the object to keep or <tt>nil</tt> to leave the key out, may be <tt>nil</tt> to keep the object of the receiver.
+	@result An <tt>NDMutableTrie</tt> with the options of the receiver.
+ */
+- (NDTrie *)trieByIntersectingTrie:(NDTrie *)trie mergePolicy:(id (^)(NSString * key, id object, id otherObject))policy;
+/*!
+	@method trieBySubtractingTrie:
+	@abstract Get a trie of the keys of the receiver not in another trie.
+	@discussion The result is a mutable copy of the receiver sent <tt>-[NDMutableTrie minusTrie:]</tt>.
+	@param trie The trie whose keys are removed.
+	@result An <tt>NDMutableTrie</tt> with the options of the receiver.
+ */
+- (NDTrie *)trieBySubtractingTrie:(NDTrie *)trie;
 
 #if NS_BLOCKS_AVAILABLE
 /*!
@@ -465,6 +857,61 @@
  */
 - (NSArray *)everyObjectForKeyWithPrefix:(NSString*)prefix passingTest:(BOOL (^)(id object, BOOL *stop))predicate;
 
+/*!
+	@method enumerateObjectsWithOptions:usingBlock:
+	@abstract Pass each members of a trie to a block, possibly concurrently.
+	@discussion The same as <tt>-[NDTrie enumerateObjectsUsingBlock:]</tt> except that if <tt><i>options</i></tt> contains <tt>NSEnumerationConcurrent</tt> the block is called from several threads at once. The trie is cut up in to pieces of about the same number of strings which are handed out to every core, so the block should be safe to call from any thread and should be expensive enough to be worth it. Setting <tt><i>stop</i></tt> to <tt>YES</tt> stops any pieces that have not started and the rest as soon as the calls already running have returned. <tt>NSEnumerationReverse</tt> is ignored. A trie created with <tt>-[NDTrie initWithMappedContentsOfURL:]</tt> is always enumerated on the calling thread.
+	@param options A bit mask of <tt>NSEnumerationOptions</tt>.
+	@param block A block of the form <code>^(NSString * string, BOOL *stop)</code>
+ */
+- (void)enumerateObjectsWithOptions:(NSEnumerationOptions)options usingBlock:(void (^)(id object, BOOL *stop))block;
+/*!
+	@method enumerateObjectsForKeysWithPrefix:options:usingBlock:
+	@abstract Pass each members of a trie with a given prefix to a block, possibly concurrently.
+	@discussion See <tt>-[NDTrie enumerateObjectsWithOptions:usingBlock:]</tt>.
+	@param prefix The prefix each string passed to the block begin with.
+	@param options A bit mask of <tt>NSEnumerationOptions</tt>.
+	@param block A block of the form <code>^(NSString * string, BOOL *stop)</code>
+ */
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)prefix options:(NSEnumerationOptions)options usingBlock:(void (^)(id object, BOOL *stop))block;
+/*!
+	@method everyObjectWithOptions:passingTest:
+	@abstract create an array with every string passing a test, possibly testing concurrently.
+	@discussion The same as <tt>-[NDTrie everyObjectPassingTest:]</tt> except that if <tt><i>options</i></tt> contains <tt>NSEnumerationConcurrent</tt> the predicate is called from several threads at once, as for <tt>-[NDTrie enumerateObjectsWithOptions:usingBlock:]</tt>. Whether concurrent or not the returned array is in the order of the keys, each thread keeps what passes its own piece of the trie and the pieces are put together in order at the end. If the predicate stops the enumeration the array contains what passed before then, which for a concurrent test need not be the first strings in order.
+	@param options A bit mask of <tt>NSEnumerationOptions</tt>.
+	@param predicate Block used to test each string of the form <code>BOOL ^(NSString * string, BOOL *stop)</code>
+	@result An <tt>NSArray</tt> containing every string that resulted in <tt><i>predicate</i><tt> returning true.
+ */
+- (NSArray *)everyObjectWithOptions:(NSEnumerationOptions)options passingTest:(BOOL (^)(id object, BOOL *stop))predicate;
+/*!
+	@method everyObjectForKeyWithPrefix:options:passingTest:
+	@abstract create an array with every string beging with a prefix and passing a test, possibly testing concurrently.
+	@discussion See <tt>-[NDTrie everyObjectWithOptions:passingTest:]</tt>.
+	@param prefix The prefix each string passed to the block begin with.
+	@param options A bit mask of <tt>NSEnumerationOptions</tt>.
+	@param predicate Block used to test each string of the form <code>BOOL ^(NSString * string, BOOL *stop)</code>
+	@result An <tt>NSArray</tt> containing every string that resulted in <tt><i>predicate</i><tt> returning true.
+ */
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString*)prefix options:(NSEnumerationOptions)options passingTest:(BOOL (^)(id object, BOOL *stop))predicate;
+
+/*!
+	@method enumerateMatchesInString:usingBlock:
+	@abstract Find every key of the receiver that occurs within a string.
+	@discussion The same as <tt>enumerateMatchesInString:options:usingBlock:</tt> with the option <tt>NDTrieMatchAll</tt>.
+	@param string The string to search.
+	@param block Block called for each match of the form <code>void ^(NSRange range, id object, BOOL *stop)</code>, where <tt><i>range</i></tt> is the range of the key within <tt><i>string</i></tt> and <tt><i>object</i></tt> is its object.
+ */
+- (void)enumerateMatchesInString:(NSString *)string usingBlock:(void (^)(NSRange range, id object, BOOL *stop))block;
+/*!
+	@method enumerateMatchesInString:options:usingBlock:
+	@abstract Find the keys of the receiver that occur within a string in a single pass.
+	@discussion The first search compiles the keys of the receiver into an Aho-Corasick automaton, with a state for every character of every key and links from each state to the longest suffix of it that is also a state and to the nearest such suffix that is a key. The automaton is kept and used until the receiver changes, which throws it away, the next search then compiles it again. Changing the receiver from within <tt><i>block</i></tt> raises an <tt>NSGenericException</tt> once <tt><i>block</i></tt> returns. The string is then read once, the time taken is proportional to the length of the string plus the number of matches, for <tt>NDTrieMatchLeftmostLongest</tt> up to the length of the longest key is read again after each match. Case insensitive tries match regardless of case. The automaton takes around 32 bytes for every character of every key, and retains every object.
+	@param string The string to search.
+	@param options One of the <tt>NDTrieMatchOptions</tt>.
+	@param block Block called for each match of the form <code>void ^(NSRange range, id object, BOOL *stop)</code>, where <tt><i>range</i></tt> is the range of the key within <tt><i>string</i></tt> and <tt><i>object</i></tt> is its object, set <tt>*<i>stop</i></tt> to <tt>YES</tt> to stop the search.
+ */
+- (void)enumerateMatchesInString:(NSString *)string options:(NDTrieMatchOptions)options usingBlock:(void (^)(NSRange range, id object, BOOL *stop))block;
+
 #endif
 
 /*!
@@ -501,6 +948,23 @@
 	@param string A key with must a <tt>NSString</tt> or a subclass.
  */
 - (void)setObject:(id)object forKey:(NSString *)string;
+/*!
+	@method addString:weight:
+	@abstract add a string the trie with a weight.
+	@discussion This is eqivelent to calling setObject:forKey:weight: with <tt><i>string</i></tt> as the key and object.
+	@param string The String to add. which is used as the key and the object.
+	@param weight The weight used to order the string by <tt>topObjects:forKeyWithPrefix:</tt>.
+ */
+- (void)addString:(NSString *)string weight:(double)weight;
+/*!
+	@method setObject:forKey:weight:
+	@abstract Add an object for a key with a weight.
+	@discussion Like <tt>setObject:forKey:</tt> but also sets the weight used to order the object by <tt>topObjects:forKeyWithPrefix:</tt>, for example how often a word is used. <tt>setObject:forKey:</tt> keeps the weight of a key already in the receiver and gives new keys a weight of 0. The weight can be changed up or down at any time by setting it again.
+	@param object The object to add for the given key.
+	@param string A key with must a <tt>NSString</tt> or a subclass.
+	@param weight A finite weight, larger weights come first.
+ */
+- (void)setObject:(id)object forKey:(NSString *)string weight:(double)weight;
 /*!
 	@method addStrings:
 	@abstract Add a list of strings to a trie.
@@ -526,7 +990,7 @@
 /*!
 	@method setObjects:forKeys:count:
 	@abstract add a c array of objects and keys to a trie/
-	@discussion Each object in the c array <tt><i>objects</i></tt> must have a key in the c array <tt><i>keys</i></tt>, there must be <tt><i>count</i></tt> or more objects and keys in each c array, if there are dupicate keys the only on object for the corresponding keys is used.
+	@discussion Each object in the c array <tt><i>objects</i></tt> must have a key in the c array <tt><i>keys</i></tt>, there must be <tt><i>count</i></tt> or more objects and keys in each c array, if there are dupicate keys the only on object for the corresponding keys is used. If the reciever is empty the trie is built in one pass from the sorted keys, the same as <tt>initWithOptions:objects:forKeys:count:</tt>.
 	@param objects A c array of objects
 	@param keys A c array of keys, where each key belongs to the object with the same index in <tt><i>objects</i></tt>.
 	@param count The number of objects and keys in the c arrays, there may be more but there can not be less.
@@ -534,10 +998,47 @@
 - (void)setObjects:(id *)objects forKeys:(NSString **)keys count:(NSUInteger)count;
 /*!
 	@method addTrie:
-	@abstract add all strings from one trie to another.
-	@discussion Ther may be strings common between the two trie, in which case the additional string will not be added.
+	@abstract add all keys from one trie to another.
+	@discussion The same as <tt>-[NDMutableTrie unionTrie:]</tt>, the objects and weights of <tt><i>trie</i></tt> are added along with its keys, keys common to the two tries take the object of <tt><i>trie</i></tt> and keep their weight.
  */
 - (void)addTrie:(NDTrie *)trie;
+/*!
+	@method unionTrie:
+	@abstract add all keys from one trie to another.
+	@discussion The same as <tt>-[NDMutableTrie unionTrie:mergePolicy:]</tt> without a policy.
+	@param trie The trie whose keys are added.
+ */
+- (void)unionTrie:(NDTrie *)trie;
+/*!
+	@method unionTrie:mergePolicy:
+	@abstract add all keys from one trie to another.
+	@discussion The two tries are walked together node by node, a part of <tt><i>trie</i></tt> with no keys in the receiver is taken whole, shared rather than copied when both tries were copied from the same trie, and a part the two tries share already is skipped, so the merge costs time in proportion to where the tries differ. Keys added take their objects and weights from <tt><i>trie</i></tt>. For a case insensitive receiver the keys of a case sensitive <tt><i>trie</i></tt> are folded first, the keys of a case insensitive <tt><i>trie</i></tt> are merged into a case sensitive receiver as they are stored, in upper case. <tt><i>trie</i></tt> may be the receiver or any kind of trie. The policy must not throw, the receiver would be left partly merged.
+	@param trie The trie whose keys are added.
+	@param policy Called for each key in both tries with the key and the objects of the receiver and of <tt><i>trie</i></tt>, returns the object to keep or <tt>nil</tt> to remove the key, may be <tt>nil</tt> to keep the object of <tt><i>trie</i></tt>. Either way the key keeps the weight it has in the receiver.
+ */
+- (void)unionTrie:(NDTrie *)trie mergePolicy:(id (^)(NSString * key, id object, id otherObject))policy;
+/*!
+	@method intersectTrie:
+	@abstract remove every key not in another trie.
+	@discussion The same as <tt>-[NDMutableTrie intersectTrie:mergePolicy:]</tt> without a policy.
+	@param trie The trie whose keys are kept.
+ */
+- (void)intersectTrie:(NDTrie *)trie;
+/*!
+	@method intersectTrie:mergePolicy:
+	@abstract remove every key not in another trie.
+	@discussion The two tries are walked together the same as <tt>-[NDMutableTrie unionTrie:mergePolicy:]</tt>, a part of the receiver with no keys in <tt><i>trie</i></tt> is dropped whole. Kept keys keep the weights of the receiver.
+	@param trie The trie whose keys are kept.
+	@param policy Called for each key in both tries with the key and the objects of the receiver and of <tt><i>trie</i></tt>, returns the object to keep or <tt>nil</tt> to remove the key, may be <tt>nil</tt> to keep the object of the receiver. The policy must not throw.
+ */
+- (void)intersectTrie:(NDTrie *)trie mergePolicy:(id (^)(NSString * key, id object, id otherObject))policy;
+/*!
+	@method minusTrie:
+	@abstract remove every key in another trie.
+	@discussion The two tries are walked together the same as <tt>-[NDMutableTrie unionTrie:mergePolicy:]</tt>, a part both tries share is dropped whole without being walked.
+	@param trie The trie whose keys are removed.
+ */
+- (void)minusTrie:(NDTrie *)trie;
 /*!
 	@method addArray:
 	@abstract add an array of strings to a trie.
@@ -552,6 +1053,24 @@
 	@param dictionary The dictionary for which each key/object pair is added to the reciever, every key must be if a <tt>NSString</tt> or subclass.
  */
 - (void)addDictionay:(NSDictionary *)dictionary;
+/*!
+	@method addContentsOfWordListFile:progress:
+	@abstract Add the lines of a text file to a trie.
+	@discussion See <tt>-[NDMutableTrie addContentsOfWordListURL:progress:]</tt>.
+	@param path A path to a UTF-8 text file with one key per line.
+	@param progress An optional block called as the file is read.
+	@result <tt>NO</tt> if the file could not be opened.
+ */
+- (BOOL)addContentsOfWordListFile:(NSString *)path progress:(void (^)(unsigned long long bytesRead, unsigned long long totalBytes, BOOL *stop))progress;
+/*!
+	@method addContentsOfWordListURL:progress:
+	@abstract Add the lines of a text file to a trie.
+	@discussion The file is read in the same way as <tt>-[NDTrie initWithOptions:contentsOfWordListURL:progress:]</tt>, keys already in the trie have their object replaced and, if the line has one, their weight.
+	@param url A file url to a UTF-8 text file with one key per line.
+	@param progress An optional block of the form <code>^(unsigned long long bytesRead, unsigned long long totalBytes, BOOL *stop)</code> called after each buffer is read, setting <tt>*stop</tt> to <tt>YES</tt> stops reading.
+	@result <tt>NO</tt> if the file could not be opened.
+ */
+- (BOOL)addContentsOfWordListURL:(NSURL *)url progress:(void (^)(unsigned long long bytesRead, unsigned long long totalBytes, BOOL *stop))progress;
 
 /*!
 	@method removeObjectForKey:
@@ -577,3 +1096,108 @@
 - (void)setObject:(id)object forKeyedSubscript:(NSString *)aKey;
 
 @end
+
+/*!
+	@class NDTrieCompletionSession
+	@abstract Completions for a prefix typed a character at a time.
+	@discussion A session keeps its place in a trie as the prefix changes, so adding or deleting a character costs one step down or back up the trie rather than a lookup of the whole prefix. The objects for the last few prefixes are kept, the objects for a longer prefix are then taken straight out of those for a shorter one and going back to a shorter prefix returns them again, without walking the trie either way. If an <tt>NDMutableTrie</tt> is changed the session finds its place again from the characters typed the next time it is used and forgets the objects it kept. Mapped and compacted tries, which have no nodes to keep a place in, and tries with the option <tt>NDTrieConcurrentReads</tt>, which can change under any thread, are instead sent the prefix methods of <tt>NDTrie</tt> each time. A session is not thread safe.
+ */
+@interface NDTrieCompletionSession : NSObject
+
+/*!
+	@method completionSessionWithTrie:
+	@abstract Create a new session with an empty prefix.
+	@param trie The trie to complete from, it is retained by the session.
+	@result A new session.
+ */
++ (id)completionSessionWithTrie:(NDTrie *)trie;
+/*!
+	@method initWithTrie:
+	@abstract Initialize a session with an empty prefix that keeps the objects for the last eight prefixes.
+	@param trie The trie to complete from, it is retained by the session.
+	@result The initialized session.
+ */
+- (id)initWithTrie:(NDTrie *)trie;
+/*!
+	@method initWithTrie:cacheLimit:
+	@abstract Initialize a session with an empty prefix.
+	@param trie The trie to complete from, it is retained by the session.
+	@param cacheLimit The number of prefixes to keep the objects for, <tt>0</tt> to always collect them from the trie.
+	@result The initialized session.
+ */
+- (id)initWithTrie:(NDTrie *)trie cacheLimit:(NSUInteger)cacheLimit;
+
+/*!
+	@property trie
+	@abstract The trie completed from.
+ */
+@property(readonly,nonatomic)	NDTrie		* trie;
+/*!
+	@property prefix
+	@abstract The characters typed so far, as they were typed.
+ */
+@property(readonly,nonatomic)	NSString	* prefix;
+
+/*!
+	@method appendString:
+	@abstract Add characters to the end of the prefix.
+	@param string The characters to add.
+ */
+- (void)appendString:(NSString *)string;
+/*!
+	@method appendCharacters:length:
+	@abstract Add characters to the end of the prefix.
+	@discussion Each character is one step down the trie, once a character has no match in the trie the characters after it are just kept to be deleted again.
+	@param characters A c array of UTF-16 characters.
+	@param length The number of characters in <tt><i>characters</i></tt>.
+ */
+- (void)appendCharacters:(const unichar *)characters length:(NSUInteger)length;
+/*!
+	@method deleteBackward
+	@abstract Remove the last character of the prefix.
+	@discussion The session steps back to where it was before the character was added, does nothing if the prefix is empty.
+ */
+- (void)deleteBackward;
+/*!
+	@method reset
+	@abstract Empty the prefix.
+	@discussion The objects kept for earlier prefixes are kept.
+ */
+- (void)reset;
+
+/*!
+	@method count
+	@abstract Get the number of objects for keys with the prefix.
+	@result The count, taken from the trie without visiting the objects.
+ */
+- (NSUInteger)count;
+/*!
+	@method object
+	@abstract Get the object for a key equal to the prefix.
+	@result The object or <tt>nil</tt> if the prefix is not a key.
+ */
+- (id)object;
+/*!
+	@method everyObject
+	@abstract Get every object for keys with the prefix.
+	@discussion The same as <tt>-[NDTrie everyObjectForKeyWithPrefix:]</tt> with the prefix, in the same order.
+	@result An array of objects, empty if no key has the prefix.
+ */
+- (NSArray *)everyObject;
+/*!
+	@method topObjects:
+	@abstract Get the objects with the highest weights for keys with the prefix.
+	@discussion The same as <tt>-[NDTrie topObjects:forKeyWithPrefix:]</tt> with the prefix, these are not kept.
+	@param count The most objects to return.
+	@result An array of up to <tt><i>count</i></tt> objects, highest weight first.
+ */
+- (NSArray *)topObjects:(NSUInteger)count;
+/*!
+	@method objectEnumerator
+	@abstract Get an enumerator for every object for keys with the prefix.
+	@discussion Changing the prefix afterwards has no effect on the enumerator, changing the trie does.
+	@result An <tt>NSEnumerator</tt>.
+ */
+- (NSEnumerator *)objectEnumerator;
+
+@end
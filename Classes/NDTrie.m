@@ -25,6 +25,19 @@
 
 #import "NDTrie.h"
 #include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#if NDTrieUseDispatch
+#include <dispatch/dispatch.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #if __has_feature(objc_arc)
 #error This file cannot be compiled with ARC enabled, you can use it in a ARC project by turning of ARC for this file, google 'disable ARC for a single file in Xcode' <https://www.google.com.au/search?client=safari&rls=en&q=disable+ARC+for+a+single+file+in+Xcode>
@@ -34,14 +47,106 @@ static NSString		* const kPListPListElementName = @"plist",
 					* const kArrayPListElementName = @"array",
 					* const kStringPListElementName = @"string";
 
+NSString * const NDTrieStatisticsNodeCountKey = @"NDTrieStatisticsNodeCount";
+NSString * const NDTrieStatisticsObjectCountKey = @"NDTrieStatisticsObjectCount";
+NSString * const NDTrieStatisticsNodeBytesKey = @"NDTrieStatisticsNodeBytes";
+NSString * const NDTrieStatisticsChildSlotBytesAllocatedKey = @"NDTrieStatisticsChildSlotBytesAllocated";
+NSString * const NDTrieStatisticsChildSlotBytesUsedKey = @"NDTrieStatisticsChildSlotBytesUsed";
+NSString * const NDTrieStatisticsDirectIndexBytesKey = @"NDTrieStatisticsDirectIndexBytes";
+NSString * const NDTrieStatisticsRunBytesKey = @"NDTrieStatisticsRunBytes";
+NSString * const NDTrieStatisticsTotalBytesKey = @"NDTrieStatisticsTotalBytes";
+NSString * const NDTrieStatisticsMaxDepthKey = @"NDTrieStatisticsMaxDepth";
+NSString * const NDTrieStatisticsDepthHistogramKey = @"NDTrieStatisticsDepthHistogram";
+NSString * const NDTrieStatisticsFanoutHistogramKey = @"NDTrieStatisticsFanoutHistogram";
+NSString * const NDTrieStatisticsSingleChildChainCountKey = @"NDTrieStatisticsSingleChildChainCount";
+NSString * const NDTrieStatisticsSingleChildChainNodeCountKey = @"NDTrieStatisticsSingleChildChainNodeCount";
+NSString * const NDTrieStatisticsLongestSingleChildChainKey = @"NDTrieStatisticsLongestSingleChildChain";
+NSString * const NDTrieStatisticsSharedNodeCountKey = @"NDTrieStatisticsSharedNodeCount";
+
+/*
+	In a path compressed trie a node can stand for more than one key component, key is the first component and run
+	holds the rest, for every other trie runLength is always 0.
+
+	The keys of the children are also kept in order in childKeys, which shares one allocation with children, so
+	finding a child only touches the parent. How a child is found depends on how many there are, up to 16 the keys
+	are compared 8 at a time with SIMD, after that binary search, and once a node has more than 48 children it also
+	gets directIndex, which maps every key below 256 straight to its position + 1.
+
+	weight is the weight of object and maxWeight is never less than the largest weight of any object in the subtree of
+	the node, it is -HUGE_VAL for a subtree without any objects, which lets topObjects:forKeyWithPrefix: skip subtrees
+	that can not contain anything better than what it has already found. objectCount is the number of objects in the
+	subtree, including the object of the node itself.
+
+	Copies of a trie share their nodes, refCount is the number of child arrays a node is in across all of the tries
+	that share it, a node is only ever changed when its refCount is 1 and every node on the way to it has been made
+	that way first by _uniqueChild, so a change copies the path from the root instead of the whole trie. Nodes do not
+	know their parent as they can have more than one. The root of each trie is its own and never shared.
+ */
 struct trieNode
 {
 	NSUInteger			key;
 	NSUInteger			count,
 						size;
 	id					object;
-	struct trieNode		* parent;
+	volatile long		refCount;
 	struct trieNode		** children;
+	unichar				* childKeys;
+	uint16_t			* directIndex;
+	NSUInteger			runLength;
+	unichar				* run;
+	double				weight,
+						maxWeight;
+	NSUInteger			objectCount;
+};
+
+/* passed as the weight to setObjectForKey to leave the weight of an existing key alone, new keys get 0 */
+#define kTrieUnchangedWeight NAN
+
+enum
+{
+	kTrieNodeSmallLimit = 16,
+	kTrieNodeDenseLimit = 48,
+	kTrieNodeSparseLimit = 40,
+	kTrieNodeDirectIndexCount = 256
+};
+
+/* the keys are padded out to whole 16 byte vectors so they can be loaded without going past the end of the block */
+#define kTrieChildKeysSize(aSize) (((aSize)*sizeof(unichar)+15)&~(NSUInteger)15)
+#define kTrieChildBlockSize(aSize) (kTrieChildKeysSize(aSize)+(aSize)*sizeof(struct trieNode*))
+
+/*
+	Every node and child array of a trie is carved out of large blocks owned by the trie, memory given back by removals
+	goes onto a free list for its size class to be reused by later insertions, and the whole lot is freed a block at a
+	time when the trie is emptied or destroyed instead of a node at a time.
+
+	Copies of a trie share its arena along with its nodes, useCount is the number of tries using it, once there is
+	more than one any of them can give memory back from any thread so the arena is locked while it is shared.
+ */
+enum
+{
+	kTrieArenaBlockSize = 64*1024,
+	kTrieArenaGranularity = 16,
+	kTrieArenaSmallLimit = 1024,
+	kTrieArenaSizeClassCount = 128
+};
+
+struct trieArenaBlock
+{
+	struct trieArenaBlock	* next;
+	NSUInteger				used,
+							size;
+};
+
+/* keep the memory handed out from a block aligned as well as malloc would */
+#define kTrieArenaBlockHeaderSize ((sizeof(struct trieArenaBlock)+kTrieArenaGranularity-1)&~(NSUInteger)(kTrieArenaGranularity-1))
+
+struct trieArena
+{
+	struct trieArenaBlock	* blocks;
+	void					* freeList[kTrieArenaSizeClassCount];
+	NSUInteger				blockCount;
+	volatile long			useCount,
+							lock;
 };
 
 struct getObjectsCountData
@@ -52,33 +157,416 @@ struct getObjectsCountData
 	id								* objects;
 };
 
-static struct trieNode * findNode( struct trieNode *, id, NSUInteger, BOOL, struct trieNode **, NSUInteger *, NSUInteger (*)( id, NSUInteger, BOOL* ));
-static BOOL removeObjectForKey( struct trieNode *, id, NSUInteger, BOOL *, NSUInteger (*)( id, NSUInteger, BOOL* ) );
-static NSUInteger removeAllChildren( struct trieNode *);
-static NSUInteger removeChild( struct trieNode *, id, NSUInteger (*)( id, NSUInteger, BOOL* ) );
-static BOOL setObjectForKey( struct trieNode *, id, id, NSUInteger (*)( id, NSUInteger, BOOL* ) );
+/*
+	A depth first walk over the nodes below a node that can be stopped and started, each frame is a node on the path
+	from the start node along with the index of the next of its children to visit.
+ */
+struct trieCursorFrame
+{
+	struct trieNode		* node;
+	NSUInteger			index;
+};
+
+struct trieCursor
+{
+	struct trieCursorFrame	* frames;
+	NSUInteger				depth,
+							capacity;
+};
+
+/*
+	The binary file written by writeBinaryToURL:atomically: is a header, then every node in a flat array, then the key
+	of every node in an array of its own followed by padding, and then the characters of every run and object. Nodes
+	refer to each other by index and to characters by offset so the file can be mapped in anywhere and used as is. The
+	children of a node are next to each other, so their keys can be searched just like childKeys, and in key order.
+	An object that is the same string as the key of its node is not written out, it is made again from the key.
+ */
+enum
+{
+	kTrieFileMagic = 0x4E445472,			// 'NDTr'
+	kTrieFileVersion = 1,
+	kTrieFileByteOrder = 0x01020304,
+	kTrieFileCaseInsensitive = 1<<0,
+	kTrieFilePathCompression = 1<<1,
+	kTrieFileKeyPadding = kTrieNodeSmallLimit		// so the keys of the last child array can be loaded 8 at a time
+};
+
+#define kTrieFileNoObject UINT32_MAX
+#define kTrieFileObjectIsKey (UINT32_MAX-1)
+
+struct trieFileHeader
+{
+	uint32_t		magic,
+					byteOrder;
+	uint16_t		version,
+					flags;
+	uint32_t		nodeCount,
+					characterCount,
+					reserved;
+	uint64_t		count;
+};
+
+struct trieFileNode
+{
+	double			weight,
+					maxWeight;
+	uint32_t		parent,
+					children,
+					count,
+					run,
+					runLength,
+					object,
+					objectLength,
+					objectCount;
+};
+
+#define kTrieFileLength(aNodeCount,aCharacterCount) (sizeof(struct trieFileHeader)+(uint64_t)(aNodeCount)*sizeof(struct trieFileNode)+((uint64_t)(aNodeCount)+kTrieFileKeyPadding+(uint64_t)(aCharacterCount))*sizeof(unichar))
+
+struct trieMap
+{
+	const struct trieFileHeader		* header;
+	const struct trieFileNode		* nodes;
+	const unichar					* keys,
+									* characters;
+};
+
+/*
+	An Aho-Corasick automaton built from the nodes of a trie for enumerateMatchesInString:options:usingBlock:, every unit
+	of every key is a state of its own, so the runs of a path compressed trie are spread out over a state a unit. As in
+	the binary file the children of a state are next to each other and in key order, and keys holds the key of every
+	state so they can be searched the same way. fail is the state for the longest proper suffix of the string of a state
+	that is also a state, output the first state with an object found by following fail links from the state itself, or
+	kTrieScanNoState. The states are in breadth first order so fail and output can be filled in going through them once.
+ */
+#define kTrieScanNoState UINT32_MAX
+
+struct trieScanState
+{
+	uint32_t		children,
+					count,
+					fail,
+					output,
+					depth;
+	id				object;
+};
+
+struct trieScanner
+{
+	struct trieScanState	* states;
+	unichar					* keys;
+	NSUInteger				count;
+};
+
+/*
+	The minimal acyclic word graph behind compactedTrie. Every subtree that is the same as another, down to the objects
+	and weights, is kept once, so a node can be reached along more than one path and has no key or parent of its own,
+	its key is made from the edges followed to get to it. Every edge is one unit, the edges of a node are next to each
+	other in key order so they can be searched like the children of a mapped file, with keys padded the same way.
+	object is kTrieFileNoObject, kTrieFileObjectIsKey for a string made again from the key each time, or the index of
+	the object in objects. weights holds the weight and maxWeight of every node, or is NULL when every weight is 0.
+	The root is node 0.
+ */
+struct trieGraphNode
+{
+	uint32_t		edges,
+					count,
+					object,
+					objectCount;
+};
+
+struct trieGraph
+{
+	struct trieGraphNode	* nodes;
+	unichar					* keys;
+	uint32_t				* targets;
+	double					* weights;
+	id						* objects;
+	NSUInteger				nodeCount,
+							edgeCount,
+							objectCount;
+};
+
+/*
+	How the walks of the read only tries, the mapped file and the graph, get around nodes they do not know the layout
+	of. A node is an index and the root is 0. The children of a node are next to each other in key order, childKeys
+	gives the unit of the edge to each of them, padded so they can be searched like the children of a node, and child
+	the node at the end of one of those edges. run is the rest of the key of a node after the unit of the edge to it.
+	A node does not have to know its key, object is given it, as an object can be made from its key, and is nil for
+	a node without one. childSlotSize is the bytes each child takes up, for statistics.
+ */
+struct trieLayout
+{
+	const unichar	* (*childKeys)( const void *, NSUInteger, NSUInteger * );
+	NSUInteger		(*child)( const void *, NSUInteger, NSUInteger );
+	const unichar	* (*run)( const void *, NSUInteger, NSUInteger * );
+	BOOL			(*hasObject)( const void *, NSUInteger );
+	id				(*object)( const void *, NSUInteger, const unichar *, NSUInteger );
+	double			(*weight)( const void *, NSUInteger );
+	double			(*maxWeight)( const void *, NSUInteger );
+	NSUInteger		(*objectCount)( const void *, NSUInteger );
+	NSUInteger		(*nodeCount)( const void * );
+	NSUInteger		childSlotSize;
+};
+
+/* a trieMap or trieGraph along with how to walk it */
+struct trieView
+{
+	const struct trieLayout		* layout;
+	const void					* data;
+};
+
+/*
+	A depth first walk over the nodes of a view below a start node, nodes holds the node at each depth of the walk,
+	children the next child of it to follow and lengths the length of its key. key holds the key of the start node
+	and then the units of the edges and runs followed, so the key of the node at the bottom is the first length units.
+	Everything grows as the walk goes deeper.
+ */
+struct viewCursor
+{
+	struct trieView		view;
+	NSUInteger			* nodes,
+						* children,
+						* lengths,
+						depth,
+						capacity,
+						length,
+						keyCapacity;
+	unichar				* key;
+	BOOL				started;
+};
+
+/*
+	what mergeNodes does with the keys of the other trie, add them, keep only the keys in both or take them away
+ */
+enum trieMergeOperation
+{
+	kTrieMergeUnion,
+	kTrieMergeIntersect,
+	kTrieMergeMinus
+};
+
+/*
+	The counters behind +[NDTrie counters], one set for every trie in the process, they are only ever added to with
+	relaxed atomics so they give a rough picture while tries are in use on other threads. Without NDTrieCollectCounters
+	the functions that count are empty and the compiler removes them along with whatever was counted.
+ */
+#if NDTrieCollectCounters
+enum
+{
+	kTrieEnumerationSizeCount = 32
+};
+
+static struct
+{
+	volatile uint64_t	lookups,
+						lookupNodesVisited,
+						lookupMaxNodesVisited,
+						childArrayResizes,
+						enumerations,
+						objectsEnumerated,
+						enumerationSizes[kTrieEnumerationSizeCount];
+} _trieCounters;
+#endif
+
+static inline void _countLookup( NSUInteger aVisited )
+{
+#if NDTrieCollectCounters
+	uint64_t		theMax = __atomic_load_n( &_trieCounters.lookupMaxNodesVisited, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &_trieCounters.lookups, 1, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &_trieCounters.lookupNodesVisited, aVisited, __ATOMIC_RELAXED );
+	while( aVisited > theMax && !__atomic_compare_exchange_n( &_trieCounters.lookupMaxNodesVisited, &theMax, (uint64_t)aVisited, YES, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+		;
+#endif
+}
+
+static inline void _countChildArrayResize( void )
+{
+#if NDTrieCollectCounters
+	__atomic_fetch_add( &_trieCounters.childArrayResizes, 1, __ATOMIC_RELAXED );
+#endif
+}
+
+/* enumerations are put in the bucket for the number of bits in their size, so 0, 1, 2-3, 4-7 and so on */
+static inline void _countEnumeration( NSUInteger aCount )
+{
+#if NDTrieCollectCounters
+	NSUInteger		theBucket = aCount > 0 ? 64 - __builtin_clzll( (unsigned long long)aCount ) : 0;
+	if( theBucket >= kTrieEnumerationSizeCount )
+		theBucket = kTrieEnumerationSizeCount-1;
+	__atomic_fetch_add( &_trieCounters.enumerations, 1, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &_trieCounters.objectsEnumerated, aCount, __ATOMIC_RELAXED );
+	__atomic_fetch_add( &_trieCounters.enumerationSizes[theBucket], 1, __ATOMIC_RELAXED );
+#endif
+}
+
+struct trieKey;
+
+static struct trieArena * createArena( void );
+static void destroyArena( struct trieArena * );
+static struct trieArena * retainArena( struct trieArena * );
+static void releaseArena( struct trieArena * );
+static void * _arenaAlloc( struct trieArena *, NSUInteger );
+static NSUInteger _arenaBytes( struct trieArena * );
+static struct trieNode * findNode( struct trieNode *, id, NSUInteger, BOOL, struct trieNode **, NSUInteger *, NSUInteger (*)( id, NSUInteger, BOOL* ) );
+static struct trieNode * lookupNode( struct trieNode *, const unichar *, NSUInteger, BOOL, NSUInteger * );
+static struct trieNode * stepNode( struct trieNode *, NSUInteger *, unichar );
+static NSUInteger objectsBeforeChild( struct trieNode *, struct trieNode * );
+struct trieBatchKey;
+static void lookupSortedKeys( struct trieNode *, const struct trieBatchKey *, NSUInteger, NSUInteger, struct trieNode ** );
+static BOOL removeObjectForKey( struct trieNode *, id, NSUInteger, BOOL *, NSUInteger (*)( id, NSUInteger, BOOL* ), struct trieArena *, BOOL );
+static void removeAllChildren( struct trieNode *, struct trieArena * );
+static void destroyAllChildren( struct trieNode *, struct trieArena * );
+static NSUInteger removeChild( struct trieNode *, id, NSUInteger (*)( id, NSUInteger, BOOL* ), struct trieArena *, BOOL );
+static BOOL setObjectForKey( struct trieNode *, id, id, NSUInteger (*)( id, NSUInteger, BOOL* ), struct trieArena *, BOOL, double );
+static BOOL forEveryObjectByWeightFromNode( struct trieNode *, BOOL(*)(id,void*), void * );
 static BOOL forEveryObjectFromNode( struct trieNode *, BOOL(*)(id,void*), void * );
 static void forEveryObjectWithBlockFromNode( struct trieNode *, void(^)(id,BOOL*), BOOL * );
 static void forEveryNodeWithBlockFromNode( struct trieNode *, void(^)(struct trieNode *,BOOL*), BOOL * );
+#if NDTrieUseDispatch
+static NSArray * forEveryObjectConcurrentlyFromNode( struct trieNode *, BOOL(^)(id,BOOL*), BOOL );
+#endif
 static BOOL nodesAreEqual( struct trieNode *, struct trieNode * );
-static struct trieNode * copyNode( struct trieNode * );
-
-static NSString * nodeDebugDescription( struct trieNode * );
-static NSUInteger depthOfNode( struct trieNode * aNode );
+static BOOL forEveryKeyFromNode( struct trieNode *, BOOL(*)(struct trieNode *,const unichar*,NSUInteger,void*), void * );
+static struct trieNode * copyNode( struct trieNode *, struct trieArena * );
+static void initCursor( struct trieCursor *, struct trieNode * );
+static struct trieNode * cursorNextNode( struct trieCursor * );
+static void cursorSeekAfter( struct trieCursor *, const unichar *, NSUInteger );
+static void freeCursor( struct trieCursor * );
+static NSArray * everyObjectNearKey( struct trieNode *, const unichar *, NSUInteger, NSUInteger, BOOL );
+static NSUInteger buildNodeWithKeys( struct trieNode *, id *, NSString **, NSUInteger, BOOL, struct trieArena *, BOOL, BOOL );
+static NSUInteger buildNodeWithArray( struct trieNode *, NSArray *, BOOL, struct trieArena *, BOOL, BOOL );
+static NSUInteger buildNodeWithDictionary( struct trieNode *, NSDictionary *, BOOL, struct trieArena *, BOOL, BOOL );
+static BOOL addEveryLineInFile( struct trieNode *, NSURL *, NSUInteger *, NSUInteger (*)( id, NSUInteger, BOOL* ), struct trieArena *, BOOL, void (^)(unsigned long long,unsigned long long,BOOL*) );
+static NSData * fileDataForNode( struct trieNode *, NSUInteger, uint16_t );
+static BOOL initMap( struct trieMap *, NSData * );
+static const struct trieLayout kTrieMapLayout;
+static void _copyChildren( struct trieNode *, struct trieNode *, struct trieArena * );
+static void shareChildren( struct trieNode *, struct trieNode *, struct trieArena * );
+static NSUInteger mergeNodes( struct trieNode *, struct trieNode *, enum trieMergeOperation, id (^)(NSString *,id,id), struct trieArena *, BOOL, BOOL );
+
+static struct trieScanner * createScanner( struct trieNode * );
+static void freeScanner( struct trieScanner * );
+static void scanString( const struct trieScanner *, NSString *, BOOL, NDTrieMatchOptions, void (^)(NSRange,id,BOOL*) );
+
+static struct trieGraph * createGraph( struct trieNode * );
+static void freeGraph( struct trieGraph * );
+static const struct trieLayout kTrieGraphLayout;
+
+static NSUInteger viewLookupNode( const struct trieView *, const unichar *, NSUInteger, BOOL, NSUInteger * );
+static id viewObjectForNode( const struct trieView *, NSUInteger, const unichar *, NSUInteger );
+static void initViewCursor( struct viewCursor *, const struct trieView *, NSUInteger, const unichar *, NSUInteger );
+static NSUInteger viewCursorNextNode( struct viewCursor * );
+static void viewCursorSeekAfter( struct viewCursor *, const unichar *, NSUInteger );
+static void freeViewCursor( struct viewCursor * );
+static BOOL forEveryObjectInView( const struct trieView *, NSUInteger, const unichar *, NSUInteger, BOOL(*)(id,void*), void * );
+static BOOL forEveryObjectInViewByWeight( const struct trieView *, NSUInteger, const unichar *, NSUInteger, BOOL(*)(id,void*), void * );
+static NSUInteger addEveryObjectInView( const struct trieView *, struct trieNode *, NSUInteger (*)( id, NSUInteger, BOOL* ), struct trieArena *, BOOL );
+static NSArray * everyObjectNearKeyInView( const struct trieView *, const unichar *, NSUInteger, NSUInteger, BOOL );
+
+static NSString * nodeDebugDescription( struct trieNode *, NSUInteger );
+static NSDictionary * nodeStatistics( struct trieNode *, struct trieArena * );
+static NSDictionary * viewStatistics( const struct trieView *, NSUInteger, NSUInteger );
 
 //static struct trieNode * nextNode( struct trieNode * );
 static BOOL getObjectsFunc( id, void * );
 
 @interface NDTrieEnumerator : NSEnumerator
 {
-	id			* _everyObject;
-	NSUInteger	_index,
-				_count;
+	NDTrie				* _trie;
+	struct trieCursor	_cursor;
+	unsigned long		_mutations;
+#if NDTrieCollectCounters
+	NSUInteger			_returned;
+#endif
 }
 
 + (id)trieEnumeratorWithTrie:(NDTrie *)trie node:(struct trieNode*)node;
 - (id)initWithTrie:(NDTrie *)trie node:(struct trieNode*)node;
+- (NSUInteger)getObjects:(id *)objects count:(NSUInteger)count;
+
+@end
+
+/*
+	The immutable tries that keep their keys in a structure of their own in place of nodes, every query is answered by
+	walking view, so is written once here for both of them. They have no rootNode, and objects that are the same
+	string as their key are made again each time they are returned.
+ */
+@interface NDStaticTrie : NDTrie
+{
+@protected
+	struct trieView		_view;
+}
+@property(readonly,nonatomic)		const struct trieView	* view;
+@end
+
+@interface NDStaticTrieEnumerator : NSEnumerator
+{
+	NDStaticTrie		* _trie;
+	struct viewCursor	_cursor;
+}
+
+- (id)initWithTrie:(NDStaticTrie *)trie prefix:(NSString *)prefix;
+- (NSUInteger)getObjects:(id *)objects count:(NSUInteger)count;
+
+@end
+
+/*
+	An immutable trie that answers every query straight out of a file written by writeBinaryToURL:atomically:, the file
+	is mapped in and pages are only read as the nodes in them are visited. Every object is a string, a new one is made
+	each time an object is returned.
+ */
+@interface NDMappedTrie : NDStaticTrie
+{
+@private
+	NSData			* _data;
+	struct trieMap	_map;
+}
+- (id)initWithMappedData:(NSData *)data;
+@end
+
+/*
+	The immutable trie returned by compactedTrie, it keeps its keys and objects in a graph in place of nodes.
+ */
+@interface NDCompactTrie : NDStaticTrie
+{
+@private
+	struct trieGraph	* _graph;
+}
+- (id)initWithGraph:(struct trieGraph *)graph options:(NDTrieOptions)options;
+@end
+
+/*
+	readers announce which of the two copies they are using in one of these, readers on different threads mostly use
+	different ones so they are not all fighting over the same cache line
+ */
+enum { kTrieReadIndicatorCount = 16 };
+struct trieReadIndicator
+{
+	volatile long		count[2];
+	char				pad[64-2*sizeof(long)];
+};
 
+/*
+	The mutable trie returned for NDTrieConcurrentReads. It keeps two copies of the nodes, readers use the copy
+	at _readSide without taking any lock, a change is made to the other copy, which then becomes the read side, and
+	when no reader is left on the old copy the same change is made to that. The writer is the only thread that can see
+	the copy being changed, rootNode and arena give it the other side.
+ */
+@interface NDConcurrentMutableTrie : NDMutableTrie
+{
+@private
+	struct trieNode				* _roots[2];
+	struct trieArena			* _arenas[2];
+	struct trieScanner * volatile	_scanners[2];
+	volatile NSUInteger			_readSide;
+	pthread_t					_writer;
+	pthread_mutex_t				_writeLock;
+	struct trieReadIndicator	_readers[kTrieReadIndicatorCount];
+}
+- (void)performRead:(void (^)(void))block;
+- (void)performWrite:(void (^)(void))block;
+- (void)copyReadSide;
+- (NDTrie *)snapshot;
 @end
 
 static NSUInteger keyComponentCaseInsensitiveForString( id anObject, NSUInteger anIndex, BOOL * anEnd )
@@ -106,23 +594,344 @@ static NSUInteger keyComponentForString( id anObject, NSUInteger anIndex, BOOL *
 	return theResult;
 }
 
-static BOOL _addTrieFunc( NSString * aString, void * aContext )
+/*
+	The characters of a key for the lookup only methods, they are pulled out of the key in one go, in to buffer if the
+	key is short enough, and have their case folded up front so lookupNode can just compare characters.
+ */
+enum { kTrieKeyBufferLength = 128 };
+
+struct trieKey
+{
+	const unichar	* characters;
+	NSUInteger		length;
+	unichar			* allocated;
+	unichar			buffer[kTrieKeyBufferLength];
+};
+
+static unichar * _trieKeyBuffer( struct trieKey * aKey, NSUInteger aLength )
+{
+	unichar		* theResult = aKey->buffer;
+	aKey->allocated = NULL;
+	if( aLength > kTrieKeyBufferLength )
+	{
+		if( (aKey->allocated = (unichar*)malloc( aLength*sizeof(unichar) )) == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for key" userInfo:nil];
+		theResult = aKey->allocated;
+	}
+	return theResult;
+}
+
+static void _trieKeyFree( struct trieKey * aKey ) { free( aKey->allocated ); }
+
+/* adds aLength characters to the end of aKey */
+static void _trieKeyAppend( struct trieKey * aKey, const unichar * aCharacters, NSUInteger aLength )
+{
+	NSUInteger		theLength = aKey->length + aLength;
+	unichar			* theBuffer = theLength <= kTrieKeyBufferLength ? aKey->buffer : (unichar*)malloc( theLength*sizeof(unichar) );
+	if( theBuffer == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for key" userInfo:nil];
+	if( theBuffer != aKey->characters )
+		memmove( theBuffer, aKey->characters, aKey->length*sizeof(unichar) );
+	memcpy( theBuffer+aKey->length, aCharacters, aLength*sizeof(unichar) );
+	if( theBuffer != aKey->buffer )
+	{
+		free( aKey->allocated );
+		aKey->allocated = theBuffer;
+	}
+	aKey->characters = theBuffer;
+	aKey->length = theLength;
+}
+
+/* makes sure the key buffer of a walk over a view, which has room for *aCapacity units, has room for aLength */
+static void _viewKeyGrow( unichar ** aKey, NSUInteger * aCapacity, NSUInteger aLength )
+{
+	if( aLength > *aCapacity )
+	{
+		NSUInteger		theCapacity = *aCapacity < 32 ? 64 : *aCapacity*2;
+		unichar			* theKey;
+		while( theCapacity < aLength )
+			theCapacity *= 2;
+		if( (theKey = (unichar*)realloc( *aKey, theCapacity*sizeof(unichar) )) == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for key" userInfo:nil];
+		*aKey = theKey;
+		*aCapacity = theCapacity;
+	}
+}
+
+/* the same folding as keyComponentCaseInsensitiveForString */
+static inline void _trieKeyFoldCase( unichar * aCharacters, NSUInteger aLength )
+{
+	for( NSUInteger i = 0; i < aLength; i++ )
+	{
+		if( aCharacters[i] >= 'a' && aCharacters[i] <= 'z' )
+			aCharacters[i] += 'A' - 'a';
+	}
+}
+
+static void trieKeyWithString( struct trieKey * aKey, NSString * aString, BOOL aCaseInsensitive )
+{
+	unichar		* theBuffer;
+	aKey->length = [aString length];
+	aKey->allocated = NULL;
+	/* most strings can hand over their characters without copying, only worth doing if they are not going to be changed */
+	if( aCaseInsensitive || (aKey->characters = CFStringGetCharactersPtr( (CFStringRef)aString )) == NULL )
+	{
+		theBuffer = _trieKeyBuffer( aKey, aKey->length );
+		[aString getCharacters:theBuffer range:NSMakeRange( 0, aKey->length )];
+		if( aCaseInsensitive )
+			_trieKeyFoldCase( theBuffer, aKey->length );
+		aKey->characters = theBuffer;
+	}
+}
+
+static void trieKeyWithCharacters( struct trieKey * aKey, const unichar * aCharacters, NSUInteger aLength, BOOL aCaseInsensitive )
+{
+	aKey->length = aLength;
+	aKey->allocated = NULL;
+	aKey->characters = aCharacters;
+	if( aCaseInsensitive )
+	{
+		unichar		* theBuffer = _trieKeyBuffer( aKey, aLength );
+		memcpy( theBuffer, aCharacters, aLength*sizeof(unichar) );
+		_trieKeyFoldCase( theBuffer, aLength );
+		aKey->characters = theBuffer;
+	}
+}
+
+enum { kTrieInvalidUTF8 = 0xFFFFFFFF };
+
+/*
+	Decodes the character at *aByte and moves *aByte past it, returns kTrieInvalidUTF8 for bytes that are not UTF-8,
+	which includes characters encoded in more bytes than they need and the surrogates U+D800 to U+DFFF, so each
+	character has only the one encoding
+ */
+static uint32_t _nextUTF8Character( const uint8_t ** aByte, const uint8_t * anEnd )
+{
+	static const uint32_t	kSmallest[] = { 0, 0x80, 0x800, 0x10000 };
+	uint32_t				theResult = *(*aByte)++;
+	NSUInteger				theFollowing = 0;
+	if( theResult >= 0x80 )
+	{
+		if( (theResult & 0xE0) == 0xC0 )
+			theFollowing = 1;
+		else if( (theResult & 0xF0) == 0xE0 )
+			theFollowing = 2;
+		else if( (theResult & 0xF8) == 0xF0 )
+			theFollowing = 3;
+		else
+			return kTrieInvalidUTF8;
+		if( (NSUInteger)(anEnd - *aByte) < theFollowing )
+			return kTrieInvalidUTF8;
+		theResult &= 0x3F >> theFollowing;
+		for( NSUInteger i = 0; i < theFollowing; i++ )
+		{
+			if( (**aByte & 0xC0) != 0x80 )
+				return kTrieInvalidUTF8;
+			theResult = (theResult << 6) | (*(*aByte)++ & 0x3F);
+		}
+		if( theResult < kSmallest[theFollowing] || theResult > 0x10FFFF || (theResult >= 0xD800 && theResult <= 0xDFFF) )
+			theResult = kTrieInvalidUTF8;
+	}
+	return theResult;
+}
+
+/* the same checks as trieKeyWithUTF8String without decoding anything, for lines read from a word list */
+static BOOL _isValidUTF8( const char * aBytes, NSUInteger aLength )
+{
+	const uint8_t	* theByte = (const uint8_t*)aBytes,
+					* theEnd = theByte + aLength;
+	BOOL			theValid = YES;
+	while( theByte < theEnd && theValid )
+		theValid = _nextUTF8Character( &theByte, theEnd ) != kTrieInvalidUTF8;
+	return theValid;
+}
+
+/*
+	Decodes aLength bytes of UTF-8 in to UTF-16, which is never more units than bytes, returns NO if the bytes are not
+	valid UTF-8
+ */
+static BOOL trieKeyWithUTF8String( struct trieKey * aKey, const char * aBytes, NSUInteger aLength, BOOL aCaseInsensitive )
+{
+	unichar			* theBuffer = _trieKeyBuffer( aKey, aLength );
+	const uint8_t	* theByte = (const uint8_t*)aBytes,
+					* theEnd = theByte + aLength;
+	BOOL			theValid = YES;
+
+	aKey->length = 0;
+	aKey->characters = theBuffer;
+	while( theByte < theEnd && theValid )
+	{
+		uint32_t		theCharacter = _nextUTF8Character( &theByte, theEnd );
+		if( theCharacter == kTrieInvalidUTF8 )
+			theValid = NO;
+		else if( theCharacter >= 0x10000 )
+		{
+			theCharacter -= 0x10000;
+			theBuffer[aKey->length++] = (unichar)(0xD800 + (theCharacter >> 10));
+			theBuffer[aKey->length++] = (unichar)(0xDC00 + (theCharacter & 0x3FF));
+		}
+		else
+			theBuffer[aKey->length++] = (unichar)theCharacter;
+	}
+
+	if( aCaseInsensitive )
+		_trieKeyFoldCase( theBuffer, aKey->length );
+	return theValid;
+}
+
+/*
+	The lookup used by every method that does not change the trie, no messages are sent to aKey after its characters
+	have been fetched
+ */
+static struct trieNode * findNodeForString( struct trieNode * aRoot, NSString * aKey, BOOL aPrefix, BOOL aCaseInsensitive )
+{
+	struct trieKey		theKey;
+	struct trieNode		* theResult;
+	if( aKey == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"objectForKey: key cannot be nil" userInfo:nil];
+	trieKeyWithString( &theKey, aKey, aCaseInsensitive );
+	theResult = lookupNode( aRoot, theKey.characters, theKey.length, aPrefix, NULL );
+	_trieKeyFree( &theKey );
+	return theResult;
+}
+
+/*
+	A key of a batch lookup, index is the position of the key in the array it came from so the keys can be sorted and
+	the results still put back in the order they were asked for.
+ */
+struct trieBatchKey
+{
+	const unichar	* characters;
+	NSUInteger		length,
+					index;
+};
+
+static int _compareBatchKeys( const void * aLeft, const void * aRight )
+{
+	const struct trieBatchKey	* theLeft = (const struct trieBatchKey*)aLeft,
+								* theRight = (const struct trieBatchKey*)aRight;
+	NSUInteger					theLength = theLeft->length < theRight->length ? theLeft->length : theRight->length;
+	for( NSUInteger i = 0; i < theLength; i++ )
+	{
+		if( theLeft->characters[i] != theRight->characters[i] )
+			return theLeft->characters[i] < theRight->characters[i] ? -1 : 1;
+	}
+	return theLeft->length < theRight->length ? -1 : theLeft->length > theRight->length ? 1 : 0;
+}
+
+/*
+	Looks up every key in aKeys with a single walk of the trie, returns an array of nodes in the same order as aKeys,
+	NULL for keys that are not found, that the caller has to free
+ */
+static struct trieNode ** findNodesForStrings( struct trieNode * aRoot, NSArray * aKeys, BOOL aCaseInsensitive )
+{
+	NSUInteger				theCount = [aKeys count],
+							theMaxLength = 0;
+	struct trieNode			** theResult = NULL;
+	struct trieKey			* theKeys = NULL;
+	struct trieBatchKey		* theBatch = NULL;
+	if( theCount == 0 )
+		return NULL;
+	@try
+	{
+		if( (theResult = (struct trieNode**)calloc( theCount, sizeof(struct trieNode*) )) == NULL
+			|| (theKeys = (struct trieKey*)calloc( theCount, sizeof(struct trieKey) )) == NULL
+			|| (theBatch = (struct trieBatchKey*)malloc( theCount*sizeof(struct trieBatchKey) )) == NULL )
+		{
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for keys" userInfo:nil];
+		}
+		for( NSUInteger i = 0; i < theCount; i++ )
+		{
+			trieKeyWithString( &theKeys[i], [aKeys objectAtIndex:i], aCaseInsensitive );
+			theBatch[i].characters = theKeys[i].characters;
+			theBatch[i].length = theKeys[i].length;
+			theBatch[i].index = i;
+			if( theKeys[i].length > theMaxLength )
+				theMaxLength = theKeys[i].length;
+		}
+		qsort( theBatch, theCount, sizeof(struct trieBatchKey), _compareBatchKeys );
+		lookupSortedKeys( aRoot, theBatch, theCount, theMaxLength, theResult );
+	}
+	@catch( NSException * anException )
+	{
+		free( theResult );
+		@throw;
+	}
+	@finally
+	{
+		if( theKeys != NULL )
+		{
+			for( NSUInteger i = 0; i < theCount; i++ )
+				_trieKeyFree( &theKeys[i] );
+		}
+		free( theKeys );
+		free( theBatch );
+	}
+	return theResult;
+}
+
+/* adds a key found with forEveryKeyFromNode to the NDMutableTrie aContext, folding its case if the trie does */
+static BOOL _addKeyFunc( struct trieNode * aNode, const unichar * aKey, NSUInteger aLength, void * aContext )
 {
 	NDMutableTrie		* theTrie = (NDMutableTrie*)aContext;
-	[theTrie addString:aString];
+	[theTrie setObject:aNode->object forKey:[NSString stringWithCharacters:aKey length:aLength] weight:aNode->weight];
 	return YES;
 }
 
 @interface NDTrie ()
 {
 @private
-	void		* _rootNode;
+	void				* _rootNode;
+	struct trieArena	* _arena;
 @protected
-	NSUInteger	_count;
-	BOOL		_caseInsensitive;
+	NSUInteger		_count;
+	unsigned long	_mutations;
+	BOOL			_caseInsensitive,
+					_pathCompression;
+	struct trieScanner * volatile	_scanner;
 }
 
 @property(readonly,nonatomic)		struct trieNode	* rootNode;
+@property(readonly,nonatomic)		struct trieArena	* arena;
+@property(readonly,nonatomic)		unsigned long	* mutationsPtr;
+- (id)initWithoutNodesWithOptions:(NDTrieOptions)options;
+- (void)copyNodesOfTrie:(NDTrie *)trie;
+- (struct trieScanner *)scanner;
+@end
+
+@interface NDMutableTrie ()
+- (void)willChange;
+- (NDTrie *)trieToMerge:(NDTrie *)trie;
+- (void)mergeTrie:(NDTrie *)trie operation:(enum trieMergeOperation)operation policy:(id (^)(NSString *, id, id))policy;
+@end
+
+/* where a completion session is after a character of its prefix, the node and how much of its run has been matched */
+struct trieCompletionStep
+{
+	struct trieNode		* node;
+	NSUInteger			runIndex;
+};
+
+@interface NDTrieCompletionSession ()
+{
+@private
+	NDTrie						* _trie;
+	unsigned long				_mutations;
+	BOOL						_walksNodes;
+	unichar						* _characters;
+	struct trieCompletionStep	* _steps;
+	NSUInteger					_length,
+								_depth,
+								_capacity,
+								_cacheLimit;
+	struct trieNode				** _cacheNodes;
+	NSMutableArray				* _cache;
+}
+- (void)advance;
+- (void)findPlace;
+- (struct trieNode *)node;
+- (void)cacheObjects:(NSArray *)objects forNode:(struct trieNode *)node;
+- (NSUInteger)cacheIndexForNode:(struct trieNode *)node;
 @end
 
 enum NDTriePListElelemt
@@ -138,10 +947,12 @@ enum NDTriePListElelemt
 	NSMutableString				* _currentString;
 	enum NDTriePListElelemt		_foundRootElement;
 	struct trieNode				* _rootNode;
+	struct trieArena			* _arena;
 	NSUInteger					_count;
-	BOOL						_caseInsensitive;
+	BOOL						_caseInsensitive,
+								_pathCompression;
 }
-- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive trieRoot:(struct trieNode*)root;
+- (id)initWithTrie:(NDTrie *)trie;
 - (BOOL)parseContentsOfURL:(NSURL *)url;
 - (NSUInteger)count;
 @end
@@ -175,6 +986,8 @@ enum NDTriePListElelemt
 
 + (id)trieWithContentsOfFile:(NSString *)aPath { return [[[self alloc] initWithContentsOfFile:aPath] autorelease]; }
 + (id)trieWithContentsOfURL:(NSURL *)aURL { return [[[self alloc] initWithContentsOfURL:aURL] autorelease]; }
++ (id)trieWithMappedContentsOfFile:(NSString *)aPath { return [[[self alloc] initWithMappedContentsOfFile:aPath] autorelease]; }
++ (id)trieWithMappedContentsOfURL:(NSURL *)aURL { return [[[self alloc] initWithMappedContentsOfURL:aURL] autorelease]; }
 + (id)trieWithStrings:(const NSString **)aStrings count:(NSUInteger)aCount
 {
 	return [[[self alloc] initWithObjects:aStrings forKeys:aStrings count:aCount] autorelease];
@@ -184,70 +997,48 @@ enum NDTriePListElelemt
 	return [[[self alloc] initWithObjects:anObjects forKeys:aKeys count:aCount] autorelease];
 }
 
-- (id)init { return [self initWithCaseInsensitive:NO]; }
-- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive
+- (id)init { return [self initWithOptions:0]; }
+- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive { return [self initWithOptions:aCaseInsensitive ? NDTrieCaseInsensitive : 0]; }
+- (id)initWithOptions:(NDTrieOptions)anOptions
 {
-	if( (self = [super init]) != nil )
+	if( (self = [self initWithoutNodesWithOptions:anOptions]) != nil )
 	{
 		_rootNode = calloc( 1, sizeof(struct trieNode) );
-		_caseInsensitive = aCaseInsensitive;
+		((struct trieNode*)_rootNode)->maxWeight = -HUGE_VAL;
+		((struct trieNode*)_rootNode)->refCount = 1;
+		_arena = createArena();
 	}
 	return self;
 }
 
 - (id)initWithArray:(NSArray *)anArray { return [self initWithCaseInsensitive:NO array:anArray]; }
-- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive array:(NSArray *)anArray
+- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive array:(NSArray *)anArray { return [self initWithOptions:aCaseInsensitive ? NDTrieCaseInsensitive : 0 array:anArray]; }
+- (id)initWithOptions:(NDTrieOptions)anOptions array:(NSArray *)anArray
 {
-	if( (self = [self initWithCaseInsensitive:aCaseInsensitive]) != nil )
-	{
-		NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
-#ifdef NDFastEnumerationAvailable
-		for( NSString * theString in anArray )
-#else
-		for( NSUInteger i = 0, c = [anArray count]; i < c; i++ )
-#endif
-
-		{
-#ifndef NDFastEnumerationAvailable
-			NSString		* theString = [anArray objectAtIndex:i];
-#endif
-			if( ![theString isKindOfClass:[NSString class]] )
-				@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theString class]] userInfo:nil];
-			_count += setObjectForKey( self.rootNode, theString, theString, theKeyComponentForString );
-		}
-	}
+	if( (self = [self initWithOptions:anOptions]) != nil )
+		_count = buildNodeWithArray( self.rootNode, anArray, self.isCaseInsensitive, self.arena, self.isPathCompressed, (anOptions & NDTrieConcurrentBuild) != 0 );
 	return self;
 }
 
 - (id)initWithDictionary:(NSDictionary *)aDictionary { return [self initWithCaseInsensitive:NO dictionary:aDictionary]; }
-- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive dictionary:(NSDictionary *)aDictionary
+- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive dictionary:(NSDictionary *)aDictionary { return [self initWithOptions:aCaseInsensitive ? NDTrieCaseInsensitive : 0 dictionary:aDictionary]; }
+- (id)initWithOptions:(NDTrieOptions)anOptions dictionary:(NSDictionary *)aDictionary
 {
-	if( (self = [self initWithCaseInsensitive:aCaseInsensitive]) != nil )
-	{
-		NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
-#ifndef NDFastEnumerationAvailable
-		NSArray		* theKeysArray = [aDictionary allKeys];
-		for( NSUInteger i = 0, c = [theKeysArray count]; i < c; i++ )
-#else
-		for( NSString * theKey in aDictionary )
-#endif
-		{
-#ifndef NDFastEnumerationAvailable
-			NSString		* theKey = [theKeysArray objectAtIndex:i];
-#endif
-			if( ![theKey isKindOfClass:[NSString class]] )
-				@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theKey class]] userInfo:nil];
-			_count += setObjectForKey( self.rootNode, [aDictionary objectForKey:theKey], theKey, theKeyComponentForString );
-		}
-	}
+	if( (self = [self initWithOptions:anOptions]) != nil )
+		_count = buildNodeWithDictionary( self.rootNode, aDictionary, self.isCaseInsensitive, self.arena, self.isPathCompressed, (anOptions & NDTrieConcurrentBuild) != 0 );
 	return self;
 }
 
 - (id)initWithTrie:(NDTrie *)anAnotherTrie { return [self initWithCaseInsensitive:NO trie:anAnotherTrie]; }
 - (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive trie:(NDTrie *)anAnotherTrie
 {
-	if( (self = [self initWithCaseInsensitive:aCaseInsensitive]) != nil )
-		_rootNode = copyNode( anAnotherTrie.rootNode );
+	if( (self = [self initWithOptions:(aCaseInsensitive ? NDTrieCaseInsensitive : 0) | (anAnotherTrie.isPathCompressed ? NDTriePathCompression : 0)]) != nil )
+	{
+		if( [anAnotherTrie isKindOfClass:[NDConcurrentMutableTrie class]] )		// the copy readers of it can see
+			[(NDConcurrentMutableTrie*)anAnotherTrie performRead:^{ [self copyNodesOfTrie:anAnotherTrie]; }];
+		else
+			[self copyNodesOfTrie:anAnotherTrie];
+	}
 	return self;
 }
 
@@ -297,33 +1088,88 @@ enum NDTriePListElelemt
 {
 	if( (self = [self initWithCaseInsensitive:aCaseInsensitive]) != nil )
 	{
-		NDTrieBuilder		* theBuilder = [[NDTrieBuilder alloc] initWithCaseInsensitive:aCaseInsensitive trieRoot:self.rootNode];
+		NDTrieBuilder		* theBuilder = [[NDTrieBuilder alloc] initWithTrie:self];
 		BOOL				theResult = [theBuilder parseContentsOfURL:aURL];
 		if( theResult )
 			_count = [theBuilder count];
 		else
 		{
 			NSArray		* theArray = [[NSArray alloc] initWithContentsOfURL:aURL];
-			self = [self initWithArray:theArray];
-			[theArray release];
+			destroyAllChildren( self.rootNode, self.arena );
+			@try
+			{
+				_count = buildNodeWithArray( self.rootNode, theArray, self.isCaseInsensitive, self.arena, self.isPathCompressed, NO );
+			}
+			@finally
+			{
+				[theArray release];
+			}
 		}
 		[theBuilder release];
 	}
 	return self;
 }
 
+- (id)initWithOptions:(NDTrieOptions)anOptions contentsOfWordListFile:(NSString *)aPath progress:(void (^)(unsigned long long,unsigned long long,BOOL*))aProgress { return [self initWithOptions:anOptions contentsOfWordListURL:[NSURL fileURLWithPath:aPath] progress:aProgress]; }
+- (id)initWithOptions:(NDTrieOptions)anOptions contentsOfWordListURL:(NSURL *)aURL progress:(void (^)(unsigned long long,unsigned long long,BOOL*))aProgress
+{
+	if( (self = [self initWithOptions:anOptions]) != nil )
+	{
+		BOOL		theRead = NO;
+		@try
+		{
+			theRead = addEveryLineInFile( self.rootNode, aURL, &_count, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed, aProgress );
+		}
+		@catch( NSException * anException )
+		{
+			[self release];
+			@throw;
+		}
+		if( !theRead )
+		{
+			[self release];
+			self = nil;
+		}
+	}
+	return self;
+}
+
+- (id)initWithMappedContentsOfFile:(NSString *)aPath { return [self initWithMappedContentsOfURL:[NSURL fileURLWithPath:aPath]]; }
+/*
+	NDTrie hands back an NDMappedTrie in place of itself, NDMutableTrie has to be able to change so it copies the
+	mapped trie in to nodes instead.
+ */
+- (id)initWithMappedContentsOfURL:(NSURL *)aURL
+{
+	NSData			* theData = [NSData dataWithContentsOfURL:aURL options:NSDataReadingMappedAlways error:NULL];
+	NDMappedTrie	* theMappedTrie = theData != nil ? [[NDMappedTrie alloc] initWithMappedData:theData] : nil;
+	if( theMappedTrie == nil )
+	{
+		[self release];
+		self = nil;
+	}
+	else if( [self isKindOfClass:[NDMutableTrie class]] )
+	{
+		self = [self initWithCaseInsensitive:theMappedTrie.isCaseInsensitive trie:theMappedTrie];
+		[theMappedTrie release];
+	}
+	else
+	{
+		[self release];
+		self = theMappedTrie;
+	}
+	return self;
+}
+
 - (id)initWithStrings:(NSString **)aStrings count:(NSUInteger)aCount { return [self initWithCaseInsensitive:NO objects:aStrings forKeys:aStrings count:aCount]; }
 - (id)initWithObjects:(id *)anObjects forKeys:(NSString **)aKeys count:(NSUInteger)aCount { return [self initWithCaseInsensitive:NO objects:anObjects forKeys:aKeys count:aCount]; }
 
 - (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive strings:(NSString **)aStrings count:(NSUInteger)aCount { return [self initWithCaseInsensitive:aCaseInsensitive objects:aStrings forKeys:aStrings count:aCount]; }
-- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive objects:(id *)anObjects forKeys:(NSString **)aKeys count:(NSUInteger)aCount
+- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive objects:(id *)anObjects forKeys:(NSString **)aKeys count:(NSUInteger)aCount { return [self initWithOptions:aCaseInsensitive ? NDTrieCaseInsensitive : 0 objects:anObjects forKeys:aKeys count:aCount]; }
+- (id)initWithOptions:(NDTrieOptions)anOptions objects:(id *)anObjects forKeys:(NSString **)aKeys count:(NSUInteger)aCount
 {
-	if( (self = [self initWithCaseInsensitive:aCaseInsensitive]) != nil )
-	{
-		NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
-		for( NSUInteger i = 0; i < aCount; i++ )
-			_count += setObjectForKey( self.rootNode, anObjects[i], aKeys[i], theKeyComponentForString );
-	}
+	if( (self = [self initWithOptions:anOptions]) != nil )
+		_count = buildNodeWithKeys( self.rootNode, anObjects, aKeys, aCount, self.isCaseInsensitive, self.arena, self.isPathCompressed, (anOptions & NDTrieConcurrentBuild) != 0 );
 	return self;
 }
 
@@ -339,7 +1185,7 @@ enum NDTriePListElelemt
 			if( ![theString isKindOfClass:[NSString class]] )
 				@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theString class]] userInfo:nil];
 
-			_count += setObjectForKey( self.rootNode, theString, theString, theKeyComponentForString );
+			_count += setObjectForKey( self.rootNode, theString, theString, theKeyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
 		}
 		while( (theString = va_arg( anArguments, NSString * ) ) != nil );
 	}
@@ -361,7 +1207,7 @@ enum NDTriePListElelemt
 			if( ![theKey isKindOfClass:[NSString class]] )
 				@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theKey class]] userInfo:nil];
 			
-			_count += setObjectForKey( self.rootNode, theObject, theKey, theKeyComponentForString );
+			_count += setObjectForKey( self.rootNode, theObject, theKey, theKeyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
 		}
 		while( (theObject = va_arg( anArguments, id ) ) != nil );
 	}
@@ -370,39 +1216,164 @@ enum NDTriePListElelemt
 
 - (void)dealloc
 {
-	removeAllChildren( _rootNode );
-	free( _rootNode );
+	freeScanner( _scanner );
+	if( _rootNode != NULL )
+	{
+		destroyAllChildren( _rootNode, _arena );
+		releaseArena( _arena );
+		free( _rootNode );
+	}
 	[super dealloc];
 }
 
 - (void)finalize
 {
-	removeAllChildren( _rootNode );
-	free( _rootNode );
+	freeScanner( _scanner );
+	if( _rootNode != NULL )
+	{
+		destroyAllChildren( _rootNode, _arena );
+		releaseArena( _arena );
+		free( _rootNode );
+	}
 	[super finalize];
 }
 
 - (NSUInteger)count { return _count; }
+- (NSDictionary *)statistics { return nodeStatistics( self.rootNode, self.arena ); }
+
+#if NDTrieCollectCounters
++ (NSDictionary *)counters
+{
+	NSMutableArray		* theSizes = [NSMutableArray arrayWithCapacity:kTrieEnumerationSizeCount];
+	for( NSUInteger i = 0; i < kTrieEnumerationSizeCount; i++ )
+		[theSizes addObject:[NSNumber numberWithUnsignedLongLong:__atomic_load_n( &_trieCounters.enumerationSizes[i], __ATOMIC_RELAXED )]];
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithUnsignedLongLong:__atomic_load_n( &_trieCounters.lookups, __ATOMIC_RELAXED )], @"lookups",
+			[NSNumber numberWithUnsignedLongLong:__atomic_load_n( &_trieCounters.lookupNodesVisited, __ATOMIC_RELAXED )], @"lookupNodesVisited",
+			[NSNumber numberWithUnsignedLongLong:__atomic_load_n( &_trieCounters.lookupMaxNodesVisited, __ATOMIC_RELAXED )], @"lookupMaxNodesVisited",
+			[NSNumber numberWithUnsignedLongLong:__atomic_load_n( &_trieCounters.childArrayResizes, __ATOMIC_RELAXED )], @"childArrayResizes",
+			[NSNumber numberWithUnsignedLongLong:__atomic_load_n( &_trieCounters.enumerations, __ATOMIC_RELAXED )], @"enumerations",
+			[NSNumber numberWithUnsignedLongLong:__atomic_load_n( &_trieCounters.objectsEnumerated, __ATOMIC_RELAXED )], @"objectsEnumerated",
+			theSizes, @"enumerationSizes",
+			nil];
+}
+
++ (void)resetCounters
+{
+	__atomic_store_n( &_trieCounters.lookups, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &_trieCounters.lookupNodesVisited, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &_trieCounters.lookupMaxNodesVisited, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &_trieCounters.childArrayResizes, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &_trieCounters.enumerations, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &_trieCounters.objectsEnumerated, 0, __ATOMIC_RELAXED );
+	for( NSUInteger i = 0; i < kTrieEnumerationSizeCount; i++ )
+		__atomic_store_n( &_trieCounters.enumerationSizes[i], 0, __ATOMIC_RELAXED );
+}
+#endif
+
 - (BOOL)isCaseInsensitive { return _caseInsensitive; }
+- (BOOL)isPathCompressed { return _pathCompression; }
 
 - (BOOL)containsObjectForKey:(NSString *)aString
 {
-	struct trieNode		* theNode = findNode( (struct trieNode *)_rootNode, aString, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+	struct trieNode		* theNode = findNodeForString( self.rootNode, aString, NO, self.isCaseInsensitive );
 	return theNode != NULL && theNode->object != nil;
 }
 
 - (BOOL)containsObjectForKeyWithPrefix:(NSString *)aString
 {
-	struct trieNode		* theNode = findNode( (struct trieNode *)_rootNode, aString, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+	struct trieNode		* theNode = findNodeForString( self.rootNode, aString, YES, self.isCaseInsensitive );
 	return theNode != NULL;
 }
 
 - (id)objectForKey:(NSString *)aKey
 {
-	struct trieNode		* theNode = findNode( (struct trieNode *)_rootNode, aKey, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+	struct trieNode		* theNode = findNodeForString( self.rootNode, aKey, NO, self.isCaseInsensitive );
+	return theNode != NULL ? theNode->object : nil;
+}
+
+static struct trieNode * _findNodeForCharacters( NDTrie * aTrie, const unichar * aCharacters, NSUInteger aLength, BOOL aPrefix )
+{
+	struct trieKey		theKey;
+	struct trieNode		* theResult;
+	trieKeyWithCharacters( &theKey, aCharacters, aLength, aTrie.isCaseInsensitive );
+	theResult = lookupNode( aTrie.rootNode, theKey.characters, theKey.length, aPrefix, NULL );
+	_trieKeyFree( &theKey );
+	return theResult;
+}
+
+- (BOOL)containsObjectForCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength
+{
+	struct trieNode		* theNode = _findNodeForCharacters( self, aCharacters, aLength, NO );
+	return theNode != NULL && theNode->object != nil;
+}
+
+- (BOOL)containsObjectForKeyWithPrefixCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength
+{
+	return _findNodeForCharacters( self, aCharacters, aLength, YES ) != NULL;
+}
+
+- (id)objectForCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength
+{
+	struct trieNode		* theNode = _findNodeForCharacters( self, aCharacters, aLength, NO );
+	return theNode != NULL ? theNode->object : nil;
+}
+
+static struct trieNode * _findNodeForUTF8String( NDTrie * aTrie, const char * aBytes, NSUInteger aLength, BOOL aPrefix )
+{
+	struct trieKey		theKey;
+	struct trieNode		* theResult = NULL;
+	if( trieKeyWithUTF8String( &theKey, aBytes, aLength, aTrie.isCaseInsensitive ) )
+		theResult = lookupNode( aTrie.rootNode, theKey.characters, theKey.length, aPrefix, NULL );
+	_trieKeyFree( &theKey );
+	return theResult;
+}
+
+- (BOOL)containsObjectForUTF8String:(const char *)aBytes length:(NSUInteger)aLength
+{
+	struct trieNode		* theNode = _findNodeForUTF8String( self, aBytes, aLength, NO );
+	return theNode != NULL && theNode->object != nil;
+}
+
+- (BOOL)containsObjectForKeyWithPrefixUTF8String:(const char *)aBytes length:(NSUInteger)aLength
+{
+	return _findNodeForUTF8String( self, aBytes, aLength, YES ) != NULL;
+}
+
+- (id)objectForUTF8String:(const char *)aBytes length:(NSUInteger)aLength
+{
+	struct trieNode		* theNode = _findNodeForUTF8String( self, aBytes, aLength, NO );
 	return theNode != NULL ? theNode->object : nil;
 }
 
+- (NSArray *)objectsForKeys:(NSArray *)aKeys notFoundMarker:(id)aMarker
+{
+	NSUInteger			theCount = [aKeys count];
+	NSMutableArray		* theResult = [NSMutableArray arrayWithCapacity:theCount];
+	struct trieNode		** theNodes;
+	if( aMarker == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"objectsForKeys:notFoundMarker: marker cannot be nil" userInfo:nil];
+	theNodes = findNodesForStrings( self.rootNode, aKeys, self.isCaseInsensitive );
+	for( NSUInteger i = 0; i < theCount; i++ )
+		[theResult addObject:theNodes[i] != NULL && theNodes[i]->object != nil ? theNodes[i]->object : aMarker];
+	free( theNodes );
+	return theResult;
+}
+
+- (NSIndexSet *)containsObjectsForKeys:(NSArray *)aKeys
+{
+	NSUInteger			theCount = [aKeys count];
+	NSMutableIndexSet	* theResult = [NSMutableIndexSet indexSet];
+	struct trieNode		** theNodes = findNodesForStrings( self.rootNode, aKeys, self.isCaseInsensitive );
+	for( NSUInteger i = 0; i < theCount; i++ )
+	{
+		if( theNodes[i] != NULL && theNodes[i]->object != nil )
+			[theResult addIndex:i];
+	}
+	free( theNodes );
+	return theResult;
+}
+
 static BOOL _addToArrayFunc( id anObject, void * anArray )
 {
 	[(id)anArray addObject:anObject];
@@ -412,20 +1383,173 @@ static BOOL _addToArrayFunc( id anObject, void * anArray )
 {
 	NSMutableArray		* theResult = [NSMutableArray arrayWithCapacity:[self count]];
 	forEveryObjectFromNode( self.rootNode, _addToArrayFunc, theResult );
+	_countEnumeration( [theResult count] );
 	return theResult;
 }
 
 - (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix
 {
-	NSMutableArray		* theResult = [NSMutableArray arrayWithCapacity:[self count]];
+	NSMutableArray		* theResult = nil;
 	struct trieNode		* theNode = self.rootNode;
 	if( aPrefix != nil && [aPrefix length] > 0 )
-		theNode = findNode( theNode, aPrefix, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
+	theResult = [NSMutableArray arrayWithCapacity:theNode != NULL ? theNode->objectCount : 0];
 	if( theNode != nil )
 		forEveryObjectFromNode( theNode, _addToArrayFunc, theResult );
+	_countEnumeration( [theResult count] );
+	return theResult;
+}
+
+/*
+	The resume token is the full key of the last object returned, case folded for case insensitive tries, as UTF-16 in
+	an NSData. The next page starts from the node for the prefix again and follows the key down from there.
+ */
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix limit:(NSUInteger)aLimit resumeToken:(id *)aToken
+{
+	NSMutableArray		* theResult = [NSMutableArray array];
+	NSData				* theResumeToken = aToken != NULL ? *aToken : nil;
+	NSMutableData		* theNodeKey = nil;
+	struct trieKey		theKey;
+	struct trieCursor	theCursor = { NULL, 0, 0 };
+	struct trieNode		* theNode = self.rootNode;
+	NSUInteger			theNodeLength = 0;
+
+	if( theResumeToken != nil && ![theResumeToken isKindOfClass:[NSData class]] )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"everyObjectForKeyWithPrefix:limit:resumeToken: invalid resume token" userInfo:nil];
+	if( aLimit == 0 )
+		return theResult;
+
+	trieKeyWithString( &theKey, aPrefix != nil ? aPrefix : @"", self.isCaseInsensitive );
+	@try
+	{
+		if( theKey.length > 0 )
+			theNode = lookupNode( theNode, theKey.characters, theKey.length, YES, &theNodeLength );
+
+		if( theNode != NULL )
+		{
+			/* the full key of the prefix node, the prefix plus whatever is left of the run it ends in */
+			theNodeKey = [NSMutableData dataWithBytes:theKey.characters length:theKey.length*sizeof(unichar)];
+			[theNodeKey appendBytes:theNode->run + theNode->runLength - (theNodeLength - theKey.length) length:(theNodeLength - theKey.length)*sizeof(unichar)];
+			initCursor( &theCursor, theNode );
+		}
+
+		if( theNode != NULL && theResumeToken != nil )
+		{
+			const unichar	* theTokenKey = (const unichar*)[theResumeToken bytes],
+							* theFullNodeKey = (const unichar*)[theNodeKey bytes];
+			NSUInteger		theTokenLength = [theResumeToken length]/sizeof(unichar),
+							theIndex = 0;
+
+			if( theTokenLength < theKey.length || memcmp( theTokenKey, theKey.characters, theKey.length*sizeof(unichar) ) != 0 )
+				@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"everyObjectForKeyWithPrefix:limit:resumeToken: resume token is for a different prefix" userInfo:nil];
+
+			while( theIndex < theTokenLength && theIndex < theNodeLength && theTokenKey[theIndex] == theFullNodeKey[theIndex] )
+				theIndex++;
+			if( theIndex == theNodeLength )
+				cursorSeekAfter( &theCursor, theTokenKey+theNodeLength, theTokenLength-theNodeLength );
+			else if( theIndex < theTokenLength && theTokenKey[theIndex] > theFullNodeKey[theIndex] )
+				freeCursor( &theCursor );		// the trie has changed and every key with the prefix is now before the token
+			/* otherwise the token comes before the prefix node, so start from the beginning */
+		}
+
+		if( theCursor.depth > 0 )
+		{
+			struct trieNode		* theNext;
+			while( theResult.count < aLimit && (theNext = cursorNextNode( &theCursor )) != NULL )
+			{
+				if( theNext->object != nil )
+					[theResult addObject:theNext->object];
+			}
+
+			if( aToken != NULL )
+			{
+				NSMutableData	* theToken = nil;
+				if( theResult.count == aLimit )
+				{
+					theToken = theNodeKey;
+					for( NSUInteger i = 1; i < theCursor.depth; i++ )
+					{
+						unichar		theCharacter = (unichar)theCursor.frames[i].node->key;
+						[theToken appendBytes:&theCharacter length:sizeof(theCharacter)];
+						[theToken appendBytes:theCursor.frames[i].node->run length:theCursor.frames[i].node->runLength*sizeof(unichar)];
+					}
+					/* only hand back a token if there really is another page */
+					while( (theNext = cursorNextNode( &theCursor )) != NULL && theNext->object == nil )
+						;
+					if( theNext == NULL )
+						theToken = nil;
+				}
+				*aToken = theToken;
+			}
+		}
+		else if( aToken != NULL )
+			*aToken = nil;
+	}
+	@finally
+	{
+		freeCursor( &theCursor );
+		_trieKeyFree( &theKey );
+	}
+	return theResult;
+}
+
+static NSArray * _everyObjectNearString( NDTrie * aTrie, NSString * aKey, NSUInteger aMaxDistance, BOOL aPrefix )
+{
+	struct trieKey		theKey;
+	NSArray				* theResult = nil;
+	if( aKey == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"maxEditDistance: key cannot be nil" userInfo:nil];
+	trieKeyWithString( &theKey, aKey, aTrie.isCaseInsensitive );
+	@try
+	{
+		theResult = everyObjectNearKey( aTrie.rootNode, theKey.characters, theKey.length, aMaxDistance, aPrefix );
+	}
+	@finally
+	{
+		_trieKeyFree( &theKey );
+	}
 	return theResult;
 }
 
+- (NSArray *)everyObjectForKey:(NSString *)aKey maxEditDistance:(NSUInteger)aDistance { return _everyObjectNearString( self, aKey, aDistance, NO ); }
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix maxEditDistance:(NSUInteger)aDistance { return _everyObjectNearString( self, aPrefix, aDistance, YES ); }
+
+- (NSUInteger)countOfObjectsForKeyWithPrefix:(NSString *)aPrefix
+{
+	struct trieNode		* theNode = self.rootNode;
+	if( aPrefix != nil && [aPrefix length] > 0 )
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
+	return theNode != NULL ? theNode->objectCount : 0;
+}
+
+struct topObjectsData
+{
+	NSMutableArray		* array;
+	NSUInteger			count;
+};
+static BOOL _addToTopObjectsFunc( id anObject, void * aContext )
+{
+	struct topObjectsData		* theData = (struct topObjectsData*)aContext;
+	[theData->array addObject:anObject];
+	return theData->array.count < theData->count;
+}
+- (NSArray *)topObjects:(NSUInteger)aCount forKeyWithPrefix:(NSString *)aPrefix
+{
+	struct topObjectsData	theData = { [NSMutableArray arrayWithCapacity:aCount < 256 ? aCount : 256], aCount };
+	struct trieNode			* theNode = self.rootNode;
+	if( aPrefix != nil && [aPrefix length] > 0 )
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
+	if( theNode != NULL && aCount > 0 )
+		forEveryObjectByWeightFromNode( theNode, _addToTopObjectsFunc, (void*)&theData );
+	return theData.array;
+}
+
+- (double)weightForKey:(NSString *)aKey
+{
+	struct trieNode		* theNode = findNodeForString( self.rootNode, aKey, NO, self.isCaseInsensitive );
+	return theNode != NULL && theNode->object != nil ? theNode->weight : 0.0;
+}
+
 - (void)getObjects:(id *)aBuffer count:(NSUInteger)aCount
 {
 	struct getObjectsCountData		theData = {0, aCount, copy, aBuffer};
@@ -438,12 +1562,27 @@ static BOOL _addToArrayFunc( id anObject, void * anArray )
 {
 	struct trieNode		* theNode = self.rootNode;
 	if( aPrefix != nil && [aPrefix length] > 0 )
-		theNode = findNode( theNode, aPrefix, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
 
 	return [NDTrieEnumerator trieEnumeratorWithTrie:self node:theNode];
 }
 
-- (BOOL)isEqualToTrie:(NDTrie *)anOtherTrie { return nodesAreEqual( self.rootNode, [anOtherTrie rootNode] ); }
+static BOOL _containsKeyFunc( struct trieNode * aNode, const unichar * aKey, NSUInteger aLength, void * aContext )
+{
+	id		theObject = [(NDTrie*)aContext objectForKey:[NSString stringWithCharacters:aKey length:aLength]];
+	return theObject == aNode->object || [theObject isEqual:aNode->object];
+}
+- (BOOL)isEqualToTrie:(NDTrie *)anOtherTrie
+{
+	BOOL		theResult = NO;
+	if( anOtherTrie.rootNode == NULL )
+		theResult = [anOtherTrie isEqualToTrie:self];
+	else if( self.isPathCompressed == anOtherTrie.isPathCompressed && ![anOtherTrie isKindOfClass:[NDConcurrentMutableTrie class]] )
+		theResult = nodesAreEqual( self.rootNode, [anOtherTrie rootNode] );
+	else if( self.count == anOtherTrie.count )			// the nodes are not laid out the same so have to compare key by key
+		theResult = forEveryKeyFromNode( self.rootNode, _containsKeyFunc, (void*)anOtherTrie );
+	return theResult;
+}
 - (BOOL)isEqual:(id)anObject { return [anObject isKindOfClass:[NDTrie class]] ? [self isEqualToTrie:anObject] : NO; }
 - (void)enumerateObjectsUsingFunction:(BOOL (*)(NSString *))aFunc
 {
@@ -460,7 +1599,7 @@ static BOOL _addToArrayFunc( id anObject, void * anArray )
 {
 	struct trieNode		* theNode = self.rootNode;
 	if( aPrefix != nil && [aPrefix length] > 0 )
-		theNode = findNode( theNode, aPrefix, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
 	if( theNode != nil )
 		forEveryObjectFromNode( theNode, (BOOL(*)(NSString*,void*))aFunc, NULL );
 }
@@ -474,13 +1613,46 @@ static BOOL _addToArrayFunc( id anObject, void * anArray )
 {
 	struct trieNode		* theNode = self.rootNode;
 	if( aPrefix != nil && [aPrefix length] > 0 )
-		theNode = findNode( theNode, aPrefix, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
 	if( theNode != nil )
 		forEveryObjectFromNode( theNode, aFunc, aContext );
 }
 
 - (BOOL)writeToFile:(NSString *)aPath atomically:(BOOL)anAtomically { return [[self everyObject] writeToFile:aPath atomically:anAtomically]; }
 - (BOOL)writeToURL:(NSURL *)aURL atomically:(BOOL)anAtomically { return [[self everyObject] writeToURL:aURL atomically:anAtomically]; }
+- (BOOL)writeBinaryToFile:(NSString *)aPath atomically:(BOOL)anAtomically { return [self writeBinaryToURL:[NSURL fileURLWithPath:aPath] atomically:anAtomically]; }
+- (BOOL)writeBinaryToURL:(NSURL *)aURL atomically:(BOOL)anAtomically
+{
+	NSData		* theData = fileDataForNode( self.rootNode, self.count, (self.isCaseInsensitive ? kTrieFileCaseInsensitive : 0) | (self.isPathCompressed ? kTrieFilePathCompression : 0) );
+	return theData != nil && [theData writeToURL:aURL atomically:anAtomically];
+}
+
+- (NDTrie *)compactedTrie
+{
+	return [[[NDCompactTrie alloc] initWithGraph:createGraph( self.rootNode ) options:(self.isCaseInsensitive ? NDTrieCaseInsensitive : 0) | (self.isPathCompressed ? NDTriePathCompression : 0)] autorelease];
+}
+
+/* a mutable copy shares every node with the receiver so only what the merge changes is copied */
+- (NDTrie *)trieByUnioningTrie:(NDTrie *)aTrie mergePolicy:(id (^)(NSString *, id, id))aPolicy
+{
+	NDMutableTrie		* theResult = [[self mutableCopy] autorelease];
+	[theResult unionTrie:aTrie mergePolicy:aPolicy];
+	return theResult;
+}
+
+- (NDTrie *)trieByIntersectingTrie:(NDTrie *)aTrie mergePolicy:(id (^)(NSString *, id, id))aPolicy
+{
+	NDMutableTrie		* theResult = [[self mutableCopy] autorelease];
+	[theResult intersectTrie:aTrie mergePolicy:aPolicy];
+	return theResult;
+}
+
+- (NDTrie *)trieBySubtractingTrie:(NDTrie *)aTrie
+{
+	NDMutableTrie		* theResult = [[self mutableCopy] autorelease];
+	[theResult minusTrie:aTrie];
+	return theResult;
+}
 
 #ifdef NS_BLOCKS_AVAILABLE
 BOOL enumerateFunc( NSString * aString, void * aContext )
@@ -496,7 +1668,7 @@ BOOL enumerateFunc( NSString * aString, void * aContext )
 	struct trieNode		* theNode = self.rootNode;
 	BOOL				theStop = NO;
 	if( aPrefix != nil && [aPrefix length] > 0 )
-		theNode = findNode( theNode, aPrefix, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
 	if( theNode != nil )
 		forEveryObjectWithBlockFromNode( theNode, (void*)aBlock, &theStop );
 }
@@ -526,12 +1698,91 @@ BOOL testFunc( id anObject, void * aContext )
 	struct testData		theData = { [NSMutableArray array], aPredicate };
 	struct trieNode		* theNode = self.rootNode;
 	if( aPrefix != nil && [aPrefix length] > 0 )
-		theNode = findNode( theNode, aPrefix, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+		theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
 	if( theNode != nil )
 		forEveryObjectFromNode( theNode, testFunc, (void*)&theData );
 	return theData.array;;
 }
 
+- (void)enumerateObjectsWithOptions:(NSEnumerationOptions)anOptions usingBlock:(void (^)(id object, BOOL *stop))aBlock
+{
+	[self enumerateObjectsForKeysWithPrefix:nil options:anOptions usingBlock:aBlock];
+}
+
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix options:(NSEnumerationOptions)anOptions usingBlock:(void (^)(id object, BOOL *stop))aBlock
+{
+	struct trieNode		* theNode = self.rootNode;
+	if( theNode == NULL )						// a mapped or compacted trie is always enumerated on the calling thread
+		[self enumerateObjectsForKeysWithPrefix:aPrefix usingBlock:aBlock];
+	else
+	{
+		if( aPrefix != nil && [aPrefix length] > 0 )
+			theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
+		if( theNode != NULL )
+		{
+#if NDTrieUseDispatch
+			if( (anOptions & NSEnumerationConcurrent) != 0 )
+				forEveryObjectConcurrentlyFromNode( theNode, ^BOOL(id anObject, BOOL * aStop){ aBlock( anObject, aStop ); return NO; }, NO );
+			else
+#endif
+			{
+				BOOL	theStop = NO;
+				forEveryObjectWithBlockFromNode( theNode, aBlock, &theStop );
+			}
+		}
+	}
+}
+
+- (NSArray *)everyObjectWithOptions:(NSEnumerationOptions)anOptions passingTest:(BOOL (^)(id object, BOOL *stop))aPredicate
+{
+	return [self everyObjectForKeyWithPrefix:nil options:anOptions passingTest:aPredicate];
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString*)aPrefix options:(NSEnumerationOptions)anOptions passingTest:(BOOL (^)(id object, BOOL *stop))aPredicate
+{
+	NSArray				* theResult = [NSArray array];
+	struct trieNode		* theNode = self.rootNode;
+	if( theNode == NULL )
+		theResult = [self everyObjectForKeyWithPrefix:aPrefix passingTest:aPredicate];
+	else
+	{
+		if( aPrefix != nil && [aPrefix length] > 0 )
+			theNode = findNodeForString( theNode, aPrefix, YES, self.isCaseInsensitive );
+		if( theNode != NULL )
+		{
+#if NDTrieUseDispatch
+			if( (anOptions & NSEnumerationConcurrent) != 0 )
+				theResult = forEveryObjectConcurrentlyFromNode( theNode, aPredicate, YES );
+			else
+#endif
+			{
+				struct testData		theData = { [NSMutableArray array], aPredicate };
+				forEveryObjectFromNode( theNode, testFunc, (void*)&theData );
+				theResult = theData.array;
+			}
+		}
+	}
+	return theResult;
+}
+
+- (void)enumerateMatchesInString:(NSString *)aString usingBlock:(void (^)(NSRange range, id object, BOOL *stop))aBlock
+{
+	[self enumerateMatchesInString:aString options:NDTrieMatchAll usingBlock:aBlock];
+}
+
+- (void)enumerateMatchesInString:(NSString *)aString options:(NDTrieMatchOptions)anOptions usingBlock:(void (^)(NSRange range, id object, BOOL *stop))aBlock
+{
+	unsigned long		theMutations = _mutations;
+	if( aString == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"enumerateMatchesInString:options:usingBlock: string cannot be nil" userInfo:nil];
+	/* a change from within aBlock frees the automaton being scanned with, so it has to stop there */
+	scanString( self.scanner, aString, self.isCaseInsensitive, anOptions, ^(NSRange aRange, id anObject, BOOL * aStop) {
+		aBlock( aRange, anObject, aStop );
+		if( theMutations != _mutations )
+			@throw [NSException exceptionWithName:NSGenericException reason:[NSString stringWithFormat:@"Collection <%@: %p> was mutated while being enumerated.", [self class], self] userInfo:nil];
+	});
+}
+
 #endif
 
 - (NSString *)description
@@ -549,65 +1800,145 @@ BOOL testFunc( id anObject, void * aContext )
 	return theResult;
 }
 
-- (NSString *)debugDescription { return nodeDebugDescription(self.rootNode); }
+- (NSString *)debugDescription { return nodeDebugDescription(self.rootNode, 0); }
 
 - (id)copyWithZone:(NSZone *)aZone { return [self retain]; }
-- (id)mutableCopyWithZone:(NSZone *)aZone { return [[NDMutableTrie allocWithZone:aZone] initWithTrie:self]; }
+- (id)mutableCopyWithZone:(NSZone *)aZone { return [[NDMutableTrie allocWithZone:aZone] initWithCaseInsensitive:self.isCaseInsensitive trie:self]; }
 
 #ifdef NDFastEnumerationAvailable
 #pragma mark NSFastEnumeration
 /*
-	Implement fast enumeration by retrieving every object in a c array, this is expensive memory wise but is quicker,
-	this may not be a suitable solution on the iPhone where memory is more restrictive, could perhaps use an alternative
-	implemention for the iPhone or maybe even change the method depending on the trie size.
+	Implement fast enumeration a buffer at a time, where the enumeration is up to is kept in an autoreleased
+	NDTrieEnumerator in extra[0], so nothing is leaked if the loop is broken out of.
  */
 - (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)aState objects:(id *)aStackbuf count:(NSUInteger)aLen
 {
-	NSUInteger		theResultLength = 0;
+	NDTrieEnumerator	* theEnumerator;
 	if( aState->state == 0 )
 	{
-		NSUInteger						theCount = [self count];
-		struct getObjectsCountData		theData = {0, theCount, assign, (id*)malloc( theCount*sizeof(id) )};
-		aState->itemsPtr = theData.objects;
-		forEveryObjectFromNode( self.rootNode, getObjectsFunc, (void*)&theData );
-		theResultLength = theCount;
-		aState->state = theCount;
-		aState->mutationsPtr = (unsigned long *)aState->itemsPtr;
-
-		*aStackbuf = *aState->itemsPtr;
+		theEnumerator = [NDTrieEnumerator trieEnumeratorWithTrie:self node:self.rootNode];
+		aState->extra[0] = (unsigned long)theEnumerator;
+		aState->mutationsPtr = self.mutationsPtr;
+		aState->state = 1;
 	}
 	else
-		free( aState->itemsPtr );
-		
+		theEnumerator = (NDTrieEnumerator*)aState->extra[0];
 
-	return theResultLength;
+	aState->itemsPtr = aStackbuf;
+	return [theEnumerator getObjects:aStackbuf count:aLen];
 }
 #endif
 
 #pragma marrk - private methods
-- (struct trieNode*)rootNode { return (struct trieNode*)_rootNode; }
-
-#pragma mark - Dictionary-Style subscripting
-
-- (id)objectForKeyedSubscript:(id)aKey
+/*
+	the nodes are not copied, the new trie takes a reference to every child of the root of anAnotherTrie, along with
+	its arena, and either trie copies whatever it changes from then on
+ */
+- (void)copyNodesOfTrie:(NDTrie *)anAnotherTrie
 {
-	struct trieNode		* theNode = findNode( (struct trieNode *)_rootNode, aKey, 0, NO, NULL, NULL, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
-	return theNode != NULL ? theNode->object : nil;
+	struct trieNode		* theRoot = anAnotherTrie.rootNode;
+	if( theRoot != NULL )
+	{
+		NSCParameterAssert( self.rootNode->count == 0 );
+		releaseArena( _arena );
+		_arena = retainArena( anAnotherTrie.arena );
+		shareChildren( self.rootNode, theRoot, self.arena );
+		self.rootNode->maxWeight = theRoot->maxWeight;
+		self.rootNode->objectCount = theRoot->objectCount;
+		_count = theRoot->objectCount;
+	}
+	else if( [anAnotherTrie isKindOfClass:[NDStaticTrie class]] )		// a mapped or compacted trie has no nodes to copy
+		_count = addEveryObjectInView( [(NDStaticTrie*)anAnotherTrie view], self.rootNode, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed );
+}
+/*
+	a mapped or compacted trie keeps its own structure, so is made without a root node or arena, every method that
+	reads rootNode has to cope with it being NULL
+ */
+- (id)initWithoutNodesWithOptions:(NDTrieOptions)anOptions
+{
+	if( (self = [super init]) != nil )
+	{
+		_caseInsensitive = (anOptions & NDTrieCaseInsensitive) != 0;
+		_pathCompression = (anOptions & NDTriePathCompression) != 0;
+	}
+	return self;
 }
 
-@end
+- (struct trieNode*)rootNode { return (struct trieNode*)_rootNode; }
+- (struct trieArena*)arena { return _arena; }
+
+/*
+	The automaton is compiled the first time it is needed, two threads can end up compiling it at the same time but
+	only one gets to keep it. Once kept it is never freed here as another reader could still be using it, NDMutableTrie
+	throws it away when it changes, which can not happen while the trie is being read.
+ */
+- (struct trieScanner *)scanner
+{
+	struct trieScanner		* theScanner = _scanner;
+	if( theScanner == NULL )
+	{
+		theScanner = createScanner( self.rootNode );
+		if( !__sync_bool_compare_and_swap( &_scanner, NULL, theScanner ) )
+		{
+			freeScanner( theScanner );
+			theScanner = _scanner;
+		}
+	}
+	return theScanner;
+}
+- (unsigned long *)mutationsPtr { return &_mutations; }
+
+#pragma mark - Dictionary-Style subscripting
+
+- (id)objectForKeyedSubscript:(id)aKey
+{
+	struct trieNode		* theNode = findNodeForString( self.rootNode, aKey, NO, self.isCaseInsensitive );
+	return theNode != NULL ? theNode->object : nil;
+}
+
+@end
 
 @implementation NDMutableTrie
 
+- (id)initWithOptions:(NDTrieOptions)anOptions
+{
+	if( (self = [super initWithOptions:anOptions]) != nil && (anOptions & NDTrieConcurrentReads) && [self isMemberOfClass:[NDMutableTrie class]] )
+	{
+		[self release];
+		self = [[NDConcurrentMutableTrie alloc] initWithOptions:anOptions];
+	}
+	return self;
+}
+
+/* every change comes through here, the automaton for matching is thrown away as no reader can be using it now */
+- (void)willChange
+{
+	_mutations++;
+	freeScanner( _scanner );
+	_scanner = NULL;
+}
+
 - (void)addString:(NSString *)aString { [self setObject:aString forKey:aString]; }
 
 - (void)setObject:(id)anObject forKey:(NSString *)aString
 {
-	_count += setObjectForKey( self.rootNode, anObject, aString, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+	[self willChange];
+	_count += setObjectForKey( self.rootNode, anObject, aString, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
+}
+
+- (void)addString:(NSString *)aString weight:(double)aWeight { [self setObject:aString forKey:aString weight:aWeight]; }
+
+- (void)setObject:(id)anObject forKey:(NSString *)aString weight:(double)aWeight
+{
+	if( !isfinite(aWeight) )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObject:forKey:weight: weight must be finite" userInfo:nil];
+	[self willChange];
+	_count += setObjectForKey( self.rootNode, anObject, aString, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed, aWeight );
 }
 
 - (void)addStrings:(NSString *)aFirstString, ...
 {
+	[self willChange];
 	va_list		theArgList;
 	NSString	* theString = aFirstString;
 
@@ -618,7 +1949,7 @@ BOOL testFunc( id anObject, void * aContext )
 		if( ![theString isKindOfClass:[NSString class]] )
 			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theString class]] userInfo:nil];
 
-		_count += setObjectForKey( self.rootNode, theString, theString, theKeyComponentForString );
+		_count += setObjectForKey( self.rootNode, theString, theString, theKeyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
 	}
 	while( (theString = va_arg( theArgList, NSString * ) ) != nil );
 
@@ -627,6 +1958,7 @@ BOOL testFunc( id anObject, void * aContext )
 
 - (void)setObjectsAndKeys:(id)aFirstObject, ...
 {
+	[self willChange];
 	va_list		theArgList;
 	id			theObject = aFirstObject;
 	
@@ -641,31 +1973,38 @@ BOOL testFunc( id anObject, void * aContext )
 		if( ![theKey isKindOfClass:[NSString class]] )
 			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theKey class]] userInfo:nil];
 		
-		_count += setObjectForKey( self.rootNode, theObject, theKey, theKeyComponentForString );
+		_count += setObjectForKey( self.rootNode, theObject, theKey, theKeyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
 	}
 	while( (theObject = va_arg( theArgList, id ) ) != nil );
 	
 	va_end( theArgList );
 }
 
-- (void)addStrings:(NSString **)aStrings count:(NSUInteger)aCount
-{
-	NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
-	for( NSUInteger i = 0; i < aCount; i++ )
-		_count += setObjectForKey( self.rootNode, aStrings[i], aStrings[i], theKeyComponentForString );
-}
+- (void)addStrings:(NSString **)aStrings count:(NSUInteger)aCount { [self setObjects:aStrings forKeys:aStrings count:aCount]; }
 
 - (void)setObjects:(id *)anObjects forKeys:(NSString **)aKeys count:(NSUInteger)aCount
 {
-	NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
-	for( NSUInteger i = 0; i < aCount; i++ )
-		_count += setObjectForKey( self.rootNode, anObjects[i], aKeys[i], theKeyComponentForString );
+	[self willChange];
+	if( self.rootNode->count == 0 )				// an empty trie can be built in one go
+		_count = buildNodeWithKeys( self.rootNode, anObjects, aKeys, aCount, self.isCaseInsensitive, self.arena, self.isPathCompressed, NO );
+	else
+	{
+		NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
+		for( NSUInteger i = 0; i < aCount; i++ )
+			_count += setObjectForKey( self.rootNode, anObjects[i], aKeys[i], theKeyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
+	}
 }
 
-- (void)addTrie:(NDTrie *)aTrie { [aTrie enumerateObjectsUsingFunction:_addTrieFunc context:(void*)self]; }
+- (void)addTrie:(NDTrie *)aTrie { [self unionTrie:aTrie]; }
 
 - (void)addArray:(NSArray *)anArray
 {
+	[self willChange];
+	if( self.rootNode->count == 0 )
+	{
+		_count = buildNodeWithArray( self.rootNode, anArray, self.isCaseInsensitive, self.arena, self.isPathCompressed, NO );
+		return;
+	}
 	NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
 #ifdef NDFastEnumerationAvailable
 	for( NSString * theString in anArray )
@@ -678,12 +2017,18 @@ BOOL testFunc( id anObject, void * aContext )
 #endif
 		if( ![theString isKindOfClass:[NSString class]] )
 			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theString class]] userInfo:nil];
-		_count += setObjectForKey( self.rootNode, theString, theString, theKeyComponentForString );
+		_count += setObjectForKey( self.rootNode, theString, theString, theKeyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
 	}
 }
 
 - (void)addDictionay:(NSDictionary *)aDictionary
 {
+	[self willChange];
+	if( self.rootNode->count == 0 )
+	{
+		_count = buildNodeWithDictionary( self.rootNode, aDictionary, self.isCaseInsensitive, self.arena, self.isPathCompressed, NO );
+		return;
+	}
 	NSArray		* theKeysArray = [aDictionary allKeys];
 	NSUInteger (*theKeyComponentForString)( id, NSUInteger, BOOL * ) = self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString;
 #ifdef NDFastEnumerationAvailable
@@ -697,37 +2042,81 @@ BOOL testFunc( id anObject, void * aContext )
 #endif
 		if( ![theKey isKindOfClass:[NSString class]] )
 			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theKey class]] userInfo:nil];
-		_count += setObjectForKey( self.rootNode, [aDictionary objectForKey:theKey], theKey, theKeyComponentForString );
+		_count += setObjectForKey( self.rootNode, [aDictionary objectForKey:theKey], theKey, theKeyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
 	}
 }
+
+- (BOOL)addContentsOfWordListFile:(NSString *)aPath progress:(void (^)(unsigned long long,unsigned long long,BOOL*))aProgress { return [self addContentsOfWordListURL:[NSURL fileURLWithPath:aPath] progress:aProgress]; }
+- (BOOL)addContentsOfWordListURL:(NSURL *)aURL progress:(void (^)(unsigned long long,unsigned long long,BOOL*))aProgress
+{
+	[self willChange];
+	return addEveryLineInFile( self.rootNode, aURL, &_count, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed, aProgress );
+}
 	 
 - (void)removeObjectForKey:(NSString *)aString
 {
+	[self willChange];
 	BOOL	theFoundNode = NO;
-	removeObjectForKey( self.rootNode, aString, 0, &theFoundNode, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+	removeObjectForKey( self.rootNode, aString, 0, &theFoundNode, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed );
 	if( theFoundNode )
 		_count--;
 }
 
 - (void)removeAllObjects
 {
-	removeAllChildren( self.rootNode );
+	[self willChange];
+	destroyAllChildren( self.rootNode, self.arena );
 	_count = 0;
 }
 
 - (void)removeAllObjectsForKeysWithPrefix:(NSString *)aPrefix
 {
+	[self willChange];
 	if( aPrefix != nil && [aPrefix length] > 0 )
-	{
-		NSUInteger			thePosition = 0;
-		struct trieNode		* theParent = nil,
-							* theNode = findNode( self.rootNode, aPrefix, 0, NO, &theParent, &thePosition, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+		_count -= removeChild( self.rootNode, aPrefix, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed );
+	else
+		[self removeAllObjects];
+}
+
+- (void)unionTrie:(NDTrie *)aTrie { [self mergeTrie:aTrie operation:kTrieMergeUnion policy:nil]; }
+- (void)unionTrie:(NDTrie *)aTrie mergePolicy:(id (^)(NSString *, id, id))aPolicy { [self mergeTrie:aTrie operation:kTrieMergeUnion policy:aPolicy]; }
+- (void)intersectTrie:(NDTrie *)aTrie { [self mergeTrie:aTrie operation:kTrieMergeIntersect policy:nil]; }
+- (void)intersectTrie:(NDTrie *)aTrie mergePolicy:(id (^)(NSString *, id, id))aPolicy { [self mergeTrie:aTrie operation:kTrieMergeIntersect policy:aPolicy]; }
+- (void)minusTrie:(NDTrie *)aTrie { [self mergeTrie:aTrie operation:kTrieMergeMinus policy:nil]; }
 
-		if( theNode != NULL && theParent != NULL )
-			_count -= removeChild( self.rootNode, aPrefix, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+/*
+	The merge walks nodes, so a trie without them, one that can change underneath the merge or the receiver itself is
+	replaced by a copy, which shares the nodes of a trie that has them. Keys of a case sensitive trie are folded for a
+	case insensitive receiver, keys of a case insensitive trie are already folded and are merged as they are.
+ */
+- (NDTrie *)trieToMerge:(NDTrie *)aTrie
+{
+	NDTrie		* theResult = aTrie;
+	if( aTrie == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"The trie to merge cannot be nil" userInfo:nil];
+	if( aTrie.rootNode == NULL )
+		theResult = [[[NDTrie alloc] initWithCaseInsensitive:self.isCaseInsensitive trie:aTrie] autorelease];
+	else if( aTrie == self || [aTrie isKindOfClass:[NDConcurrentMutableTrie class]] )
+		theResult = [[[NDTrie alloc] initWithCaseInsensitive:aTrie.isCaseInsensitive trie:aTrie] autorelease];
+	if( self.isCaseInsensitive && !theResult.isCaseInsensitive )
+	{
+		NDMutableTrie		* theFolded = [[[NDMutableTrie alloc] initWithOptions:NDTrieCaseInsensitive | (self.isPathCompressed ? NDTriePathCompression : 0)] autorelease];
+		forEveryKeyFromNode( theResult.rootNode, _addKeyFunc, theFolded );
+		theResult = theFolded;
 	}
-	else
-		removeAllChildren( self.rootNode );
+	return theResult;
+}
+
+- (void)mergeTrie:(NDTrie *)aTrie operation:(enum trieMergeOperation)anOperation policy:(id (^)(NSString *, id, id))aPolicy
+{
+	NDTrie		* theOther = [self trieToMerge:aTrie];
+#if NDTrieUseNodeArena
+	BOOL		theShare = self.arena == theOther.arena;
+#else
+	BOOL		theShare = YES;					// every node is malloced so any trie can free it
+#endif
+	[self willChange];
+	_count = mergeNodes( self.rootNode, theOther.rootNode, anOperation, aPolicy, self.arena, theShare, self.isPathCompressed );
 }
 
 - (id)copyWithZone:(NSZone *)aZone { return [[NDTrie allocWithZone:aZone] initWithCaseInsensitive:self.isCaseInsensitive trie:self]; }
@@ -736,457 +2125,5516 @@ BOOL testFunc( id anObject, void * aContext )
 
 - (void)setObject:(id)anObject forKeyedSubscript:(NSString *)aString
 {
+	[self willChange];
 	if( ![aString isKindOfClass:[NSString class]] )
 		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"The key subscript must of of kind NSString" userInfo:nil];
-	_count += setObjectForKey( self.rootNode, anObject, aString, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
+	_count += setObjectForKey( self.rootNode, anObject, aString, self.isCaseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, self.arena, self.isPathCompressed, kTrieUnchangedWeight );
 }
 
 @end
 
-@implementation NDTrieEnumerator
-
-+ (id)trieEnumeratorWithTrie:(NDTrie *)aTrie node:(struct trieNode*)aNode { return [[[self alloc] initWithTrie:aTrie node:aNode] autorelease]; }
+@implementation NDConcurrentMutableTrie
 
-- (id)initWithTrie:(NDTrie *)aTrie node:(struct trieNode*)aNode
+- (id)initWithOptions:(NDTrieOptions)anOptions
 {
-	if( (self = [self init]) != nil )
+	if( (self = [super initWithOptions:anOptions]) != nil )
 	{
-		struct getObjectsCountData		theData = {0, 0, retain, NULL};
-		_count = [aTrie count];
-		_everyObject = (id*)malloc( _count*sizeof(id) );
-		_index = 0;
-		theData.count = _count;
-		theData.objects = _everyObject;
-		forEveryObjectFromNode( aNode, getObjectsFunc, (void*)&theData );
-		_count = theData.index;
+		_roots[0] = [super rootNode];
+		_arenas[0] = [super arena];
+		pthread_mutex_init( &_writeLock, NULL );
 	}
 	return self;
 }
 
 - (void)dealloc
 {
-	for( NSUInteger i = 0; i < _count; i++ )
-		[_everyObject[i] release];
-	free( _everyObject );
-	[super dealloc];
-}
-
-- (id)nextObject { return _index < _count ? _everyObject[_index++] : nil; }
-- (NSArray *)allObjects { return [NSArray arrayWithObjects:_everyObject+_index count:_count-_index]; }
-
-#pragma mark NSFastEnumeration
-- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)aState objects:(id *)aStackbuf count:(NSUInteger)aLen
-{
-	NSUInteger		theCount = 0;
-	if( aState->state == 0 )
+	freeScanner( _scanners[0] );
+	freeScanner( _scanners[1] );
+	if( _roots[1] != NULL )
 	{
-		aState->itemsPtr = _everyObject+_index;
-		aState->state = theCount = _count - _index;
-		aState->mutationsPtr = (unsigned long *)aState->itemsPtr;
+		destroyAllChildren( _roots[1], _arenas[1] );
+		releaseArena( _arenas[1] );
+		free( _roots[1] );
 	}
-	return theCount;
+	pthread_mutex_destroy( &_writeLock );
+	[super dealloc];
 }
 
-@end
-
-@implementation NDTrieBuilder
-- (id)initWithCaseInsensitive:(BOOL)aCaseInsensitive trieRoot:(struct trieNode*)aRoot
+- (void)finalize
 {
-	if( (self = [super init]) != nil )
+	freeScanner( _scanners[0] );
+	freeScanner( _scanners[1] );
+	if( _roots[1] != NULL )
 	{
-		_caseInsensitive = aCaseInsensitive;
-		_rootNode = aRoot;
+		destroyAllChildren( _roots[1], _arenas[1] );
+		releaseArena( _arenas[1] );
+		free( _roots[1] );
 	}
-	return self;
+	pthread_mutex_destroy( &_writeLock );
+	[super finalize];
 }
-- (void)dealloc
+
+/*
+	every performRead a thread is inside of, innermost first, kept through a thread specific key so that a reader
+	stays on the side it counted itself on for as long as its read lasts, however many times it asks for the root
+ */
+struct trieReadFrame
 {
-	[_currentString release];
-    [super dealloc];
-}
+	NDConcurrentMutableTrie		* trie;
+	NSUInteger					side;
+	struct trieReadFrame		* next;
+};
 
-- (BOOL)parseContentsOfURL:(NSURL *)aURL
+static pthread_key_t		_readFrameKey;
+static pthread_once_t		_readFrameOnce = PTHREAD_ONCE_INIT;
+
+static void _createReadFrameKey( void ) { pthread_key_create( &_readFrameKey, NULL ); }
+
+static struct trieReadFrame * _readFrameForTrie( NDConcurrentMutableTrie * aTrie )
 {
-	NSXMLParser		* theParser = [[NSXMLParser alloc] initWithContentsOfURL:aURL];
-	BOOL			theResult = NO;
-	[theParser setDelegate:self];
-	[theParser setShouldProcessNamespaces:NO];
-	[theParser setShouldReportNamespacePrefixes:NO];
-	[theParser setShouldResolveExternalEntities:NO];
-	if( (theResult = [theParser parse])== NO )
-		NSLog( @"%@", [theParser parserError] );
-	return theResult;
+	struct trieReadFrame	* theFrame;
+	pthread_once( &_readFrameOnce, _createReadFrameKey );
+	for( theFrame = pthread_getspecific( _readFrameKey ); theFrame != NULL && theFrame->trie != aTrie; theFrame = theFrame->next )
+		;
+	return theFrame;
 }
 
-- (NSUInteger)count { return _count; }
-
-#pragma mark NSXMLParserDelegate
-- (void)parser:(NSXMLParser *)aParser didStartElement:(NSString *)anElementName namespaceURI:(NSString *)aNamespaceURI qualifiedName:(NSString *)aQualifiedName attributes:(NSDictionary *)anAttributeDict
+/*
+	the writer always changes the side readers are not on, a reader uses the side performRead counted it on, the
+	writer may have swapped sides since
+ */
+static NSUInteger _sideForThread( NDConcurrentMutableTrie * aTrie )
 {
-	if( _foundRootElement == NDTriePListElelemtNone )
-	{
-		if( [anElementName isEqualToString:kArrayPListElementName] )
-			_foundRootElement = NDTriePListElelemtArray;
-		else if( [anElementName isEqualToString:kArrayPListElementName] )
-			_foundRootElement = NDTriePListElelemtArray;
-	}
-	else if( [anElementName isEqualToString:kStringPListElementName] )
-		_currentString = [[NSMutableString alloc] init];
-	else
-		NSLog( @"Unexpected element %@", anElementName );
+	struct trieReadFrame	* theFrame;
+	if( pthread_equal( aTrie->_writer, pthread_self() ) )
+		return !aTrie->_readSide;
+	theFrame = _readFrameForTrie( aTrie );
+	return theFrame != NULL ? theFrame->side : aTrie->_readSide;
 }
 
-- (void)parser:(NSXMLParser *)aParser didEndElement:(NSString *)anElementName namespaceURI:(NSString *)aNamespaceURI qualifiedName:(NSString *)aQName
+- (struct trieNode*)rootNode { return _roots[_sideForThread( self )]; }
+- (struct trieArena*)arena { return _arenas[_sideForThread( self )]; }
+
+/*
+	each side has its own automaton, performWrite throws away the one for the side it is about to change once no
+	reader can be using it, the one willChange throws away is never made
+ */
+- (struct trieScanner *)scanner
 {
-	if( _foundRootElement != NDTriePListElelemtNone )
+	NSUInteger				theSide = _sideForThread( self );
+	struct trieScanner		* theScanner = _scanners[theSide];
+	if( theScanner == NULL )
 	{
-		if( [anElementName isEqualToString:kArrayPListElementName] )
-			_foundRootElement = NDTriePListElelemtNone;
-		else if( [anElementName isEqualToString:kStringPListElementName] )
+		theScanner = createScanner( _roots[theSide] );
+		if( !__sync_bool_compare_and_swap( &_scanners[theSide], NULL, theScanner ) )
 		{
-			_count += setObjectForKey( _rootNode, _currentString, [_currentString description], _caseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString );
-			[_currentString release];
-			_currentString = nil;
+			freeScanner( theScanner );
+			theScanner = _scanners[theSide];
 		}
 	}
-	else if( ![anElementName isEqualToString:kPListPListElementName] )
-		NSLog( @"Unexpected element %@", anElementName );
+	return theScanner;
 }
-	
-- (void)parser:(NSXMLParser *)aParser foundCharacters:(NSString *)aString
+
+static void _discardScanner( struct trieScanner * volatile * aScanner )
 {
-	if( _currentString != nil )
-		[_currentString appendString:aString];
+	freeScanner( *aScanner );
+	*aScanner = NULL;
 }
 
-@end
-	
-static struct trieNode * _createNode( NSUInteger aKey, struct trieNode * aParent )
+static struct trieReadIndicator * _readIndicatorForThread( struct trieReadIndicator * aReaders )
 {
-	struct trieNode		* theNode = malloc( sizeof(struct trieNode) );
-	theNode->key = aKey;
-	theNode->children = NULL;
-	theNode->parent = aParent;
-	theNode->object = nil;
-	theNode->count = 0;
-	return theNode;
+	uintptr_t		theThread = (uintptr_t)pthread_self();
+	return &aReaders[(theThread ^ (theThread >> 12)) % kTrieReadIndicatorCount];
 }
 
-NSUInteger removeAllChildren( struct trieNode * aNode )
+/*
+	a reader counts itself on the side it is going to read and then checks that side is still the read side, if the
+	writer swapped sides in between it may have already looked at the count, so the reader tries again on the new side.
+	A read from inside a read is already counted and has to stay on the same side.
+ */
+- (void)performRead:(void (^)(void))aBlock
 {
-	NSUInteger	theCount = 0;
-
-	if( aNode->children )
+	struct trieReadIndicator	* theIndicator = _readIndicatorForThread( _readers );
+	struct trieReadFrame		theFrame = { self, 0, NULL };
+	NSUInteger					theSide;
+	if( _readFrameForTrie( self ) != NULL )
 	{
-		for( NSUInteger i = 0; i < aNode->count; i++ )
-		{
-			theCount += removeAllChildren( aNode->children[i] );
-			[aNode->children[i]->object release];
-			free( aNode->children[i] );
-		}
-
-		free( aNode->children );
-		aNode->children = NULL;
-		aNode->count = 0;
-		aNode->size = 0;
+		aBlock();
+		return;
+	}
+	for( ;; )
+	{
+		theSide = _readSide;
+		__sync_fetch_and_add( &theIndicator->count[theSide], 1 );
+		if( theSide == _readSide )
+			break;
+		__sync_fetch_and_sub( &theIndicator->count[theSide], 1 );
+	}
+	theFrame.side = theSide;
+	theFrame.next = pthread_getspecific( _readFrameKey );
+	pthread_setspecific( _readFrameKey, &theFrame );
+	@try
+	{
+		aBlock();
+	}
+	@finally
+	{
+		pthread_setspecific( _readFrameKey, theFrame.next );
+		__sync_fetch_and_sub( &theIndicator->count[theSide], 1 );
 	}
-
-	if( aNode->object != nil )
-		theCount++;
-
-	return theCount;
 }
 
-/*
-	Perform binary search to find node for key or location to insert node
- */
-inline static NSUInteger _indexForChild( struct trieNode * aNode, NSUInteger aKey )
+static void _waitForReaders( struct trieReadIndicator * aReaders, NSUInteger aSide )
 {
-	NSUInteger		theIndex = NSNotFound;
-	if( aNode->count > 0 )
+	for( NSUInteger i = 0; i < kTrieReadIndicatorCount; i++ )
 	{
-		NSUInteger		l = 0,
-						u = aNode->count,
-						m;
-
-		while( l < u-1 && theIndex == NSNotFound )
-		{
-			m = (u+l) >> 1;
-			if( aNode->children[m]->key < aKey )
-				l = m;
-			else if( aNode->children[m]->key > aKey )
-				u = m;
-			else
-				theIndex = m;
-		}
-		if( theIndex == NSNotFound )
-			theIndex = aNode->children[l]->key < aKey ? u : l;
+		while( aReaders[i].count[aSide] != 0 )
+			sched_yield();
 	}
-	else
-		theIndex = 0;
-	return theIndex;
 }
 
 /*
-	Finds a node, if aCreate == YES nodes are created as needed but the final node is not set to terminal node
-	Should not return NULL if aCreate == YES
+	aBlock is called twice, once for each copy, so it has to make the same change both times, exceptions are thrown
+	after both copies have been changed. If the second call throws its copy is made again from the first so the two
+	still match. Changes made from inside aBlock are just part of it. A change from inside a read on the same thread
+	would wait for that read to finish forever, so it throws instead, as the other tries do for a change while
+	enumerating.
  */
-static struct trieNode * findNode( struct trieNode * aNode, id aKey, NSUInteger anIndex, BOOL aCreate, struct trieNode ** aParent, NSUInteger * anPosition, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ) )
+- (void)performWrite:(void (^)(void))aBlock
 {
-	if( aKey == nil )
-		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"objectForKey: key cannot be nil" userInfo:nil];
-
-	struct trieNode		* theNode = NULL;
-	BOOL				theEnd = NO;
-	NSUInteger			theKeyComponent = aKeyComponentFunc( aKey, anIndex, &theEnd );
+	NSException		* theException = nil;
+	if( pthread_equal( _writer, pthread_self() ) )
+	{
+		aBlock();
+		return;
+	}
+	if( _readFrameForTrie( self ) != NULL )
+		@throw [NSException exceptionWithName:NSGenericException reason:[NSString stringWithFormat:@"Collection <%@: %p> was mutated while being enumerated.", [self class], self] userInfo:nil];
 
-	if( aNode->children != NULL )
+	pthread_mutex_lock( &_writeLock );
+	@try
 	{
-		NSUInteger		theIndex = _indexForChild( aNode, theKeyComponent );
-		if( theIndex >= aNode->count || aNode->children[theIndex]->key != theKeyComponent )
+		NSUInteger		theCount = _count;
+		if( _roots[1] == NULL )			// the second copy is only needed once there is a change to make
 		{
-			if( aCreate )
-			{
-				if( aNode->count >= aNode->size )
-				{
-					aNode->size <<= 1;
-					aNode->children = (struct trieNode**)reallocf( aNode->children, aNode->size*sizeof(struct trieNode*) );
-					NSCParameterAssert( aNode->children != NULL );
-				}
-				memmove( &aNode->children[theIndex+1], &aNode->children[theIndex], (aNode->count-theIndex)*sizeof(struct trieNode*) );
-				aNode->children[theIndex] = _createNode( theKeyComponent, aNode );
-				theNode = aNode->children[theIndex];
-				aNode->count++;
-				if( anPosition )
-					*anPosition = theIndex;
-				if( aParent )
-					*aParent = aNode;
-				
-			}
+			_roots[1] = calloc( 1, sizeof(struct trieNode) );
+			_roots[1]->refCount = 1;
+			_arenas[1] = createArena();
+			_copyChildren( _roots[1], _roots[0], _arenas[1] );
+			_roots[1]->maxWeight = _roots[0]->maxWeight;
+			_roots[1]->objectCount = _roots[0]->objectCount;
 		}
-		else
-		{			
-			theNode = aNode->children[theIndex];
-			if( anPosition )
-				*anPosition = theIndex;
-			if( aParent )
-				*aParent = aNode;
+		_writer = pthread_self();
+		_discardScanner( &_scanners[!_readSide] );
+		@try
+		{
+			aBlock();
+		}
+		@catch( NSException * anException )
+		{
+			theException = [anException retain];
+		}
+
+		__sync_synchronize();
+		_readSide = !_readSide;
+		__sync_synchronize();
+		_waitForReaders( _readers, !_readSide );
+
+		NSUInteger		theNewCount = _count;
+		_count = theCount;
+		_discardScanner( &_scanners[!_readSide] );
+		@try
+		{
+			aBlock();
+		}
+		@catch( NSException * anException )
+		{
+			[self copyReadSide];
+			if( theException == nil )
+				theException = [anException retain];
 		}
+		_count = theNewCount;
 	}
-	else if( aCreate )
+	@finally
 	{
-		aNode->size = 4;
-		aNode->children = malloc( aNode->size*sizeof(struct trieNode*) );
-		aNode->children[0] = _createNode( theKeyComponent, aNode );
-		theNode = aNode->children[0];
-		aNode->count++;
-		if( anPosition )
-			*anPosition = 0;
-		if( aParent )
-			*aParent = aNode;
+		_writer = (pthread_t)0;
+		pthread_mutex_unlock( &_writeLock );
 	}
+	if( theException != nil )
+		@throw [theException autorelease];
+}
 
-	anIndex++;
-	if( theNode != NULL && !theEnd )
-		theNode = findNode( theNode, aKey, anIndex, aCreate, aParent, anPosition, aKeyComponentFunc );
+/*
+	throws away the side being written and copies the side being read in to it, only for the second half of
+	performWrite, when no reader can be on the side being written
+ */
+- (void)copyReadSide
+{
+	struct trieNode		* theWriteRoot = _roots[!_readSide],
+						* theReadRoot = _roots[_readSide];
+	destroyAllChildren( theWriteRoot, _arenas[!_readSide] );
+	_copyChildren( theWriteRoot, theReadRoot, _arenas[!_readSide] );
+	theWriteRoot->maxWeight = theReadRoot->maxWeight;
+	theWriteRoot->objectCount = theReadRoot->objectCount;
+}
 
-	return theNode;
+- (NSUInteger)count
+{
+	__block NSUInteger		theResult = 0;
+	[self performRead:^{ theResult = self.rootNode->objectCount; }];
+	return theResult;
 }
 
-BOOL removeObjectForKey( struct trieNode * aNode, id aKey, NSUInteger anIndex, BOOL * aFoundNode, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ) )
+- (BOOL)containsObjectForKey:(NSString *)aString
 {
-	BOOL			theResult = NO;
-	BOOL			theEnd = NO;
-	NSUInteger		theKeyComponent = aKeyComponentFunc( aKey, anIndex, &theEnd );
-	if( aNode->children == NULL )
-	{
-//		if( theEnd )
-//		{
-//			*aFoundNode = aNode->object != nil;
-//			theResult = YES;
-//		}
-	}
-	else
-	{
-		NSUInteger		theIndex = _indexForChild( aNode, theKeyComponent );
-		if( theIndex < aNode->count )
-		{
-			if( aNode->children[theIndex]->key == theKeyComponent )
-			{
-				if( theEnd )
-				{
-					if( aNode->children[theIndex]->object != nil )
-					{
-						[aNode->children[theIndex]->object release], aNode->children[theIndex]->object = nil;
-						if( aNode->children[theIndex]->count == 0 )
-						{
-							aNode->count--;
-							if( aNode->count > 0 )
-							{
-								memmove( &aNode->children[theIndex], &aNode->children[theIndex+1], (aNode->count-theIndex)*sizeof(struct trieNode*) );
-							}
-							else
-							{
-								free( aNode->children );
-								theResult = YES;
-								aNode->children = NULL;
-							}
-						}
-						*aFoundNode = YES;
-					}
-				}
-				else if( removeObjectForKey( aNode->children[theIndex], aKey, anIndex+1, aFoundNode, aKeyComponentFunc ) )
-				{
-					if( aNode->children[theIndex]->object == nil )			// aNode->children[theIndex]
-					{
-						aNode->count--;
-						if( aNode->count > 0 )
-						{
-							memmove( &aNode->children[theIndex], &aNode->children[theIndex+1], (aNode->count-theIndex)*sizeof(struct trieNode*) );
-						}
-						else
-						{
-							free( aNode->children );
-							theResult = YES;
-							aNode->children = NULL;
-						}
+	__block BOOL		theResult = NO;
+	[self performRead:^{ theResult = [super containsObjectForKey:aString]; }];
+	return theResult;
+}
+
+- (BOOL)containsObjectForKeyWithPrefix:(NSString *)aString
+{
+	__block BOOL		theResult = NO;
+	[self performRead:^{ theResult = [super containsObjectForKeyWithPrefix:aString]; }];
+	return theResult;
+}
+
+/*
+	objects are retained before leaving the read, the writer may release the last copy of them as soon as it has
+ */
+- (id)objectForKey:(NSString *)aKey
+{
+	__block id		theResult = nil;
+	[self performRead:^{ theResult = [[super objectForKey:aKey] retain]; }];
+	return [theResult autorelease];
+}
+
+- (BOOL)containsObjectForCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength
+{
+	__block BOOL		theResult = NO;
+	[self performRead:^{ theResult = [super containsObjectForCharacters:aCharacters length:aLength]; }];
+	return theResult;
+}
+
+- (BOOL)containsObjectForKeyWithPrefixCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength
+{
+	__block BOOL		theResult = NO;
+	[self performRead:^{ theResult = [super containsObjectForKeyWithPrefixCharacters:aCharacters length:aLength]; }];
+	return theResult;
+}
+
+- (id)objectForCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength
+{
+	__block id		theResult = nil;
+	[self performRead:^{ theResult = [[super objectForCharacters:aCharacters length:aLength] retain]; }];
+	return [theResult autorelease];
+}
+
+- (BOOL)containsObjectForUTF8String:(const char *)aBytes length:(NSUInteger)aLength
+{
+	__block BOOL		theResult = NO;
+	[self performRead:^{ theResult = [super containsObjectForUTF8String:aBytes length:aLength]; }];
+	return theResult;
+}
+
+- (BOOL)containsObjectForKeyWithPrefixUTF8String:(const char *)aBytes length:(NSUInteger)aLength
+{
+	__block BOOL		theResult = NO;
+	[self performRead:^{ theResult = [super containsObjectForKeyWithPrefixUTF8String:aBytes length:aLength]; }];
+	return theResult;
+}
+
+- (id)objectForUTF8String:(const char *)aBytes length:(NSUInteger)aLength
+{
+	__block id		theResult = nil;
+	[self performRead:^{ theResult = [[super objectForUTF8String:aBytes length:aLength] retain]; }];
+	return [theResult autorelease];
+}
+
+- (NSArray *)objectsForKeys:(NSArray *)aKeys notFoundMarker:(id)aMarker
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super objectsForKeys:aKeys notFoundMarker:aMarker]; }];
+	return theResult;
+}
+
+- (NSIndexSet *)containsObjectsForKeys:(NSArray *)aKeys
+{
+	__block NSIndexSet		* theResult = nil;
+	[self performRead:^{ theResult = [super containsObjectsForKeys:aKeys]; }];
+	return theResult;
+}
+
+- (id)objectForKeyedSubscript:(id)aKey
+{
+	__block id		theResult = nil;
+	[self performRead:^{ theResult = [[super objectForKeyedSubscript:aKey] retain]; }];
+	return [theResult autorelease];
+}
+
+- (NSArray *)everyObject
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObject]; }];
+	return theResult;
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObjectForKeyWithPrefix:aPrefix]; }];
+	return theResult;
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix limit:(NSUInteger)aLimit resumeToken:(id *)aToken
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObjectForKeyWithPrefix:aPrefix limit:aLimit resumeToken:aToken]; }];
+	return theResult;
+}
+
+- (NSUInteger)countOfObjectsForKeyWithPrefix:(NSString *)aPrefix
+{
+	__block NSUInteger		theResult = 0;
+	[self performRead:^{ theResult = [super countOfObjectsForKeyWithPrefix:aPrefix]; }];
+	return theResult;
+}
+
+- (NSArray *)everyObjectForKey:(NSString *)aKey maxEditDistance:(NSUInteger)aDistance
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObjectForKey:aKey maxEditDistance:aDistance]; }];
+	return theResult;
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix maxEditDistance:(NSUInteger)aDistance
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObjectForKeyWithPrefix:aPrefix maxEditDistance:aDistance]; }];
+	return theResult;
+}
+
+- (NSArray *)topObjects:(NSUInteger)aCount forKeyWithPrefix:(NSString *)aPrefix
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super topObjects:aCount forKeyWithPrefix:aPrefix]; }];
+	return theResult;
+}
+
+- (double)weightForKey:(NSString *)aKey
+{
+	__block double		theResult = 0.0;
+	[self performRead:^{ theResult = [super weightForKey:aKey]; }];
+	return theResult;
+}
+
+- (void)getObjects:(id *)aBuffer count:(NSUInteger)aCount { [self performRead:^{ [super getObjects:aBuffer count:aCount]; }]; }
+
+/*
+	enumerators and fast enumeration can not stay inside a read between calls, so they walk a copy taken inside one,
+	the copy shares the nodes of the side being read and only takes a reference to each child of the root, the
+	writer then copies whichever of the shared nodes it changes
+ */
+- (NDTrie *)snapshot { return [[[NDTrie alloc] initWithCaseInsensitive:self.isCaseInsensitive trie:self] autorelease]; }
+- (NSEnumerator *)objectEnumerator { return [[self snapshot] objectEnumerator]; }
+- (NSEnumerator *)objectEnumeratorForKeyWithPrefix:(NSString *)aPrefix { return [[self snapshot] objectEnumeratorForKeyWithPrefix:aPrefix]; }
+
+- (BOOL)isEqualToTrie:(NDTrie *)anOtherTrie
+{
+	__block BOOL		theResult = NO;
+	[self performRead:^{ theResult = [super isEqualToTrie:anOtherTrie]; }];
+	return theResult;
+}
+
+- (void)enumerateObjectsUsingFunction:(BOOL (*)(NSString *))aFunc { [self performRead:^{ [super enumerateObjectsUsingFunction:aFunc]; }]; }
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix usingFunction:(BOOL (*)(id))aFunc { [self performRead:^{ [super enumerateObjectsForKeysWithPrefix:aPrefix usingFunction:aFunc]; }]; }
+- (void)enumerateObjectsUsingFunction:(BOOL (*)(id,void *))aFunc context:(void*)aContext { [self performRead:^{ [super enumerateObjectsUsingFunction:aFunc context:aContext]; }]; }
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix usingFunction:(BOOL (*)(id,void *))aFunc context:(void*)aContext { [self performRead:^{ [super enumerateObjectsForKeysWithPrefix:aPrefix usingFunction:aFunc context:aContext]; }]; }
+- (void)enumerateObjectsUsingBlock:(void (^)(id obj, BOOL *stop))aBlock { [self performRead:^{ [super enumerateObjectsUsingBlock:aBlock]; }]; }
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix usingBlock:(void (^)(id string, BOOL *stop))aBlock { [self performRead:^{ [super enumerateObjectsForKeysWithPrefix:aPrefix usingBlock:aBlock]; }]; }
+
+- (NSArray *)everyObjectPassingTest:(BOOL (^)(id, BOOL *))aPredicate
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObjectPassingTest:aPredicate]; }];
+	return theResult;
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString*)aPrefix passingTest:(BOOL (^)(id object, BOOL *stop))aPredicate
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObjectForKeyWithPrefix:aPrefix passingTest:aPredicate]; }];
+	return theResult;
+}
+
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix options:(NSEnumerationOptions)anOptions usingBlock:(void (^)(id object, BOOL *stop))aBlock
+{
+	[self performRead:^{ [super enumerateObjectsForKeysWithPrefix:aPrefix options:anOptions usingBlock:aBlock]; }];
+}
+
+- (void)enumerateMatchesInString:(NSString *)aString options:(NDTrieMatchOptions)anOptions usingBlock:(void (^)(NSRange range, id object, BOOL *stop))aBlock
+{
+	[self performRead:^{ [super enumerateMatchesInString:aString options:anOptions usingBlock:aBlock]; }];
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString*)aPrefix options:(NSEnumerationOptions)anOptions passingTest:(BOOL (^)(id object, BOOL *stop))aPredicate
+{
+	__block NSArray		* theResult = nil;
+	[self performRead:^{ theResult = [super everyObjectForKeyWithPrefix:aPrefix options:anOptions passingTest:aPredicate]; }];
+	return theResult;
+}
+
+- (BOOL)writeBinaryToURL:(NSURL *)aURL atomically:(BOOL)anAtomically
+{
+	__block NSData		* theData = nil;
+	[self performRead:^{
+		struct trieNode		* theRoot = self.rootNode;
+		theData = fileDataForNode( theRoot, theRoot->objectCount, (self.isCaseInsensitive ? kTrieFileCaseInsensitive : 0) | (self.isPathCompressed ? kTrieFilePathCompression : 0) );
+	}];
+	return theData != nil && [theData writeToURL:aURL atomically:anAtomically];
+}
+
+- (NDTrie *)compactedTrie
+{
+	__block NDTrie		* theResult = nil;
+	[self performRead:^{ theResult = [super compactedTrie]; }];
+	return theResult;
+}
+
+- (NSString *)debugDescription
+{
+	__block NSString		* theResult = nil;
+	[self performRead:^{ theResult = [super debugDescription]; }];
+	return theResult;
+}
+
+- (NSDictionary *)statistics
+{
+	__block NSDictionary	* theResult = nil;
+	[self performRead:^{ theResult = [super statistics]; }];
+	return theResult;
+}
+
+#ifdef NDFastEnumerationAvailable
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)aState objects:(id *)aStackbuf count:(NSUInteger)aLen
+{
+	NDTrieEnumerator	* theEnumerator;
+	if( aState->state == 0 )
+	{
+		theEnumerator = (NDTrieEnumerator*)[[self snapshot] objectEnumerator];
+		aState->extra[0] = (unsigned long)theEnumerator;
+		aState->mutationsPtr = &aState->extra[1];			// changes do not affect the copy
+		aState->state = 1;
+	}
+	else
+		theEnumerator = (NDTrieEnumerator*)aState->extra[0];
+
+	aState->itemsPtr = aStackbuf;
+	return [theEnumerator getObjects:aStackbuf count:aLen];
+}
+#endif
+
+- (void)setObject:(id)anObject forKey:(NSString *)aString { [self performWrite:^{ [super setObject:anObject forKey:aString]; }]; }
+- (void)setObject:(id)anObject forKey:(NSString *)aString weight:(double)aWeight { [self performWrite:^{ [super setObject:anObject forKey:aString weight:aWeight]; }]; }
+- (void)setObject:(id)anObject forKeyedSubscript:(NSString *)aString { [self performWrite:^{ [super setObject:anObject forKeyedSubscript:aString]; }]; }
+
+/*
+	a va_list can not be read twice so the arguments are collected first
+ */
+- (void)addStrings:(NSString *)aFirstString, ...
+{
+	va_list				theArgList;
+	NSString			* theString = aFirstString;
+	NSMutableArray		* theStrings = [NSMutableArray array];
+
+	va_start( theArgList, aFirstString );
+	do
+	{
+		if( ![theString isKindOfClass:[NSString class]] )
+		{
+			va_end( theArgList );
+			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theString class]] userInfo:nil];
+		}
+		[theStrings addObject:theString];
+	}
+	while( (theString = va_arg( theArgList, NSString * ) ) != nil );
+	va_end( theArgList );
+
+	[self performWrite:^{
+		for( NSString * theString in theStrings )
+			[super setObject:theString forKey:theString];
+	}];
+}
+
+- (void)setObjectsAndKeys:(id)aFirstObject, ...
+{
+	va_list				theArgList;
+	id					theObject = aFirstObject;
+	NSMutableArray		* theObjects = [NSMutableArray array],
+						* theKeys = [NSMutableArray array];
+
+	va_start( theArgList, aFirstObject );
+	do
+	{
+		NSString	* theKey = va_arg( theArgList, id );
+		if( theKey == nil || ![theKey isKindOfClass:[NSString class]] )
+		{
+			va_end( theArgList );
+			if( theKey == nil )
+				@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"missing key for object" userInfo:nil];
+			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [theKey class]] userInfo:nil];
+		}
+		[theObjects addObject:theObject];
+		[theKeys addObject:theKey];
+	}
+	while( (theObject = va_arg( theArgList, id ) ) != nil );
+	va_end( theArgList );
+
+	[self performWrite:^{
+		for( NSUInteger i = 0, c = [theKeys count]; i < c; i++ )
+			[super setObject:[theObjects objectAtIndex:i] forKey:[theKeys objectAtIndex:i]];
+	}];
+}
+
+- (void)setObjects:(id *)anObjects forKeys:(NSString **)aKeys count:(NSUInteger)aCount { [self performWrite:^{ [super setObjects:anObjects forKeys:aKeys count:aCount]; }]; }
+
+/*
+	The trie to merge is copied before the write so both sides merge the same keys, and the policy is only asked
+	about the first side, the second is given the same answers in the same order.
+ */
+- (void)mergeTrie:(NDTrie *)aTrie operation:(enum trieMergeOperation)anOperation policy:(id (^)(NSString *, id, id))aPolicy
+{
+	NDTrie				* theOther = [self trieToMerge:aTrie];
+	NSMutableArray		* theAnswers = [NSMutableArray array];
+	id					theNil = [[[NSObject alloc] init] autorelease];
+	__block NSUInteger	theAnswer = 0;
+	__block BOOL		theFirst = YES;
+	[self performWrite:^{
+		id (^thePolicy)(NSString *, id, id) = nil;
+		if( aPolicy != nil && theFirst )
+			thePolicy = ^id(NSString * aKey, id anObject, id anOtherObject) {
+				id		theResult = aPolicy( aKey, anObject, anOtherObject );
+				[theAnswers addObject:theResult != nil ? theResult : theNil];
+				return theResult;
+			};
+		else if( aPolicy != nil )
+			thePolicy = ^id(NSString * aKey, id anObject, id anOtherObject) {
+				id		theResult = [theAnswers objectAtIndex:theAnswer++];
+				return theResult != theNil ? theResult : nil;
+			};
+		theFirst = NO;
+		[super mergeTrie:theOther operation:anOperation policy:thePolicy];
+	}];
+}
+- (void)addArray:(NSArray *)anArray { [self performWrite:^{ [super addArray:anArray]; }]; }
+- (void)addDictionay:(NSDictionary *)aDictionary { [self performWrite:^{ [super addDictionay:aDictionary]; }]; }
+
+/*
+	the file is only read for the first copy, reading it again could give different lines if it has changed, the
+	second copy is made from the first instead
+ */
+- (BOOL)addContentsOfWordListURL:(NSURL *)aURL progress:(void (^)(unsigned long long,unsigned long long,BOOL*))aProgress
+{
+	__block BOOL				theResult = NO,
+								theFirst = YES;
+	[self performWrite:^{
+		if( theFirst )
+		{
+			theFirst = NO;
+			theResult = [super addContentsOfWordListURL:aURL progress:aProgress];
+		}
+		else
+			[self copyReadSide];
+	}];
+	return theResult;
+}
+
+- (void)removeObjectForKey:(NSString *)aString { [self performWrite:^{ [super removeObjectForKey:aString]; }]; }
+- (void)removeAllObjects { [self performWrite:^{ [super removeAllObjects]; }]; }
+- (void)removeAllObjectsForKeysWithPrefix:(NSString *)aPrefix { [self performWrite:^{ [super removeAllObjectsForKeysWithPrefix:aPrefix]; }]; }
+
+@end
+
+@implementation NDTrieEnumerator
+
++ (id)trieEnumeratorWithTrie:(NDTrie *)aTrie node:(struct trieNode*)aNode { return [[[self alloc] initWithTrie:aTrie node:aNode] autorelease]; }
+
+- (id)initWithTrie:(NDTrie *)aTrie node:(struct trieNode*)aNode
+{
+	if( (self = [self init]) != nil )
+	{
+		_trie = [aTrie retain];
+		_mutations = *aTrie.mutationsPtr;
+		initCursor( &_cursor, aNode );
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+#if NDTrieCollectCounters
+	_countEnumeration( _returned );
+#endif
+	freeCursor( &_cursor );
+	[_trie release];
+	[super dealloc];
+}
+
+- (id)nextObject
+{
+	struct trieNode		* theNode;
+	if( _mutations != *_trie.mutationsPtr )
+		@throw [NSException exceptionWithName:NSGenericException reason:[NSString stringWithFormat:@"Collection <%@: %p> was mutated while being enumerated.", [_trie class], _trie] userInfo:nil];
+	while( (theNode = cursorNextNode( &_cursor )) != NULL && theNode->object == nil )
+		;
+#if NDTrieCollectCounters
+	if( theNode != NULL )
+		_returned++;
+#endif
+	return theNode != NULL ? theNode->object : nil;
+}
+
+/*
+	fills objects with up to count more objects, returns the number put in objects, which is less than count only once
+	every object has been returned
+ */
+- (NSUInteger)getObjects:(id *)anObjects count:(NSUInteger)aCount
+{
+	NSUInteger			theIndex = 0;
+	struct trieNode		* theNode;
+	while( theIndex < aCount && (theNode = cursorNextNode( &_cursor )) != NULL )
+	{
+		if( theNode->object != nil )
+			anObjects[theIndex++] = theNode->object;
+	}
+#if NDTrieCollectCounters
+	_returned += theIndex;
+#endif
+	return theIndex;
+}
+
+- (NSArray *)allObjects
+{
+	NSMutableArray		* theResult = [NSMutableArray array];
+	id					theObject;
+	while( (theObject = [self nextObject]) != nil )
+		[theResult addObject:theObject];
+	return theResult;
+}
+
+@end
+
+@implementation NDTrieBuilder
+- (id)initWithTrie:(NDTrie *)aTrie
+{
+	if( (self = [super init]) != nil )
+	{
+		_caseInsensitive = aTrie.isCaseInsensitive;
+		_pathCompression = aTrie.isPathCompressed;
+		_rootNode = aTrie.rootNode;
+		_arena = aTrie.arena;
+	}
+	return self;
+}
+- (void)dealloc
+{
+	[_currentString release];
+    [super dealloc];
+}
+
+- (BOOL)parseContentsOfURL:(NSURL *)aURL
+{
+	NSXMLParser		* theParser = [[NSXMLParser alloc] initWithContentsOfURL:aURL];
+	BOOL			theResult = NO;
+	[theParser setDelegate:self];
+	[theParser setShouldProcessNamespaces:NO];
+	[theParser setShouldReportNamespacePrefixes:NO];
+	[theParser setShouldResolveExternalEntities:NO];
+	if( (theResult = [theParser parse])== NO )
+		NSLog( @"%@", [theParser parserError] );
+	return theResult;
+}
+
+- (NSUInteger)count { return _count; }
+
+#pragma mark NSXMLParserDelegate
+- (void)parser:(NSXMLParser *)aParser didStartElement:(NSString *)anElementName namespaceURI:(NSString *)aNamespaceURI qualifiedName:(NSString *)aQualifiedName attributes:(NSDictionary *)anAttributeDict
+{
+	if( _foundRootElement == NDTriePListElelemtNone )
+	{
+		if( [anElementName isEqualToString:kArrayPListElementName] )
+			_foundRootElement = NDTriePListElelemtArray;
+		else if( [anElementName isEqualToString:kArrayPListElementName] )
+			_foundRootElement = NDTriePListElelemtArray;
+	}
+	else if( [anElementName isEqualToString:kStringPListElementName] )
+		_currentString = [[NSMutableString alloc] init];
+	else
+		NSLog( @"Unexpected element %@", anElementName );
+}
+
+- (void)parser:(NSXMLParser *)aParser didEndElement:(NSString *)anElementName namespaceURI:(NSString *)aNamespaceURI qualifiedName:(NSString *)aQName
+{
+	if( _foundRootElement != NDTriePListElelemtNone )
+	{
+		if( [anElementName isEqualToString:kArrayPListElementName] )
+			_foundRootElement = NDTriePListElelemtNone;
+		else if( [anElementName isEqualToString:kStringPListElementName] )
+		{
+			_count += setObjectForKey( _rootNode, _currentString, [_currentString description], _caseInsensitive ? keyComponentCaseInsensitiveForString : keyComponentForString, _arena, _pathCompression, kTrieUnchangedWeight );
+			[_currentString release];
+			_currentString = nil;
+		}
+	}
+	else if( ![anElementName isEqualToString:kPListPListElementName] )
+		NSLog( @"Unexpected element %@", anElementName );
+}
+	
+- (void)parser:(NSXMLParser *)aParser foundCharacters:(NSString *)aString
+{
+	if( _currentString != nil )
+		[_currentString appendString:aString];
+}
+
+@end
+	
+@implementation NDStaticTrie
+
+/* the node for aKey, if anObject is not NULL it is given the object of the node, nil if there is none */
+static NSUInteger _viewLookup( NDStaticTrie * aTrie, const struct trieKey * aKey, BOOL aPrefix, id * anObject )
+{
+	NSUInteger		theResult = viewLookupNode( aTrie.view, aKey->characters, aKey->length, aPrefix, NULL );
+	if( anObject != NULL )
+		*anObject = viewObjectForNode( aTrie.view, theResult, aKey->characters, aKey->length );
+	return theResult;
+}
+
+static NSUInteger _viewFindNodeForString( NDStaticTrie * aTrie, NSString * aKey, BOOL aPrefix, id * anObject )
+{
+	struct trieKey		theKey;
+	NSUInteger			theResult;
+	if( aKey == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"objectForKey: key cannot be nil" userInfo:nil];
+	trieKeyWithString( &theKey, aKey, aTrie.isCaseInsensitive );
+	theResult = _viewLookup( aTrie, &theKey, aPrefix, anObject );
+	_trieKeyFree( &theKey );
+	return theResult;
+}
+
+static NSUInteger _viewFindNodeForCharacters( NDStaticTrie * aTrie, const unichar * aCharacters, NSUInteger aLength, BOOL aPrefix, id * anObject )
+{
+	struct trieKey		theKey;
+	NSUInteger			theResult;
+	trieKeyWithCharacters( &theKey, aCharacters, aLength, aTrie.isCaseInsensitive );
+	theResult = _viewLookup( aTrie, &theKey, aPrefix, anObject );
+	_trieKeyFree( &theKey );
+	return theResult;
+}
+
+static NSUInteger _viewFindNodeForUTF8String( NDStaticTrie * aTrie, const char * aBytes, NSUInteger aLength, BOOL aPrefix, id * anObject )
+{
+	struct trieKey		theKey;
+	NSUInteger			theResult = NSNotFound;
+	if( anObject != NULL )
+		*anObject = nil;
+	if( trieKeyWithUTF8String( &theKey, aBytes, aLength, aTrie.isCaseInsensitive ) )
+		theResult = _viewLookup( aTrie, &theKey, aPrefix, anObject );
+	_trieKeyFree( &theKey );
+	return theResult;
+}
+
+/*
+	the node for aPrefix, the root for no prefix, and NSNotFound if nothing has the prefix, aKey is given the key of
+	the node, which is longer than the prefix if it ends part way along a run, and has to be freed
+ */
+static NSUInteger _viewNodeForPrefix( NDStaticTrie * aTrie, NSString * aPrefix, struct trieKey * aKey )
+{
+	NSUInteger		theResult = 0,
+					theRemaining = 0;
+	trieKeyWithString( aKey, aPrefix != nil ? aPrefix : @"", aTrie.isCaseInsensitive );
+	if( aKey->length > 0 )
+		theResult = viewLookupNode( aTrie.view, aKey->characters, aKey->length, YES, &theRemaining );
+	if( theRemaining > 0 )
+	{
+		NSUInteger		theRunLength;
+		const unichar	* theRun = aTrie.view->layout->run( aTrie.view->data, theResult, &theRunLength );
+		_trieKeyAppend( aKey, theRun+theRunLength-theRemaining, theRemaining );
+	}
+	return theResult;
+}
+
+static BOOL _viewHasObject( NDStaticTrie * aTrie, NSUInteger aNode )
+{
+	return aNode != NSNotFound && aTrie.view->layout->hasObject( aTrie.view->data, aNode );
+}
+
+/* every object with the prefix aPrefix in key order, or heaviest first if aByWeight */
+static BOOL _viewForEveryObjectWithPrefix( NDStaticTrie * aTrie, NSString * aPrefix, BOOL(*aFunc)(id,void*), void * aContext, BOOL aByWeight )
+{
+	struct trieKey		thePrefix;
+	NSUInteger			theNode = _viewNodeForPrefix( aTrie, aPrefix, &thePrefix );
+	BOOL				theResult = YES;
+	@try
+	{
+		if( theNode != NSNotFound && aByWeight )
+			theResult = forEveryObjectInViewByWeight( aTrie.view, theNode, thePrefix.characters, thePrefix.length, aFunc, aContext );
+		else if( theNode != NSNotFound )
+			theResult = forEveryObjectInView( aTrie.view, theNode, thePrefix.characters, thePrefix.length, aFunc, aContext );
+	}
+	@finally
+	{
+		_trieKeyFree( &thePrefix );
+	}
+	return theResult;
+}
+
+- (BOOL)containsObjectForKey:(NSString *)aString { return _viewHasObject( self, _viewFindNodeForString( self, aString, NO, NULL ) ); }
+- (BOOL)containsObjectForKeyWithPrefix:(NSString *)aString { return _viewFindNodeForString( self, aString, YES, NULL ) != NSNotFound; }
+- (id)objectForKey:(NSString *)aKey { id theResult; _viewFindNodeForString( self, aKey, NO, &theResult ); return theResult; }
+- (id)objectForKeyedSubscript:(id)aKey { id theResult; _viewFindNodeForString( self, aKey, NO, &theResult ); return theResult; }
+
+- (BOOL)containsObjectForCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength { return _viewHasObject( self, _viewFindNodeForCharacters( self, aCharacters, aLength, NO, NULL ) ); }
+- (BOOL)containsObjectForKeyWithPrefixCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength { return _viewFindNodeForCharacters( self, aCharacters, aLength, YES, NULL ) != NSNotFound; }
+- (id)objectForCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength { id theResult; _viewFindNodeForCharacters( self, aCharacters, aLength, NO, &theResult ); return theResult; }
+
+- (BOOL)containsObjectForUTF8String:(const char *)aBytes length:(NSUInteger)aLength { return _viewHasObject( self, _viewFindNodeForUTF8String( self, aBytes, aLength, NO, NULL ) ); }
+- (BOOL)containsObjectForKeyWithPrefixUTF8String:(const char *)aBytes length:(NSUInteger)aLength { return _viewFindNodeForUTF8String( self, aBytes, aLength, YES, NULL ) != NSNotFound; }
+- (id)objectForUTF8String:(const char *)aBytes length:(NSUInteger)aLength { id theResult; _viewFindNodeForUTF8String( self, aBytes, aLength, NO, &theResult ); return theResult; }
+
+/* the nodes are only read, so there are no paths worth keeping between keys, each key is just looked up */
+- (NSArray *)objectsForKeys:(NSArray *)aKeys notFoundMarker:(id)aMarker
+{
+	NSUInteger			theCount = [aKeys count];
+	NSMutableArray		* theResult = [NSMutableArray arrayWithCapacity:theCount];
+	if( aMarker == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"objectsForKeys:notFoundMarker: marker cannot be nil" userInfo:nil];
+	for( NSUInteger i = 0; i < theCount; i++ )
+	{
+		id		theObject;
+		_viewFindNodeForString( self, [aKeys objectAtIndex:i], NO, &theObject );
+		[theResult addObject:theObject != nil ? theObject : aMarker];
+	}
+	return theResult;
+}
+
+- (NSIndexSet *)containsObjectsForKeys:(NSArray *)aKeys
+{
+	NSUInteger			theCount = [aKeys count];
+	NSMutableIndexSet	* theResult = [NSMutableIndexSet indexSet];
+	for( NSUInteger i = 0; i < theCount; i++ )
+	{
+		if( _viewHasObject( self, _viewFindNodeForString( self, [aKeys objectAtIndex:i], NO, NULL ) ) )
+			[theResult addIndex:i];
+	}
+	return theResult;
+}
+
+- (NSArray *)everyObject
+{
+	NSMutableArray		* theResult = [NSMutableArray arrayWithCapacity:[self count]];
+	forEveryObjectInView( self.view, 0, NULL, 0, _addToArrayFunc, theResult );
+	return theResult;
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix
+{
+	NSMutableArray		* theResult = [NSMutableArray array];
+	_viewForEveryObjectWithPrefix( self, aPrefix, _addToArrayFunc, theResult, NO );
+	return theResult;
+}
+
+/*
+	The same resume tokens as NDTrie, the cursor is moved on past the key in the token, and once the page is full it
+	is the key of the last object, which is kept before looking for another object to know if there is another page
+ */
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix limit:(NSUInteger)aLimit resumeToken:(id *)aToken
+{
+	NSMutableArray			* theResult = [NSMutableArray array];
+	NSData					* theResumeToken = aToken != NULL ? *aToken : nil,
+							* theNextToken = nil;
+	const struct trieView	* theView = self.view;
+	struct trieKey			thePrefix;
+	struct viewCursor		theCursor = { { NULL, NULL }, NULL, NULL, NULL, 0, 0, 0, 0, NULL, NO };
+	NSUInteger				theNode = NSNotFound;
+
+	if( theResumeToken != nil && ![theResumeToken isKindOfClass:[NSData class]] )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"everyObjectForKeyWithPrefix:limit:resumeToken: invalid resume token" userInfo:nil];
+	if( aLimit == 0 )
+		return theResult;
+
+	theNode = _viewNodeForPrefix( self, aPrefix, &thePrefix );
+	@try
+	{
+		if( theResumeToken != nil && ([theResumeToken length]/sizeof(unichar) < thePrefix.length || memcmp( [theResumeToken bytes], thePrefix.characters, thePrefix.length*sizeof(unichar) ) != 0) )
+			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"everyObjectForKeyWithPrefix:limit:resumeToken: resume token is for a different prefix" userInfo:nil];
+		initViewCursor( &theCursor, theView, theNode, thePrefix.characters, thePrefix.length );
+		if( theResumeToken != nil )
+			viewCursorSeekAfter( &theCursor, (const unichar*)[theResumeToken bytes], [theResumeToken length]/sizeof(unichar) );
+
+		while( theResult.count < aLimit && (theNode = viewCursorNextNode( &theCursor )) != NSNotFound )
+		{
+			if( theView->layout->hasObject( theView->data, theNode ) )
+				[theResult addObject:theView->layout->object( theView->data, theNode, theCursor.key, theCursor.length )];
+		}
+
+		/* only hand back a token if there really is another page */
+		if( aToken != NULL && theNode != NSNotFound )
+		{
+			theNextToken = [NSData dataWithBytes:theCursor.key length:theCursor.length*sizeof(unichar)];
+			while( (theNode = viewCursorNextNode( &theCursor )) != NSNotFound && !theView->layout->hasObject( theView->data, theNode ) )
+				;
+			if( theNode == NSNotFound )
+				theNextToken = nil;
+		}
+	}
+	@finally
+	{
+		freeViewCursor( &theCursor );
+		_trieKeyFree( &thePrefix );
+	}
+	if( aToken != NULL )
+		*aToken = theNextToken;
+	return theResult;
+}
+
+static NSArray * _viewObjectsNearString( NDStaticTrie * aTrie, NSString * aKey, NSUInteger aMaxDistance, BOOL aPrefix )
+{
+	struct trieKey		theKey;
+	NSArray				* theResult = nil;
+	if( aKey == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"maxEditDistance: key cannot be nil" userInfo:nil];
+	trieKeyWithString( &theKey, aKey, aTrie.isCaseInsensitive );
+	@try
+	{
+		theResult = everyObjectNearKeyInView( aTrie.view, theKey.characters, theKey.length, aMaxDistance, aPrefix );
+	}
+	@finally
+	{
+		_trieKeyFree( &theKey );
+	}
+	return theResult;
+}
+
+- (NSArray *)everyObjectForKey:(NSString *)aKey maxEditDistance:(NSUInteger)aDistance { return _viewObjectsNearString( self, aKey, aDistance, NO ); }
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString *)aPrefix maxEditDistance:(NSUInteger)aDistance { return _viewObjectsNearString( self, aPrefix, aDistance, YES ); }
+
+- (NSUInteger)countOfObjectsForKeyWithPrefix:(NSString *)aPrefix
+{
+	NSUInteger		theNode = aPrefix != nil && [aPrefix length] > 0 ? _viewFindNodeForString( self, aPrefix, YES, NULL ) : 0;
+	return theNode != NSNotFound ? self.view->layout->objectCount( self.view->data, theNode ) : 0;
+}
+
+- (NSArray *)topObjects:(NSUInteger)aCount forKeyWithPrefix:(NSString *)aPrefix
+{
+	struct topObjectsData	theData = { [NSMutableArray arrayWithCapacity:aCount < 256 ? aCount : 256], aCount };
+	if( aCount > 0 )
+		_viewForEveryObjectWithPrefix( self, aPrefix, _addToTopObjectsFunc, (void*)&theData, YES );
+	return theData.array;
+}
+
+- (double)weightForKey:(NSString *)aKey
+{
+	NSUInteger		theNode = _viewFindNodeForString( self, aKey, NO, NULL );
+	return _viewHasObject( self, theNode ) ? self.view->layout->weight( self.view->data, theNode ) : 0.0;
+}
+
+- (void)getObjects:(id *)aBuffer count:(NSUInteger)aCount
+{
+	struct getObjectsCountData		theData = {0, aCount, copy, aBuffer};
+	forEveryObjectInView( self.view, 0, NULL, 0, getObjectsFunc, (void*)&theData );
+}
+
+- (NSEnumerator *)objectEnumerator { return [[[NDStaticTrieEnumerator alloc] initWithTrie:self prefix:nil] autorelease]; }
+- (NSEnumerator *)objectEnumeratorForKeyWithPrefix:(NSString *)aPrefix { return [[[NDStaticTrieEnumerator alloc] initWithTrie:self prefix:aPrefix] autorelease]; }
+
+- (BOOL)isEqualToTrie:(NDTrie *)anOtherTrie
+{
+	const struct trieView	* theView = self.view;
+	struct viewCursor		theCursor;
+	BOOL					theResult = self.count == anOtherTrie.count;
+	initViewCursor( &theCursor, theView, 0, NULL, 0 );
+	@try
+	{
+		for( NSUInteger theNode = viewCursorNextNode( &theCursor ); theResult && theNode != NSNotFound; theNode = viewCursorNextNode( &theCursor ) )
+		{
+			if( theView->layout->hasObject( theView->data, theNode ) )
+			{
+				id		theObject = [anOtherTrie objectForCharacters:theCursor.key length:theCursor.length];
+				theResult = [theObject isEqual:theView->layout->object( theView->data, theNode, theCursor.key, theCursor.length )];
+			}
+		}
+	}
+	@finally
+	{
+		freeViewCursor( &theCursor );
+	}
+	return theResult;
+}
+
+- (void)enumerateObjectsUsingFunction:(BOOL (*)(NSString *))aFunc { forEveryObjectInView( self.view, 0, NULL, 0, (BOOL(*)(NSString*,void*))aFunc, NULL ); }
+- (void)enumerateObjectsUsingFunction:(BOOL (*)(id,void *))aFunc context:(void*)aContext { forEveryObjectInView( self.view, 0, NULL, 0, aFunc, aContext ); }
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix usingFunction:(BOOL (*)(id))aFunc { _viewForEveryObjectWithPrefix( self, aPrefix, (BOOL(*)(NSString*,void*))aFunc, NULL, NO ); }
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix usingFunction:(BOOL (*)(id,void *))aFunc context:(void*)aContext { _viewForEveryObjectWithPrefix( self, aPrefix, aFunc, aContext, NO ); }
+
+#ifdef NS_BLOCKS_AVAILABLE
+- (void)enumerateObjectsUsingBlock:(void (^)(id obj, BOOL *stop))aBlock { forEveryObjectInView( self.view, 0, NULL, 0, enumerateFunc, (void*)aBlock ); }
+- (void)enumerateObjectsForKeysWithPrefix:(NSString*)aPrefix usingBlock:(void (^)(id string, BOOL *stop))aBlock { _viewForEveryObjectWithPrefix( self, aPrefix, enumerateFunc, (void*)aBlock, NO ); }
+
+- (NSArray *)everyObjectPassingTest:(BOOL (^)(id, BOOL *))aPredicate
+{
+	struct testData		theData = { [NSMutableArray array], aPredicate };
+	forEveryObjectInView( self.view, 0, NULL, 0, testFunc, (void*)&theData );
+	return theData.array;
+}
+
+- (NSArray *)everyObjectForKeyWithPrefix:(NSString*)aPrefix passingTest:(BOOL (^)(id object, BOOL *stop))aPredicate
+{
+	struct testData		theData = { [NSMutableArray array], aPredicate };
+	_viewForEveryObjectWithPrefix( self, aPrefix, testFunc, (void*)&theData, NO );
+	return theData.array;
+}
+#endif
+
+/* the automaton is built from a copy of the trie in nodes that is thrown away once it is done */
+- (struct trieScanner *)scanner
+{
+	struct trieScanner		* theScanner = _scanner;
+	if( theScanner == NULL )
+	{
+		NDTrie		* theTrie = [[NDTrie alloc] initWithCaseInsensitive:self.isCaseInsensitive trie:self];
+		@try
+		{
+			theScanner = createScanner( theTrie.rootNode );
+		}
+		@finally
+		{
+			[theTrie release];
+		}
+		if( !__sync_bool_compare_and_swap( &_scanner, NULL, theScanner ) )
+		{
+			freeScanner( theScanner );
+			theScanner = _scanner;
+		}
+	}
+	return theScanner;
+}
+
+#ifdef NDFastEnumerationAvailable
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)aState objects:(id *)aStackbuf count:(NSUInteger)aLen
+{
+	NDStaticTrieEnumerator	* theEnumerator;
+	if( aState->state == 0 )
+	{
+		theEnumerator = (NDStaticTrieEnumerator*)[self objectEnumerator];
+		aState->extra[0] = (unsigned long)theEnumerator;
+		aState->mutationsPtr = self.mutationsPtr;
+		aState->state = 1;
+	}
+	else
+		theEnumerator = (NDStaticTrieEnumerator*)aState->extra[0];
+
+	aState->itemsPtr = aStackbuf;
+	return [theEnumerator getObjects:aStackbuf count:aLen];
+}
+#endif
+
+- (struct trieNode*)rootNode { return NULL; }
+- (const struct trieView *)view { return &_view; }
+
+@end
+
+@implementation NDStaticTrieEnumerator
+
+- (id)initWithTrie:(NDStaticTrie *)aTrie prefix:(NSString *)aPrefix
+{
+	if( (self = [self init]) != nil )
+	{
+		struct trieKey		thePrefix;
+		NSUInteger			theNode = _viewNodeForPrefix( aTrie, aPrefix, &thePrefix );
+		_trie = [aTrie retain];
+		@try
+		{
+			initViewCursor( &_cursor, aTrie.view, theNode, thePrefix.characters, thePrefix.length );
+		}
+		@finally
+		{
+			_trieKeyFree( &thePrefix );
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	freeViewCursor( &_cursor );
+	[_trie release];
+	[super dealloc];
+}
+
+- (id)nextObject
+{
+	id		theResult = nil;
+	[self getObjects:&theResult count:1];
+	return theResult;
+}
+
+- (NSUInteger)getObjects:(id *)anObjects count:(NSUInteger)aCount
+{
+	const struct trieView	* theView = _trie.view;
+	NSUInteger				theIndex = 0,
+							theNode;
+	while( theIndex < aCount && (theNode = viewCursorNextNode( &_cursor )) != NSNotFound )
+	{
+		if( theView->layout->hasObject( theView->data, theNode ) )
+			anObjects[theIndex++] = theView->layout->object( theView->data, theNode, _cursor.key, _cursor.length );
+	}
+	return theIndex;
+}
+
+- (NSArray *)allObjects
+{
+	NSMutableArray		* theResult = [NSMutableArray array];
+	id					theObject;
+	while( (theObject = [self nextObject]) != nil )
+		[theResult addObject:theObject];
+	return theResult;
+}
+
+@end
+
+@implementation NDMappedTrie
+
+- (id)initWithMappedData:(NSData *)aData
+{
+	struct trieMap		theMap;
+	BOOL				theValid = initMap( &theMap, aData );
+	NSUInteger			theFlags = theValid ? theMap.header->flags : 0;
+	if( (self = [super initWithoutNodesWithOptions:((theFlags & kTrieFileCaseInsensitive) ? NDTrieCaseInsensitive : 0) | ((theFlags & kTrieFilePathCompression) ? NDTriePathCompression : 0)]) != nil )
+	{
+		if( theValid )
+		{
+			_data = [aData retain];
+			_map = theMap;
+			_view.layout = &kTrieMapLayout;
+			_view.data = &_map;
+			_count = (NSUInteger)theMap.header->count;
+		}
+		else
+		{
+			[self release];
+			self = nil;
+		}
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	[_data release];
+	[super dealloc];
+}
+
+- (BOOL)writeBinaryToURL:(NSURL *)aURL atomically:(BOOL)anAtomically { return [_data writeToURL:aURL atomically:anAtomically]; }
+
+- (NSDictionary *)statistics { return viewStatistics( self.view, _map.header->nodeCount*sizeof(struct trieFileNode), [_data length] ); }
+
+/* the graph is built from a copy of the trie in nodes as well */
+- (NDTrie *)compactedTrie
+{
+	NDTrie		* theTrie = [[NDTrie alloc] initWithCaseInsensitive:self.isCaseInsensitive trie:self],
+				* theResult = nil;
+	@try
+	{
+		theResult = [theTrie compactedTrie];
+	}
+	@finally
+	{
+		[theTrie release];
+	}
+	return theResult;
+}
+
+- (NSString *)debugDescription { return [NSString stringWithFormat:@"<%@: %p> %u nodes mapped from %lu bytes", [self class], self, _map.header->nodeCount, (unsigned long)[_data length]]; }
+
+@end
+
+@implementation NDCompactTrie
+
+/* takes ownership of aGraph, which is freed if the trie can not be made */
+- (id)initWithGraph:(struct trieGraph *)aGraph options:(NDTrieOptions)anOptions
+{
+	if( (self = [super initWithoutNodesWithOptions:anOptions]) != nil )
+	{
+		_graph = aGraph;
+		_view.layout = &kTrieGraphLayout;
+		_view.data = aGraph;
+		_count = aGraph->nodes[0].objectCount;
+	}
+	else
+		freeGraph( aGraph );
+	return self;
+}
+
+- (void)dealloc
+{
+	freeGraph( _graph );
+	[super dealloc];
+}
+
+- (void)finalize
+{
+	freeGraph( _graph );
+	[super finalize];
+}
+
+/* the binary file has a node for every key so it is written from an ordinary copy of the trie */
+- (BOOL)writeBinaryToURL:(NSURL *)aURL atomically:(BOOL)anAtomically
+{
+	NDTrie		* theTrie = [[NDTrie alloc] initWithCaseInsensitive:self.isCaseInsensitive trie:self];
+	BOOL		theResult = NO;
+	@try
+	{
+		theResult = [theTrie writeBinaryToURL:aURL atomically:anAtomically];
+	}
+	@finally
+	{
+		[theTrie release];
+	}
+	return theResult;
+}
+
+/* every node is counted once however many paths reach it, and a node with an object can be the end of many keys */
+- (NSDictionary *)statistics
+{
+	NSUInteger		theNodeBytes = _graph->nodeCount*(sizeof(struct trieGraphNode) + (_graph->weights != NULL ? 2*sizeof(double) : 0));
+	return viewStatistics( self.view, theNodeBytes, sizeof(struct trieGraph) + theNodeBytes + _graph->edgeCount*kTrieGraphLayout.childSlotSize + kTrieFileKeyPadding*sizeof(unichar) + _graph->objectCount*sizeof(id) );
+}
+
+- (NDTrie *)compactedTrie { return [[self retain] autorelease]; }
+
+- (NSString *)debugDescription { return [NSString stringWithFormat:@"<%@: %p> %lu keys in %lu nodes and %lu edges", [self class], self, (unsigned long)_count, (unsigned long)_graph->nodeCount, (unsigned long)_graph->edgeCount]; }
+
+@end
+
+@implementation NDTrieCompletionSession
+
++ (id)completionSessionWithTrie:(NDTrie *)aTrie { return [[[self alloc] initWithTrie:aTrie] autorelease]; }
+
+- (id)initWithTrie:(NDTrie *)aTrie { return [self initWithTrie:aTrie cacheLimit:8]; }
+
+- (id)initWithTrie:(NDTrie *)aTrie cacheLimit:(NSUInteger)aCacheLimit
+{
+	if( aTrie == nil )
+	{
+		[self release];
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"initWithTrie:cacheLimit: trie cannot be nil" userInfo:nil];
+	}
+	if( (self = [super init]) != nil )
+	{
+		_trie = [aTrie retain];
+		_walksNodes = aTrie.rootNode != NULL && ![aTrie isKindOfClass:[NDConcurrentMutableTrie class]];
+		_cacheLimit = _walksNodes ? aCacheLimit : 0;
+		_capacity = 16;
+		if( (_characters = (unichar*)malloc( _capacity*sizeof(unichar) )) == NULL
+			|| (_steps = (struct trieCompletionStep*)malloc( (_capacity+1)*sizeof(struct trieCompletionStep) )) == NULL
+			|| (_cacheLimit > 0 && (_cacheNodes = (struct trieNode**)malloc( _cacheLimit*sizeof(struct trieNode*) )) == NULL) )
+		{
+			[self release];
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for completion session" userInfo:nil];
+		}
+		_cache = [[NSMutableArray alloc] init];
+		if( _walksNodes )
+			[self findPlace];
+	}
+	return self;
+}
+
+- (void)dealloc
+{
+	free( _characters );
+	free( _steps );
+	free( _cacheNodes );
+	[_cache release];
+	[_trie release];
+	[super dealloc];
+}
+
+- (NDTrie *)trie { return _trie; }
+- (NSString *)prefix { return [NSString stringWithCharacters:_characters length:_length]; }
+
+/*
+	steps down the trie for every character of the prefix past _depth, a character without a match stops it there
+	and is tried again each time a character is added, which is one failed step each time
+ */
+- (void)advance
+{
+	BOOL		theCaseInsensitive = _trie.isCaseInsensitive;
+	while( _depth < _length )
+	{
+		struct trieCompletionStep	theStep = _steps[_depth];
+		unichar						theCharacter = _characters[_depth];
+		if( theCaseInsensitive )
+			_trieKeyFoldCase( &theCharacter, 1 );
+		if( (theStep.node = stepNode( theStep.node, &theStep.runIndex, theCharacter )) == NULL )
+			break;
+		_steps[++_depth] = theStep;
+	}
+}
+
+/* the nodes the session has are only good until the trie changes, after that the whole prefix is walked again */
+- (void)findPlace
+{
+	_mutations = *_trie.mutationsPtr;
+	[_cache removeAllObjects];
+	_steps[0].node = _trie.rootNode;
+	_steps[0].runIndex = 0;
+	_depth = 0;
+	[self advance];
+}
+
+/* the node every key with the prefix is below, NULL if there is none */
+- (struct trieNode *)node
+{
+	if( _mutations != *_trie.mutationsPtr )
+		[self findPlace];
+	return _depth == _length ? _steps[_depth].node : NULL;
+}
+
+- (void)appendString:(NSString *)aString
+{
+	struct trieKey		theKey;
+	if( aString == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"appendString: string cannot be nil" userInfo:nil];
+	trieKeyWithString( &theKey, aString, NO );
+	@try
+	{
+		[self appendCharacters:theKey.characters length:theKey.length];
+	}
+	@finally
+	{
+		_trieKeyFree( &theKey );
+	}
+}
+
+- (void)appendCharacters:(const unichar *)aCharacters length:(NSUInteger)aLength
+{
+	if( _length + aLength > _capacity )
+	{
+		NSUInteger		theCapacity = _capacity;
+		while( theCapacity < _length + aLength )
+			theCapacity <<= 1;
+		if( (_characters = (unichar*)reallocf( _characters, theCapacity*sizeof(unichar) )) == NULL
+			|| (_steps = (struct trieCompletionStep*)reallocf( _steps, (theCapacity+1)*sizeof(struct trieCompletionStep) )) == NULL )
+		{
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for completion session" userInfo:nil];
+		}
+		_capacity = theCapacity;
+	}
+	memcpy( _characters+_length, aCharacters, aLength*sizeof(unichar) );
+	_length += aLength;
+	if( _walksNodes && _mutations != *_trie.mutationsPtr )
+		[self findPlace];
+	else if( _walksNodes )
+		[self advance];
+}
+
+- (void)deleteBackward
+{
+	if( _length > 0 )
+	{
+		_length--;
+		if( _depth > _length )
+			_depth = _length;
+	}
+}
+
+- (void)reset { _length = _depth = 0; }
+
+- (NSUInteger)count
+{
+	struct trieNode		* theNode = NULL;
+	if( !_walksNodes )
+		return [_trie countOfObjectsForKeyWithPrefix:self.prefix];
+	theNode = [self node];
+	return theNode != NULL ? theNode->objectCount : 0;
+}
+
+- (id)object
+{
+	struct trieNode		* theNode = NULL;
+	if( !_walksNodes )
+		return [_trie objectForKey:self.prefix];
+	theNode = [self node];
+	return _length > 0 && theNode != NULL && _steps[_depth].runIndex == theNode->runLength ? theNode->object : nil;
+}
+
+/* keeps anObjects as the most recent, forgetting the least recent if there are already _cacheLimit */
+- (void)cacheObjects:(NSArray *)anObjects forNode:(struct trieNode *)aNode
+{
+	if( _cacheLimit == 0 )
+		return;
+	if( _cache.count == _cacheLimit )
+	{
+		[_cache removeObjectAtIndex:0];
+		memmove( _cacheNodes, _cacheNodes+1, (_cacheLimit-1)*sizeof(struct trieNode*) );
+	}
+	_cacheNodes[_cache.count] = aNode;
+	[_cache addObject:anObjects];
+}
+
+- (NSUInteger)cacheIndexForNode:(struct trieNode *)aNode
+{
+	for( NSUInteger i = 0, c = _cache.count; i < c; i++ )
+	{
+		if( _cacheNodes[i] == aNode )
+			return i;
+	}
+	return NSNotFound;
+}
+
+/*
+	Objects are returned in key order, so the objects below a node are one run of the objects below any node above it,
+	which starts after the objects of every child before the one the prefix goes through at each node in between. The
+	objects kept for the nearest node back up the prefix are cut down that way instead of walking the trie again.
+ */
+- (NSArray *)everyObject
+{
+	NSArray				* theResult = nil;
+	struct trieNode		* theNode = NULL;
+	NSUInteger			theStep = 0,
+						theCached = NSNotFound;
+	if( !_walksNodes )
+		return [_trie everyObjectForKeyWithPrefix:self.prefix];
+	if( (theNode = [self node]) == NULL )
+		return [NSArray array];
+
+	for( theStep = _depth+1; theCached == NSNotFound && theStep-- > 0; )
+	{
+		if( theStep == _depth || _steps[theStep].node != _steps[theStep+1].node )
+			theCached = [self cacheIndexForNode:_steps[theStep].node];
+	}
+
+	if( theCached == NSNotFound )
+	{
+		NSMutableArray		* theObjects = [NSMutableArray arrayWithCapacity:theNode->objectCount];
+		forEveryObjectFromNode( theNode, _addToArrayFunc, theObjects );
+		_countEnumeration( theObjects.count );
+		theResult = theObjects;
+	}
+	else if( _steps[theStep].node == theNode )
+	{
+		theResult = [[[_cache objectAtIndex:theCached] retain] autorelease];
+		[_cache removeObjectAtIndex:theCached];
+		memmove( _cacheNodes+theCached, _cacheNodes+theCached+1, (_cache.count-theCached)*sizeof(struct trieNode*) );
+	}
+	else
+	{
+		NSUInteger			theOffset = 0;
+		for( NSUInteger i = theStep; i < _depth; i++ )
+		{
+			if( _steps[i+1].node != _steps[i].node )
+				theOffset += objectsBeforeChild( _steps[i].node, _steps[i+1].node );
+		}
+		theResult = [[_cache objectAtIndex:theCached] subarrayWithRange:NSMakeRange( theOffset, theNode->objectCount )];
+	}
+	[self cacheObjects:theResult forNode:theNode];
+	return theResult;
+}
+
+- (NSArray *)topObjects:(NSUInteger)aCount
+{
+	struct topObjectsData	theData = { [NSMutableArray arrayWithCapacity:aCount < 256 ? aCount : 256], aCount };
+	struct trieNode			* theNode = NULL;
+	if( !_walksNodes )
+		return [_trie topObjects:aCount forKeyWithPrefix:self.prefix];
+	theNode = [self node];
+	if( theNode != NULL && aCount > 0 )
+		forEveryObjectByWeightFromNode( theNode, _addToTopObjectsFunc, (void*)&theData );
+	return theData.array;
+}
+
+- (NSEnumerator *)objectEnumerator
+{
+	if( !_walksNodes )
+		return [_trie objectEnumeratorForKeyWithPrefix:self.prefix];
+	return [NDTrieEnumerator trieEnumeratorWithTrie:_trie node:[self node]];
+}
+
+@end
+
+struct trieArena * createArena( void )
+{
+	struct trieArena	* theArena = (struct trieArena *)calloc( 1, sizeof(struct trieArena) );
+	if( theArena != NULL )
+		theArena->useCount = 1;
+	return theArena;
+}
+
+/*
+	frees every block of memory in one go, anything still allocated out of the arena is gone after this
+ */
+static void _arenaReset( struct trieArena * anArena )
+{
+	struct trieArenaBlock		* theBlock = anArena->blocks;
+	while( theBlock != NULL )
+	{
+		struct trieArenaBlock	* theNext = theBlock->next;
+		free( theBlock );
+		theBlock = theNext;
+	}
+	anArena->blocks = NULL;
+	memset( anArena->freeList, 0, sizeof(anArena->freeList) );
+	anArena->blockCount = 0;
+}
+
+void destroyArena( struct trieArena * anArena )
+{
+	if( anArena != NULL )
+	{
+		_arenaReset( anArena );
+		free( anArena );
+	}
+}
+
+struct trieArena * retainArena( struct trieArena * anArena )
+{
+	__sync_fetch_and_add( &anArena->useCount, 1 );
+	return anArena;
+}
+
+/*
+	the last trie using the arena destroys it, the other tries have already given back their nodes
+ */
+void releaseArena( struct trieArena * anArena )
+{
+	if( anArena != NULL && __sync_sub_and_fetch( &anArena->useCount, 1 ) == 0 )
+		destroyArena( anArena );
+}
+
+/*
+	the acquire makes sure the memory given back by a trie that has just stopped sharing the arena is seen
+ */
+static inline BOOL _arenaIsShared( struct trieArena * anArena )
+{
+	return __atomic_load_n( &anArena->useCount, __ATOMIC_ACQUIRE ) > 1;
+}
+
+static inline void _arenaLock( struct trieArena * anArena )
+{
+	while( __sync_lock_test_and_set( &anArena->lock, 1 ) )
+		sched_yield();
+}
+
+static inline void _arenaUnlock( struct trieArena * anArena )
+{
+	__sync_lock_release( &anArena->lock );
+}
+
+#if NDTrieUseDispatch
+/*
+	moves every block and free list entry of anOther in to anArena and frees anOther, used to take over the nodes built
+	on another thread, the current block of anArena stays current
+ */
+static void _arenaAdopt( struct trieArena * anArena, struct trieArena * anOther )
+{
+	BOOL		theShared = _arenaIsShared( anArena );
+	if( theShared )
+		_arenaLock( anArena );
+	if( anOther->blocks != NULL )
+	{
+		struct trieArenaBlock	* theLast = anOther->blocks;
+		while( theLast->next != NULL )
+			theLast = theLast->next;
+		if( anArena->blocks != NULL )
+		{
+			theLast->next = anArena->blocks->next;
+			anArena->blocks->next = anOther->blocks;
+		}
+		else
+			anArena->blocks = anOther->blocks;
+		anArena->blockCount += anOther->blockCount;
+	}
+	for( NSUInteger i = 0; i < kTrieArenaSizeClassCount; i++ )
+	{
+		while( anOther->freeList[i] != NULL )
+		{
+			void	* theFree = anOther->freeList[i];
+			anOther->freeList[i] = *(void**)theFree;
+			*(void**)theFree = anArena->freeList[i];
+			anArena->freeList[i] = theFree;
+		}
+	}
+	if( theShared )
+		_arenaUnlock( anArena );
+	free( anOther );
+}
+#endif
+
+/*
+	Small sizes are rounded up to a multiple of kTrieArenaGranularity and each has it own free list, larger sizes,
+	which are only ever child arrays, are rounded up to a power of two.
+ */
+static NSUInteger _arenaSizeClass( NSUInteger * aSize )
+{
+	NSUInteger		theClass = 0;
+	if( *aSize <= kTrieArenaSmallLimit )
+	{
+		theClass = (*aSize + kTrieArenaGranularity - 1) / kTrieArenaGranularity;
+		*aSize = theClass * kTrieArenaGranularity;
+	}
+	else
+	{
+		NSUInteger	theSize = kTrieArenaSmallLimit;
+		theClass = kTrieArenaSmallLimit / kTrieArenaGranularity;
+		while( theSize < *aSize )
+		{
+			theSize <<= 1;
+			theClass++;
+		}
+		*aSize = theSize;
+	}
+	NSCParameterAssert( theClass < kTrieArenaSizeClassCount );
+	return theClass;
+}
+
+static struct trieArenaBlock * _arenaAddBlock( struct trieArena * anArena, NSUInteger aSize )
+{
+	NSUInteger				theSize = aSize > kTrieArenaBlockSize/4 ? aSize : kTrieArenaBlockSize;
+	struct trieArenaBlock	* theBlock = malloc( kTrieArenaBlockHeaderSize + theSize );
+	if( theBlock == NULL )
+		return NULL;
+	theBlock->used = 0;
+	theBlock->size = theSize;
+	/*
+		large allocations get a block to themselves, put it behind the current block so we can keep using what is left of it
+	 */
+	if( theSize != kTrieArenaBlockSize && anArena->blocks != NULL )
+	{
+		theBlock->next = anArena->blocks->next;
+		anArena->blocks->next = theBlock;
+	}
+	else
+	{
+		theBlock->next = anArena->blocks;
+		anArena->blocks = theBlock;
+	}
+	anArena->blockCount++;
+	return theBlock;
+}
+
+static void * _arenaAlloc( struct trieArena * anArena, NSUInteger aSize )
+{
+#if NDTrieUseNodeArena
+	void			* theResult = NULL;
+	NSUInteger		theClass = _arenaSizeClass( &aSize );
+	BOOL			theShared = _arenaIsShared( anArena );
+	if( theShared )
+		_arenaLock( anArena );
+	if( anArena->freeList[theClass] != NULL )
+	{
+		theResult = anArena->freeList[theClass];
+		anArena->freeList[theClass] = *(void**)theResult;
+	}
+	else
+	{
+		struct trieArenaBlock	* theBlock = anArena->blocks;
+		if( theBlock == NULL || theBlock->used + aSize > theBlock->size )
+			theBlock = _arenaAddBlock( anArena, aSize );
+		if( theBlock != NULL )
+		{
+			theResult = (char*)theBlock + kTrieArenaBlockHeaderSize + theBlock->used;
+			theBlock->used += aSize;
+		}
+	}
+	if( theShared )
+		_arenaUnlock( anArena );
+	if( theResult == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for NDTrie nodes" userInfo:nil];
+	return theResult;
+#else
+	void			* theResult = malloc( aSize );
+	if( theResult == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for NDTrie nodes" userInfo:nil];
+	return theResult;
+#endif
+}
+
+/*
+	aSize has to be the same size that was passed to _arenaAlloc
+ */
+static void _arenaFree( struct trieArena * anArena, void * aPtr, NSUInteger aSize )
+{
+#if NDTrieUseNodeArena
+	NSUInteger		theClass = _arenaSizeClass( &aSize );
+	BOOL			theShared = _arenaIsShared( anArena );
+	if( theShared )
+		_arenaLock( anArena );
+	*(void**)aPtr = anArena->freeList[theClass];
+	anArena->freeList[theClass] = aPtr;
+	if( theShared )
+		_arenaUnlock( anArena );
+#else
+	free( aPtr );
+#endif
+}
+
+static void * _arenaRealloc( struct trieArena * anArena, void * aPtr, NSUInteger anOldSize, NSUInteger aNewSize )
+{
+	void		* theResult = _arenaAlloc( anArena, aNewSize );
+	memcpy( theResult, aPtr, anOldSize < aNewSize ? anOldSize : aNewSize );
+	_arenaFree( anArena, aPtr, anOldSize );
+	return theResult;
+}
+
+/* the memory held by the blocks of anArena, whether it is in use or on a free list */
+NSUInteger _arenaBytes( struct trieArena * anArena )
+{
+	NSUInteger		theResult = 0;
+	BOOL			theShared = _arenaIsShared( anArena );
+	if( theShared )
+		_arenaLock( anArena );
+	for( struct trieArenaBlock * theBlock = anArena->blocks; theBlock != NULL; theBlock = theBlock->next )
+		theResult += kTrieArenaBlockHeaderSize + theBlock->size;
+	if( theShared )
+		_arenaUnlock( anArena );
+	return theResult;
+}
+
+static struct trieNode * _createNode( NSUInteger aKey, struct trieArena * anArena )
+{
+	struct trieNode		* theNode = _arenaAlloc( anArena, sizeof(struct trieNode) );
+	theNode->key = aKey;
+	theNode->children = NULL;
+	theNode->childKeys = NULL;
+	theNode->directIndex = NULL;
+	theNode->refCount = 1;
+	theNode->object = nil;
+	theNode->count = 0;
+	theNode->size = 0;
+	theNode->runLength = 0;
+	theNode->run = NULL;
+	theNode->weight = 0.0;
+	theNode->maxWeight = -HUGE_VAL;
+	theNode->objectCount = 0;
+	return theNode;
+}
+
+/*
+	replaces the run of aNode with a copy of aLength units from aRun, aRun can point into the current run
+ */
+static void _setNodeRun( struct trieNode * aNode, const unichar * aRun, NSUInteger aLength, struct trieArena * anArena )
+{
+	unichar		* theRun = NULL;
+	if( aLength > 0 )
+	{
+		theRun = (unichar*)_arenaAlloc( anArena, aLength*sizeof(unichar) );
+		memcpy( theRun, aRun, aLength*sizeof(unichar) );
+	}
+	if( aNode->run != NULL )
+		_arenaFree( anArena, aNode->run, aNode->runLength*sizeof(unichar) );
+	aNode->run = theRun;
+	aNode->runLength = aLength;
+}
+
+/*
+	gives the child array of aNode room for aSize children, keeping the children it already has, aSize of 0 gives the
+	memory back
+ */
+static void _setChildCapacity( struct trieNode * aNode, NSUInteger aSize, struct trieArena * anArena )
+{
+	NSCParameterAssert( aSize >= aNode->count );
+	unichar				* theKeys = NULL;
+	struct trieNode		** theChildren = NULL;
+	if( aSize > 0 )
+	{
+		theKeys = (unichar*)_arenaAlloc( anArena, kTrieChildBlockSize(aSize) );
+		theChildren = (struct trieNode**)((char*)theKeys + kTrieChildKeysSize(aSize));
+		if( aNode->count > 0 )
+		{
+			memcpy( theKeys, aNode->childKeys, aNode->count*sizeof(unichar) );
+			memcpy( theChildren, aNode->children, aNode->count*sizeof(struct trieNode*) );
+			_countChildArrayResize();
+		}
+	}
+	if( aNode->childKeys != NULL )
+		_arenaFree( anArena, aNode->childKeys, kTrieChildBlockSize(aNode->size) );
+	aNode->childKeys = theKeys;
+	aNode->children = theChildren;
+	aNode->size = aSize;
+}
+
+static void _freeChildren( struct trieNode * aNode, struct trieArena * anArena )
+{
+	aNode->count = 0;
+	_setChildCapacity( aNode, 0, anArena );
+	if( aNode->directIndex != NULL )
+		_arenaFree( anArena, aNode->directIndex, kTrieNodeDirectIndexCount*sizeof(uint16_t) );
+	aNode->directIndex = NULL;
+}
+
+/*
+	called after the children of aNode have changed, moves aNode between using and not using a direct index, the gap
+	between kTrieNodeSparseLimit and kTrieNodeDenseLimit stops a node from flipping back and forth, a node in the gap
+	that already has an index keeps it, and it is filled in again as the children may have moved
+ */
+static void _updateDirectIndex( struct trieNode * aNode, struct trieArena * anArena )
+{
+	if( aNode->count > kTrieNodeDenseLimit || (aNode->directIndex != NULL && aNode->count >= kTrieNodeSparseLimit) )
+	{
+		if( aNode->directIndex == NULL )
+			aNode->directIndex = (uint16_t*)_arenaAlloc( anArena, kTrieNodeDirectIndexCount*sizeof(uint16_t) );
+		memset( aNode->directIndex, 0, kTrieNodeDirectIndexCount*sizeof(uint16_t) );
+		for( NSUInteger i = 0; i < aNode->count && aNode->childKeys[i] < kTrieNodeDirectIndexCount; i++ )
+			aNode->directIndex[aNode->childKeys[i]] = (uint16_t)(i+1);
+	}
+	else if( aNode->directIndex != NULL )
+	{
+		_arenaFree( anArena, aNode->directIndex, kTrieNodeDirectIndexCount*sizeof(uint16_t) );
+		aNode->directIndex = NULL;
+	}
+}
+
+static void _freeNode( struct trieNode * aNode, struct trieArena * anArena )
+{
+	if( aNode->childKeys != NULL || aNode->directIndex != NULL )
+		_freeChildren( aNode, anArena );
+	if( aNode->run != NULL )
+		_arenaFree( anArena, aNode->run, aNode->runLength*sizeof(unichar) );
+	_arenaFree( anArena, aNode, sizeof(struct trieNode) );
+}
+
+/*
+	gives up one reference to aNode, the last reference frees it along with its object and its references to its
+	children, a refCount of 1 can not be changed by anyone else so it does not need an atomic decrement
+ */
+static void _releaseNode( struct trieNode * aNode, struct trieArena * anArena )
+{
+	if( aNode->refCount == 1 || __sync_sub_and_fetch( &aNode->refCount, 1 ) == 0 )
+	{
+		for( NSUInteger i = 0; i < aNode->count; i++ )
+			_releaseNode( aNode->children[i], anArena );
+		[aNode->object release];
+		_freeNode( aNode, anArena );
+	}
+}
+
+void removeAllChildren( struct trieNode * aNode, struct trieArena * anArena )
+{
+	if( aNode->children )
+	{
+		for( NSUInteger i = 0; i < aNode->count; i++ )
+			_releaseNode( aNode->children[i], anArena );
+		_freeChildren( aNode, anArena );
+	}
+}
+
+static void _releaseAllObjects( struct trieNode * aNode )
+{
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+	{
+		_releaseAllObjects( aNode->children[i] );
+		[aNode->children[i]->object release];
+	}
+}
+
+/*
+	Like removeAllChildren but for when every node in the arena is being thrown away, only the objects are
+	visited, the memory goes back in one go. That can only be done if no other trie is sharing the arena.
+ */
+void destroyAllChildren( struct trieNode * aNode, struct trieArena * anArena )
+{
+#if NDTrieUseNodeArena
+	if( !_arenaIsShared( anArena ) )
+	{
+		_releaseAllObjects( aNode );
+		_arenaReset( anArena );
+		aNode->children = NULL;
+		aNode->childKeys = NULL;
+		aNode->directIndex = NULL;
+		aNode->count = 0;
+		aNode->size = 0;
+	}
+	else
+#endif
+		removeAllChildren( aNode, anArena );
+	aNode->maxWeight = -HUGE_VAL;
+	aNode->objectCount = 0;
+}
+
+/*
+	returns how many of the first aCount keys of aKeys are less than aKey, aCount must be no more than
+	kTrieNodeSmallLimit, the keys are compared 8 at a time, unichar is unsigned but SSE2 only has a signed
+	compare so both sides are flipped by 0x8000 first.
+ */
+inline static NSUInteger _lowerBoundSmall( const unichar * aKeys, NSUInteger aCount, NSUInteger aKey )
+{
+	NSCParameterAssert( aCount <= kTrieNodeSmallLimit );
+#if defined(__SSE2__)
+	__m128i			theBias = _mm_set1_epi16( (short)0x8000 ),
+					theKey = _mm_xor_si128( _mm_set1_epi16( (short)aKey ), theBias );
+	unsigned int	theMask = (unsigned int)_mm_movemask_epi8( _mm_cmplt_epi16( _mm_xor_si128( _mm_loadu_si128( (const __m128i*)aKeys ), theBias ), theKey ) );
+	if( aCount > 8 )
+		theMask |= (unsigned int)_mm_movemask_epi8( _mm_cmplt_epi16( _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(aKeys+8) ), theBias ), theKey ) ) << 16;
+	if( aCount < kTrieNodeSmallLimit )
+		theMask &= (1u << (aCount*2)) - 1;
+	return (NSUInteger)__builtin_popcount( theMask ) >> 1;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint16_t	kLanes[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	uint16x8_t		theKey = vdupq_n_u16( (uint16_t)aKey ),
+					theLanes = vld1q_u16( kLanes ),
+					theLess = vandq_u16( vcltq_u16( vld1q_u16( aKeys ), theKey ), vcltq_u16( theLanes, vdupq_n_u16( (uint16_t)aCount ) ) );
+	NSUInteger		theResult = vaddvq_u16( vshrq_n_u16( theLess, 15 ) );
+	if( aCount > 8 )
+	{
+		theLess = vandq_u16( vcltq_u16( vld1q_u16( aKeys+8 ), theKey ), vcltq_u16( theLanes, vdupq_n_u16( (uint16_t)(aCount-8) ) ) );
+		theResult += vaddvq_u16( vshrq_n_u16( theLess, 15 ) );
+	}
+	return theResult;
+#else
+	NSUInteger		theResult = 0;
+	while( theResult < aCount && aKeys[theResult] < aKey )
+		theResult++;
+	return theResult;
+#endif
+}
+
+/* lower bound of aKey in the sorted keys, these are either the childKeys of a node or the keys of a mapped file */
+inline static NSUInteger _lowerBoundKeys( const unichar * aKeys, NSUInteger aCount, NSUInteger aKey )
+{
+	NSUInteger		theIndex = 0;
+	if( aCount <= kTrieNodeSmallLimit )
+	{
+		if( aCount > 0 )
+			theIndex = _lowerBoundSmall( aKeys, aCount, aKey );
+	}
+	else
+	{
+		NSUInteger		u = aCount;
+		while( theIndex < u )
+		{
+			NSUInteger		m = (u+theIndex) >> 1;
+			if( aKeys[m] < aKey )
+				theIndex = m+1;
+			else
+				u = m;
+		}
+	}
+	return theIndex;
+}
+
+/*
+	Find the position of the child for key or location to insert it
+ */
+inline static NSUInteger _indexForChild( struct trieNode * aNode, NSUInteger aKey )
+{
+#if NDTrieUseInlineChildKeys
+	return _lowerBoundKeys( aNode->childKeys, aNode->count, aKey );
+#else
+	NSUInteger		theIndex = NSNotFound;
+	if( aNode->count > 0 )
+	{
+		NSUInteger		l = 0,
+						u = aNode->count,
+						m;
+
+		while( l < u-1 && theIndex == NSNotFound )
+		{
+			m = (u+l) >> 1;
+			if( aNode->children[m]->key < aKey )
+				l = m;
+			else if( aNode->children[m]->key > aKey )
+				u = m;
+			else
+				theIndex = m;
+		}
+		if( theIndex == NSNotFound )
+			theIndex = aNode->children[l]->key < aKey ? u : l;
+	}
+	else
+		theIndex = 0;
+	return theIndex;
+#endif
+}
+
+/*
+	returns the position of the child of aNode for aKey or NSNotFound
+ */
+inline static NSUInteger _positionOfChild( struct trieNode * aNode, NSUInteger aKey )
+{
+	NSUInteger		theIndex;
+#if NDTrieUseInlineChildKeys
+	if( aNode->directIndex != NULL && aKey < kTrieNodeDirectIndexCount )
+		theIndex = aNode->directIndex[aKey] > 0 ? (NSUInteger)aNode->directIndex[aKey]-1 : NSNotFound;
+	else if( (theIndex = _indexForChild( aNode, aKey )) >= aNode->count || aNode->childKeys[theIndex] != aKey )
+		theIndex = NSNotFound;
+	return theIndex;
+#else
+	if( (theIndex = _indexForChild( aNode, aKey )) >= aNode->count || aNode->children[theIndex]->key != aKey )
+		theIndex = NSNotFound;
+	return theIndex;
+#endif
+}
+
+/*
+	Compares the run of aNode with the key from *anIndex on, *anIndex and *anEnd are advanced past every unit that
+	matches, returns the number of units of the run matched.
+ */
+static NSUInteger _matchRun( struct trieNode * aNode, id aKey, NSUInteger * anIndex, BOOL * anEnd, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ) )
+{
+	NSUInteger		theMatched = 0;
+	while( !*anEnd && theMatched < aNode->runLength )
+	{
+		BOOL		theEnd = NO;
+		if( aKeyComponentFunc( aKey, *anIndex, &theEnd ) != aNode->run[theMatched] )
+			break;
+		theMatched++;
+		(*anIndex)++;
+		*anEnd = theEnd;
+	}
+	return theMatched;
+}
+
+/*
+	Finds a node, if aPrefix == YES then a key that ends part way through the run of a node returns that node
+ */
+static struct trieNode * findNode( struct trieNode * aNode, id aKey, NSUInteger anIndex, BOOL aPrefix, struct trieNode ** aParent, NSUInteger * anPosition, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ) )
+{
+	if( aKey == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"objectForKey: key cannot be nil" userInfo:nil];
+
+	struct trieNode		* theNode = NULL;
+	BOOL				theEnd = NO;
+	NSUInteger			theKeyComponent = aKeyComponentFunc( aKey, anIndex, &theEnd );
+
+	if( aNode->children != NULL )
+	{
+		NSUInteger		theIndex = _positionOfChild( aNode, theKeyComponent );
+		if( theIndex != NSNotFound )
+		{
+			theNode = aNode->children[theIndex];
+			anIndex++;
+			if( _matchRun( theNode, aKey, &anIndex, &theEnd, aKeyComponentFunc ) < theNode->runLength && !(aPrefix && theEnd) )
+				theNode = NULL;
+			else
+			{
+				if( anPosition )
+					*anPosition = theIndex;
+				if( aParent )
+					*aParent = aNode;
+			}
+		}
+	}
+
+	if( theNode != NULL && !theEnd )
+		theNode = findNode( theNode, aKey, anIndex, aPrefix, aParent, anPosition, aKeyComponentFunc );
+
+	return theNode;
+}
+
+/*
+	The iterative version of findNode for keys that have already been turned into characters, with case folded if
+	needed, if aPrefix == YES then a key that ends part way through the run of a node returns that node. If aNodeLength
+	is not NULL it is set to the length of the full key of the found node, which is longer than aLength when the key
+	ends part way through a run.
+ */
+static struct trieNode * lookupNode( struct trieNode * aRoot, const unichar * aKey, NSUInteger aLength, BOOL aPrefix, NSUInteger * aNodeLength )
+{
+	struct trieNode		* theNode = aLength > 0 ? aRoot : NULL;
+	NSUInteger			theIndex = 0,
+						theNodeLength = 0,
+						theVisited = 0;
+	while( theNode != NULL && theIndex < aLength )
+	{
+		NSUInteger		thePosition = _positionOfChild( theNode, aKey[theIndex++] );
+		theVisited++;
+		if( thePosition != NSNotFound )
+		{
+			theNode = theNode->children[thePosition];
+			theNodeLength = theIndex + theNode->runLength;
+			if( theNode->runLength > 0 )
+			{
+				NSUInteger		theCompareLength = aLength - theIndex < theNode->runLength ? aLength - theIndex : theNode->runLength;
+				if( memcmp( theNode->run, aKey+theIndex, theCompareLength*sizeof(unichar) ) != 0 || (theCompareLength < theNode->runLength && !aPrefix) )
+					theNode = NULL;
+				theIndex += theCompareLength;
+			}
+		}
+		else
+			theNode = NULL;
+	}
+	if( aNodeLength != NULL )
+		*aNodeLength = theNodeLength;
+	_countLookup( theVisited );
+	return theNode;
+}
+
+/*
+	One character on from aNode with *aRunIndex units of its run matched, returns aNode if the character is the next
+	unit of its run, otherwise the child for the character with *aRunIndex reset, or NULL if there is neither
+ */
+struct trieNode * stepNode( struct trieNode * aNode, NSUInteger * aRunIndex, unichar aCharacter )
+{
+	struct trieNode		* theResult = NULL;
+	if( *aRunIndex < aNode->runLength )
+	{
+		if( aNode->run[*aRunIndex] == aCharacter )
+		{
+			theResult = aNode;
+			(*aRunIndex)++;
+		}
+	}
+	else
+	{
+		NSUInteger		thePosition = _positionOfChild( aNode, aCharacter );
+		if( thePosition != NSNotFound )
+		{
+			theResult = aNode->children[thePosition];
+			*aRunIndex = 0;
+		}
+	}
+	return theResult;
+}
+
+/* the number of objects forEveryObjectFromNode passes on from aNode before it gets to those of aChild */
+NSUInteger objectsBeforeChild( struct trieNode * aNode, struct trieNode * aChild )
+{
+	NSUInteger		theResult = aNode->object != nil ? 1 : 0,
+					thePosition = _positionOfChild( aNode, aChild->key );
+	for( NSUInteger i = 0; i < thePosition; i++ )
+		theResult += aNode->children[i]->objectCount;
+	return theResult;
+}
+
+/*
+	The same as lookupNode for every key in aKeys, which have to be sorted, aResults[aKeys[i].index] is set to the node
+	found for aKeys[i] or NULL. The path followed for one key is kept, each entry the node and the length of key it
+	ends at, so the next key starts from the deepest node on the path within the prefix it shares with the last key.
+	The characters of the next key are prefetched while the current key is followed down the trie.
+ */
+void lookupSortedKeys( struct trieNode * aRoot, const struct trieBatchKey * aKeys, NSUInteger aCount, NSUInteger aMaxLength, struct trieNode ** aResults )
+{
+	struct trieStep { struct trieNode * node; NSUInteger length; }		* thePath = malloc( (aMaxLength+1)*sizeof(struct trieStep) );
+	NSUInteger		theDepth = 1;
+	if( thePath == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for keys" userInfo:nil];
+	thePath[0].node = aRoot;
+	thePath[0].length = 0;
+	for( NSUInteger k = 0; k < aCount; k++ )
+	{
+		const unichar		* theKey = aKeys[k].characters;
+		NSUInteger			theLength = aKeys[k].length,
+							theShared = 0,
+							theIndex,
+							theVisited = 0;
+		struct trieNode		* theNode;
+
+		if( k+1 < aCount )
+			__builtin_prefetch( aKeys[k+1].characters );
+		if( k > 0 )
+		{
+			const struct trieBatchKey	* theLast = &aKeys[k-1];
+			while( theShared < theLength && theShared < theLast->length && theLast->characters[theShared] == theKey[theShared] )
+				theShared++;
+		}
+		while( theDepth > 1 && thePath[theDepth-1].length > theShared )
+			theDepth--;
+		theNode = theLength > 0 ? thePath[theDepth-1].node : NULL;
+		theIndex = thePath[theDepth-1].length;
+		while( theNode != NULL && theIndex < theLength )
+		{
+			NSUInteger		thePosition = _positionOfChild( theNode, theKey[theIndex++] );
+			theVisited++;
+			if( thePosition != NSNotFound )
+			{
+				theNode = theNode->children[thePosition];
+				if( theNode->runLength > 0 )
+				{
+					if( theLength - theIndex < theNode->runLength || memcmp( theNode->run, theKey+theIndex, theNode->runLength*sizeof(unichar) ) != 0 )
+						theNode = NULL;
+					else
+						theIndex += theNode->runLength;
+				}
+				if( theNode != NULL )
+				{
+					thePath[theDepth].node = theNode;
+					thePath[theDepth].length = theIndex;
+					theDepth++;
+				}
+			}
+			else
+				theNode = NULL;
+		}
+		aResults[aKeys[k].index] = theNode;
+		_countLookup( theVisited );
+	}
+	free( thePath );
+}
+
+/*
+	The child array grows through the same sizes as the nodes of an adaptive radix tree, 4, 16, 48 and 256 and then
+	doubles, it shrinks back a size once it is down to half of the smaller size.
+ */
+static NSUInteger _largerChildCapacity( NSUInteger aSize )
+{
+	NSUInteger		theResult = aSize << 1;
+	if( aSize < 4 )
+		theResult = 4;
+	else if( aSize < 16 )
+		theResult = 16;
+	else if( aSize < 48 )
+		theResult = 48;
+	else if( aSize < 256 )
+		theResult = 256;
+	return theResult;
+}
+
+static NSUInteger _smallerChildCapacity( NSUInteger aSize )
+{
+	NSUInteger		theResult = 0;
+	if( aSize > 512 )
+		theResult = aSize >> 1;
+	else if( aSize > 256 )
+		theResult = 256;
+	else if( aSize > 48 )
+		theResult = 48;
+	else if( aSize > 16 )
+		theResult = 16;
+	else if( aSize > 4 )
+		theResult = 4;
+	return theResult;
+}
+
+/*
+	insert a new empty child into aNode at anIndex, growing the child array as needed
+ */
+static struct trieNode * _insertChildAtIndex( struct trieNode * aNode, NSUInteger anIndex, NSUInteger aKey, struct trieArena * anArena )
+{
+	if( aNode->count >= aNode->size )
+		_setChildCapacity( aNode, _largerChildCapacity( aNode->size ), anArena );
+	memmove( &aNode->children[anIndex+1], &aNode->children[anIndex], (aNode->count-anIndex)*sizeof(struct trieNode*) );
+	memmove( &aNode->childKeys[anIndex+1], &aNode->childKeys[anIndex], (aNode->count-anIndex)*sizeof(unichar) );
+	aNode->children[anIndex] = _createNode( aKey, anArena );
+	aNode->childKeys[anIndex] = (unichar)aKey;
+	aNode->count++;
+	/* keys from 256 up come after every key in the direct index so don't move anything in it */
+	if( aKey < kTrieNodeDirectIndexCount || aNode->directIndex == NULL )
+		_updateDirectIndex( aNode, anArena );
+	return aNode->children[anIndex];
+}
+
+/*
+	makes sure the child of aNode at anIndex is not shared with another trie before it is changed, a shared child is
+	replaced by a copy that shares the grandchildren instead, aNode must already be unshared
+ */
+static struct trieNode * _uniqueChild( struct trieNode * aNode, NSUInteger anIndex, struct trieArena * anArena )
+{
+	struct trieNode		* theChild = aNode->children[anIndex];
+	if( theChild->refCount > 1 )
+	{
+		struct trieNode		* theCopy = _createNode( theChild->key, anArena );
+		theCopy->object = [theChild->object retain];
+		theCopy->weight = theChild->weight;
+		theCopy->maxWeight = theChild->maxWeight;
+		theCopy->objectCount = theChild->objectCount;
+		_setNodeRun( theCopy, theChild->run, theChild->runLength, anArena );
+		shareChildren( theCopy, theChild, anArena );
+		aNode->children[anIndex] = theCopy;
+		_releaseNode( theChild, anArena );
+		theChild = theCopy;
+	}
+	return theChild;
+}
+
+/*
+	Splits aNode after aLength units of its run, the rest of the run along with the object and children of aNode are
+	moved into a new child, leaving aNode with a single child and no object.
+ */
+static void _splitNode( struct trieNode * aNode, NSUInteger aLength, struct trieArena * anArena )
+{
+	NSCParameterAssert( aLength < aNode->runLength );
+	struct trieNode		* theLower = _createNode( aNode->run[aLength], anArena );
+	theLower->object = aNode->object;
+	theLower->weight = aNode->weight;
+	theLower->maxWeight = aNode->maxWeight;
+	theLower->objectCount = aNode->objectCount;
+	theLower->children = aNode->children;
+	theLower->childKeys = aNode->childKeys;
+	theLower->directIndex = aNode->directIndex;
+	theLower->count = aNode->count;
+	theLower->size = aNode->size;
+	_setNodeRun( theLower, aNode->run+aLength+1, aNode->runLength-aLength-1, anArena );
+	_setNodeRun( aNode, aNode->run, aLength, anArena );
+
+	aNode->object = nil;
+	aNode->weight = 0.0;
+	aNode->children = NULL;
+	aNode->childKeys = NULL;
+	aNode->directIndex = NULL;
+	aNode->count = 0;
+	aNode->size = 0;
+	_setChildCapacity( aNode, 4, anArena );
+	aNode->children[0] = theLower;
+	aNode->childKeys[0] = (unichar)theLower->key;
+	aNode->count = 1;
+}
+
+/*
+	The opposite of _splitNode, folds the only child of aNode into aNode, used to keep a path compressed trie
+	compressed after removals, aNode must not be the root
+ */
+static void _mergeWithChild( struct trieNode * aNode, struct trieArena * anArena )
+{
+	NSCParameterAssert( aNode->count == 1 && aNode->object == nil );
+	struct trieNode		* theChild = _uniqueChild( aNode, 0, anArena );
+	NSUInteger			theLength = aNode->runLength + 1 + theChild->runLength;
+	unichar				* theRun = (unichar*)_arenaAlloc( anArena, theLength*sizeof(unichar) );
+
+	if( aNode->runLength > 0 )
+		memcpy( theRun, aNode->run, aNode->runLength*sizeof(unichar) );
+	theRun[aNode->runLength] = (unichar)theChild->key;
+	if( theChild->runLength > 0 )
+		memcpy( theRun+aNode->runLength+1, theChild->run, theChild->runLength*sizeof(unichar) );
+	if( aNode->run != NULL )
+		_arenaFree( anArena, aNode->run, aNode->runLength*sizeof(unichar) );
+	aNode->run = theRun;
+	aNode->runLength = theLength;
+
+	_freeChildren( aNode, anArena );
+	aNode->object = theChild->object;
+	aNode->weight = theChild->weight;
+	aNode->maxWeight = theChild->maxWeight;
+	aNode->objectCount = theChild->objectCount;
+	aNode->children = theChild->children;
+	aNode->childKeys = theChild->childKeys;
+	aNode->directIndex = theChild->directIndex;
+	aNode->count = theChild->count;
+	aNode->size = theChild->size;
+
+	theChild->children = NULL;
+	theChild->childKeys = NULL;
+	theChild->directIndex = NULL;
+	_freeNode( theChild, anArena );
+}
+
+/*
+	Finds the node for a key creating nodes as needed, the final node is not set to terminal node, should not return NULL.
+	If aCompress == YES the tail of a key not already in the trie goes into the run of a single new node. The maxWeight
+	of every node on the way, including aNode, is raised to aWeight and the key is counted in their objectCount as if
+	it is new, setObjectForKey puts that right if it is not. Every node on the way is made unshared.
+ */
+static struct trieNode * insertNode( struct trieNode * aNode, id aKey, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ), struct trieArena * anArena, BOOL aCompress, double aWeight )
+{
+	if( aKey == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: key cannot be nil" userInfo:nil];
+
+	if( [aKey length] == 0 )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: key cannot be empty" userInfo:nil];
+
+	struct trieNode		* theNode = aNode;
+	NSUInteger			theIndex = 0;
+	BOOL				theEnd = NO;
+	do
+	{
+		if( theNode->maxWeight < aWeight )
+			theNode->maxWeight = aWeight;
+		theNode->objectCount++;
+		NSUInteger		theKeyComponent = aKeyComponentFunc( aKey, theIndex++, &theEnd ),
+						thePosition = _positionOfChild( theNode, theKeyComponent );
+		if( thePosition != NSNotFound )
+		{
+			NSUInteger		theMatched;
+			theNode = _uniqueChild( theNode, thePosition, anArena );
+			theMatched = _matchRun( theNode, aKey, &theIndex, &theEnd, aKeyComponentFunc );
+			if( theMatched < theNode->runLength )
+				_splitNode( theNode, theMatched, anArena );
+		}
+		else
+		{
+			theNode = _insertChildAtIndex( theNode, _indexForChild( theNode, theKeyComponent ), theKeyComponent, anArena );
+			if( aCompress && !theEnd )
+			{
+				NSUInteger		theLength = [aKey length] - theIndex;
+				unichar			* theRun = (unichar*)_arenaAlloc( anArena, theLength*sizeof(unichar) );
+				for( NSUInteger i = 0; i < theLength; i++ )
+					theRun[i] = (unichar)aKeyComponentFunc( aKey, theIndex++, &theEnd );
+				theNode->run = theRun;
+				theNode->runLength = theLength;
+				NSCParameterAssert( theEnd );
+			}
+		}
+	}
+	while( !theEnd );
+
+	if( theNode->maxWeight < aWeight )
+		theNode->maxWeight = aWeight;
+	theNode->objectCount++;
+	return theNode;
+}
+
+/*
+	sets the maxWeight and objectCount of aNode from its own object and the totals of its children
+ */
+static void _updateSubtreeTotals( struct trieNode * aNode )
+{
+	double			theMaxWeight = aNode->object != nil ? aNode->weight : -HUGE_VAL;
+	NSUInteger		theObjectCount = aNode->object != nil ? 1 : 0;
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+	{
+		if( aNode->children[i]->maxWeight > theMaxWeight )
+			theMaxWeight = aNode->children[i]->maxWeight;
+		theObjectCount += aNode->children[i]->objectCount;
+	}
+	aNode->maxWeight = theMaxWeight;
+	aNode->objectCount = theObjectCount;
+}
+
+/*
+	recalculates maxWeight and objectCount from the bottom up for every node on the path of aKey, as far as the path
+	exists, used after something on the path has lost weight or objects
+ */
+static void refreshSubtreeTotals( struct trieNode * aNode, id aKey, NSUInteger anIndex, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ) )
+{
+	BOOL			theEnd = NO;
+	NSUInteger		thePosition = _positionOfChild( aNode, aKeyComponentFunc( aKey, anIndex, &theEnd ) );
+	if( thePosition != NSNotFound )
+	{
+		struct trieNode		* theChild = aNode->children[thePosition];
+		anIndex++;
+		if( _matchRun( theChild, aKey, &anIndex, &theEnd, aKeyComponentFunc ) == theChild->runLength && !theEnd )
+			refreshSubtreeTotals( theChild, aKey, anIndex, aKeyComponentFunc );
+		else
+			_updateSubtreeTotals( theChild );
+	}
+	_updateSubtreeTotals( aNode );
+}
+
+/*
+	take the child at anIndex out of aNode and release it, returns YES if aNode no longer has any children
+ */
+static BOOL _removeChildAtIndex( struct trieNode * aNode, NSUInteger anIndex, struct trieArena * anArena )
+{
+	BOOL		theResult = NO;
+	unichar		theKey = aNode->childKeys[anIndex];
+	_releaseNode( aNode->children[anIndex], anArena );
+	aNode->count--;
+	if( aNode->count > 0 )
+	{
+		NSUInteger		theSmallerSize = _smallerChildCapacity( aNode->size );
+		memmove( &aNode->children[anIndex], &aNode->children[anIndex+1], (aNode->count-anIndex)*sizeof(struct trieNode*) );
+		memmove( &aNode->childKeys[anIndex], &aNode->childKeys[anIndex+1], (aNode->count-anIndex)*sizeof(unichar) );
+		if( theSmallerSize > 0 && aNode->count <= theSmallerSize>>1 )
+			_setChildCapacity( aNode, theSmallerSize, anArena );
+		if( theKey < kTrieNodeDirectIndexCount || aNode->count < kTrieNodeSparseLimit )
+			_updateDirectIndex( aNode, anArena );
+	}
+	else
+	{
+		_freeChildren( aNode, anArena );
+		theResult = YES;
+	}
+	return theResult;
+}
+
+static BOOL _removeObjectForKey( struct trieNode * aNode, id aKey, NSUInteger anIndex, BOOL * aFoundNode, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ), struct trieArena * anArena, BOOL aCompress )
+{
+	BOOL			theResult = NO;
+	BOOL			theEnd = NO;
+	NSUInteger		theKeyComponent = aKeyComponentFunc( aKey, anIndex, &theEnd );
+	if( aNode->children != NULL )
+	{
+		NSUInteger		theIndex = _positionOfChild( aNode, theKeyComponent );
+		if( theIndex != NSNotFound )
+		{
+			struct trieNode		* theChild = aNode->children[theIndex];
+			anIndex++;
+			if( _matchRun( theChild, aKey, &anIndex, &theEnd, aKeyComponentFunc ) == theChild->runLength )
+			{
+				if( theEnd )
+				{
+					if( theChild->object != nil )
+					{
+						if( theChild->count == 0 )			// releasing the child releases the object
+							theResult = _removeChildAtIndex( aNode, theIndex, anArena );
+						else
+						{
+							theChild = _uniqueChild( aNode, theIndex, anArena );
+							[theChild->object release], theChild->object = nil;
+							theChild->weight = 0.0;
+							if( aCompress && theChild->count == 1 )
+								_mergeWithChild( theChild, anArena );
+							_updateSubtreeTotals( theChild );
+						}
+						*aFoundNode = YES;
+					}
+				}
+				else if( _removeObjectForKey( theChild = _uniqueChild( aNode, theIndex, anArena ), aKey, anIndex, aFoundNode, aKeyComponentFunc, anArena, aCompress ) )
+				{
+					if( theChild->object == nil )
+						theResult = _removeChildAtIndex( aNode, theIndex, anArena );
+				}
+				else if( aCompress && *aFoundNode && theChild->object == nil && theChild->count == 1 )
+					_mergeWithChild( theChild, anArena );
+			}
+		}
+	}
+
+	if( *aFoundNode )
+		_updateSubtreeTotals( aNode );
+	return theResult;
+}
+
+/*
+	the key is looked for first without changing anything, _removeObjectForKey makes its own copy of every shared node
+	on the way down, which would be for nothing if the key is not there
+ */
+BOOL removeObjectForKey( struct trieNode * aNode, id aKey, NSUInteger anIndex, BOOL * aFoundNode, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ), struct trieArena * anArena, BOOL aCompress )
+{
+	struct trieNode		* theNode = aKey != nil ? findNode( aNode, aKey, anIndex, NO, NULL, NULL, aKeyComponentFunc ) : NULL;
+	return theNode != NULL && theNode->object != nil ? _removeObjectForKey( aNode, aKey, anIndex, aFoundNode, aKeyComponentFunc, anArena, aCompress ) : NO;
+}
+
+/*
+	Removes the child of aNode on the path of aPrefix that the prefix ends in along with everything below it, the
+	number of objects removed goes in aRemoveCount. Returns YES if aNode is left without children. Nodes on the way
+	that no longer lead to any objects are removed as well, so the path is followed down instead of back up.
+ */
+static BOOL _removeChildForPrefix( struct trieNode * aNode, id aPrefix, NSUInteger anIndex, NSUInteger * aRemoveCount, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL* ), struct trieArena * anArena, BOOL aCompress )
+{
+	BOOL			theResult = NO,
+					theEnd = NO;
+	NSUInteger		thePosition = aNode->children != NULL ? _positionOfChild( aNode, aKeyComponentFunc( aPrefix, anIndex, &theEnd ) ) : NSNotFound;
+	if( thePosition != NSNotFound )
+	{
+		struct trieNode		* theChild = aNode->children[thePosition];
+		anIndex++;
+		if( _matchRun( theChild, aPrefix, &anIndex, &theEnd, aKeyComponentFunc ) == theChild->runLength || theEnd )
+		{
+			if( theEnd )
+			{
+				*aRemoveCount = theChild->objectCount;
+				theResult = _removeChildAtIndex( aNode, thePosition, anArena );
+			}
+			else
+			{
+				theChild = _uniqueChild( aNode, thePosition, anArena );
+				if( _removeChildForPrefix( theChild, aPrefix, anIndex, aRemoveCount, aKeyComponentFunc, anArena, aCompress ) && theChild->object == nil )
+					theResult = _removeChildAtIndex( aNode, thePosition, anArena );
+				else if( *aRemoveCount > 0 && aCompress && theChild->object == nil && theChild->count == 1 )
+					_mergeWithChild( theChild, anArena );
+			}
+		}
+	}
+	if( *aRemoveCount > 0 )
+		_updateSubtreeTotals( aNode );
+	return theResult;
+}
+
+NSUInteger removeChild( struct trieNode * aRoot, id aPrefix, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL* ), struct trieArena * anArena, BOOL aCompress )
+{
+	NSUInteger		theRemoveCount = 0;
+	NSCParameterAssert( aPrefix != nil );
+	/* the same as removeObjectForKey, nothing is copied unless there is something to remove */
+	if( findNode( aRoot, aPrefix, 0, YES, NULL, NULL, aKeyComponentFunc ) != NULL )
+		_removeChildForPrefix( aRoot, aPrefix, 0, &theRemoveCount, aKeyComponentFunc, anArena, aCompress );
+	return theRemoveCount;
+}
+
+/*
+	aWeight is the weight for the key, or kTrieUnchangedWeight to keep the weight of a key already in the trie
+ */
+BOOL setObjectForKey( struct trieNode * aNode, id anObject, id aKey, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ), struct trieArena * anArena, BOOL aCompress, double aWeight )
+{
+	if( aKey == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: key cannot be nil" userInfo:nil];
+	if( anObject == nil )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: object cannot be nil" userInfo:[NSDictionary dictionaryWithObject:aKey forKey:@"key"]];
+
+	BOOL				theNewString = NO;
+	struct trieNode		* theNode = insertNode( aNode, aKey, aKeyComponentFunc, anArena, aCompress, isnan(aWeight) ? 0.0 : aWeight );
+	NSCParameterAssert( theNode != NULL );
+
+	theNewString = theNode->object == nil;
+	[theNode->object release];
+	theNode->object = [anObject retain];
+	if( !isnan(aWeight) )
+		theNode->weight = aWeight;
+	else if( theNewString )
+		theNode->weight = 0.0;
+	/* insertNode counted the key as new and may have raised maxWeight past the weight of a replaced key */
+	if( !theNewString )
+		refreshSubtreeTotals( aNode, aKey, 0, aKeyComponentFunc );
+	return theNewString;
+}
+
+BOOL forEveryObjectFromNode( struct trieNode * aNode, BOOL(*aFunc)(id,void*), void * aContext )
+{
+	BOOL		theContinue = YES;
+
+	if( aNode->object != nil )
+		theContinue = aFunc( aNode->object, aContext );
+
+	for( NSUInteger i = 0; i < aNode->count && theContinue; i++ )
+		theContinue = forEveryObjectFromNode( aNode->children[i], aFunc, aContext );
+	return theContinue;
+}
+
+/*
+	aNode can be NULL for a cursor that returns nothing, memory used is proportional to the depth of the trie
+ */
+void initCursor( struct trieCursor * aCursor, struct trieNode * aNode )
+{
+	aCursor->frames = NULL;
+	aCursor->depth = 0;
+	aCursor->capacity = 0;
+	if( aNode != NULL )
+	{
+		aCursor->capacity = 16;
+		if( (aCursor->frames = (struct trieCursorFrame*)malloc( aCursor->capacity*sizeof(struct trieCursorFrame) )) == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for enumerator" userInfo:nil];
+		aCursor->frames[0].node = aNode;
+		aCursor->frames[0].index = NSNotFound;			// the start node itself has not been returned yet
+		aCursor->depth = 1;
+	}
+}
+
+/* the new frame is for a node that has already been returned */
+static void _cursorPush( struct trieCursor * aCursor, struct trieNode * aNode )
+{
+	if( aCursor->depth >= aCursor->capacity )
+	{
+		struct trieCursorFrame	* theFrames = (struct trieCursorFrame*)realloc( aCursor->frames, (aCursor->capacity<<1)*sizeof(struct trieCursorFrame) );
+		if( theFrames == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for enumerator" userInfo:nil];
+		aCursor->frames = theFrames;
+		aCursor->capacity <<= 1;
+	}
+	aCursor->frames[aCursor->depth].node = aNode;
+	aCursor->frames[aCursor->depth].index = 0;
+	aCursor->depth++;
+}
+
+/*
+	returns the nodes in the same order as forEveryObjectFromNode visits them, including nodes without objects, and
+	NULL once every node has been returned
+ */
+struct trieNode * cursorNextNode( struct trieCursor * aCursor )
+{
+	struct trieNode		* theResult = NULL;
+	while( theResult == NULL && aCursor->depth > 0 )
+	{
+		struct trieCursorFrame	* theFrame = &aCursor->frames[aCursor->depth-1];
+		if( theFrame->index == NSNotFound )
+		{
+			theResult = theFrame->node;
+			theFrame->index = 0;
+		}
+		else if( theFrame->index < theFrame->node->count )
+		{
+			theResult = theFrame->node->children[theFrame->index++];
+			_cursorPush( aCursor, theResult );
+		}
+		else
+			aCursor->depth--;
+	}
+	return theResult;
+}
+
+/*
+	Moves a new cursor on to just after aKey, as if every node with a key up to and including aKey has been returned,
+	aKey is relative to the start node of the cursor. Children are in order so this only has to follow aKey down,
+	it does not matter if aKey is no longer in the trie.
+ */
+void cursorSeekAfter( struct trieCursor * aCursor, const unichar * aKey, NSUInteger aLength )
+{
+	NSUInteger		theIndex = 0;
+	BOOL			theFollowing = aCursor->depth > 0;
+	if( theFollowing )
+		aCursor->frames[0].index = 0;
+	while( theFollowing && theIndex < aLength )
+	{
+		struct trieCursorFrame	* theFrame = &aCursor->frames[aCursor->depth-1];
+		struct trieNode			* theNode = theFrame->node;
+		NSUInteger				thePosition = _indexForChild( theNode, aKey[theIndex] );
+
+		theFollowing = NO;
+		theFrame->index = thePosition;			// every child from thePosition on comes after aKey
+		if( thePosition < theNode->count && theNode->childKeys[thePosition] == aKey[theIndex] )
+		{
+			struct trieNode		* theChild = theNode->children[thePosition];
+			NSUInteger			theMatched = 0;
+			theIndex++;
+			while( theMatched < theChild->runLength && theIndex < aLength && theChild->run[theMatched] == aKey[theIndex] )
+			{
+				theMatched++;
+				theIndex++;
+			}
+
+			if( theMatched == theChild->runLength )
+			{
+				theFrame->index = thePosition+1;
+				_cursorPush( aCursor, theChild );
+				theFollowing = YES;
+			}
+			else if( theIndex < aLength && theChild->run[theMatched] < aKey[theIndex] )
+				theFrame->index = thePosition+1;		// the child comes before aKey
+		}
+	}
+}
+
+void freeCursor( struct trieCursor * aCursor )
+{
+	free( aCursor->frames );
+	aCursor->frames = NULL;
+	aCursor->depth = aCursor->capacity = 0;
+}
+
+/*
+	A max heap of nodes waiting to be visited by forEveryObjectByWeightFromNode, an entry is either a node standing in
+	for its whole subtree, ordered by maxWeight, or just the object of a node, ordered by weight. The nodes are either
+	trieNodes or, for a mapped or compacted trie, the index of a viewPath.
+ */
+struct trieHeapEntry
+{
+	double				weight;
+	const void			* node;
+	BOOL				object;
+};
+
+struct trieHeap
+{
+	struct trieHeapEntry	* entries;
+	NSUInteger				count,
+							capacity;
+};
+
+/* objects come before subtrees of the same weight, as nothing in the subtree can be better */
+static inline BOOL _heapEntryBefore( const struct trieHeapEntry * anEntryA, const struct trieHeapEntry * anEntryB )
+{
+	return anEntryA->weight > anEntryB->weight || (anEntryA->weight == anEntryB->weight && anEntryA->object && !anEntryB->object);
+}
+
+static void _heapPush( struct trieHeap * aHeap, double aWeight, const void * aNode, BOOL anObject )
+{
+	struct trieHeapEntry	theEntry = { aWeight, aNode, anObject };
+	NSUInteger				theIndex = aHeap->count++;
+	if( aHeap->count > aHeap->capacity )
+	{
+		NSUInteger				theCapacity = aHeap->capacity > 0 ? aHeap->capacity<<1 : 64;
+		struct trieHeapEntry	* theEntries = (struct trieHeapEntry*)realloc( aHeap->entries, theCapacity*sizeof(struct trieHeapEntry) );
+		if( theEntries == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for weighted enumeration" userInfo:nil];
+		aHeap->entries = theEntries;
+		aHeap->capacity = theCapacity;
+	}
+	while( theIndex > 0 && _heapEntryBefore( &theEntry, &aHeap->entries[(theIndex-1)>>1] ) )
+	{
+		aHeap->entries[theIndex] = aHeap->entries[(theIndex-1)>>1];
+		theIndex = (theIndex-1)>>1;
+	}
+	aHeap->entries[theIndex] = theEntry;
+}
+
+static struct trieHeapEntry _heapPop( struct trieHeap * aHeap )
+{
+	struct trieHeapEntry	theResult = aHeap->entries[0],
+							theLast = aHeap->entries[--aHeap->count];
+	NSUInteger				theIndex = 0,
+							theChild;
+	while( (theChild = (theIndex<<1)+1) < aHeap->count )
+	{
+		if( theChild+1 < aHeap->count && _heapEntryBefore( &aHeap->entries[theChild+1], &aHeap->entries[theChild] ) )
+			theChild++;
+		if( !_heapEntryBefore( &aHeap->entries[theChild], &theLast ) )
+			break;
+		aHeap->entries[theIndex] = aHeap->entries[theChild];
+		theIndex = theChild;
+	}
+	if( aHeap->count > 0 )
+		aHeap->entries[theIndex] = theLast;
+	return theResult;
+}
+
+/*
+	Like forEveryObjectFromNode but in order of weight, heaviest first, a best first search using maxWeight so the only
+	subtrees opened up are those that could still hold the next object, so stopping after k objects costs about k
+	times the depth and not the size of the subtree.
+ */
+BOOL forEveryObjectByWeightFromNode( struct trieNode * aNode, BOOL(*aFunc)(id,void*), void * aContext )
+{
+	BOOL				theContinue = YES;
+	struct trieHeap		theHeap = { NULL, 0, 0 };
+	@try
+	{
+		if( aNode->maxWeight > -HUGE_VAL )
+			_heapPush( &theHeap, aNode->maxWeight, aNode, NO );
+		while( theContinue && theHeap.count > 0 )
+		{
+			struct trieHeapEntry	theEntry = _heapPop( &theHeap );
+			struct trieNode			* theNode = (struct trieNode*)theEntry.node;
+			if( theEntry.object )
+				theContinue = aFunc( theNode->object, aContext );
+			else
+			{
+				if( theNode->object != nil )
+					_heapPush( &theHeap, theNode->weight, theNode, YES );
+				for( NSUInteger i = 0; i < theNode->count; i++ )
+				{
+					if( theNode->children[i]->maxWeight > -HUGE_VAL )
+						_heapPush( &theHeap, theNode->children[i]->maxWeight, theNode->children[i], NO );
+				}
+			}
+		}
+	}
+	@finally
+	{
+		free( theHeap.entries );
+	}
+	return theContinue;
+}
+
+void forEveryObjectWithBlockFromNode( struct trieNode * aNode, void(^aBlock)(id,BOOL*), BOOL * aStop )
+{
+	if( aNode->object != nil )
+		aBlock( aNode->object, aStop );
+
+	for( NSUInteger i = 0; i < aNode->count && *aStop == NO; i++ )
+		forEveryObjectWithBlockFromNode( aNode->children[i], aBlock, aStop );
+}
+
+void forEveryNodeWithBlockFromNode( struct trieNode * aNode, void(^aBlock)(struct trieNode*,BOOL*), BOOL * aStop )
+{
+	if( aNode->object != nil )
+		aBlock( aNode, aStop );
+
+	for( NSUInteger i = 0; i < aNode->count && *aStop == NO; i++ )
+		forEveryNodeWithBlockFromNode( aNode->children[i], aBlock, aStop );
+}
+
+#if NDTrieUseDispatch
+/*
+	A piece of a concurrent enumeration, the object of node if object is set and the subtrees of the children of node
+	from first up to but not including last.
+ */
+struct trieTask
+{
+	struct trieNode		* node;
+	NSUInteger			first,
+						last;
+	BOOL				object;
+};
+
+struct trieTaskList
+{
+	struct trieTask		* tasks;
+	NSUInteger			count,
+						capacity;
+};
+
+static void _addTask( struct trieTaskList * aList, struct trieNode * aNode, NSUInteger aFirst, NSUInteger aLast, BOOL anObject )
+{
+	if( aList->count == aList->capacity )
+	{
+		NSUInteger			theCapacity = aList->capacity > 0 ? aList->capacity*2 : 64;
+		struct trieTask		* theTasks = (struct trieTask*)realloc( aList->tasks, theCapacity*sizeof(struct trieTask) );
+		if( theTasks == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for enumerating NDTrie" userInfo:nil];
+		aList->tasks = theTasks;
+		aList->capacity = theCapacity;
+	}
+	aList->tasks[aList->count++] = (struct trieTask){ aNode, aFirst, aLast, anObject };
+}
+
+/*
+	Cuts the subtree of aNode in to tasks of about aTarget objects each using the objectCount of each child, runs of
+	siblings small enough to share a task do and a child with more than aTarget objects is cut up itself. The tasks
+	are added in key order.
+ */
+static void _collectTasks( struct trieNode * aNode, NSUInteger aTarget, struct trieTaskList * aList )
+{
+	BOOL			theObject = aNode->object != nil;
+	NSUInteger		theFirst = 0,
+					theSize = theObject ? 1 : 0;
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+	{
+		struct trieNode		* theChild = aNode->children[i];
+		if( theChild->objectCount > aTarget && theChild->count > 0 )
+		{
+			if( theFirst < i || theObject )
+				_addTask( aList, aNode, theFirst, i, theObject );
+			_collectTasks( theChild, aTarget, aList );
+			theObject = NO;
+			theFirst = i+1;
+			theSize = 0;
+		}
+		else
+		{
+			if( theSize + theChild->objectCount > aTarget && (theFirst < i || theObject) )
+			{
+				_addTask( aList, aNode, theFirst, i, theObject );
+				theObject = NO;
+				theFirst = i;
+				theSize = 0;
+			}
+			theSize += theChild->objectCount;
+		}
+	}
+	if( theFirst < aNode->count || theObject )
+		_addTask( aList, aNode, theFirst, aNode->count, theObject );
+}
+
+/*
+	Passes every object of the subtree of aNode to aBlock spread over every core, the subtree is cut in to several
+	tasks a core so one slow part does not hold up the rest. Setting stop stops tasks that have not started yet and the
+	ones running as soon as aBlock returns. If aCollect is set the objects aBlock returns YES for are kept a task at a
+	time and put together in key order at the end, otherwise nil is returned. An exception thrown by aBlock stops the
+	enumeration and is rethrown on the calling thread.
+ */
+NSArray * forEveryObjectConcurrentlyFromNode( struct trieNode * aNode, BOOL(^aBlock)(id,BOOL*), BOOL aCollect )
+{
+	NSMutableArray			* theResult = aCollect ? [NSMutableArray arrayWithCapacity:aNode->objectCount] : nil;
+	struct trieTaskList		theList = { NULL, 0, 0 };
+	NSMutableArray			** theBuffers = NULL;
+	NSException				** theExceptions = NULL;
+	@try
+	{
+		NSUInteger				theTarget = aNode->objectCount/([[NSProcessInfo processInfo] activeProcessorCount]*8) + 1;
+		_collectTasks( aNode, theTarget, &theList );
+		if( theList.count == 0 )
+			return theResult;
+		if( (theExceptions = (NSException**)calloc( theList.count, sizeof(NSException*) )) == NULL
+			|| (aCollect && (theBuffers = (NSMutableArray**)calloc( theList.count, sizeof(NSMutableArray*) )) == NULL) )
+		{
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for enumerating NDTrie" userInfo:nil];
+		}
+
+		struct trieTask			* theTasks = theList.tasks;
+		__block BOOL			theStop = NO;
+		dispatch_apply( theList.count, dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_DEFAULT, 0 ), ^(size_t t){
+			if( theStop )
+				return;
+			@autoreleasepool
+			{
+				@try
+				{
+					struct trieTask		* theTask = &theTasks[t];
+					NSMutableArray		* theBuffer = aCollect ? (theBuffers[t] = [[NSMutableArray alloc] init]) : nil;
+					void (^theBlock)(id,BOOL*) = ^(id anObject, BOOL * aStop){
+						if( aBlock( anObject, aStop ) && aCollect )
+							[theBuffer addObject:anObject];
+					};
+					if( theTask->object )
+						theBlock( theTask->node->object, &theStop );
+					for( NSUInteger i = theTask->first; i < theTask->last && !theStop; i++ )
+						forEveryObjectWithBlockFromNode( theTask->node->children[i], theBlock, &theStop );
+				}
+				@catch( NSException * anException )
+				{
+					theExceptions[t] = [anException retain];
+					theStop = YES;
+				}
+			}
+		});
+
+		for( NSUInteger t = 0; t < theList.count; t++ )
+		{
+			if( theExceptions[t] != nil )
+			{
+				NSException		* theException = theExceptions[t];
+				theExceptions[t] = nil;
+				@throw [theException autorelease];
+			}
+		}
+		for( NSUInteger t = 0; theBuffers != NULL && t < theList.count; t++ )
+		{
+			if( theBuffers[t] != nil )
+				[theResult addObjectsFromArray:theBuffers[t]];
+		}
+	}
+	@finally
+	{
+		for( NSUInteger t = 0; t < theList.count; t++ )
+		{
+			if( theBuffers != NULL )
+				[theBuffers[t] release];
+			if( theExceptions != NULL )
+				[theExceptions[t] release];
+		}
+		free( theBuffers );
+		free( theExceptions );
+		free( theList.tasks );
+	}
+	return theResult;
+}
+#endif
+
+BOOL nodesAreEqual( struct trieNode * aNodeA, struct trieNode * aNodeB )
+{
+	BOOL		theEqual = YES;
+
+	if( aNodeA == aNodeB )				// a node shared by two copies
+		return YES;
+	// need to test for two equal object pointers because, the root node they will both be nil
+	if( aNodeA->count == aNodeB->count && aNodeA->key == aNodeB->key && (aNodeA->object == aNodeB->object || [aNodeA->object isEqual:aNodeB->object])
+	   && aNodeA->runLength == aNodeB->runLength && (aNodeA->runLength == 0 || memcmp( aNodeA->run, aNodeB->run, aNodeA->runLength*sizeof(unichar) ) == 0) )
+	{
+		for( NSUInteger i = 0; i < aNodeA->count && theEqual; i++ )
+			theEqual = nodesAreEqual( aNodeA->children[i], aNodeB->children[i] );
+	}
+	else
+		theEqual = NO;
+	return theEqual;
+}
+
+struct keyBuffer
+{
+	unichar			* characters;
+	NSUInteger		length,
+					capacity;
+};
+
+static void _appendToKeyBuffer( struct keyBuffer * aBuffer, struct trieNode * aNode )
+{
+	if( aBuffer->length + 1 + aNode->runLength > aBuffer->capacity )
+	{
+		while( aBuffer->length + 1 + aNode->runLength > aBuffer->capacity )
+			aBuffer->capacity <<= 1;
+		aBuffer->characters = (unichar*)reallocf( aBuffer->characters, aBuffer->capacity*sizeof(unichar) );
+		if( aBuffer->characters == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for NDTrie key" userInfo:nil];
+	}
+	aBuffer->characters[aBuffer->length++] = (unichar)aNode->key;
+	if( aNode->runLength > 0 )
+		memcpy( aBuffer->characters+aBuffer->length, aNode->run, aNode->runLength*sizeof(unichar) );
+	aBuffer->length += aNode->runLength;
+}
+
+static BOOL _forEveryKeyFromNode( struct trieNode * aNode, struct keyBuffer * aBuffer, BOOL(*aFunc)(struct trieNode *,const unichar*,NSUInteger,void*), void * aContext )
+{
+	BOOL		theContinue = YES;
+	if( aNode->object != nil )
+		theContinue = aFunc( aNode, aBuffer->characters, aBuffer->length, aContext );
+	for( NSUInteger i = 0; i < aNode->count && theContinue; i++ )
+	{
+		NSUInteger		theLength = aBuffer->length;
+		_appendToKeyBuffer( aBuffer, aNode->children[i] );
+		theContinue = _forEveryKeyFromNode( aNode->children[i], aBuffer, aFunc, aContext );
+		aBuffer->length = theLength;
+	}
+	return theContinue;
+}
+
+/*
+	Like forEveryObjectFromNode but passes the node and the key rebuilt from the path to it, keys are relative to aNode
+	and for case insensitive tries the letters are uppercase
+ */
+BOOL forEveryKeyFromNode( struct trieNode * aNode, BOOL(*aFunc)(struct trieNode *,const unichar*,NSUInteger,void*), void * aContext )
+{
+	struct keyBuffer	theBuffer = { (unichar*)malloc( 64*sizeof(unichar) ), 0, 64 };
+	BOOL				theResult = NO;
+	@try
+	{
+		theResult = _forEveryKeyFromNode( aNode, &theBuffer, aFunc, aContext );
+	}
+	@finally
+	{
+		free( theBuffer.characters );
+	}
+	return theResult;
+}
+
+/*
+	Fuzzy searches walk the trie once working out the Levenshtein distance between the key being searched for and the
+	key of every node a row at a time, row n being the distances from the first n units of the node key to every prefix
+	of the search key, so each node only adds one row to the row of its parent. The smallest value in a row never goes
+	down further along a path, once it is over the maximum distance nothing below can match. For a prefix search the
+	distance of a key is the smallest distance of any of its prefixes, the objects found are kept in a bucket for each
+	distance so the result comes out ordered by distance and then by key.
+ */
+struct fuzzySearch
+{
+	const unichar		* key;
+	NSUInteger			length,
+						maxDistance,
+						* rows,
+						rowCapacity;
+	BOOL				prefix;
+	NSMutableArray		* buckets;
+};
+
+/* row aDepth+1 from row aDepth for the unit aUnit, returns the smallest value in the new row */
+static NSUInteger _fuzzyStep( struct fuzzySearch * aSearch, NSUInteger aDepth, unichar aUnit )
+{
+	NSUInteger		theWidth = aSearch->length+1,
+					* thePrevious,
+					* theRow,
+					theMin;
+	if( aDepth+1 >= aSearch->rowCapacity )
+	{
+		NSUInteger	* theRows = (NSUInteger*)realloc( aSearch->rows, (aSearch->rowCapacity<<1)*theWidth*sizeof(NSUInteger) );
+		if( theRows == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for fuzzy search" userInfo:nil];
+		aSearch->rows = theRows;
+		aSearch->rowCapacity <<= 1;
+	}
+	thePrevious = aSearch->rows + aDepth*theWidth;
+	theRow = thePrevious + theWidth;
+	theMin = theRow[0] = thePrevious[0] + 1;
+	for( NSUInteger i = 1; i < theWidth; i++ )
+	{
+		NSUInteger		theValue = thePrevious[i-1] + (aSearch->key[i-1] == aUnit ? 0 : 1);
+		if( thePrevious[i] + 1 < theValue )
+			theValue = thePrevious[i] + 1;
+		if( theRow[i-1] + 1 < theValue )
+			theValue = theRow[i-1] + 1;
+		theRow[i] = theValue;
+		if( theValue < theMin )
+			theMin = theValue;
+	}
+	return theMin;
+}
+
+static NSUInteger _fuzzyDistance( struct fuzzySearch * aSearch, NSUInteger aDepth ) { return aSearch->rows[aDepth*(aSearch->length+1)+aSearch->length]; }
+
+/* whether anything further along the path can still be found, for a prefix search a close enough prefix is enough */
+static BOOL _fuzzyCanMatch( struct fuzzySearch * aSearch, NSUInteger aMin, NSUInteger aBest )
+{
+	return aMin <= aSearch->maxDistance || (aSearch->prefix && aBest <= aSearch->maxDistance);
+}
+
+static NSMutableArray * _fuzzyBucket( struct fuzzySearch * aSearch, NSUInteger aDistance )
+{
+	while( [aSearch->buckets count] <= aDistance )
+		[aSearch->buckets addObject:[NSMutableArray array]];
+	return [aSearch->buckets objectAtIndex:aDistance];
+}
+
+static void _fuzzyInit( struct fuzzySearch * aSearch, const unichar * aKey, NSUInteger aLength, NSUInteger aMaxDistance, BOOL aPrefix )
+{
+	aSearch->key = aKey;
+	aSearch->length = aLength;
+	aSearch->maxDistance = aMaxDistance;
+	aSearch->prefix = aPrefix;
+	aSearch->rowCapacity = 32;
+	aSearch->buckets = [NSMutableArray array];
+	if( (aSearch->rows = (NSUInteger*)malloc( aSearch->rowCapacity*(aLength+1)*sizeof(NSUInteger) )) == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for fuzzy search" userInfo:nil];
+	for( NSUInteger i = 0; i <= aLength; i++ )
+		aSearch->rows[i] = i;
+}
+
+static NSArray * _fuzzyResult( struct fuzzySearch * aSearch )
+{
+	NSMutableArray		* theResult = [NSMutableArray array];
+	for( NSArray * theBucket in aSearch->buckets )
+		[theResult addObjectsFromArray:theBucket];
+	return theResult;
+}
+
+/*
+	the row for the key of aNode is at aDepth, aBest is the smallest distance of any prefix of the key for prefix
+	searches, aMin the smallest value in the row
+ */
+static void _fuzzySearchNode( struct fuzzySearch * aSearch, struct trieNode * aNode, NSUInteger aDepth, NSUInteger aBest, NSUInteger aMin )
+{
+	NSUInteger		theDistance = aSearch->prefix ? aBest : _fuzzyDistance( aSearch, aDepth );
+	if( aNode->object != nil && theDistance <= aSearch->maxDistance )
+		[_fuzzyBucket( aSearch, theDistance ) addObject:aNode->object];
+	if( aSearch->prefix && aBest <= aSearch->maxDistance && aMin >= aBest )
+	{
+		/* nothing below can get any closer, so everything below is at aBest */
+		NSMutableArray		* theBucket = _fuzzyBucket( aSearch, aBest );
+		for( NSUInteger i = 0; i < aNode->count; i++ )
+			forEveryObjectFromNode( aNode->children[i], _addToArrayFunc, theBucket );
+		return;
+	}
+
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+	{
+		struct trieNode		* theChild = aNode->children[i];
+		NSUInteger			theDepth = aDepth,
+							theBest = aBest,
+							theMin = _fuzzyStep( aSearch, theDepth++, (unichar)theChild->key );
+		if( _fuzzyDistance( aSearch, theDepth ) < theBest )
+			theBest = _fuzzyDistance( aSearch, theDepth );
+		for( NSUInteger j = 0; j < theChild->runLength && _fuzzyCanMatch( aSearch, theMin, theBest ); j++ )
+		{
+			theMin = _fuzzyStep( aSearch, theDepth++, theChild->run[j] );
+			if( _fuzzyDistance( aSearch, theDepth ) < theBest )
+				theBest = _fuzzyDistance( aSearch, theDepth );
+		}
+		if( _fuzzyCanMatch( aSearch, theMin, theBest ) )
+			_fuzzySearchNode( aSearch, theChild, theDepth, theBest, theMin );
+	}
+}
+
+NSArray * everyObjectNearKey( struct trieNode * aRoot, const unichar * aKey, NSUInteger aLength, NSUInteger aMaxDistance, BOOL aPrefix )
+{
+	struct fuzzySearch		theSearch;
+	_fuzzyInit( &theSearch, aKey, aLength, aMaxDistance, aPrefix );
+	@try
+	{
+		_fuzzySearchNode( &theSearch, aRoot, 0, aLength, 0 );
+	}
+	@finally
+	{
+		free( theSearch.rows );
+	}
+	return _fuzzyResult( &theSearch );
+}
+
+/*
+	the same as _fuzzySearchNode for the nodes of a view, *aKey holds the key of aNode, which is aDepth units long, and
+	is grown as the search goes deeper
+ */
+static void _fuzzySearchView( struct fuzzySearch * aSearch, const struct trieView * aView, NSUInteger aNode, unichar ** aKey, NSUInteger * aCapacity, NSUInteger aDepth, NSUInteger aBest, NSUInteger aMin )
+{
+	const struct trieLayout		* theLayout = aView->layout;
+	NSUInteger					theDistance = aSearch->prefix ? aBest : _fuzzyDistance( aSearch, aDepth ),
+								theCount;
+	const unichar				* theKeys = theLayout->childKeys( aView->data, aNode, &theCount );
+	if( theLayout->hasObject( aView->data, aNode ) && theDistance <= aSearch->maxDistance )
+		[_fuzzyBucket( aSearch, theDistance ) addObject:theLayout->object( aView->data, aNode, *aKey, aDepth )];
+	if( aSearch->prefix && aBest <= aSearch->maxDistance && aMin >= aBest )
+	{
+		/* nothing below can get any closer, so everything below is at aBest */
+		NSMutableArray		* theBucket = _fuzzyBucket( aSearch, aBest );
+		_viewKeyGrow( aKey, aCapacity, aDepth+1 );
+		for( NSUInteger i = 0; i < theCount; i++ )
+		{
+			(*aKey)[aDepth] = theKeys[i];
+			forEveryObjectInView( aView, theLayout->child( aView->data, aNode, i ), *aKey, aDepth+1, _addToArrayFunc, theBucket );
+		}
+		return;
+	}
+
+	for( NSUInteger i = 0; i < theCount; i++ )
+	{
+		NSUInteger		theChild = theLayout->child( aView->data, aNode, i ),
+						theRunLength,
+						theDepth = aDepth,
+						theBest = aBest,
+						theMin = _fuzzyStep( aSearch, theDepth++, theKeys[i] );
+		const unichar	* theRun = theLayout->run( aView->data, theChild, &theRunLength );
+		if( _fuzzyDistance( aSearch, theDepth ) < theBest )
+			theBest = _fuzzyDistance( aSearch, theDepth );
+		for( NSUInteger j = 0; j < theRunLength && _fuzzyCanMatch( aSearch, theMin, theBest ); j++ )
+		{
+			theMin = _fuzzyStep( aSearch, theDepth++, theRun[j] );
+			if( _fuzzyDistance( aSearch, theDepth ) < theBest )
+				theBest = _fuzzyDistance( aSearch, theDepth );
+		}
+		if( _fuzzyCanMatch( aSearch, theMin, theBest ) )
+		{
+			_viewKeyGrow( aKey, aCapacity, theDepth );
+			(*aKey)[aDepth] = theKeys[i];
+			memcpy( *aKey+aDepth+1, theRun, theRunLength*sizeof(unichar) );
+			_fuzzySearchView( aSearch, aView, theChild, aKey, aCapacity, theDepth, theBest, theMin );
+		}
+	}
+}
+
+NSArray * everyObjectNearKeyInView( const struct trieView * aView, const unichar * aKey, NSUInteger aLength, NSUInteger aMaxDistance, BOOL aPrefix )
+{
+	struct fuzzySearch		theSearch;
+	unichar					* theKey = NULL;
+	NSUInteger				theCapacity = 0;
+	_fuzzyInit( &theSearch, aKey, aLength, aMaxDistance, aPrefix );
+	@try
+	{
+		_viewKeyGrow( &theKey, &theCapacity, aLength+1 );
+		_fuzzySearchView( &theSearch, aView, 0, &theKey, &theCapacity, 0, aLength, 0 );
+	}
+	@finally
+	{
+		free( theSearch.rows );
+		free( theKey );
+	}
+	return _fuzzyResult( &theSearch );
+}
+
+/*
+	The bulk builder sorts the keys, folded for case insensitive tries, so keys with the same prefix are next to each
+	other, then every node can be made once with a child array of exactly the right size instead of growing as keys
+	are inserted. index is the position of the key in the input, it breaks ties so the last of any duplicate keys wins,
+	as it would if they were set one at a time.
+ */
+struct bulkKey
+{
+	const unichar	* characters;
+	NSUInteger		length,
+					index;
+};
+
+static int _compareBulkKeys( const void * aKeyA, const void * aKeyB )
+{
+	const struct bulkKey	* theKeyA = (const struct bulkKey*)aKeyA,
+							* theKeyB = (const struct bulkKey*)aKeyB;
+	NSUInteger				theLength = theKeyA->length < theKeyB->length ? theKeyA->length : theKeyB->length;
+	int						theResult = 0;
+	for( NSUInteger i = 0; i < theLength && theResult == 0; i++ )
+	{
+		if( theKeyA->characters[i] != theKeyB->characters[i] )
+			theResult = theKeyA->characters[i] < theKeyB->characters[i] ? -1 : 1;
+	}
+	if( theResult == 0 && theKeyA->length != theKeyB->length )
+		theResult = theKeyA->length < theKeyB->length ? -1 : 1;
+	if( theResult == 0 && theKeyA->index != theKeyB->index )
+		theResult = theKeyA->index < theKeyB->index ? -1 : 1;
+	return theResult;
+}
+
+static struct trieNode * _buildChild( const struct bulkKey *, NSUInteger, NSUInteger, id *, struct trieArena *, BOOL );
+
+/*
+	every key is at least aDepth long and they all share the first aDepth units, the key of aNode, so those of length
+	aDepth are the object of aNode and the rest are split up by the unit at aDepth in to the children
+ */
+static void _buildNode( struct trieNode * aNode, const struct bulkKey * aKeys, NSUInteger aCount, NSUInteger aDepth, id * anObjects, struct trieArena * anArena, BOOL aCompress )
+{
+	NSUInteger		theFirst = 0,
+					theChildCount = 0;
+	while( theFirst < aCount && aKeys[theFirst].length == aDepth )
+		theFirst++;
+	if( theFirst > 0 )
+	{
+		aNode->object = [anObjects[aKeys[theFirst-1].index] retain];
+		aNode->weight = 0.0;
+	}
+
+	for( NSUInteger i = theFirst; i < aCount; i++ )
+	{
+		if( i == theFirst || aKeys[i].characters[aDepth] != aKeys[i-1].characters[aDepth] )
+			theChildCount++;
+	}
+
+	if( theChildCount > 0 )
+	{
+		_setChildCapacity( aNode, theChildCount, anArena );
+		for( NSUInteger i = theFirst, theEnd; i < aCount; i = theEnd )
+		{
+			unichar				theKey = aKeys[i].characters[aDepth];
+			for( theEnd = i+1; theEnd < aCount && aKeys[theEnd].characters[aDepth] == theKey; theEnd++ )
+				;
+			aNode->childKeys[aNode->count] = theKey;
+			aNode->children[aNode->count++] = _buildChild( aKeys+i, theEnd-i, aDepth, anObjects, anArena, aCompress );
+		}
+		_updateDirectIndex( aNode, anArena );
+	}
+	_updateSubtreeTotals( aNode );
+}
+
+/*
+	makes the child of aParent for keys that all have the same unit at aDepth
+ */
+static struct trieNode * _buildChild( const struct bulkKey * aKeys, NSUInteger aCount, NSUInteger aDepth, id * anObjects, struct trieArena * anArena, BOOL aCompress )
+{
+	struct trieNode		* theChild = _createNode( aKeys[0].characters[aDepth], anArena );
+	NSUInteger			theRunLength = 0;
+	if( aCompress )
+	{
+		/* the keys are sorted, so whatever the first and last have in common every key in between has too */
+		const struct bulkKey	* theLow = &aKeys[0],
+								* theHigh = &aKeys[aCount-1];
+		NSUInteger				theLimit = theLow->length < theHigh->length ? theLow->length : theHigh->length;
+		while( aDepth+1+theRunLength < theLimit && theLow->characters[aDepth+1+theRunLength] == theHigh->characters[aDepth+1+theRunLength] )
+			theRunLength++;
+		_setNodeRun( theChild, theLow->characters+aDepth+1, theRunLength, anArena );
+	}
+	_buildNode( theChild, aKeys, aCount, aDepth+1+theRunLength, anObjects, anArena, aCompress );
+	return theChild;
+}
+
+#if NDTrieUseDispatch
+/*
+	Below this many keys the build is done on the calling thread, handing the work out would cost more than it saves.
+ */
+#define kTrieConcurrentBuildLimit		(1<<14)
+#define kTrieUnitCount					(1<<16)
+
+/*
+	Builds the children of aRoot on every core. The keys are bucketed on their first unit, so each child of aRoot has
+	its own run of keys, the children are then shared out in contiguous chunks of about the same number of keys and each
+	chunk sorts and builds its children with an arena of its own, an arena not being thread safe. The nodes built are
+	the same as _buildNode would build, the arenas of the chunks are handed over to anArena once they are all done.
+ */
+static void _buildRootConcurrently( struct trieNode * aRoot, struct bulkKey * aKeys, NSUInteger aCount, BOOL aSorted, id * anObjects, struct trieArena * anArena, BOOL aCompress )
+{
+	NSUInteger			* theStarts = NULL,
+						* theGroups = NULL,
+						* theChunks = NULL,
+						theGroupCount = 0,
+						theChunkCount = 0;
+	struct bulkKey		* theKeys = aKeys,
+						* theBucketed = NULL;
+	struct trieArena	** theArenas = NULL;
+	NSException			** theExceptions = NULL;
+	BOOL				theBuilt = NO;
+
+	NSCParameterAssert( aRoot->count == 0 );
+	@try
+	{
+		if( (theStarts = (NSUInteger*)calloc( kTrieUnitCount+1, sizeof(NSUInteger) )) == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for building NDTrie" userInfo:nil];
+		for( NSUInteger i = 0; i < aCount; i++ )
+			theStarts[aKeys[i].characters[0]+1]++;
+		for( NSUInteger i = 0; i < kTrieUnitCount; i++ )
+		{
+			if( theStarts[i+1] > 0 )
+				theGroupCount++;
+			theStarts[i+1] += theStarts[i];
+		}
+
+		if( !aSorted )
+		{
+			NSUInteger		* theFill = NULL;
+			if( (theBucketed = (struct bulkKey*)malloc( aCount*sizeof(struct bulkKey) )) == NULL || (theFill = (NSUInteger*)malloc( kTrieUnitCount*sizeof(NSUInteger) )) == NULL )
+			{
+				free( theFill );
+				@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for building NDTrie" userInfo:nil];
+			}
+			memcpy( theFill, theStarts, kTrieUnitCount*sizeof(NSUInteger) );
+			for( NSUInteger i = 0; i < aCount; i++ )
+				theBucketed[theFill[aKeys[i].characters[0]]++] = aKeys[i];
+			free( theFill );
+			theKeys = theBucketed;
+		}
+
+		theChunkCount = [[NSProcessInfo processInfo] activeProcessorCount]*4;
+		if( theChunkCount > theGroupCount )
+			theChunkCount = theGroupCount;
+		if( (theGroups = (NSUInteger*)malloc( (theGroupCount+1)*sizeof(NSUInteger) )) == NULL
+			|| (theChunks = (NSUInteger*)malloc( (theChunkCount+1)*sizeof(NSUInteger) )) == NULL
+			|| (theArenas = (struct trieArena**)calloc( theChunkCount, sizeof(struct trieArena*) )) == NULL
+			|| (theExceptions = (NSException**)calloc( theChunkCount, sizeof(NSException*) )) == NULL )
+		{
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for building NDTrie" userInfo:nil];
+		}
+		for( NSUInteger i = 0, g = 0; i < kTrieUnitCount; i++ )
+		{
+			if( theStarts[i+1] > theStarts[i] )
+				theGroups[g++] = theStarts[i];
+		}
+		theGroups[theGroupCount] = aCount;
+
+		/* cut the children in to chunks at about every aCount/theChunkCount keys */
+		theChunks[0] = 0;
+		for( NSUInteger c = 1, g = 0; c < theChunkCount; c++ )
+		{
+			while( g < theGroupCount && theGroups[g] < c*aCount/theChunkCount )
+				g++;
+			theChunks[c] = g;
+		}
+		theChunks[theChunkCount] = theGroupCount;
+
+		for( NSUInteger c = 0; c < theChunkCount; c++ )
+		{
+			if( (theArenas[c] = createArena()) == NULL )
+				@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for building NDTrie" userInfo:nil];
+		}
+
+		_setChildCapacity( aRoot, theGroupCount, anArena );
+		memset( aRoot->children, 0, theGroupCount*sizeof(struct trieNode*) );		// so the children built can be found if a chunk fails
+		dispatch_apply( theChunkCount, dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_DEFAULT, 0 ), ^( size_t c )
+		{
+			/* an exception can not be allowed to escape a dispatched block, it is thrown again on the calling thread */
+			@try
+			{
+				for( NSUInteger g = theChunks[c]; g < theChunks[c+1]; g++ )
+				{
+					NSUInteger		theStart = theGroups[g],
+									theCount = theGroups[g+1] - theStart;
+					if( !aSorted )
+						qsort( theKeys+theStart, theCount, sizeof(struct bulkKey), _compareBulkKeys );
+					aRoot->childKeys[g] = theKeys[theStart].characters[0];
+					aRoot->children[g] = _buildChild( theKeys+theStart, theCount, 0, anObjects, theArenas[c], aCompress );
+				}
+			}
+			@catch( NSException * anException )
+			{
+				theExceptions[c] = [anException retain];
+			}
+		});
+
+		for( NSUInteger c = 0; c < theChunkCount; c++ )
+		{
+			if( theExceptions[c] != nil )
+			{
+				NSException		* theException = theExceptions[c];
+				theExceptions[c] = nil;
+				@throw [theException autorelease];
+			}
+		}
+		aRoot->count = theGroupCount;
+		_updateDirectIndex( aRoot, anArena );
+		_updateSubtreeTotals( aRoot );
+		theBuilt = YES;
+	}
+	@finally
+	{
+		for( NSUInteger c = 0; theArenas != NULL && c < theChunkCount; c++ )
+		{
+			if( theArenas[c] != NULL )
+				_arenaAdopt( anArena, theArenas[c] );
+		}
+		/* the children the other chunks finished hold retained objects, they are released now their nodes are in anArena */
+		if( !theBuilt && aRoot->children != NULL )
+		{
+			for( NSUInteger g = 0; g < theGroupCount; g++ )
+			{
+				if( aRoot->children[g] != NULL )
+					aRoot->children[aRoot->count++] = aRoot->children[g];
+			}
+			removeAllChildren( aRoot, anArena );
+		}
+		for( NSUInteger c = 0; theExceptions != NULL && c < theChunkCount; c++ )
+		{
+			if( theExceptions[c] != nil )
+				[theExceptions[c] release];
+		}
+		free( theExceptions );
+		free( theArenas );
+		free( theChunks );
+		free( theGroups );
+		free( theBucketed );
+		free( theStarts );
+	}
+}
+#endif
+
+/*
+	Builds the children of the childless aRoot from aCount objects and keys, returns the number of different keys. Every
+	key and object is checked before anything is built so nothing is left half done if one of them is bad. With
+	aConcurrent large builds are spread over every core, see _buildRootConcurrently.
+ */
+NSUInteger buildNodeWithKeys( struct trieNode * aRoot, id * anObjects, NSString ** aKeys, NSUInteger aCount, BOOL aCaseInsensitive, struct trieArena * anArena, BOOL aCompress, BOOL aConcurrent )
+{
+	NSUInteger			theLength = 0,
+						theCount = 0;
+	unichar				* theCharacters = NULL;
+	struct bulkKey		* theKeys = NULL;
+	BOOL				theSorted = YES;
+
+	NSCParameterAssert( aRoot->count == 0 && aRoot->object == nil );
+	for( NSUInteger i = 0; i < aCount; i++ )
+	{
+		if( aKeys[i] == nil )
+			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: key cannot be nil" userInfo:nil];
+		if( ![aKeys[i] isKindOfClass:[NSString class]] )
+			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"An attempt was made to add and object of class %@ to a NDTrie", [aKeys[i] class]] userInfo:nil];
+		if( [aKeys[i] length] == 0 )
+			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: key cannot be empty" userInfo:nil];
+		if( anObjects[i] == nil )
+			@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: object cannot be nil" userInfo:[NSDictionary dictionaryWithObject:aKeys[i] forKey:@"key"]];
+		theLength += [aKeys[i] length];
+	}
+
+	if( aCount > 0 )
+	{
+		@try
+		{
+			if( (theCharacters = (unichar*)malloc( theLength*sizeof(unichar) )) == NULL || (theKeys = (struct bulkKey*)malloc( aCount*sizeof(struct bulkKey) )) == NULL )
+				@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for building NDTrie" userInfo:nil];
+			theLength = 0;
+			for( NSUInteger i = 0; i < aCount; i++ )
+			{
+				theKeys[i].characters = theCharacters+theLength;
+				theKeys[i].length = [aKeys[i] length];
+				theKeys[i].index = i;
+				[aKeys[i] getCharacters:theCharacters+theLength range:NSMakeRange( 0, theKeys[i].length )];
+				if( aCaseInsensitive )
+					_trieKeyFoldCase( theCharacters+theLength, theKeys[i].length );
+				theLength += theKeys[i].length;
+				if( i > 0 && theSorted )
+					theSorted = _compareBulkKeys( &theKeys[i-1], &theKeys[i] ) < 0;
+			}
+#if NDTrieUseDispatch
+			if( aConcurrent && aCount >= kTrieConcurrentBuildLimit )
+				_buildRootConcurrently( aRoot, theKeys, aCount, theSorted, anObjects, anArena, aCompress );
+			else
+#endif
+			{
+				/* word lists are often sorted already */
+				if( !theSorted )
+					qsort( theKeys, aCount, sizeof(struct bulkKey), _compareBulkKeys );
+				_buildNode( aRoot, theKeys, aCount, 0, anObjects, anArena, aCompress );
+			}
+			theCount = aRoot->objectCount;
+		}
+		@finally
+		{
+			free( theKeys );
+			free( theCharacters );
+		}
+	}
+	return theCount;
+}
+
+NSUInteger buildNodeWithArray( struct trieNode * aRoot, NSArray * anArray, BOOL aCaseInsensitive, struct trieArena * anArena, BOOL aCompress, BOOL aConcurrent )
+{
+	NSUInteger		theCount = [anArray count],
+					theResult = 0;
+	id				* theStrings = (id*)malloc( theCount*sizeof(id) );
+	if( theStrings == NULL && theCount > 0 )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for building NDTrie" userInfo:nil];
+	@try
+	{
+		[anArray getObjects:theStrings range:NSMakeRange( 0, theCount )];
+		theResult = buildNodeWithKeys( aRoot, theStrings, theStrings, theCount, aCaseInsensitive, anArena, aCompress, aConcurrent );
+	}
+	@finally
+	{
+		free( theStrings );
+	}
+	return theResult;
+}
+
+NSUInteger buildNodeWithDictionary( struct trieNode * aRoot, NSDictionary * aDictionary, BOOL aCaseInsensitive, struct trieArena * anArena, BOOL aCompress, BOOL aConcurrent )
+{
+	NSUInteger		theCount = [aDictionary count],
+					theResult = 0;
+	id				* theObjects = (id*)malloc( theCount*sizeof(id) ),
+					* theKeys = (id*)malloc( theCount*sizeof(id) );
+	@try
+	{
+		if( theCount > 0 && (theObjects == NULL || theKeys == NULL) )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for building NDTrie" userInfo:nil];
+		[aDictionary getObjects:theObjects andKeys:theKeys];
+		theResult = buildNodeWithKeys( aRoot, theObjects, theKeys, theCount, aCaseInsensitive, anArena, aCompress, aConcurrent );
+	}
+	@finally
+	{
+		free( theObjects );
+		free( theKeys );
+	}
+	return theResult;
+}
+
+/*
+	Reads a word list a buffer at a time and adds each line as it is found, so the memory used depends on the longest
+	line and not the size of the file. A line is a key, or a key then a tab then a weight for the key, the object for
+	each key is the key itself. The progress block, if there is one, is called after each buffer. aCount is added to as
+	new keys are found, so it is right even if an exception is thrown part way through, returns NO if the file could
+	not be opened.
+ */
+enum
+{
+	kTrieLineBufferSize = 64*1024
+};
+
+static double _weightForLine( const char * aBytes, NSUInteger aLength, NSUInteger aLine, NSURL * aURL )
+{
+	char		theString[64],
+				* theEnd = NULL;
+	double		theResult = NAN;
+	if( aLength > 0 && aLength < sizeof(theString) )
+	{
+		memcpy( theString, aBytes, aLength );
+		theString[aLength] = '\0';
+		theResult = strtod( theString, &theEnd );
+	}
+	if( theEnd != theString+aLength || !isfinite(theResult) )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"line %lu of %@ does not have a finite weight", (unsigned long)aLine, aURL] userInfo:nil];
+	return theResult;
+}
+
+BOOL addEveryLineInFile( struct trieNode * aRoot, NSURL * aURL, NSUInteger * aCount, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ), struct trieArena * anArena, BOOL aCompress, void (^aProgress)(unsigned long long,unsigned long long,BOOL*) )
+{
+	FILE				* theFile = [aURL isFileURL] ? fopen( [[aURL path] fileSystemRepresentation], "rb" ) : NULL;
+	char				* theBuffer = NULL;
+	NSUInteger			theSize = kTrieLineBufferSize,
+						theUsed = 0,
+						theLine = 0;
+	unsigned long long	theRead = 0,
+						theTotal = 0;
+	struct stat			theStat;
+	BOOL				theStop = NO,
+						theEndOfFile = NO;
+
+	if( theFile == NULL )
+		return NO;
+
+	@try
+	{
+		if( fstat( fileno(theFile), &theStat ) == 0 )
+			theTotal = (unsigned long long)theStat.st_size;
+		if( (theBuffer = (char*)malloc( theSize )) == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for reading word list" userInfo:nil];
+
+		while( !theEndOfFile && !theStop )
+		{
+			NSUInteger		theLength = fread( theBuffer+theUsed, 1, theSize-theUsed, theFile ),
+							theStart = 0;
+			if( theLength == 0 )
+			{
+				if( ferror( theFile ) )
+					@throw [NSException exceptionWithName:NSGenericException reason:[NSString stringWithFormat:@"Failed to read %@", aURL] userInfo:nil];
+				theEndOfFile = YES;
+			}
+			/* skip a byte order mark */
+			if( theRead == 0 && theUsed+theLength >= 3 && memcmp( theBuffer, "\xEF\xBB\xBF", 3 ) == 0 )
+				theStart = 3;
+			theRead += theLength;
+			theUsed += theLength;
+
+			/* every complete line, and at the end of the file whatever is left */
+			while( theStart < theUsed )
+			{
+				char		* theNewLine = memchr( theBuffer+theStart, '\n', theUsed-theStart ),
+							* theTab = NULL;
+				NSUInteger	theEnd = theNewLine != NULL ? (NSUInteger)(theNewLine-theBuffer) : theUsed,
+							theNext = theEnd+1;
+				double		theWeight = kTrieUnchangedWeight;
+				if( theNewLine == NULL && !theEndOfFile )
+					break;
+				theLine++;
+				if( theEnd > theStart && theBuffer[theEnd-1] == '\r' )
+					theEnd--;
+				if( (theTab = memchr( theBuffer+theStart, '\t', theEnd-theStart )) != NULL )
+				{
+					theWeight = _weightForLine( theTab+1, theEnd-(theTab+1-theBuffer), theLine, aURL );
+					theEnd = theTab-theBuffer;
+				}
+				if( theEnd > theStart )
+				{
+					NSString	* theKey = _isValidUTF8( theBuffer+theStart, theEnd-theStart ) ? [[NSString alloc] initWithBytes:theBuffer+theStart length:theEnd-theStart encoding:NSUTF8StringEncoding] : nil;
+					if( theKey == nil )
+						@throw [NSException exceptionWithName:NSInvalidArgumentException reason:[NSString stringWithFormat:@"line %lu of %@ is not UTF-8", (unsigned long)theLine, aURL] userInfo:nil];
+					@try
+					{
+						*aCount += setObjectForKey( aRoot, theKey, theKey, aKeyComponentFunc, anArena, aCompress, theWeight );
+					}
+					@finally
+					{
+						[theKey release];
 					}
 				}
+				theStart = theNext < theUsed ? theNext : theUsed;
+			}
+
+			/* keep the start of an unfinished line, the buffer only grows for a line longer than it */
+			theUsed -= theStart;
+			memmove( theBuffer, theBuffer+theStart, theUsed );
+			if( theUsed == theSize )
+			{
+				char	* theLarger = (char*)realloc( theBuffer, theSize<<1 );
+				if( theLarger == NULL )
+					@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for reading word list" userInfo:nil];
+				theBuffer = theLarger;
+				theSize <<= 1;
+			}
+			if( aProgress != nil )
+				aProgress( theRead, theTotal > theRead ? theTotal : theRead, &theStop );
+		}
+	}
+	@finally
+	{
+		free( theBuffer );
+		fclose( theFile );
+	}
+	return YES;
+}
+
+/*
+	Writing a binary file takes two walks over the trie, the first to find how big the file is and the second to fill
+	it in, key is the key of the node being written so objects that are the same as their key can be left out.
+ */
+struct fileWriter
+{
+	struct trieFileNode		* nodes;
+	unichar					* keys,
+							* characters;
+	NSUInteger				nodeCount,
+							characterCount;
+	struct keyBuffer		key;
+};
+
+/* counts the characters as if every object has to be written out, returns NO if an object is not a string */
+static BOOL _sizeOfFileForNode( struct trieNode * aNode, NSUInteger * aNodeCount, NSUInteger * aCharacterCount )
+{
+	BOOL		theResult = aNode->object == nil || [aNode->object isKindOfClass:[NSString class]];
+	*aNodeCount += 1;
+	*aCharacterCount += aNode->runLength;
+	if( aNode->object != nil && theResult )
+		*aCharacterCount += [aNode->object length];
+	for( NSUInteger i = 0; i < aNode->count && theResult; i++ )
+		theResult = _sizeOfFileForNode( aNode->children[i], aNodeCount, aCharacterCount );
+	return theResult;
+}
+
+/* the children of a node are given the next free indexes all together before any of them are written */
+static void _writeFileNode( struct fileWriter * aWriter, struct trieNode * aNode, NSUInteger anIndex )
+{
+	struct trieFileNode		* theFileNode = &aWriter->nodes[anIndex];
+	NSUInteger				theFirstChild = aWriter->nodeCount;
+
+	theFileNode->weight = aNode->weight;
+	theFileNode->maxWeight = aNode->maxWeight;
+	theFileNode->objectCount = (uint32_t)aNode->objectCount;
+	theFileNode->run = (uint32_t)aWriter->characterCount;
+	theFileNode->runLength = (uint32_t)aNode->runLength;
+	if( aNode->runLength > 0 )
+		memcpy( aWriter->characters+aWriter->characterCount, aNode->run, aNode->runLength*sizeof(unichar) );
+	aWriter->characterCount += aNode->runLength;
+
+	theFileNode->object = kTrieFileNoObject;
+	theFileNode->objectLength = 0;
+	if( aNode->object != nil )
+	{
+		unichar			* theCharacters = aWriter->characters+aWriter->characterCount;
+		NSUInteger		theLength = [aNode->object length];
+		[aNode->object getCharacters:theCharacters range:NSMakeRange( 0, theLength )];
+		if( theLength == aWriter->key.length && memcmp( theCharacters, aWriter->key.characters, theLength*sizeof(unichar) ) == 0 )
+			theFileNode->object = kTrieFileObjectIsKey;
+		else
+		{
+			theFileNode->object = (uint32_t)aWriter->characterCount;
+			theFileNode->objectLength = (uint32_t)theLength;
+			aWriter->characterCount += theLength;
+		}
+	}
+
+	theFileNode->children = (uint32_t)theFirstChild;
+	theFileNode->count = (uint32_t)aNode->count;
+	aWriter->nodeCount += aNode->count;
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+	{
+		aWriter->keys[theFirstChild+i] = (unichar)aNode->children[i]->key;
+		aWriter->nodes[theFirstChild+i].parent = (uint32_t)anIndex;
+	}
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+	{
+		NSUInteger		theLength = aWriter->key.length;
+		_appendToKeyBuffer( &aWriter->key, aNode->children[i] );
+		_writeFileNode( aWriter, aNode->children[i], theFirstChild+i );
+		aWriter->key.length = theLength;
+	}
+}
+
+/*
+	returns the contents of a binary file for the trie with the root aRoot, or nil if it can not be written because an
+	object is not a string or there are too many nodes
+ */
+NSData * fileDataForNode( struct trieNode * aRoot, NSUInteger aCount, uint16_t aFlags )
+{
+	NSMutableData		* theResult = nil;
+	NSUInteger			theNodeCount = 0,
+						theCharacterCount = 0;
+	if( _sizeOfFileForNode( aRoot, &theNodeCount, &theCharacterCount ) && theNodeCount < kTrieFileObjectIsKey && theCharacterCount < kTrieFileObjectIsKey )
+	{
+		struct trieFileHeader	* theHeader;
+		struct fileWriter		theWriter;
+
+		theResult = [NSMutableData dataWithLength:(NSUInteger)kTrieFileLength( theNodeCount, theCharacterCount )];
+		theHeader = (struct trieFileHeader*)[theResult mutableBytes];
+		theWriter.nodes = (struct trieFileNode*)(theHeader+1);
+		theWriter.keys = (unichar*)(theWriter.nodes+theNodeCount);
+		theWriter.characters = theWriter.keys+theNodeCount+kTrieFileKeyPadding;
+		theWriter.nodeCount = 1;
+		theWriter.characterCount = 0;
+		theWriter.key.characters = (unichar*)malloc( 64*sizeof(unichar) );
+		theWriter.key.length = 0;
+		theWriter.key.capacity = 64;
+		@try
+		{
+			_writeFileNode( &theWriter, aRoot, 0 );
+		}
+		@finally
+		{
+			free( theWriter.key.characters );
+		}
+
+		theHeader->magic = kTrieFileMagic;
+		theHeader->byteOrder = kTrieFileByteOrder;
+		theHeader->version = kTrieFileVersion;
+		theHeader->flags = aFlags;
+		theHeader->nodeCount = (uint32_t)theNodeCount;
+		theHeader->characterCount = (uint32_t)theWriter.characterCount;
+		theHeader->count = aCount;
+		[theResult setLength:(NSUInteger)kTrieFileLength( theNodeCount, theWriter.characterCount )];
+	}
+	return theResult;
+}
+
+/*
+	Every index and offset the walks over a mapped file follow without checking, children are given indexes after their
+	parent so following parents always ends at the root, the children of every node together are every node but the
+	root once, which makes the nodes a tree, and the object counts are checked so the count can be trusted as well.
+ */
+static BOOL _isValidMap( const struct trieMap * aMap )
+{
+	uint64_t		theNodeCount = aMap->header->nodeCount,
+					theCharacterCount = aMap->header->characterCount,
+					theChildCount = 0;
+	BOOL			theResult = aMap->nodes[0].objectCount == aMap->header->count;
+	for( uint64_t i = 0; i < theNodeCount && theResult; i++ )
+	{
+		const struct trieFileNode	* theFileNode = &aMap->nodes[i];
+		uint64_t					theObjectCount = theFileNode->object != kTrieFileNoObject ? 1 : 0;
+		theResult = (uint64_t)theFileNode->run + theFileNode->runLength <= theCharacterCount
+			&& (theFileNode->object >= kTrieFileObjectIsKey || (uint64_t)theFileNode->object + theFileNode->objectLength <= theCharacterCount)
+			&& (theFileNode->count == 0 || (theFileNode->children > i && (uint64_t)theFileNode->children + theFileNode->count <= theNodeCount));
+		for( uint64_t c = theFileNode->children; c < (uint64_t)theFileNode->children+theFileNode->count && theResult; c++ )
+		{
+			theResult = aMap->nodes[c].parent == i && (c == theFileNode->children || aMap->keys[c-1] < aMap->keys[c]);
+			theObjectCount += aMap->nodes[c].objectCount;
+		}
+		theChildCount += theFileNode->count;
+		theResult = theResult && theObjectCount == theFileNode->objectCount;
+	}
+	return theResult && theChildCount == theNodeCount - 1;
+}
+
+/*
+	Returns NO if aData is not a binary file this version can read, or if any of its nodes would take a walk outside of
+	it, which takes one pass over the nodes
+ */
+BOOL initMap( struct trieMap * aMap, NSData * aData )
+{
+	const struct trieFileHeader		* theHeader = (const struct trieFileHeader*)[aData bytes];
+	BOOL							theResult = [aData length] >= sizeof(struct trieFileHeader)
+										&& theHeader->magic == kTrieFileMagic && theHeader->byteOrder == kTrieFileByteOrder
+										&& theHeader->version == kTrieFileVersion && theHeader->nodeCount > 0
+										&& (uint64_t)[aData length] == kTrieFileLength( theHeader->nodeCount, theHeader->characterCount );
+	if( theResult )
+	{
+		aMap->header = theHeader;
+		aMap->nodes = (const struct trieFileNode*)(theHeader+1);
+		aMap->keys = (const unichar*)(aMap->nodes+theHeader->nodeCount);
+		aMap->characters = aMap->keys+theHeader->nodeCount+kTrieFileKeyPadding;
+		theResult = _isValidMap( aMap );
+	}
+	return theResult;
+}
+
+/* the nodes of a mapped file as a view, the children of a node follow one another and every node has its own run */
+static const unichar * _mapChildKeys( const void * aMap, NSUInteger aNode, NSUInteger * aCount )
+{
+	const struct trieFileNode	* theFileNode = &((const struct trieMap*)aMap)->nodes[aNode];
+	*aCount = theFileNode->count;
+	return ((const struct trieMap*)aMap)->keys + theFileNode->children;
+}
+
+static NSUInteger _mapChild( const void * aMap, NSUInteger aNode, NSUInteger anIndex ) { return ((const struct trieMap*)aMap)->nodes[aNode].children + anIndex; }
+
+static const unichar * _mapRun( const void * aMap, NSUInteger aNode, NSUInteger * aLength )
+{
+	const struct trieFileNode	* theFileNode = &((const struct trieMap*)aMap)->nodes[aNode];
+	*aLength = theFileNode->runLength;
+	return ((const struct trieMap*)aMap)->characters + theFileNode->run;
+}
+
+static BOOL _mapHasObject( const void * aMap, NSUInteger aNode ) { return ((const struct trieMap*)aMap)->nodes[aNode].object != kTrieFileNoObject; }
+
+/* a new string for the object of aNode, which has the key aKey */
+static id _mapObject( const void * aMap, NSUInteger aNode, const unichar * aKey, NSUInteger aLength )
+{
+	const struct trieMap	* theMap = (const struct trieMap*)aMap;
+	id						theResult = nil;
+	if( theMap->nodes[aNode].object == kTrieFileObjectIsKey )
+		theResult = [NSString stringWithCharacters:aKey length:aLength];
+	else if( theMap->nodes[aNode].object != kTrieFileNoObject )
+		theResult = [NSString stringWithCharacters:theMap->characters+theMap->nodes[aNode].object length:theMap->nodes[aNode].objectLength];
+	return theResult;
+}
+
+static double _mapWeight( const void * aMap, NSUInteger aNode ) { return ((const struct trieMap*)aMap)->nodes[aNode].weight; }
+static double _mapMaxWeight( const void * aMap, NSUInteger aNode ) { return ((const struct trieMap*)aMap)->nodes[aNode].maxWeight; }
+static NSUInteger _mapObjectCount( const void * aMap, NSUInteger aNode ) { return ((const struct trieMap*)aMap)->nodes[aNode].objectCount; }
+static NSUInteger _mapNodeCount( const void * aMap ) { return ((const struct trieMap*)aMap)->header->nodeCount; }
+
+static const struct trieLayout		kTrieMapLayout = { _mapChildKeys, _mapChild, _mapRun, _mapHasObject, _mapObject, _mapWeight, _mapMaxWeight, _mapObjectCount, _mapNodeCount, sizeof(unichar) };
+
+/*
+	The same as lookupNode but for the nodes of a view, returns the index of the node or NSNotFound. A prefix can end
+	part way along the run of the node, if aRemaining is not NULL it is given the number of units of the run left over.
+ */
+NSUInteger viewLookupNode( const struct trieView * aView, const unichar * aKey, NSUInteger aLength, BOOL aPrefix, NSUInteger * aRemaining )
+{
+	const struct trieLayout		* theLayout = aView->layout;
+	NSUInteger					theNode = aLength > 0 ? 0 : NSNotFound,
+								theIndex = 0,
+								theVisited = 0,
+								theRemaining = 0;
+	while( theNode != NSNotFound && theIndex < aLength )
+	{
+		NSUInteger		theCount,
+						thePosition;
+		const unichar	* theKeys = theLayout->childKeys( aView->data, theNode, &theCount );
+		thePosition = _lowerBoundKeys( theKeys, theCount, aKey[theIndex] );
+		theVisited++;
+		if( thePosition < theCount && theKeys[thePosition] == aKey[theIndex] )
+		{
+			NSUInteger		theRunLength;
+			const unichar	* theRun;
+			theIndex++;
+			theNode = theLayout->child( aView->data, theNode, thePosition );
+			theRun = theLayout->run( aView->data, theNode, &theRunLength );
+			if( theRunLength > 0 )
+			{
+				NSUInteger		theCompareLength = aLength - theIndex < theRunLength ? aLength - theIndex : theRunLength;
+				if( memcmp( theRun, aKey+theIndex, theCompareLength*sizeof(unichar) ) != 0 || (theCompareLength < theRunLength && !aPrefix) )
+					theNode = NSNotFound;
+				theRemaining = theRunLength - theCompareLength;
+				theIndex += theCompareLength;
+			}
+		}
+		else
+			theNode = NSNotFound;
+	}
+	_countLookup( theVisited );
+	if( aRemaining != NULL )
+		*aRemaining = theNode != NSNotFound ? theRemaining : 0;
+	return theNode;
+}
+
+/* the object of aNode which has the key aKey, nil if aNode is NSNotFound or has no object */
+id viewObjectForNode( const struct trieView * aView, NSUInteger aNode, const unichar * aKey, NSUInteger aLength )
+{
+	return aNode != NSNotFound ? aView->layout->object( aView->data, aNode, aKey, aLength ) : nil;
+}
+
+static void _viewCursorGrow( struct viewCursor * aCursor, NSUInteger aDepth, NSUInteger aLength )
+{
+	if( aDepth >= aCursor->capacity )
+	{
+		NSUInteger		theCapacity = aCursor->capacity < 16 ? 32 : aCursor->capacity*2;
+		NSUInteger		* theNodes,
+						* theChildren,
+						* theLengths;
+		if( (theNodes = (NSUInteger*)realloc( aCursor->nodes, theCapacity*sizeof(NSUInteger) )) != NULL )
+			aCursor->nodes = theNodes;
+		if( (theChildren = (NSUInteger*)realloc( aCursor->children, theCapacity*sizeof(NSUInteger) )) != NULL )
+			aCursor->children = theChildren;
+		if( (theLengths = (NSUInteger*)realloc( aCursor->lengths, theCapacity*sizeof(NSUInteger) )) != NULL )
+			aCursor->lengths = theLengths;
+		if( theNodes == NULL || theChildren == NULL || theLengths == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for enumerator" userInfo:nil];
+		aCursor->capacity = theCapacity;
+	}
+	_viewKeyGrow( &aCursor->key, &aCursor->keyCapacity, aLength );
+}
+
+/* aStart is the node for aKey, or NSNotFound for a cursor that returns nothing */
+void initViewCursor( struct viewCursor * aCursor, const struct trieView * aView, NSUInteger aStart, const unichar * aKey, NSUInteger aLength )
+{
+	aCursor->view = *aView;
+	aCursor->nodes = aCursor->children = aCursor->lengths = NULL;
+	aCursor->key = NULL;
+	aCursor->depth = aCursor->capacity = aCursor->length = aCursor->keyCapacity = 0;
+	aCursor->started = NO;
+	@try
+	{
+		_viewCursorGrow( aCursor, 0, aLength );
+	}
+	@catch( NSException * anException )
+	{
+		freeViewCursor( aCursor );
+		@throw;
+	}
+	if( aLength > 0 )
+		memcpy( aCursor->key, aKey, aLength*sizeof(unichar) );
+	if( aStart != NSNotFound )
+	{
+		aCursor->nodes[0] = aStart;
+		aCursor->children[0] = 0;
+		aCursor->lengths[0] = aLength;
+		aCursor->depth = 1;
+	}
+}
+
+/* follows the edge with the unit aKey from the node at the bottom of the cursor down to aNode */
+static NSUInteger _viewCursorPush( struct viewCursor * aCursor, NSUInteger aNode, unichar aKey )
+{
+	NSUInteger		theRunLength,
+					theLength;
+	const unichar	* theRun = aCursor->view.layout->run( aCursor->view.data, aNode, &theRunLength );
+	theLength = aCursor->lengths[aCursor->depth-1] + 1 + theRunLength;
+	_viewCursorGrow( aCursor, aCursor->depth, theLength );
+	aCursor->key[theLength-theRunLength-1] = aKey;
+	memcpy( aCursor->key+theLength-theRunLength, theRun, theRunLength*sizeof(unichar) );
+	aCursor->nodes[aCursor->depth] = aNode;
+	aCursor->children[aCursor->depth] = 0;
+	aCursor->lengths[aCursor->depth++] = theLength;
+	return aNode;
+}
+
+/*
+	returns the nodes in the same order as forEveryObjectInView visits them, including nodes without objects, and
+	NSNotFound once every node has been returned, the key of the node returned is left in key and length
+ */
+NSUInteger viewCursorNextNode( struct viewCursor * aCursor )
+{
+	const struct trieView	* theView = &aCursor->view;
+	NSUInteger				theResult = NSNotFound;
+	if( !aCursor->started )
+	{
+		aCursor->started = YES;
+		if( aCursor->depth > 0 )
+			theResult = aCursor->nodes[0];
+	}
+	while( theResult == NSNotFound && aCursor->depth > 0 )
+	{
+		NSUInteger		theTop = aCursor->depth-1,
+						theCount;
+		const unichar	* theKeys = theView->layout->childKeys( theView->data, aCursor->nodes[theTop], &theCount );
+		if( aCursor->children[theTop] < theCount )
+		{
+			NSUInteger		theIndex = aCursor->children[theTop]++;
+			theResult = _viewCursorPush( aCursor, theView->layout->child( theView->data, aCursor->nodes[theTop], theIndex ), theKeys[theIndex] );
+		}
+		else
+			aCursor->depth--;
+	}
+	if( theResult != NSNotFound )
+		aCursor->length = aCursor->lengths[aCursor->depth-1];
+	return theResult;
+}
+
+/*
+	Moves a new cursor on to just after aKey, as cursorSeekAfter does. Only the children along aKey have to be
+	followed, every child after them comes after aKey. A key that does not start with the key of the start node leaves
+	the cursor at the start if it comes before it, or with nothing left if it comes after everything below it.
+ */
+void viewCursorSeekAfter( struct viewCursor * aCursor, const unichar * aKey, NSUInteger aLength )
+{
+	const struct trieView	* theView = &aCursor->view;
+	NSUInteger				theIndex = 0;
+	BOOL					theFollowing = aCursor->depth > 0;
+	if( theFollowing )
+	{
+		while( theIndex < aCursor->lengths[0] && theIndex < aLength && aKey[theIndex] == aCursor->key[theIndex] )
+			theIndex++;
+		if( theIndex < aCursor->lengths[0] )
+		{
+			theFollowing = NO;
+			if( theIndex < aLength && aKey[theIndex] > aCursor->key[theIndex] )
+				aCursor->depth = 0;
+		}
+		else
+			aCursor->started = YES;
+	}
+	while( theFollowing && theIndex < aLength )
+	{
+		NSUInteger		theTop = aCursor->depth-1,
+						theCount,
+						thePosition;
+		const unichar	* theKeys = theView->layout->childKeys( theView->data, aCursor->nodes[theTop], &theCount );
+		thePosition = _lowerBoundKeys( theKeys, theCount, aKey[theIndex] );
+		aCursor->children[theTop] = thePosition;
+		theFollowing = NO;
+		if( thePosition < theCount && theKeys[thePosition] == aKey[theIndex] )
+		{
+			NSUInteger		theChild = theView->layout->child( theView->data, aCursor->nodes[theTop], thePosition ),
+							theRunLength,
+							theMatched = 0;
+			const unichar	* theRun = theView->layout->run( theView->data, theChild, &theRunLength );
+			theIndex++;
+			while( theMatched < theRunLength && theIndex < aLength && theRun[theMatched] == aKey[theIndex] )
+			{
+				theMatched++;
+				theIndex++;
+			}
+
+			if( theMatched == theRunLength )
+			{
+				aCursor->children[theTop] = thePosition+1;
+				_viewCursorPush( aCursor, theChild, theKeys[thePosition] );
+				theFollowing = YES;
+			}
+			else if( theIndex < aLength && theRun[theMatched] < aKey[theIndex] )
+				aCursor->children[theTop] = thePosition+1;				// the child comes before aKey
+		}
+	}
+}
+
+void freeViewCursor( struct viewCursor * aCursor )
+{
+	free( aCursor->nodes );
+	free( aCursor->children );
+	free( aCursor->lengths );
+	free( aCursor->key );
+	aCursor->nodes = aCursor->children = aCursor->lengths = NULL;
+	aCursor->key = NULL;
+	aCursor->depth = aCursor->capacity = aCursor->keyCapacity = 0;
+}
+
+/* every object below aStart in key order, aKey is the key of aStart */
+BOOL forEveryObjectInView( const struct trieView * aView, NSUInteger aStart, const unichar * aKey, NSUInteger aLength, BOOL(*aFunc)(id,void*), void * aContext )
+{
+	struct viewCursor		theCursor;
+	BOOL					theContinue = YES;
+	initViewCursor( &theCursor, aView, aStart, aKey, aLength );
+	@try
+	{
+		NSUInteger		theNode;
+		while( theContinue && (theNode = viewCursorNextNode( &theCursor )) != NSNotFound )
+		{
+			if( aView->layout->hasObject( aView->data, theNode ) )
+				theContinue = aFunc( aView->layout->object( aView->data, theNode, theCursor.key, theCursor.length ), aContext );
+		}
+	}
+	@finally
+	{
+		freeViewCursor( &theCursor );
+	}
+	return theContinue;
+}
+
+/*
+	The same best first search as forEveryObjectByWeightFromNode, but as a node of a view need not know its key every
+	heap entry is for a path, the node along with the unit of the edge to it and the path to the node before, so the
+	key can be made for each object as it comes off the heap. Path 0 is aStart, the key of which is aKey.
+ */
+struct viewPath
+{
+	NSUInteger		node,
+					parent;
+	unichar			key;
+};
+
+struct viewPaths
+{
+	struct viewPath		* paths;
+	NSUInteger			count,
+						capacity;
+};
+
+static const void * _viewAddPath( struct viewPaths * aPaths, NSUInteger aNode, NSUInteger aParent, unichar aKey )
+{
+	if( aPaths->count >= aPaths->capacity )
+	{
+		NSUInteger			theCapacity = aPaths->capacity < 32 ? 64 : aPaths->capacity*2;
+		struct viewPath		* thePaths = (struct viewPath*)realloc( aPaths->paths, theCapacity*sizeof(struct viewPath) );
+		if( thePaths == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for weighted enumeration" userInfo:nil];
+		aPaths->paths = thePaths;
+		aPaths->capacity = theCapacity;
+	}
+	aPaths->paths[aPaths->count].node = aNode;
+	aPaths->paths[aPaths->count].parent = aParent;
+	aPaths->paths[aPaths->count].key = aKey;
+	return (const void*)(uintptr_t)aPaths->count++;
+}
+
+BOOL forEveryObjectInViewByWeight( const struct trieView * aView, NSUInteger aStart, const unichar * aKey, NSUInteger aLength, BOOL(*aFunc)(id,void*), void * aContext )
+{
+	const struct trieLayout		* theLayout = aView->layout;
+	BOOL						theContinue = YES;
+	struct trieHeap				theHeap = { NULL, 0, 0 };
+	struct viewPaths			thePaths = { NULL, 0, 0 };
+	unichar						* theKey = NULL;
+	NSUInteger					theCapacity = 0;
+	@try
+	{
+		if( theLayout->maxWeight( aView->data, aStart ) > -HUGE_VAL )
+			_heapPush( &theHeap, theLayout->maxWeight( aView->data, aStart ), _viewAddPath( &thePaths, aStart, 0, 0 ), NO );
+		while( theContinue && theHeap.count > 0 )
+		{
+			struct trieHeapEntry	theEntry = _heapPop( &theHeap );
+			NSUInteger				thePath = (NSUInteger)(uintptr_t)theEntry.node,
+									theNode = thePaths.paths[thePath].node;
+			if( theEntry.object )
+			{
+				NSUInteger		theLength = aLength,
+								theRunLength;
+				for( NSUInteger p = thePath; p != 0; p = thePaths.paths[p].parent )
+				{
+					theLayout->run( aView->data, thePaths.paths[p].node, &theRunLength );
+					theLength += 1 + theRunLength;
+				}
+				_viewKeyGrow( &theKey, &theCapacity, theLength );
+				if( aLength > 0 )
+					memcpy( theKey, aKey, aLength*sizeof(unichar) );
+				for( NSUInteger p = thePath, i = theLength; p != 0; p = thePaths.paths[p].parent )
+				{
+					const unichar	* theRun = theLayout->run( aView->data, thePaths.paths[p].node, &theRunLength );
+					i -= theRunLength;
+					memcpy( theKey+i, theRun, theRunLength*sizeof(unichar) );
+					theKey[--i] = thePaths.paths[p].key;
+				}
+				theContinue = aFunc( theLayout->object( aView->data, theNode, theKey, theLength ), aContext );
+			}
+			else
+			{
+				NSUInteger		theCount;
+				const unichar	* theKeys = theLayout->childKeys( aView->data, theNode, &theCount );
+				if( theLayout->hasObject( aView->data, theNode ) )
+					_heapPush( &theHeap, theLayout->weight( aView->data, theNode ), theEntry.node, YES );
+				for( NSUInteger i = 0; i < theCount; i++ )
+				{
+					NSUInteger		theChild = theLayout->child( aView->data, theNode, i );
+					if( theLayout->maxWeight( aView->data, theChild ) > -HUGE_VAL )
+						_heapPush( &theHeap, theLayout->maxWeight( aView->data, theChild ), _viewAddPath( &thePaths, theChild, thePath, theKeys[i] ), NO );
+				}
+			}
+		}
+	}
+	@finally
+	{
+		free( theHeap.entries );
+		free( thePaths.paths );
+		free( theKey );
+	}
+	return theContinue;
+}
+
+/* adds every object in a view to the trie with the root aRoot, returns the number of new keys */
+NSUInteger addEveryObjectInView( const struct trieView * aView, struct trieNode * aRoot, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ), struct trieArena * anArena, BOOL aCompress )
+{
+	struct viewCursor		theCursor;
+	NSUInteger				theCount = 0;
+	initViewCursor( &theCursor, aView, 0, NULL, 0 );
+	@try
+	{
+		NSUInteger		theNode;
+		while( (theNode = viewCursorNextNode( &theCursor )) != NSNotFound )
+		{
+			if( aView->layout->hasObject( aView->data, theNode ) )
+			{
+				NSString		* theKeyString = [[NSString alloc] initWithCharacters:theCursor.key length:theCursor.length];
+				theCount += setObjectForKey( aRoot, aView->layout->object( aView->data, theNode, theCursor.key, theCursor.length ), theKeyString,
+											aKeyComponentFunc, anArena, aCompress, aView->layout->weight( aView->data, theNode ) );
+				[theKeyString release];
+			}
+		}
+	}
+	@finally
+	{
+		freeViewCursor( &theCursor );
+	}
+	return theCount;
+}
+
+/*
+	gives the childless aNode a copy of every child of aSource
+ */
+static void _copyChildren( struct trieNode * aNode, struct trieNode * aSource, struct trieArena * anArena )
+{
+	NSCParameterAssert( aNode->count == 0 );
+	if( aSource->count > 0 )
+	{
+		_setChildCapacity( aNode, aSource->count, anArena );
+		memcpy( aNode->childKeys, aSource->childKeys, aSource->count*sizeof(unichar) );
+		for( NSUInteger i = 0; i < aSource->count; i++ )
+			aNode->children[i] = copyNode( aSource->children[i], anArena );
+		aNode->count = aSource->count;
+		_updateDirectIndex( aNode, anArena );
+	}
+}
+
+/*
+	gives the childless aNode the same children as aSource, without copying them, both must be using anArena
+ */
+void shareChildren( struct trieNode * aNode, struct trieNode * aSource, struct trieArena * anArena )
+{
+	NSCParameterAssert( aNode->count == 0 );
+	if( aSource->count > 0 )
+	{
+		_setChildCapacity( aNode, aSource->count, anArena );
+		memcpy( aNode->childKeys, aSource->childKeys, aSource->count*sizeof(unichar) );
+		memcpy( aNode->children, aSource->children, aSource->count*sizeof(struct trieNode*) );
+		for( NSUInteger i = 0; i < aSource->count; i++ )
+			__sync_fetch_and_add( &aNode->children[i]->refCount, 1 );
+		aNode->count = aSource->count;
+		_updateDirectIndex( aNode, anArena );
+	}
+}
+
+struct trieNode * copyNode( struct trieNode * aNode, struct trieArena * anArena )
+{
+	struct trieNode		* theNode = _createNode( aNode->key, anArena );
+	theNode->object = [aNode->object retain];
+	theNode->weight = aNode->weight;
+	theNode->maxWeight = aNode->maxWeight;
+	theNode->objectCount = aNode->objectCount;
+	_setNodeRun( theNode, aNode->run, aNode->runLength, anArena );
+	_copyChildren( theNode, aNode, anArena );
+	return theNode;
+}
+
+/*
+	The state of a merge, key is the key of the node being merged, only kept up to date when there is a policy to pass
+	it to, share is YES when the nodes of the other trie are in the same arena so they can be shared instead of copied
+ */
+struct trieMerge
+{
+	enum trieMergeOperation		operation;
+	id							(^policy)(NSString *, id, id);
+	struct trieArena			* arena;
+	BOOL						share,
+								compress;
+	struct keyBuffer			key;
+};
+
+static void _appendCharactersToKeyBuffer( struct keyBuffer * aBuffer, const unichar * aCharacters, NSUInteger aLength )
+{
+	if( aBuffer->length + aLength > aBuffer->capacity )
+	{
+		while( aBuffer->length + aLength > aBuffer->capacity )
+			aBuffer->capacity <<= 1;
+		aBuffer->characters = (unichar*)reallocf( aBuffer->characters, aBuffer->capacity*sizeof(unichar) );
+		if( aBuffer->characters == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for NDTrie key" userInfo:nil];
+	}
+	if( aLength > 0 )
+		memcpy( aBuffer->characters+aBuffer->length, aCharacters, aLength*sizeof(unichar) );
+	aBuffer->length += aLength;
+}
+
+/*
+	a node for a subtree only in the other trie, the part of anOther from anOffset units into its run, anOther itself
+	is shared if it can be, otherwise the node is made again and its children are shared or copied
+ */
+static struct trieNode * _mergeAdoptNode( struct trieMerge * aMerge, struct trieNode * anOther, NSUInteger anOffset )
+{
+	struct trieNode		* theResult = anOther;
+	if( anOffset == 0 && aMerge->share )
+		__sync_fetch_and_add( &theResult->refCount, 1 );
+	else
+	{
+		theResult = _createNode( anOffset == 0 ? anOther->key : anOther->run[anOffset-1], aMerge->arena );
+		theResult->object = [anOther->object retain];
+		theResult->weight = anOther->weight;
+		theResult->maxWeight = anOther->maxWeight;
+		theResult->objectCount = anOther->objectCount;
+		_setNodeRun( theResult, anOther->run+anOffset, anOther->runLength-anOffset, aMerge->arena );
+		if( aMerge->share )
+			shareChildren( theResult, anOther, aMerge->arena );
+		else
+			_copyChildren( theResult, anOther, aMerge->arena );
+	}
+	return theResult;
+}
+
+/* the object to keep for a key with an object in both tries, aDefault without a policy */
+static id _mergeObjects( struct trieMerge * aMerge, id anObject, id anOtherObject, id aDefault )
+{
+	id		theResult = aDefault;
+	if( aMerge->policy != nil )
+		theResult = aMerge->policy( [NSString stringWithCharacters:aMerge->key.characters length:aMerge->key.length], anObject, anOtherObject );
+	return theResult;
+}
+
+static BOOL _mergeNode( struct trieMerge *, struct trieNode *, struct trieNode *, NSUInteger );
+
+/*
+	Walks the children of aNode and the aCount children of the other trie in aKeys and aChildren side by side, they
+	are both in key order. For the rest of the run of an other node the one child is the node itself with anOffset
+	the units of its run already passed. Children only in the other trie are added for a union, children only in
+	aNode are dropped for an intersection, and either way the child array is written once, in place unless it grows.
+ */
+static void _mergeChildren( struct trieMerge * aMerge, struct trieNode * aNode, const unichar * aKeys, struct trieNode ** aChildren, NSUInteger aCount, NSUInteger anOffset )
+{
+	BOOL				theUnion = aMerge->operation == kTrieMergeUnion;
+	unichar				* theKeys = aNode->childKeys;
+	struct trieNode		** theChildren = aNode->children;
+	NSUInteger			theSize = aNode->size,
+						theCount = 0,
+						i = 0,
+						j = 0;
+
+	if( theUnion )
+	{
+		NSUInteger		theAdded = 0;
+		while( j < aCount )
+		{
+			if( i < aNode->count && aNode->childKeys[i] < aKeys[j] )
+				i++;
+			else
+			{
+				if( i < aNode->count && aNode->childKeys[i] == aKeys[j] )
+					i++;
+				else
+					theAdded++;
+				j++;
+			}
+		}
+		if( theAdded > 0 )
+		{
+			while( theSize < aNode->count + theAdded )
+				theSize = _largerChildCapacity( theSize );
+			theKeys = (unichar*)_arenaAlloc( aMerge->arena, kTrieChildBlockSize(theSize) );
+			theChildren = (struct trieNode**)((char*)theKeys + kTrieChildKeysSize(theSize));
+		}
+		i = j = 0;
+	}
+
+	while( i < aNode->count || (theUnion && j < aCount) )
+	{
+		struct trieNode		* theChild = NULL;
+		unichar				theKey;
+		if( j >= aCount || (i < aNode->count && aNode->childKeys[i] < aKeys[j]) )		// only in aNode
+		{
+			theKey = aNode->childKeys[i];
+			theChild = aNode->children[i++];
+			if( aMerge->operation == kTrieMergeIntersect )
+			{
+				_releaseNode( theChild, aMerge->arena );
+				theChild = NULL;
+			}
+		}
+		else if( i >= aNode->count || aKeys[j] < aNode->childKeys[i] )				// only in the other trie
+		{
+			theKey = aKeys[j];
+			if( theUnion )
+				theChild = _mergeAdoptNode( aMerge, aChildren[j], anOffset );
+			j++;
+		}
+		else
+		{
+			theKey = aKeys[j];
+			theChild = aNode->children[i];
+			if( anOffset == 0 && theChild == aChildren[j] && (aMerge->policy == nil || aMerge->operation == kTrieMergeMinus) )
+			{
+				/* the same subtree on both sides, from a copy, there is nothing to walk */
+				if( aMerge->operation == kTrieMergeMinus )
+				{
+					_releaseNode( theChild, aMerge->arena );
+					theChild = NULL;
+				}
+			}
+			else
+			{
+				NSUInteger		theLength = aMerge->key.length;
+				theChild = _uniqueChild( aNode, i, aMerge->arena );
+				if( aMerge->policy != nil )
+					_appendCharactersToKeyBuffer( &aMerge->key, &theKey, 1 );
+				if( _mergeNode( aMerge, theChild, aChildren[j], anOffset ) )
+				{
+					_releaseNode( theChild, aMerge->arena );
+					theChild = NULL;
+				}
+				else if( aMerge->compress && theChild->object == nil && theChild->count == 1 )
+					_mergeWithChild( theChild, aMerge->arena );
+				aMerge->key.length = theLength;
 			}
+			i++;
+			j++;
+		}
+		if( theChild != NULL )
+		{
+			theKeys[theCount] = theKey;
+			theChildren[theCount++] = theChild;
+		}
+	}
+
+	if( theKeys != aNode->childKeys )
+	{
+		if( aNode->childKeys != NULL )
+			_arenaFree( aMerge->arena, aNode->childKeys, kTrieChildBlockSize(aNode->size) );
+		aNode->childKeys = theKeys;
+		aNode->children = theChildren;
+		aNode->size = theSize;
+		aNode->count = theCount;
+		_updateDirectIndex( aNode, aMerge->arena );
+	}
+	else if( theCount != aNode->count )
+	{
+		aNode->count = theCount;
+		if( theCount > 0 )
+		{
+			NSUInteger		theSmallerSize;
+			while( (theSmallerSize = _smallerChildCapacity( theSize )) > 0 && theCount <= theSmallerSize>>1 )
+				theSize = theSmallerSize;
+			if( theSize != aNode->size )
+				_setChildCapacity( aNode, theSize, aMerge->arena );
+			_updateDirectIndex( aNode, aMerge->arena );
+		}
+		else
+			_freeChildren( aNode, aMerge->arena );
+	}
+}
+
+/*
+	Merges anOther, from anOffset units into its run, into aNode, which is unshared and is at the same key. aNode is
+	split where the two runs part so its run is never longer than what is left of the run of anOther. Returns YES if
+	aNode is left without an object or children, for the caller to remove.
+ */
+static BOOL _mergeNode( struct trieMerge * aMerge, struct trieNode * aNode, struct trieNode * anOther, NSUInteger anOffset )
+{
+	NSUInteger		theMatched = 0;
+	while( theMatched < aNode->runLength && anOffset+theMatched < anOther->runLength && aNode->run[theMatched] == anOther->run[anOffset+theMatched] )
+		theMatched++;
+	if( theMatched < aNode->runLength )
+		_splitNode( aNode, theMatched, aMerge->arena );
+	if( aMerge->policy != nil )
+		_appendCharactersToKeyBuffer( &aMerge->key, aNode->run, aNode->runLength );
+	anOffset += theMatched;
+
+	if( anOffset < anOther->runLength )			// the other key carries on past aNode
+	{
+		if( aMerge->operation == kTrieMergeIntersect && aNode->object != nil )
+		{
+			[aNode->object release], aNode->object = nil;
+			aNode->weight = 0.0;
+		}
+		_mergeChildren( aMerge, aNode, anOther->run+anOffset, &anOther, 1, anOffset+1 );
+	}
+	else
+	{
+		id		theObject = aNode->object;
+		if( anOther->object != nil && aMerge->operation == kTrieMergeUnion )
+		{
+			if( theObject == nil )
+				aNode->weight = anOther->weight;
+			theObject = theObject == nil ? anOther->object : _mergeObjects( aMerge, theObject, anOther->object, anOther->object );
+		}
+		else if( aMerge->operation == kTrieMergeIntersect )
+			theObject = anOther->object == nil || theObject == nil ? nil : _mergeObjects( aMerge, theObject, anOther->object, theObject );
+		else if( anOther->object != nil && aMerge->operation == kTrieMergeMinus )
+			theObject = nil;
+
+		if( theObject != aNode->object )
+		{
+			[theObject retain];
+			[aNode->object release];
+			aNode->object = theObject;
+			if( theObject == nil )
+				aNode->weight = 0.0;
+		}
+		_mergeChildren( aMerge, aNode, anOther->childKeys, anOther->children, anOther->count, 0 );
+	}
+	_updateSubtreeTotals( aNode );
+	return aNode->object == nil && aNode->count == 0;
+}
+
+/*
+	merges the trie with the root anOtherRoot into the trie with the root aRoot, which keeps the weight of a key in
+	both, returns the number of objects left in aRoot
+ */
+NSUInteger mergeNodes( struct trieNode * aRoot, struct trieNode * anOtherRoot, enum trieMergeOperation anOperation, id (^aPolicy)(NSString *,id,id), struct trieArena * anArena, BOOL aShare, BOOL aCompress )
+{
+	struct trieMerge	theMerge = { anOperation, aPolicy, anArena, aShare, aCompress, { NULL, 0, 64 } };
+	if( aPolicy != nil && (theMerge.key.characters = (unichar*)malloc( theMerge.key.capacity*sizeof(unichar) )) == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for NDTrie key" userInfo:nil];
+	@try
+	{
+		_mergeNode( &theMerge, aRoot, anOtherRoot, 0 );
+	}
+	@finally
+	{
+		free( theMerge.key.characters );
+	}
+	return aRoot->objectCount;
+}
+
+BOOL getObjectsFunc( id anObject, void * aContext )
+{
+	struct getObjectsCountData		* theContent = (struct getObjectsCountData*)aContext;
+	switch( theContent->assignMethod )
+	{
+	case assign:
+		theContent->objects[theContent->index] = anObject;
+		break;
+	case retain:
+		theContent->objects[theContent->index] = [anObject retain];
+		break;
+	case copy:
+		theContent->objects[theContent->index] = [anObject copy];
+		break;
+	}
+	return theContent->count > ++theContent->index;
+}
+
+NSString * nodeDebugDescription( struct trieNode * aNode, NSUInteger aDepth )
+{
+	NSMutableString			* theChildren = [NSMutableString string];
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+		[theChildren appendFormat:@"%s%@", i == 0 ? " " : ", ", nodeDebugDescription(aNode->children[i], aDepth+1)];
+	return [NSString stringWithFormat:@"{key=%lu'%c'%@, object=%s%@%s, depth=%lu, children = [%@]}",
+			(unsigned long)aNode->key, (char)aNode->key, aNode->runLength > 0 ? [NSString stringWithFormat:@", run=\"%@\"", [NSString stringWithCharacters:aNode->run length:aNode->runLength]] : @"",
+			aNode->object != nil ? "\"" : "", aNode->object != nil ? aNode->object : @"nil", aNode->object != nil ? "\"" : "",
+			(unsigned long)aDepth, theChildren];
+}
+
+/*
+	The totals gathered by nodeStatistics and viewStatistics, depths grows as deeper nodes are found, the last entry of
+	fanouts counts every node with kTrieNodeDirectIndexCount or more children.
+ */
+struct trieStatistics
+{
+	NSUInteger		nodeCount,
+					objectCount,
+					childSlotBytesAllocated,
+					childSlotBytesUsed,
+					directIndexBytes,
+					runBytes,
+					maxDepth,
+					chainCount,
+					chainNodeCount,
+					longestChain,
+					sharedNodeCount;
+	NSUInteger		* depths,
+					depthCount,
+					fanouts[kTrieNodeDirectIndexCount+1];
+};
+
+static void _countNode( struct trieStatistics * aStatistics, NSUInteger aDepth, NSUInteger aChildCount, BOOL anObject )
+{
+	if( aDepth >= aStatistics->depthCount )
+	{
+		NSUInteger		theCount = aDepth < 32 ? 64 : aDepth*2,
+						* theDepths = (NSUInteger*)realloc( aStatistics->depths, theCount*sizeof(NSUInteger) );
+		if( theDepths == NULL )
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for NDTrie statistics" userInfo:nil];
+		memset( theDepths+aStatistics->depthCount, 0, (theCount-aStatistics->depthCount)*sizeof(NSUInteger) );
+		aStatistics->depths = theDepths;
+		aStatistics->depthCount = theCount;
+	}
+	aStatistics->depths[aDepth]++;
+	if( aDepth > aStatistics->maxDepth )
+		aStatistics->maxDepth = aDepth;
+	aStatistics->fanouts[aChildCount < kTrieNodeDirectIndexCount ? aChildCount : kTrieNodeDirectIndexCount]++;
+	aStatistics->nodeCount++;
+	if( anObject )
+		aStatistics->objectCount++;
+}
+
+/*
+	a node below the root with one child and no object continues the chain above it, any other node ends it, so every
+	chain is counted once by the node it ends at, returns the length of the chain to pass on to the children
+ */
+static NSUInteger _countChain( struct trieStatistics * aStatistics, NSUInteger aDepth, NSUInteger aChildCount, BOOL anObject, NSUInteger aChain )
+{
+	NSUInteger		theResult = 0;
+	if( aDepth > 0 && aChildCount == 1 && !anObject )
+		theResult = aChain + 1;
+	else if( aChain > 0 )
+	{
+		aStatistics->chainCount++;
+		aStatistics->chainNodeCount += aChain;
+		if( aChain > aStatistics->longestChain )
+			aStatistics->longestChain = aChain;
+	}
+	return theResult;
+}
+
+/* every node below a shared node is shared as well even if its own refCount is 1 */
+static void _gatherStatistics( struct trieNode * aNode, NSUInteger aDepth, NSUInteger aChain, BOOL aShared, struct trieStatistics * aStatistics )
+{
+	aShared = aShared || aNode->refCount > 1;
+	_countNode( aStatistics, aDepth, aNode->count, aNode->object != nil );
+	aChain = _countChain( aStatistics, aDepth, aNode->count, aNode->object != nil, aChain );
+	if( aNode->childKeys != NULL )
+	{
+		aStatistics->childSlotBytesAllocated += kTrieChildBlockSize(aNode->size);
+		aStatistics->childSlotBytesUsed += aNode->count*(sizeof(unichar)+sizeof(struct trieNode*));
+	}
+	if( aNode->directIndex != NULL )
+		aStatistics->directIndexBytes += kTrieNodeDirectIndexCount*sizeof(uint16_t);
+	aStatistics->runBytes += aNode->runLength*sizeof(unichar);
+	if( aShared )
+		aStatistics->sharedNodeCount++;
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+		_gatherStatistics( aNode->children[i], aDepth+1, aChain, aShared, aStatistics );
+}
+
+/*
+	The children of a node of a view are next to each other so only their edges take up child slots. A node of a graph
+	can be reached along more than one path, every node is counted once, at the depth and in the chain of the first path
+	to reach it, and every node reached again along another path is counted as shared, visited is 1 for a node seen
+	once and 2 once it is shared.
+ */
+static void _gatherViewStatistics( const struct trieView * aView, NSUInteger aNode, NSUInteger aDepth, NSUInteger aChain, uint8_t * aVisited, struct trieStatistics * aStatistics )
+{
+	const struct trieLayout		* theLayout = aView->layout;
+	BOOL						theObject = theLayout->hasObject( aView->data, aNode );
+	NSUInteger					theCount,
+								theRunLength;
+	theLayout->childKeys( aView->data, aNode, &theCount );
+	theLayout->run( aView->data, aNode, &theRunLength );
+	aVisited[aNode] = 1;
+	_countNode( aStatistics, aDepth, theCount, theObject );
+	aChain = _countChain( aStatistics, aDepth, theCount, theObject, aChain );
+	aStatistics->childSlotBytesAllocated += theCount*theLayout->childSlotSize;
+	aStatistics->childSlotBytesUsed += theCount*theLayout->childSlotSize;
+	aStatistics->runBytes += theRunLength*sizeof(unichar);
+	for( NSUInteger i = 0; i < theCount; i++ )
+	{
+		NSUInteger		theChild = theLayout->child( aView->data, aNode, i );
+		if( aVisited[theChild] == 0 )
+			_gatherViewStatistics( aView, theChild, aDepth+1, aChain, aVisited, aStatistics );
+		else
+		{
+			_countChain( aStatistics, aDepth+1, 0, theObject, aChain );			// the chain ends where it joins the rest
+			if( aVisited[theChild] == 1 )
+				aStatistics->sharedNodeCount++;
+			aVisited[theChild] = 2;
 		}
 	}
+}
 
+static NSArray * _histogramArray( const NSUInteger * aCounts, NSUInteger aCount )
+{
+	NSMutableArray		* theResult = [NSMutableArray arrayWithCapacity:aCount];
+	for( NSUInteger i = 0; i < aCount; i++ )
+		[theResult addObject:[NSNumber numberWithUnsignedInteger:aCounts[i]]];
 	return theResult;
 }
 
-NSUInteger removeChild( struct trieNode * aRoot, id aPrefix, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL* ) )
+static NSDictionary * _statisticsDictionary( struct trieStatistics * aStatistics, NSUInteger aNodeBytes, NSUInteger aTotalBytes )
 {
-	NSUInteger		theRemoveCount = 0;
-	NSCParameterAssert( aPrefix != nil );
+	NSUInteger		theFanoutCount = kTrieNodeDirectIndexCount+1;
+	while( theFanoutCount > 1 && aStatistics->fanouts[theFanoutCount-1] == 0 )
+		theFanoutCount--;
+	return [NSDictionary dictionaryWithObjectsAndKeys:
+			[NSNumber numberWithUnsignedInteger:aStatistics->nodeCount], NDTrieStatisticsNodeCountKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->objectCount], NDTrieStatisticsObjectCountKey,
+			[NSNumber numberWithUnsignedInteger:aNodeBytes], NDTrieStatisticsNodeBytesKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->childSlotBytesAllocated], NDTrieStatisticsChildSlotBytesAllocatedKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->childSlotBytesUsed], NDTrieStatisticsChildSlotBytesUsedKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->directIndexBytes], NDTrieStatisticsDirectIndexBytesKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->runBytes], NDTrieStatisticsRunBytesKey,
+			[NSNumber numberWithUnsignedInteger:aTotalBytes], NDTrieStatisticsTotalBytesKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->maxDepth], NDTrieStatisticsMaxDepthKey,
+			_histogramArray( aStatistics->depths, aStatistics->maxDepth+1 ), NDTrieStatisticsDepthHistogramKey,
+			_histogramArray( aStatistics->fanouts, theFanoutCount ), NDTrieStatisticsFanoutHistogramKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->chainCount], NDTrieStatisticsSingleChildChainCountKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->chainNodeCount], NDTrieStatisticsSingleChildChainNodeCountKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->longestChain], NDTrieStatisticsLongestSingleChildChainKey,
+			[NSNumber numberWithUnsignedInteger:aStatistics->sharedNodeCount], NDTrieStatisticsSharedNodeCountKey,
+			nil];
+}
 
-	NSUInteger			thePosition = 0;
-	struct trieNode		* theParent = nil,
-						* theNode = findNode( aRoot, aPrefix, 0, NO, &theParent, &thePosition, aKeyComponentFunc );
+/*
+	Without the arena the total is what the nodes asked for, with it the whole of every block, which includes memory
+	that removals have given back and memory used by copies of the trie that share the arena.
+ */
+NSDictionary * nodeStatistics( struct trieNode * aRoot, struct trieArena * anArena )
+{
+	NSDictionary				* theResult = nil;
+	struct trieStatistics		theStatistics;
+	memset( &theStatistics, 0, sizeof(theStatistics) );
+	@try
+	{
+		NSUInteger		theNodeBytes,
+						theTotalBytes;
+		_gatherStatistics( aRoot, 0, 0, NO, &theStatistics );
+		theNodeBytes = theStatistics.nodeCount*sizeof(struct trieNode);
+#if NDTrieUseNodeArena
+		theTotalBytes = _arenaBytes( anArena ) + sizeof(struct trieNode);		// the root is not in the arena
+#else
+		theTotalBytes = theNodeBytes + theStatistics.childSlotBytesAllocated + theStatistics.directIndexBytes + theStatistics.runBytes;
+#endif
+		theResult = _statisticsDictionary( &theStatistics, theNodeBytes, theTotalBytes );
+	}
+	@finally
+	{
+		free( theStatistics.depths );
+	}
+	return theResult;
+}
 
-	NSCParameterAssert( theParent != theNode );
-	
-	if( theNode != NULL && theParent != NULL )
+/* aNodeBytes and aTotalBytes depend on how the view is stored so are worked out by its trie */
+static NSDictionary * viewStatistics( const struct trieView * aView, NSUInteger aNodeBytes, NSUInteger aTotalBytes )
+{
+	NSDictionary				* theResult = nil;
+	struct trieStatistics		theStatistics;
+	uint8_t						* theVisited = (uint8_t*)calloc( aView->layout->nodeCount( aView->data ), sizeof(uint8_t) );
+	if( theVisited == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for NDTrie statistics" userInfo:nil];
+	memset( &theStatistics, 0, sizeof(theStatistics) );
+	@try
 	{
-		theRemoveCount = removeAllChildren( theNode );
-		[theNode->object release];
-		free( theNode );
-		memmove( &theParent->children[thePosition], &theParent->children[thePosition+1], (theParent->count-thePosition)*sizeof(struct trieNode*) );
-		theParent->count--;
+		_gatherViewStatistics( aView, 0, 0, 0, theVisited, &theStatistics );
+		theStatistics.objectCount = aView->layout->objectCount( aView->data, 0 );		// a node of a graph with an object can be the end of many keys
+		theResult = _statisticsDictionary( &theStatistics, aNodeBytes, aTotalBytes );
 	}
-	return theRemoveCount;
+	@finally
+	{
+		free( theVisited );
+		free( theStatistics.depths );
+	}
+	return theResult;
 }
 
-BOOL setObjectForKey( struct trieNode * aNode, id anObject, id aKey, NSUInteger (*aKeyComponentFunc)( id, NSUInteger, BOOL * ) )
+static NSUInteger _scanStateCount( struct trieNode * aNode )
 {
-	if( aKey == nil )
-		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: key cannot be nil" userInfo:nil];
-	if( anObject == nil )
-		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"setObjectForKey: object cannot be nil" userInfo:[NSDictionary dictionaryWithObject:aKey forKey:@"key"]];
+	NSUInteger		theResult = 1 + aNode->runLength;
+	for( NSUInteger i = 0; i < aNode->count; i++ )
+		theResult += _scanStateCount( aNode->children[i] );
+	return theResult;
+}
 
-	BOOL				theNewString = NO;
-	struct trieNode		* theNode = findNode( aNode, aKey, 0, YES, NULL, NULL, aKeyComponentFunc );
-	NSCParameterAssert( theNode != NULL );
+static inline uint32_t _scanGoto( const struct trieScanner * aScanner, uint32_t aState, unichar aKey )
+{
+	const struct trieScanState	* theState = &aScanner->states[aState];
+	NSUInteger					theIndex = _lowerBoundKeys( aScanner->keys+theState->children, theState->count, aKey );
+	return theIndex < theState->count && aScanner->keys[theState->children+theIndex] == aKey ? theState->children+(uint32_t)theIndex : kTrieScanNoState;
+}
 
-	theNewString = theNode->object == nil;
-	[theNode->object release];
-	theNode->object = [anObject retain];
-	return theNewString;
+/* follows fail links until a state has a child for aKey, ending up at the root if none do */
+static inline uint32_t _scanNext( const struct trieScanner * aScanner, uint32_t aState, unichar aKey )
+{
+	uint32_t		theNext;
+	while( (theNext = _scanGoto( aScanner, aState, aKey )) == kTrieScanNoState && aState != 0 )
+		aState = aScanner->states[aState].fail;
+	return theNext != kTrieScanNoState ? theNext : 0;
 }
 
-BOOL forEveryObjectFromNode( struct trieNode * aNode, BOOL(*aFunc)(id,void*), void * aContext )
+/*
+	The states are laid out breadth first using the states array itself as the queue, sources and runs record the node
+	each state came from and how much of its run had been used, every state gets its children before any of its
+	children do. Then a second pass in the same order fills in fail and output, each only depends on states nearer the
+	root.
+ */
+struct trieScanner * createScanner( struct trieNode * aRoot )
 {
-	BOOL		theContinue = YES;
+	NSUInteger				theCount = _scanStateCount( aRoot ),
+							theNext = 1;
+	struct trieScanner		* theScanner = NULL;
+	struct trieNode			** theSources = NULL;
+	NSUInteger				* theRuns = NULL;
+	if( theCount >= kTrieScanNoState )
+		@throw [NSException exceptionWithName:NSInvalidArgumentException reason:@"Too many characters in the keys of the NDTrie to compile for matching" userInfo:nil];
+	@try
+	{
+		if( (theScanner = (struct trieScanner*)calloc( 1, sizeof(struct trieScanner) )) == NULL
+			|| (theScanner->states = (struct trieScanState*)calloc( theCount, sizeof(struct trieScanState) )) == NULL
+			|| (theScanner->keys = (unichar*)calloc( theCount+kTrieFileKeyPadding, sizeof(unichar) )) == NULL
+			|| (theSources = (struct trieNode**)malloc( theCount*sizeof(struct trieNode*) )) == NULL
+			|| (theRuns = (NSUInteger*)malloc( theCount*sizeof(NSUInteger) )) == NULL )
+		{
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for matching" userInfo:nil];
+		}
+		theScanner->count = theCount;
+		theSources[0] = aRoot;
+		theRuns[0] = 0;
+		for( NSUInteger s = 0; s < theCount; s++ )
+		{
+			struct trieNode		* theNode = theSources[s];
+			NSUInteger			theRun = theRuns[s];
+			theScanner->states[s].children = (uint32_t)theNext;
+			if( theRun < theNode->runLength )
+			{
+				theScanner->keys[theNext] = theNode->run[theRun];
+				theSources[theNext] = theNode;
+				theRuns[theNext++] = theRun+1;
+			}
+			else
+			{
+				for( NSUInteger i = 0; i < theNode->count; i++ )
+				{
+					theScanner->keys[theNext] = (unichar)theNode->children[i]->key;
+					theSources[theNext] = theNode->children[i];
+					theRuns[theNext++] = 0;
+				}
+			}
+			theScanner->states[s].count = (uint32_t)(theNext - theScanner->states[s].children);
+			for( NSUInteger c = theScanner->states[s].children; c < theNext; c++ )
+			{
+				theScanner->states[c].depth = theScanner->states[s].depth + 1;
+				if( theRuns[c] == theSources[c]->runLength )
+					theScanner->states[c].object = [theSources[c]->object retain];
+			}
+		}
+		NSCParameterAssert( theNext == theCount );
 
-	if( aNode->object != nil )
-		theContinue = aFunc( aNode->object, aContext );
+		theScanner->states[0].fail = 0;
+		for( NSUInteger s = 0; s < theCount; s++ )
+		{
+			struct trieScanState	* theState = &theScanner->states[s];
+			theState->output = theState->object != nil ? (uint32_t)s : s > 0 ? theScanner->states[theState->fail].output : kTrieScanNoState;
+			for( uint32_t c = theState->children; c < theState->children+theState->count; c++ )
+			{
+				uint32_t		theFail = kTrieScanNoState;
+				if( s > 0 )
+				{
+					uint32_t	theSuffix = theState->fail;
+					while( (theFail = _scanGoto( theScanner, theSuffix, theScanner->keys[c] )) == kTrieScanNoState && theSuffix != 0 )
+						theSuffix = theScanner->states[theSuffix].fail;
+				}
+				theScanner->states[c].fail = theFail != kTrieScanNoState ? theFail : 0;
+			}
+		}
+	}
+	@catch( NSException * anException )
+	{
+		freeScanner( theScanner );
+		@throw;
+	}
+	@finally
+	{
+		free( theSources );
+		free( theRuns );
+	}
+	return theScanner;
+}
 
-	for( NSUInteger i = 0; i < aNode->count && theContinue; i++ )
-		theContinue = forEveryObjectFromNode( aNode->children[i], aFunc, aContext );
-	return theContinue;
+void freeScanner( struct trieScanner * aScanner )
+{
+	if( aScanner != NULL )
+	{
+		if( aScanner->states != NULL )
+		{
+			for( NSUInteger i = 0; i < aScanner->count; i++ )
+				[aScanner->states[i].object release];
+		}
+		free( aScanner->states );
+		free( aScanner->keys );
+		free( aScanner );
+	}
 }
 
-void forEveryObjectWithBlockFromNode( struct trieNode * aNode, void(^aBlock)(id,BOOL*), BOOL * aStop )
+/* every match, for matches that end at the same place the output links give the longest first */
+static void _scanAll( const struct trieScanner * aScanner, const unichar * aText, NSUInteger aLength, void (^aBlock)(NSRange,id,BOOL*) )
 {
-	if( aNode->object != nil )
-		aBlock( aNode->object, aStop );
+	const struct trieScanState	* theStates = aScanner->states;
+	uint32_t					theState = 0;
+	BOOL						theStop = NO;
+	for( NSUInteger i = 0; i < aLength && !theStop; i++ )
+	{
+		theState = _scanNext( aScanner, theState, aText[i] );
+		for( uint32_t o = theStates[theState].output; o != kTrieScanNoState && !theStop; o = theStates[theStates[o].fail].output )
+			aBlock( NSMakeRange( i+1-theStates[o].depth, theStates[o].depth ), theStates[o].object, &theStop );
+	}
+}
 
-	for( NSUInteger i = 0; i < aNode->count && *aStop == NO; i++ )
-		forEveryObjectWithBlockFromNode( aNode->children[i], aBlock, aStop );
+/*
+	The best match so far is the one that starts first, and is longest of those that start there. Once the string of
+	the current state, which is the longest that any match still to come could start with, starts after the best match
+	nothing better can turn up, so it is reported and the search starts again from the root at its end. At most the
+	length of the longest key is read again each time.
+ */
+static void _scanLeftmostLongest( const struct trieScanner * aScanner, const unichar * aText, NSUInteger aLength, void (^aBlock)(NSRange,id,BOOL*) )
+{
+	const struct trieScanState	* theStates = aScanner->states;
+	uint32_t					theState = 0,
+								theBest = kTrieScanNoState;
+	NSUInteger					theIndex = 0,
+								theStart = 0,
+								theBestStart = 0;
+	BOOL						theStop = NO;
+	while( !theStop )
+	{
+		if( theIndex < aLength )
+		{
+			theState = _scanNext( aScanner, theState, aText[theIndex++] );
+			/* the first match that does not start inside the last one reported is the longest that can be used */
+			for( uint32_t o = theStates[theState].output; o != kTrieScanNoState; o = theStates[theStates[o].fail].output )
+			{
+				if( theIndex - theStates[o].depth >= theStart )
+				{
+					if( theBest == kTrieScanNoState || theIndex - theStates[o].depth <= theBestStart )
+					{
+						theBest = o;
+						theBestStart = theIndex - theStates[o].depth;
+					}
+					break;
+				}
+			}
+		}
+		if( theBest != kTrieScanNoState && (theIndex >= aLength || theIndex - theStates[theState].depth > theBestStart) )
+		{
+			aBlock( NSMakeRange( theBestStart, theStates[theBest].depth ), theStates[theBest].object, &theStop );
+			theStart = theIndex = theBestStart + theStates[theBest].depth;
+			theState = 0;
+			theBest = kTrieScanNoState;
+		}
+		else if( theIndex >= aLength )
+			break;
+	}
 }
 
-void forEveryNodeWithBlockFromNode( struct trieNode * aNode, void(^aBlock)(struct trieNode*,BOOL*), BOOL * aStop )
+/* a plain walk down from the root, no fail links are needed as every match has to start at the beginning */
+static void _scanLongestPrefix( const struct trieScanner * aScanner, const unichar * aText, NSUInteger aLength, void (^aBlock)(NSRange,id,BOOL*) )
 {
-	if( aNode->object != nil )
-		aBlock( aNode, aStop );
+	const struct trieScanState	* theStates = aScanner->states;
+	uint32_t					theState = 0,
+								theBest = kTrieScanNoState;
+	for( NSUInteger i = 0; i < aLength && (theState = _scanGoto( aScanner, theState, aText[i] )) != kTrieScanNoState; i++ )
+	{
+		if( theStates[theState].object != nil )
+			theBest = theState;
+	}
+	if( theBest != kTrieScanNoState )
+	{
+		BOOL		theStop = NO;
+		aBlock( NSMakeRange( 0, theStates[theBest].depth ), theStates[theBest].object, &theStop );
+	}
+}
 
-	for( NSUInteger i = 0; i < aNode->count && *aStop == NO; i++ )
-		forEveryNodeWithBlockFromNode( aNode->children[i], aBlock, aStop );
+void scanString( const struct trieScanner * aScanner, NSString * aString, BOOL aCaseInsensitive, NDTrieMatchOptions anOptions, void (^aBlock)(NSRange,id,BOOL*) )
+{
+	struct trieKey		theText;
+	trieKeyWithString( &theText, aString, aCaseInsensitive );
+	@try
+	{
+		switch( anOptions )
+		{
+		case NDTrieMatchLeftmostLongest:
+			_scanLeftmostLongest( aScanner, theText.characters, theText.length, aBlock );
+			break;
+		case NDTrieMatchLongestPrefix:
+			_scanLongestPrefix( aScanner, theText.characters, theText.length, aBlock );
+			break;
+		default:
+			_scanAll( aScanner, theText.characters, theText.length, aBlock );
+			break;
+		}
+	}
+	@finally
+	{
+		_trieKeyFree( &theText );
+	}
 }
 
-BOOL nodesAreEqual( struct trieNode * aNodeA, struct trieNode * aNodeB )
+/*
+	compactedTrie builds the graph bottom up, the graph nodes below a node are made before it so its edges are known,
+	then the node is looked up in table, a hash table of every node made so far, and only added if there is not one
+	the same already. The edges of the nodes waiting on the rest of their children are kept on the stack pendingKeys
+	and pendingTargets, and key is the key of the node being made so objects can be compared with it. The root is
+	never in the table so 0 marks an empty slot.
+ */
+struct graphBuilder
 {
-	BOOL		theEqual = YES;
+	struct trieGraph	* graph;
+	uint32_t			* table,
+						* pendingTargets;
+	unichar				* pendingKeys,
+						* characters;
+	NSUInteger			tableSize,
+						tableCount,
+						nodeCapacity,
+						edgeCapacity,
+						objectCapacity,
+						pendingCount,
+						pendingCapacity,
+						characterCapacity;
+	BOOL				weighted;
+	struct keyBuffer	key;
+};
 
-	// need to test for two equal object pointers because, the root node they will both be nil
-	if( aNodeA->count == aNodeB->count && aNodeA->key == aNodeB->key && (aNodeA->object == aNodeB->object || [aNodeA->object isEqual:aNodeB->object]) )
+/* the index of every node and edge has to fit in 32 bits, with room for kTrieFileNoObject and kTrieFileObjectIsKey */
+static void * _graphRealloc( void * aPointer, NSUInteger aCount, NSUInteger aSize )
+{
+	void		* theResult = aCount < kTrieFileObjectIsKey ? realloc( aPointer, aCount*aSize ) : NULL;
+	if( theResult == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for compacted NDTrie" userInfo:nil];
+	return theResult;
+}
+
+static NSUInteger _graphGrowCapacity( NSUInteger aCapacity, NSUInteger aCount )
+{
+	if( aCapacity == 0 )
+		aCapacity = 256;
+	while( aCapacity < aCount )
+		aCapacity <<= 1;
+	return aCapacity;
+}
+
+static inline double _graphMaxWeight( const struct trieGraph * aGraph, NSUInteger aNode )
+{
+	return aGraph->weights != NULL ? aGraph->weights[aNode*2+1] : aGraph->nodes[aNode].objectCount > 0 ? 0.0 : -HUGE_VAL;
+}
+
+static double graphWeightForNode( const struct trieGraph * aGraph, NSUInteger aNode )
+{
+	return aGraph->weights != NULL ? aGraph->weights[aNode*2] : 0.0;
+}
+
+/* anObject is nil for no object, anIsKey for an object that is the key, aWeight is 0 for no object */
+static NSUInteger _graphHash( id anObject, BOOL anIsKey, double aWeight, const unichar * aKeys, const uint32_t * aTargets, NSUInteger aCount )
+{
+	uint64_t		theHash = anIsKey ? 1 : (uint64_t)(uintptr_t)anObject,
+					theWeight;
+	memcpy( &theWeight, &aWeight, sizeof(theWeight) );
+	theHash = (theHash ^ theWeight) * 0x100000001B3ULL;
+	for( NSUInteger i = 0; i < aCount; i++ )
+		theHash = (theHash ^ ((uint64_t)aKeys[i] << 32 | aTargets[i])) * 0x100000001B3ULL;
+	return (NSUInteger)(theHash ^ (theHash >> 29));
+}
+
+static NSUInteger _graphHashOfNode( const struct trieGraph * aGraph, NSUInteger aNode )
+{
+	const struct trieGraphNode	* theNode = &aGraph->nodes[aNode];
+	return _graphHash( theNode->object < kTrieFileObjectIsKey ? aGraph->objects[theNode->object] : nil, theNode->object == kTrieFileObjectIsKey,
+						aGraph->weights[aNode*2], aGraph->keys+theNode->edges, aGraph->targets+theNode->edges, theNode->count );
+}
+
+/* objects other than the key are only the same if they are the same object */
+static BOOL _graphNodeIsSame( const struct trieGraph * aGraph, NSUInteger aNode, id anObject, BOOL anIsKey, double aWeight, const unichar * aKeys, const uint32_t * aTargets, NSUInteger aCount )
+{
+	const struct trieGraphNode	* theNode = &aGraph->nodes[aNode];
+	BOOL						theSameObject = anObject == nil ? theNode->object == kTrieFileNoObject
+													: anIsKey ? theNode->object == kTrieFileObjectIsKey
+													: theNode->object < kTrieFileObjectIsKey && aGraph->objects[theNode->object] == anObject;
+	return theSameObject && theNode->count == aCount && aGraph->weights[aNode*2] == aWeight
+			&& memcmp( aGraph->keys+theNode->edges, aKeys, aCount*sizeof(unichar) ) == 0
+			&& memcmp( aGraph->targets+theNode->edges, aTargets, aCount*sizeof(uint32_t) ) == 0;
+}
+
+/* fills in the node anIndex with the aCount pending edges from aBase */
+static void _graphFillNode( struct graphBuilder * aBuilder, NSUInteger anIndex, id anObject, BOOL anIsKey, double aWeight, NSUInteger aBase, NSUInteger aCount )
+{
+	struct trieGraph		* theGraph = aBuilder->graph;
+	struct trieGraphNode	* theNode = &theGraph->nodes[anIndex];
+	double					theMaxWeight = anObject != nil ? aWeight : -HUGE_VAL;
+
+	if( theGraph->edgeCount + aCount > aBuilder->edgeCapacity )
 	{
-		for( NSUInteger i = 0; i < aNodeA->count && theEqual; i++ )
-			theEqual = nodesAreEqual( aNodeA->children[i], aNodeB->children[i] );
+		NSUInteger		theCapacity = _graphGrowCapacity( aBuilder->edgeCapacity, theGraph->edgeCount + aCount );
+		theGraph->keys = (unichar*)_graphRealloc( theGraph->keys, theCapacity, sizeof(unichar) );
+		theGraph->targets = (uint32_t*)_graphRealloc( theGraph->targets, theCapacity, sizeof(uint32_t) );
+		aBuilder->edgeCapacity = theCapacity;
+	}
+	theNode->edges = (uint32_t)theGraph->edgeCount;
+	theNode->count = (uint32_t)aCount;
+	theNode->objectCount = anObject != nil ? 1 : 0;
+	if( aCount > 0 )
+	{
+		memcpy( theGraph->keys+theGraph->edgeCount, aBuilder->pendingKeys+aBase, aCount*sizeof(unichar) );
+		memcpy( theGraph->targets+theGraph->edgeCount, aBuilder->pendingTargets+aBase, aCount*sizeof(uint32_t) );
 	}
+	theGraph->edgeCount += aCount;
+	for( NSUInteger i = theNode->edges; i < theGraph->edgeCount; i++ )
+	{
+		theNode->objectCount += theGraph->nodes[theGraph->targets[i]].objectCount;
+		if( theGraph->weights[theGraph->targets[i]*2+1] > theMaxWeight )
+			theMaxWeight = theGraph->weights[theGraph->targets[i]*2+1];
+	}
+
+	if( anObject == nil )
+		theNode->object = kTrieFileNoObject;
+	else if( anIsKey )
+		theNode->object = kTrieFileObjectIsKey;
 	else
-		theEqual = NO;
-	return theEqual;
+	{
+		if( theGraph->objectCount >= aBuilder->objectCapacity )
+		{
+			aBuilder->objectCapacity = _graphGrowCapacity( aBuilder->objectCapacity, theGraph->objectCount+1 );
+			theGraph->objects = (id*)_graphRealloc( theGraph->objects, aBuilder->objectCapacity, sizeof(id) );
+		}
+		theNode->object = (uint32_t)theGraph->objectCount;
+		theGraph->objects[theGraph->objectCount++] = [anObject retain];
+	}
+	theGraph->weights[anIndex*2] = aWeight;
+	theGraph->weights[anIndex*2+1] = theMaxWeight;
+	if( aWeight != 0.0 )
+		aBuilder->weighted = YES;
 }
 
-struct trieNode * copyNode( struct trieNode * aNode )
+static void _graphGrowTable( struct graphBuilder * aBuilder )
 {
-	struct trieNode		* theNode = _createNode(aNode->key, aNode );
-	theNode->object = [aNode->object retain];
-	theNode->count = theNode->size = aNode->count;
-	theNode->children = (struct trieNode**)malloc( theNode->size * sizeof(struct trieNode*) );
-	for( NSUInteger i = 0; i < theNode->count; i++ )
+	NSUInteger		theSize = aBuilder->tableSize<<1,
+					theMask = theSize-1;
+	uint32_t		* theTable = (uint32_t*)calloc( theSize, sizeof(uint32_t) );
+	if( theTable == NULL )
+		@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for compacted NDTrie" userInfo:nil];
+	for( NSUInteger i = 0; i < aBuilder->tableSize; i++ )
 	{
-		theNode->children[i] = copyNode( aNode->children[i] );
-		theNode->parent = aNode;
+		if( aBuilder->table[i] != 0 )
+		{
+			NSUInteger		theSlot = _graphHashOfNode( aBuilder->graph, aBuilder->table[i] ) & theMask;
+			while( theTable[theSlot] != 0 )
+				theSlot = (theSlot+1) & theMask;
+			theTable[theSlot] = aBuilder->table[i];
+		}
 	}
-	return theNode;
+	free( aBuilder->table );
+	aBuilder->table = theTable;
+	aBuilder->tableSize = theSize;
 }
 
-BOOL getObjectsFunc( id anObject, void * aContext )
+/* the node with the aCount pending edges from aBase, one already made if there is one the same */
+static uint32_t _graphAddNode( struct graphBuilder * aBuilder, id anObject, BOOL anIsKey, double aWeight, NSUInteger aBase, NSUInteger aCount )
 {
-	struct getObjectsCountData		* theContent = (struct getObjectsCountData*)aContext;
-	switch( theContent->assignMethod )
+	struct trieGraph	* theGraph = aBuilder->graph;
+	NSUInteger			theMask = aBuilder->tableSize-1,
+						theSlot = _graphHash( anObject, anIsKey, aWeight, aBuilder->pendingKeys+aBase, aBuilder->pendingTargets+aBase, aCount ) & theMask;
+	uint32_t			theResult = 0;
+	while( theResult == 0 && aBuilder->table[theSlot] != 0 )
 	{
-	case assign:
-		theContent->objects[theContent->index] = anObject;
-		break;
-	case retain:
-		theContent->objects[theContent->index] = [anObject retain];
-		break;
-	case copy:
-		theContent->objects[theContent->index] = [anObject copy];
-		break;
+		if( _graphNodeIsSame( theGraph, aBuilder->table[theSlot], anObject, anIsKey, aWeight, aBuilder->pendingKeys+aBase, aBuilder->pendingTargets+aBase, aCount ) )
+			theResult = aBuilder->table[theSlot];
+		else
+			theSlot = (theSlot+1) & theMask;
 	}
-	return theContent->count > ++theContent->index;
+	if( theResult == 0 )
+	{
+		if( theGraph->nodeCount >= aBuilder->nodeCapacity )
+		{
+			aBuilder->nodeCapacity = _graphGrowCapacity( aBuilder->nodeCapacity, theGraph->nodeCount+1 );
+			theGraph->nodes = (struct trieGraphNode*)_graphRealloc( theGraph->nodes, aBuilder->nodeCapacity, sizeof(struct trieGraphNode) );
+			theGraph->weights = (double*)_graphRealloc( theGraph->weights, aBuilder->nodeCapacity, 2*sizeof(double) );
+		}
+		theResult = (uint32_t)theGraph->nodeCount++;
+		_graphFillNode( aBuilder, theResult, anObject, anIsKey, aWeight, aBase, aCount );
+		aBuilder->table[theSlot] = theResult;
+		if( ++aBuilder->tableCount*2 > aBuilder->tableSize )
+			_graphGrowTable( aBuilder );
+	}
+	return theResult;
 }
 
-NSString * nodeDebugDescription( struct trieNode * aNode )
+static BOOL _graphObjectIsKey( struct graphBuilder * aBuilder, id anObject )
 {
-	NSMutableString			* theChildren = [NSMutableString string];
+	NSUInteger		theLength = aBuilder->key.length;
+	BOOL			theResult = [anObject isKindOfClass:[NSString class]] && [anObject length] == theLength;
+	if( theResult && theLength > 0 )
+	{
+		if( theLength > aBuilder->characterCapacity )
+		{
+			aBuilder->characters = (unichar*)_graphRealloc( aBuilder->characters, theLength, sizeof(unichar) );
+			aBuilder->characterCapacity = theLength;
+		}
+		[anObject getCharacters:aBuilder->characters range:NSMakeRange( 0, theLength )];
+		theResult = memcmp( aBuilder->characters, aBuilder->key.characters, theLength*sizeof(unichar) ) == 0;
+	}
+	return theResult;
+}
+
+/*
+	the graph node for aNode, the key of which is in aBuilder, or for a path compressed node the first of the chain of
+	nodes for its run, the root goes in node 0
+ */
+static uint32_t _buildGraphNode( struct graphBuilder * aBuilder, struct trieNode * aNode, BOOL aRoot )
+{
+	NSUInteger		theBase = aBuilder->pendingCount,
+					theLength = aBuilder->key.length;
+	id				theObject = aNode->object;
+	BOOL			theIsKey = theObject != nil && _graphObjectIsKey( aBuilder, theObject );
+	double			theWeight = theObject != nil ? aNode->weight : 0.0;
+	uint32_t		theResult = 0;
+
+	if( theBase + aNode->count + 1 > aBuilder->pendingCapacity )
+	{
+		NSUInteger		theCapacity = _graphGrowCapacity( aBuilder->pendingCapacity, theBase + aNode->count + 1 );
+		aBuilder->pendingKeys = (unichar*)_graphRealloc( aBuilder->pendingKeys, theCapacity, sizeof(unichar) );
+		aBuilder->pendingTargets = (uint32_t*)_graphRealloc( aBuilder->pendingTargets, theCapacity, sizeof(uint32_t) );
+		aBuilder->pendingCapacity = theCapacity;
+	}
+	aBuilder->pendingCount = theBase + aNode->count;
+
 	for( NSUInteger i = 0; i < aNode->count; i++ )
-		[theChildren appendFormat:@"%s%@", i == 0 ? " " : ", ", nodeDebugDescription(aNode->children[i])];
-	return [NSString stringWithFormat:@"{key=%lu'%c', object=%s%@%s, depth=%lu, children = [%@]}",
-			(unsigned long)aNode->key, (char)aNode->key,
-			aNode->object != nil ? "\"" : "", aNode->object != nil ? aNode->object : @"nil", aNode->object != nil ? "\"" : "",
-			(unsigned long)depthOfNode(aNode), theChildren];
+	{
+		uint32_t		theChild;
+		_appendToKeyBuffer( &aBuilder->key, aNode->children[i] );
+		theChild = _buildGraphNode( aBuilder, aNode->children[i], NO );
+		aBuilder->pendingKeys[theBase+i] = (unichar)aNode->children[i]->key;
+		aBuilder->pendingTargets[theBase+i] = theChild;
+		aBuilder->key.length = theLength;
+	}
+
+	if( aRoot )
+		_graphFillNode( aBuilder, 0, theObject, theIsKey, theWeight, theBase, aNode->count );
+	else
+	{
+		theResult = _graphAddNode( aBuilder, theObject, theIsKey, theWeight, theBase, aNode->count );
+		for( NSUInteger i = aNode->runLength; i > 0; i-- )
+		{
+			aBuilder->pendingKeys[theBase] = aNode->run[i-1];
+			aBuilder->pendingTargets[theBase] = theResult;
+			theResult = _graphAddNode( aBuilder, nil, NO, 0.0, theBase, 1 );
+		}
+	}
+	aBuilder->pendingCount = theBase;
+	return theResult;
+}
+
+struct trieGraph * createGraph( struct trieNode * aRoot )
+{
+	struct graphBuilder		theBuilder;
+	memset( &theBuilder, 0, sizeof(theBuilder) );
+	@try
+	{
+		struct trieGraph		* theGraph;
+		if( (theBuilder.graph = theGraph = (struct trieGraph*)calloc( 1, sizeof(struct trieGraph) )) == NULL
+			|| (theBuilder.table = (uint32_t*)calloc( 1024, sizeof(uint32_t) )) == NULL
+			|| (theBuilder.key.characters = (unichar*)malloc( 64*sizeof(unichar) )) == NULL )
+		{
+			@throw [NSException exceptionWithName:NSMallocException reason:@"Failed to allocate memory for compacted NDTrie" userInfo:nil];
+		}
+		theBuilder.tableSize = 1024;
+		theBuilder.key.capacity = 64;
+		theBuilder.nodeCapacity = 1024;
+		theGraph->nodes = (struct trieGraphNode*)_graphRealloc( NULL, theBuilder.nodeCapacity, sizeof(struct trieGraphNode) );
+		theGraph->weights = (double*)_graphRealloc( NULL, theBuilder.nodeCapacity, 2*sizeof(double) );
+		theGraph->nodeCount = 1;				// the root is made last but goes first
+		_buildGraphNode( &theBuilder, aRoot, YES );
+
+		/* give back the room left for growth, keeping padding after the keys */
+		theGraph->nodes = (struct trieGraphNode*)_graphRealloc( theGraph->nodes, theGraph->nodeCount, sizeof(struct trieGraphNode) );
+		theGraph->keys = (unichar*)_graphRealloc( theGraph->keys, theGraph->edgeCount+kTrieFileKeyPadding, sizeof(unichar) );
+		memset( theGraph->keys+theGraph->edgeCount, 0, kTrieFileKeyPadding*sizeof(unichar) );
+		if( theGraph->edgeCount > 0 )
+			theGraph->targets = (uint32_t*)_graphRealloc( theGraph->targets, theGraph->edgeCount, sizeof(uint32_t) );
+		if( theGraph->objectCount > 0 )
+			theGraph->objects = (id*)_graphRealloc( theGraph->objects, theGraph->objectCount, sizeof(id) );
+		if( theBuilder.weighted )
+			theGraph->weights = (double*)_graphRealloc( theGraph->weights, theGraph->nodeCount, 2*sizeof(double) );
+		else
+		{
+			free( theGraph->weights );
+			theGraph->weights = NULL;
+		}
+	}
+	@catch( NSException * anException )
+	{
+		freeGraph( theBuilder.graph );
+		@throw;
+	}
+	@finally
+	{
+		free( theBuilder.table );
+		free( theBuilder.pendingKeys );
+		free( theBuilder.pendingTargets );
+		free( theBuilder.characters );
+		free( theBuilder.key.characters );
+	}
+	return theBuilder.graph;
+}
+
+void freeGraph( struct trieGraph * aGraph )
+{
+	if( aGraph != NULL )
+	{
+		for( NSUInteger i = 0; i < aGraph->objectCount; i++ )
+			[aGraph->objects[i] release];
+		free( aGraph->objects );
+		free( aGraph->nodes );
+		free( aGraph->keys );
+		free( aGraph->targets );
+		free( aGraph->weights );
+		free( aGraph );
+	}
+}
+
+/* the object of aNode which has the key aKey, nil if aNode is NSNotFound or has no object */
+static id graphObjectForNode( const struct trieGraph * aGraph, NSUInteger aNode, const unichar * aKey, NSUInteger aLength )
+{
+	id		theResult = nil;
+	if( aNode != NSNotFound && aGraph->nodes[aNode].object == kTrieFileObjectIsKey )
+		theResult = [NSString stringWithCharacters:aKey length:aLength];
+	else if( aNode != NSNotFound && aGraph->nodes[aNode].object != kTrieFileNoObject )
+		theResult = aGraph->objects[aGraph->nodes[aNode].object];
+	return theResult;
 }
 
-NSUInteger depthOfNode( struct trieNode * aNode ) { return aNode->parent == nil ? 0 : depthOfNode( aNode->parent )+1; }
+/* the nodes of a graph as a view, every edge is one unit so no node has a run, and a prefix ends at a node like any other key */
+static const unichar * _graphChildKeys( const void * aGraph, NSUInteger aNode, NSUInteger * aCount )
+{
+	const struct trieGraphNode	* theGraphNode = &((const struct trieGraph*)aGraph)->nodes[aNode];
+	*aCount = theGraphNode->count;
+	return ((const struct trieGraph*)aGraph)->keys + theGraphNode->edges;
+}
+
+static NSUInteger _graphChild( const void * aGraph, NSUInteger aNode, NSUInteger anIndex ) { return ((const struct trieGraph*)aGraph)->targets[((const struct trieGraph*)aGraph)->nodes[aNode].edges+anIndex]; }
+
+static const unichar * _graphRun( const void * aGraph, NSUInteger aNode, NSUInteger * aLength )
+{
+	*aLength = 0;
+	return ((const struct trieGraph*)aGraph)->keys;		// never read, but safe to hand to memcpy
+}
+
+static BOOL _graphHasObject( const void * aGraph, NSUInteger aNode ) { return ((const struct trieGraph*)aGraph)->nodes[aNode].object != kTrieFileNoObject; }
+static id _graphObject( const void * aGraph, NSUInteger aNode, const unichar * aKey, NSUInteger aLength ) { return graphObjectForNode( (const struct trieGraph*)aGraph, aNode, aKey, aLength ); }
+static double _graphWeight( const void * aGraph, NSUInteger aNode ) { return graphWeightForNode( (const struct trieGraph*)aGraph, aNode ); }
+static double _graphViewMaxWeight( const void * aGraph, NSUInteger aNode ) { return _graphMaxWeight( (const struct trieGraph*)aGraph, aNode ); }
+static NSUInteger _graphObjectCount( const void * aGraph, NSUInteger aNode ) { return ((const struct trieGraph*)aGraph)->nodes[aNode].objectCount; }
+static NSUInteger _graphNodeCount( const void * aGraph ) { return ((const struct trieGraph*)aGraph)->nodeCount; }
+
+static const struct trieLayout		kTrieGraphLayout = { _graphChildKeys, _graphChild, _graphRun, _graphHasObject, _graphObject, _graphWeight, _graphViewMaxWeight, _graphObjectCount, _graphNodeCount, sizeof(unichar)+sizeof(uint32_t) };
 
 #if 0
 static struct trieNode * nextNode( struct trieNode * aNode )
@@ -1,13 +1,41 @@
 #import <Foundation/Foundation.h>
 #import "NDTrie.h"
+#include <dispatch/dispatch.h>
 
-static NSString		* const kSampleFile = @"/Users/nathan/Developer/Projects/Libraries/ndtrie/sample_file_xml.plist";
+/* the sample file is found next to this file instead of at a path on one machine */
+#define kSampleFile [[[NSString stringWithUTF8String:__FILE__] stringByDeletingLastPathComponent] stringByAppendingPathComponent:@"sample_file_xml.plist"]
 static NSString		* const kUNIXWordsFilePath = @"/usr/share/dict/words";
+static NSString		* const kLowercaseLetters = @"abcdefghijklmnopqrstuvwxyz";
+
+static NSArray * randomWords( unsigned aSeed, NSUInteger aCount, NSUInteger aMaxLength, NSString * anAlphabet );
 
 static void testSetOneCaseInsensitive(BOOL caseInsensitive);
 static void testRemoveKeyHasNoChildren(BOOL aSolo);
 static void testRemoveKeyHasChildren(BOOL aSolo);
 static void testEveryWord();
+static void testNodeAllocator();
+static void testPathCompression();
+static void testChildKinds();
+static void testWideAlphabet();
+static void testCharacterLookup();
+static void testEnumerator();
+static void testFastEnumeration();
+static void testTopObjects();
+static void testPagination();
+static void testMappedTrie();
+static void testBulkLoad();
+static void testConcurrentBuild();
+static void testWordList();
+static void testFuzzySearch();
+static void testConcurrentReads();
+static void testCopyOnWrite();
+static void testConcurrentEnumeration();
+static void testStatistics();
+static void testBatchLookup();
+static void testMatching();
+static void testCompactedTrie();
+static void testSetOperations();
+static void testCompletionSession();
 
 int main (int argc, const char * argv[])
 {
@@ -19,12 +47,55 @@ int main (int argc, const char * argv[])
 		testRemoveKeyHasNoChildren(NO);
 		testRemoveKeyHasChildren(YES);
 		testRemoveKeyHasChildren(NO);
+		testNodeAllocator();
+		testPathCompression();
+		testChildKinds();
+		testWideAlphabet();
+		testCharacterLookup();
+		testEnumerator();
+		testFastEnumeration();
+		testTopObjects();
+		testPagination();
+		testMappedTrie();
+		testBulkLoad();
+		testConcurrentBuild();
+		testWordList();
+		testFuzzySearch();
+		testConcurrentReads();
+		testCopyOnWrite();
+		testConcurrentEnumeration();
+		testStatistics();
+		testBatchLookup();
+		testMatching();
+		testCompactedTrie();
+		testSetOperations();
+		testCompletionSession();
 		printf( "Big test\n" );
 		testEveryWord();
 	}
 	return 0;
 }
 
+/*
+	aCount words of one to aMaxLength characters from anAlphabet, the same words every time for a seed, repeat a
+	character in anAlphabet to make it more likely, the words are not distinct
+ */
+NSArray * randomWords( unsigned aSeed, NSUInteger aCount, NSUInteger aMaxLength, NSString * anAlphabet )
+{
+	NSMutableArray		* theResult = [NSMutableArray arrayWithCapacity:aCount];
+	NSUInteger			theAlphabetLength = anAlphabet.length;
+	unichar				theCharacters[aMaxLength];
+	srandom( aSeed );
+	for( NSUInteger i = 0; i < aCount; i++ )
+	{
+		NSUInteger		theLength = 1 + random()%aMaxLength;
+		for( NSUInteger j = 0; j < theLength; j++ )
+			theCharacters[j] = [anAlphabet characterAtIndex:random()%theAlphabetLength];
+		[theResult addObject:[NSString stringWithCharacters:theCharacters length:theLength]];
+	}
+	return theResult;
+}
+
 void testSetOneCaseInsensitive(BOOL caseInsensitive)
 {
 	NSArray				* theTestTrueStrings = @[@"caterpillar", @"dog", @"catalog", @"creak", @"cat", @"caterpillar", @"camera", @"camcorder"],
@@ -310,10 +381,19 @@ void testEveryWord()
 {
 	NSError					* theError = nil;
 	NSString				* theString = [NSString stringWithContentsOfFile:kUNIXWordsFilePath encoding:NSUTF8StringEncoding error:&theError];
-	NSCAssert( theString != nil, @"Failed to load '%@', error: %@", kUNIXWordsFilePath, theError );
-	NSArray					* theOriginalEveryWord = [theString componentsSeparatedByString:@"\n"];
-	if( [[theOriginalEveryWord lastObject] length] == 0 )
-		theOriginalEveryWord = [theOriginalEveryWord subarrayWithRange:NSMakeRange(0, (theOriginalEveryWord.count-1)>>6)];
+	NSArray					* theOriginalEveryWord = nil;
+	if( theString != nil )
+	{
+		theOriginalEveryWord = [theString componentsSeparatedByString:@"\n"];
+		if( [[theOriginalEveryWord lastObject] length] == 0 )
+			theOriginalEveryWord = [theOriginalEveryWord subarrayWithRange:NSMakeRange(0, (theOriginalEveryWord.count-1)>>6)];
+	}
+	else				// not every system has a words file, the sample file will do
+	{
+		printf( "Failed to load '%s' (%s), using the sample file\n", [kUNIXWordsFilePath UTF8String], [[theError localizedDescription] UTF8String] );
+		theOriginalEveryWord = [[NSSet setWithArray:[NSArray arrayWithContentsOfFile:kSampleFile]] allObjects];
+		NSCAssert( theOriginalEveryWord.count > 0, @"Failed to load '%@'", kSampleFile );
+	}
 	NSMutableArray			* theEveryPresentWord = nil;
 	NDMutableTrie			* theTrie = [NDMutableTrie trie];
 
@@ -405,3 +485,1650 @@ void testEveryWord()
 	[theEveryPresentWord release];
 	[theEveryRemovedWord release];
 }
+
+/*
+	Thin out a trie and fill it again, so nodes and child arrays freed back to the arena are used again
+ */
+void testNodeAllocator()
+{
+	NSArray					* theWords = [[NSOrderedSet orderedSetWithArray:randomWords( 42, 2000, 14, kLowercaseLetters )] array];
+	NSUInteger				theCount = theWords.count;
+
+	@autoreleasepool
+	{
+		NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithArray:theWords];
+		NDTrie				* theExpected = [NDTrie trieWithArray:theWords];
+
+		for( NSUInteger i = 0; i < theCount; i += 2 )
+			[theTrie removeObjectForKey:[theWords objectAtIndex:i]];
+		NSCAssert( theTrie.count == theCount/2, @"%lu strings left after removing half", theTrie.count );
+		for( NSUInteger i = 0; i < theCount; i++ )
+			NSCAssert( [theTrie containsObjectForKey:[theWords objectAtIndex:i]] == (i%2 == 1), @"The Trie was wrong about %@ after removing half", [theWords objectAtIndex:i] );
+
+		for( NSUInteger i = 0; i < theCount; i += 2 )
+			[theTrie addString:[theWords objectAtIndex:i]];
+		NSCAssert( theTrie.count == theCount, @"%lu strings after adding them again", theTrie.count );
+		NSCAssert( [theTrie isEqualToTrie:theExpected], @"The Trie is not the same after adding the strings again" );
+		[theTrie release];
+	}
+}
+
+void testPathCompression()
+{
+	NSArray				* theWords = @[@"romane", @"romanus", @"romulus", @"rubens", @"ruber", @"rubicon", @"rubicundus", @"rub", @"r"];
+	NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:NDTriePathCompression array:theWords];
+	NDTrie				* theUncompressedTrie = [NDTrie trieWithArray:theWords];
+
+	NSCAssert( theTrie.isPathCompressed, @"trie is not path compressed" );
+	NSCAssert( theTrie.count == theWords.count, @"The Trie had %lu strings", theTrie.count );
+	for( NSString * theWord in theWords )
+		NSCAssert( [[theTrie objectForKey:theWord] isEqualToString:theWord], @"The Trie did NOT contain %@", theWord );
+	for( NSString * theWord in @[@"rom", @"roman", @"rubi", @"ru", @"romanes", @"x"] )
+		NSCAssert( ![theTrie containsObjectForKey:theWord], @"The Trie did contain %@", theWord );
+	NSCAssert( [theTrie containsObjectForKeyWithPrefix:@"roma"], @"The Trie did NOT contain prefix roma" );
+	NSCAssert( [theTrie everyObjectForKeyWithPrefix:@"rubic"].count == 2, @"wrong number of objects with prefix rubic" );
+	NSCAssert( [theTrie everyObjectForKeyWithPrefix:@"rom"].count == 3, @"wrong number of objects with prefix rom" );
+	NSCAssert( [theTrie isEqualToTrie:theUncompressedTrie], @"compressed and uncompressed tries are NOT Equal" );
+	NSCAssert( [theUncompressedTrie isEqualToTrie:theTrie], @"uncompressed and compressed tries are NOT Equal" );
+
+	[theTrie removeObjectForKey:@"rub"];
+	[theTrie removeObjectForKey:@"romulus"];
+	[theTrie removeAllObjectsForKeysWithPrefix:@"rubic"];
+	NSCAssert( theTrie.count == theWords.count-4, @"The Trie had %lu strings", theTrie.count );
+	for( NSString * theWord in @[@"romane", @"romanus", @"rubens", @"ruber", @"r"] )
+		NSCAssert( [theTrie containsObjectForKey:theWord], @"The Trie did NOT contain %@", theWord );
+	for( NSString * theWord in @[@"rub", @"romulus", @"rubicon", @"rubicundus"] )
+		NSCAssert( ![theTrie containsObjectForKey:theWord], @"The Trie did contain %@", theWord );
+	NSCAssert( ![theTrie containsObjectForKeyWithPrefix:@"rubi"], @"The Trie did contain prefix rubi" );
+
+	NDMutableTrie		* theCopy = [theTrie mutableCopy];
+	NSCAssert( theCopy.isPathCompressed && [theCopy isEqualToTrie:theTrie], @"The copy is NOT Equal" );
+	[theCopy release];
+	[theTrie release];
+}
+
+/*
+	Grow the root through every size of child array, with and without a direct index, and back down again
+ */
+void testChildKinds()
+{
+	const NSUInteger		kKeyCount = 600;
+	NDMutableTrie			* theTrie = [[NDMutableTrie alloc] init];
+	NSMutableArray			* theKeys = [NSMutableArray arrayWithCapacity:kKeyCount];
+
+	for( NSUInteger i = 0; i < kKeyCount; i++ )
+	{
+		/* interleave the keys so children are inserted in the middle of the arrays and not just on the end */
+		unichar		theCharacter = (unichar)(i % 2 == 0 ? 32 + i/2 : 32 + kKeyCount - 1 - i/2);
+		[theKeys addObject:[NSString stringWithCharacters:&theCharacter length:1]];
+	}
+
+	for( NSUInteger i = 0; i < kKeyCount; i++ )
+	{
+		[theTrie addString:[theKeys objectAtIndex:i]];
+		if( i % 7 == 0 )
+		{
+			for( NSUInteger j = 0; j < kKeyCount; j++ )
+				NSCAssert( [theTrie containsObjectForKey:[theKeys objectAtIndex:j]] == (j <= i), @"The Trie was wrong about %@ after %lu adds", [theKeys objectAtIndex:j], i+1 );
+		}
+	}
+	NSCAssert( theTrie.count == kKeyCount, @"The Trie had %lu strings", theTrie.count );
+
+	for( NSUInteger i = 0; i < kKeyCount-1; i++ )
+	{
+		[theTrie removeObjectForKey:[theKeys objectAtIndex:i]];
+		if( i % 7 == 0 )
+		{
+			for( NSUInteger j = 0; j < kKeyCount; j++ )
+				NSCAssert( [theTrie containsObjectForKey:[theKeys objectAtIndex:j]] == (j > i), @"The Trie was wrong about %@ after %lu removes", [theKeys objectAtIndex:j], i+1 );
+		}
+	}
+	NSCAssert( theTrie.count == 1 && [theTrie containsObjectForKey:[theKeys lastObject]], @"The Trie had %lu strings", theTrie.count );
+	[theTrie release];
+}
+
+/*
+	Look up keys in a trie with a wide alphabet, so the first levels have hundreds of children to search
+ */
+void testWideAlphabet()
+{
+	const NSUInteger		kWordCount = 5000;
+	NSMutableString			* theAlphabet = [NSMutableString string];
+	NSMutableArray			* theWords = [[NSMutableArray alloc] initWithCapacity:kWordCount];
+	NSArray					* thePrefixes,
+							* theEndings = randomWords( 43, kWordCount, 9, kLowercaseLetters );
+
+	for( unichar c = 0x21; c < 0x17F; c++ )
+		[theAlphabet appendFormat:@"%C", c];
+	thePrefixes = [randomWords( 42, kWordCount, 2, theAlphabet ) retain];
+	for( NSUInteger i = 0; i < kWordCount; i++ )
+		[theWords addObject:[[thePrefixes objectAtIndex:i] stringByAppendingString:[theEndings objectAtIndex:i]]];
+
+	@autoreleasepool
+	{
+		NDTrie		* theTrie = [[NDTrie alloc] initWithArray:theWords];
+
+		for( NSUInteger i = 0; i < kWordCount; i++ )
+		{
+			NSCAssert( [[theTrie objectForKey:[theWords objectAtIndex:i]] isEqualToString:[theWords objectAtIndex:i]], @"The Trie did NOT contain %@", [theWords objectAtIndex:i] );
+			NSCAssert( [theTrie containsObjectForKeyWithPrefix:[thePrefixes objectAtIndex:i]], @"The Trie did NOT contain prefix %@", [thePrefixes objectAtIndex:i] );
+		}
+
+		[theTrie release];
+	}
+	[thePrefixes release];
+	[theWords release];
+}
+
+/*
+	The unichar and UTF-8 lookups should find exactly what the NSString ones do
+ */
+void testCharacterLookup()
+{
+	NSString			* theLongWord = [@"" stringByPaddingToLength:300 withString:@"antidisestablishmentarianism" startingAtIndex:0];
+	NSArray				* theWords = @[@"caf\u00e9", @"cafe", @"\U0001F600smile", @"tree", @"treehouse", theLongWord];
+	NDTrie				* theTries[] = { [NDTrie trieWithArray:theWords], [[[NDTrie alloc] initWithOptions:NDTriePathCompression array:theWords] autorelease] };
+	NDTrie				* theCaseInsensitiveTrie = [[[NDTrie alloc] initWithOptions:NDTrieCaseInsensitive array:theWords] autorelease];
+
+	for( NSUInteger t = 0; t < sizeof(theTries)/sizeof(*theTries); t++ )
+	{
+		NDTrie		* theTrie = theTries[t];
+		for( NSString * theWord in [theWords arrayByAddingObjectsFromArray:@[@"caf", @"treeh", @"\U0001F600", @"trees"]] )
+		{
+			unichar			theCharacters[theWord.length];
+			const char		* theUTF8 = [theWord UTF8String];
+			BOOL			theContains = [theTrie containsObjectForKey:theWord],
+							theContainsPrefix = [theTrie containsObjectForKeyWithPrefix:theWord];
+			[theWord getCharacters:theCharacters range:NSMakeRange(0,theWord.length)];
+
+			NSCAssert( [theTrie containsObjectForCharacters:theCharacters length:theWord.length] == theContains, @"characters lookup disagreed for %@", theWord );
+			NSCAssert( [theTrie containsObjectForKeyWithPrefixCharacters:theCharacters length:theWord.length] == theContainsPrefix, @"characters prefix lookup disagreed for %@", theWord );
+			NSCAssert( [theTrie objectForCharacters:theCharacters length:theWord.length] == [theTrie objectForKey:theWord], @"characters object disagreed for %@", theWord );
+			NSCAssert( [theTrie containsObjectForUTF8String:theUTF8 length:strlen(theUTF8)] == theContains, @"UTF-8 lookup disagreed for %@", theWord );
+			NSCAssert( [theTrie containsObjectForKeyWithPrefixUTF8String:theUTF8 length:strlen(theUTF8)] == theContainsPrefix, @"UTF-8 prefix lookup disagreed for %@", theWord );
+			NSCAssert( [theTrie objectForUTF8String:theUTF8 length:strlen(theUTF8)] == [theTrie objectForKey:theWord], @"UTF-8 object disagreed for %@", theWord );
+		}
+		NSCAssert( [theTrie containsObjectForUTF8String:"tree house" length:4], @"UTF-8 lookup did not respect length" );
+		NSCAssert( ![theTrie containsObjectForUTF8String:"caf\xc3" length:4], @"UTF-8 lookup accepted a truncated character" );
+		NSCAssert( ![theTrie containsObjectForKeyWithPrefixUTF8String:"\xff" length:1], @"UTF-8 lookup accepted an invalid byte" );
+		NSCAssert( ![theTrie containsObjectForKeyWithPrefixUTF8String:"\xc1\xb4" length:2], @"UTF-8 lookup accepted an overlong t" );
+		NSCAssert( ![theTrie containsObjectForKeyWithPrefixUTF8String:"\xed\xa0\xbd" length:3], @"UTF-8 lookup accepted a surrogate" );
+	}
+
+	NSCAssert( [theCaseInsensitiveTrie containsObjectForUTF8String:"TreeHouse" length:9], @"case insensitive UTF-8 lookup failed" );
+	NSCAssert( [theCaseInsensitiveTrie containsObjectForKey:[theLongWord uppercaseString]], @"case insensitive long lookup failed" );
+	NSCAssert( [theCaseInsensitiveTrie containsObjectForKeyWithPrefixCharacters:(const unichar[]){'T','R','E','E','H'} length:5], @"case insensitive characters prefix lookup failed" );
+}
+
+void testEnumerator()
+{
+	NSArray				* theWords = @[@"cat", @"catalog", @"catapult", @"category", @"dog", @"doge", @"zebra"];
+	NDMutableTrie		* theTrie = [NDMutableTrie trieWithArray:theWords];
+	NSEnumerator		* theEnumerator = [theTrie objectEnumeratorForKeyWithPrefix:@"cat"];
+	NSMutableSet		* theFound = [NSMutableSet set];
+	id					theObject;
+	BOOL				theThrown = NO;
+
+	[theFound addObject:[theEnumerator nextObject]];
+	[theFound addObjectsFromArray:[theEnumerator allObjects]];
+	NSCAssert( [theFound isEqualToSet:[NSSet setWithArray:[theTrie everyObjectForKeyWithPrefix:@"cat"]]], @"enumerator returned %@", theFound );
+	NSCAssert( [theEnumerator nextObject] == nil, @"enumerator did not finish" );
+
+	[theFound removeAllObjects];
+	for( theEnumerator = [theTrie objectEnumerator]; (theObject = [theEnumerator nextObject]) != nil; )
+		[theFound addObject:theObject];
+	NSCAssert( [theFound isEqualToSet:[NSSet setWithArray:theWords]], @"enumerator returned %@", theFound );
+
+	NSCAssert( [[theTrie objectEnumeratorForKeyWithPrefix:@"cow"] nextObject] == nil, @"enumerator for missing prefix returned an object" );
+	NSCAssert( [[[theTrie objectEnumeratorForKeyWithPrefix:@"dog"] allObjects] count] == 2, @"wrong number of objects with prefix dog" );
+
+	theEnumerator = [theTrie objectEnumerator];
+	[theEnumerator nextObject];
+	[theTrie addString:@"cow"];
+	@try
+	{
+		[theEnumerator nextObject];
+	}
+	@catch( NSException * anException )
+	{
+		theThrown = YES;
+	}
+	NSCAssert( theThrown, @"enumerator did not notice the trie changing" );
+}
+
+void testFastEnumeration()
+{
+	NDMutableTrie		* theTrie = [NDMutableTrie trie];
+	NSMutableSet		* theFound = [NSMutableSet set];
+	NSUInteger			theCount = 0;
+	BOOL				theThrown = NO;
+
+	for( NSUInteger i = 0; i < 5000; i++ )
+		[theTrie addString:[NSString stringWithFormat:@"%lu", (unsigned long)i*7919]];
+
+	for( NSString * theString in theTrie )
+		[theFound addObject:theString];
+	NSCAssert( theFound.count == theTrie.count, @"for in found %lu of %lu", theFound.count, theTrie.count );
+	NSCAssert( [theFound isEqualToSet:[NSSet setWithArray:[theTrie everyObject]]], @"for in found different objects" );
+
+	for( NSString * theString in theTrie )
+	{
+		if( ++theCount == 10 )
+			break;
+	}
+	NSCAssert( theCount == 10, @"could not break out of for in" );
+
+	@try
+	{
+		for( NSString * theString in theTrie )
+			[theTrie removeObjectForKey:theString];
+	}
+	@catch( NSException * anException )
+	{
+		theThrown = YES;
+	}
+	NSCAssert( theThrown, @"for in did not notice the trie changing" );
+}
+
+/*
+	check topObjects:forKeyWithPrefix: against sorting every matching word by weight
+ */
+static void checkTopObjects( NDTrie * aTrie, NSDictionary * aWeights, NSString * aPrefix, NSUInteger aCount )
+{
+	NSArray		* theTop = [aTrie topObjects:aCount forKeyWithPrefix:aPrefix],
+				* theExpected = [[[aWeights allKeys] filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"SELF BEGINSWITH %@", aPrefix]]
+									sortedArrayUsingComparator:^(id a, id b){ return [[aWeights objectForKey:b] compare:[aWeights objectForKey:a]]; }];
+	if( theExpected.count > aCount )
+		theExpected = [theExpected subarrayWithRange:NSMakeRange(0,aCount)];
+	NSCAssert( [theTop isEqualToArray:theExpected], @"top %lu for '%@' was %@ expected %@", aCount, aPrefix, theTop, theExpected );
+}
+
+void testTopObjects()
+{
+	NSArray				* thePrefixes = @[@"", @"a", @"ab", @"abc", @"b", @"zz"],
+						* theWords = randomWords( 7, 2000, 6, @"abcd" );
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression };
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		NDMutableTrie			* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t]];
+		NSMutableDictionary		* theWeights = [NSMutableDictionary dictionary];
+
+		for( NSUInteger i = 0; i < theWords.count; i++ )
+		{
+			NSString	* theWord = [theWords objectAtIndex:i];
+			double		theWeight = (double)i * 13 - 9000.0;		// distinct so the order is certain
+			[theTrie addString:theWord weight:theWeight];
+			[theWeights setObject:@(theWeight) forKey:theWord];
+		}
+		[theTrie addString:@"zzz"];
+		[theWeights setObject:@0.0 forKey:@"zzz"];
+
+		for( NSString * thePrefix in thePrefixes )
+		{
+			checkTopObjects( theTrie, theWeights, thePrefix, 1 );
+			checkTopObjects( theTrie, theWeights, thePrefix, 10 );
+			checkTopObjects( theTrie, theWeights, thePrefix, 5000 );
+		}
+
+		/* move the heaviest words to the bottom, and remove some more */
+		NSArray		* theHeaviest = [theTrie topObjects:20 forKeyWithPrefix:nil];
+		for( NSUInteger i = 0; i < theHeaviest.count; i++ )
+		{
+			NSString	* theWord = [theHeaviest objectAtIndex:i];
+			if( i % 2 == 0 )
+			{
+				[theTrie setObject:theWord forKey:theWord weight:-20000.0 - i];
+				[theWeights setObject:@(-20000.0 - i) forKey:theWord];
+			}
+			else
+			{
+				[theTrie removeObjectForKey:theWord];
+				[theWeights removeObjectForKey:theWord];
+			}
+		}
+		[theTrie removeAllObjectsForKeysWithPrefix:@"abd"];
+		for( NSString * theWord in [theWeights allKeys] )
+		{
+			if( [theWord hasPrefix:@"abd"] )
+				[theWeights removeObjectForKey:theWord];
+		}
+		/* re-adding without a weight keeps the weight */
+		[theTrie addString:[theHeaviest objectAtIndex:0]];
+
+		NSCAssert( theTrie.count == theWeights.count, @"The Trie had %lu strings", theTrie.count );
+		for( NSString * thePrefix in thePrefixes )
+		{
+			checkTopObjects( theTrie, theWeights, thePrefix, 1 );
+			checkTopObjects( theTrie, theWeights, thePrefix, 10 );
+			checkTopObjects( theTrie, theWeights, thePrefix, 5000 );
+		}
+		NDTrie		* theCopy = [theTrie copy];
+		checkTopObjects( theCopy, theWeights, @"a", 10 );
+		[theCopy release];
+		[theTrie release];
+	}
+}
+
+/*
+	page through every word with a prefix and check it against sorting the words
+ */
+static void checkPages( NDTrie * aTrie, NSArray * aWords, NSString * aPrefix, NSUInteger aLimit )
+{
+	NSMutableArray	* thePages = [NSMutableArray array];
+	NSArray			* theExpected = [[aWords filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"SELF BEGINSWITH %@", aPrefix]]
+								sortedArrayUsingComparator:^(id a, id b){ return [a compare:b options:NSLiteralSearch]; }];
+	id				theToken = nil;
+	do
+	{
+		NSArray		* thePage = [aTrie everyObjectForKeyWithPrefix:aPrefix limit:aLimit resumeToken:&theToken];
+		NSCAssert( thePage.count <= aLimit, @"page of %lu for limit %lu", thePage.count, aLimit );
+		NSCAssert( thePage.count == aLimit || theToken == nil, @"short page with a resume token" );
+		[thePages addObjectsFromArray:thePage];
+	}
+	while( theToken != nil );
+	NSCAssert( [thePages isEqualToArray:theExpected], @"pages of %lu for '%@' were %@ expected %@", aLimit, aPrefix, thePages, theExpected );
+	NSCAssert( [aTrie countOfObjectsForKeyWithPrefix:aPrefix] == theExpected.count, @"count for '%@' was %lu expected %lu", aPrefix, [aTrie countOfObjectsForKeyWithPrefix:aPrefix], theExpected.count );
+}
+
+void testPagination()
+{
+	NSArray				* thePrefixes = @[@"", @"a", @"ab", @"abc", @"b", @"zz"];
+	NSSet				* theWords = [NSSet setWithArray:randomWords( 11, 1000, 6, @"abcd" )];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression };
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t] array:[theWords allObjects]];
+		NSArray				* thePage = nil;
+		id					theToken = nil;
+
+		for( NSString * thePrefix in thePrefixes )
+		{
+			checkPages( theTrie, [theWords allObjects], thePrefix, 1 );
+			checkPages( theTrie, [theWords allObjects], thePrefix, 7 );
+			checkPages( theTrie, [theWords allObjects], thePrefix, 5000 );
+		}
+		NSCAssert( [theTrie countOfObjectsForKeyWithPrefix:nil] == theTrie.count, @"count for every object was %lu", [theTrie countOfObjectsForKeyWithPrefix:nil] );
+
+		/* a token still works after the last word returned has been removed, and after words are added before it */
+		thePage = [theTrie everyObjectForKeyWithPrefix:@"a" limit:10 resumeToken:&theToken];
+		NSString	* theLast = [[[thePage lastObject] retain] autorelease];
+		[theTrie removeObjectForKey:theLast];
+		[theTrie addString:@"a"];
+		thePage = [theTrie everyObjectForKeyWithPrefix:@"a" limit:5 resumeToken:&theToken];
+		NSCAssert( [[thePage objectAtIndex:0] compare:theLast options:NSLiteralSearch] == NSOrderedDescending, @"page started with %@ after %@", [thePage objectAtIndex:0], theLast );
+
+		/* removing a whole branch updates the counts above it */
+		[theTrie removeAllObjectsForKeysWithPrefix:@"abc"];
+		NSCAssert( [theTrie countOfObjectsForKeyWithPrefix:@"abc"] == 0, @"count for removed prefix was %lu", [theTrie countOfObjectsForKeyWithPrefix:@"abc"] );
+		NSCAssert( [theTrie countOfObjectsForKeyWithPrefix:@""] == theTrie.count, @"count for every object was %lu", [theTrie countOfObjectsForKeyWithPrefix:@""] );
+		checkPages( theTrie, [theTrie everyObject], @"ab", 3 );
+
+		[theTrie release];
+	}
+
+	NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:NDTrieCaseInsensitive|NDTriePathCompression];
+	NSArray				* thePage = nil;
+	id					theToken = nil;
+	[theTrie addStrings:@"Alpha", @"alphabet", @"ALPS", @"beta", nil];
+	NSCAssert( [theTrie countOfObjectsForKeyWithPrefix:@"aL"] == 3, @"case insensitive count was %lu", [theTrie countOfObjectsForKeyWithPrefix:@"aL"] );
+	thePage = [theTrie everyObjectForKeyWithPrefix:@"al" limit:2 resumeToken:&theToken];
+	NSCAssert( thePage.count == 2 && theToken != nil, @"first case insensitive page was %@", thePage );
+	thePage = [theTrie everyObjectForKeyWithPrefix:@"AL" limit:2 resumeToken:&theToken];
+	NSCAssert( [thePage isEqualToArray:@[@"ALPS"]] && theToken == nil, @"second case insensitive page was %@", thePage );
+	[theTrie release];
+}
+
+void testMappedTrie()
+{
+	NSString			* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieTest.trie"];
+	NSArray				* thePrefixes = @[@"", @"a", @"ab", @"abc", @"B", @"zz"],
+						* theRandomWords = randomWords( 13, 1000, 6, @"abcdabcdABCD" );
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression };
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t]];
+		NSMutableArray		* theWords = [NSMutableArray array];
+		NDTrie				* theMapped = nil;
+		NDMutableTrie		* theCopy = nil;
+		NSUInteger			theCount = 0;
+
+		for( NSUInteger i = 0; i < theRandomWords.count; i++ )
+		{
+			NSString	* theWord = [theRandomWords objectAtIndex:i];
+			if( ![theTrie containsObjectForKey:theWord] )
+				[theWords addObject:theWord];
+			[theTrie addString:theWord weight:(double)(i%97)];
+		}
+		[theTrie setObject:@"b, not its key" forKey:@"b"];
+
+		NSCAssert( [theTrie writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+		theMapped = [NDTrie trieWithMappedContentsOfFile:thePath];
+		NSCAssert( theMapped != nil, @"failed to map %@", thePath );
+		NSCAssert( theMapped.count == theTrie.count, @"mapped count %lu expected %lu", theMapped.count, theTrie.count );
+		NSCAssert( theMapped.isCaseInsensitive == theTrie.isCaseInsensitive && theMapped.isPathCompressed == theTrie.isPathCompressed, @"mapped options changed" );
+		NSCAssert( [theMapped isEqualToTrie:theTrie] && [theTrie isEqualToTrie:theMapped], @"mapped trie is not equal" );
+		NSCAssert( [[theMapped everyObject] isEqualToArray:[theTrie everyObject]], @"mapped trie enumerates in a different order" );
+		NSCAssert( [[theMapped objectForKey:@"b"] isEqualToString:@"b, not its key"], @"mapped object %@", [theMapped objectForKey:@"b"] );
+		NSCAssert( [theMapped objectForKey:@""] == nil && [theMapped objectForKey:@"abcabcabc"] == nil, @"mapped trie found a missing key" );
+
+		for( NSString * theWord in theWords )
+		{
+			NSString	* theKey = theTrie.isCaseInsensitive ? [theWord lowercaseString] : theWord;
+			NSCAssert( [[theMapped objectForKey:theKey] isEqual:[theTrie objectForKey:theKey]], @"mapped trie lookup of %@", theKey );
+			NSCAssert( [theMapped containsObjectForUTF8String:[theKey UTF8String] length:strlen([theKey UTF8String])], @"mapped trie UTF-8 lookup of %@", theKey );
+			NSCAssert( [theMapped weightForKey:theKey] == [theTrie weightForKey:theKey], @"mapped weight of %@", theKey );
+		}
+
+		for( NSString * thePrefix in thePrefixes )
+		{
+			NSCAssert( [[theMapped everyObjectForKeyWithPrefix:thePrefix] isEqualToArray:[theTrie everyObjectForKeyWithPrefix:thePrefix]], @"mapped prefix %@", thePrefix );
+			NSCAssert( [theMapped countOfObjectsForKeyWithPrefix:thePrefix] == [theTrie countOfObjectsForKeyWithPrefix:thePrefix], @"mapped count for %@", thePrefix );
+			NSArray		* theTop = [theMapped topObjects:10 forKeyWithPrefix:thePrefix],
+						* theExpected = [theTrie topObjects:10 forKeyWithPrefix:thePrefix];
+			NSCAssert( theTop.count == theExpected.count, @"mapped top objects for %@ were %@", thePrefix, theTop );
+			for( NSUInteger i = 0; i < theTop.count; i++ )		// objects of the same weight can come in any order
+				NSCAssert( [theTrie weightForKey:[theTop objectAtIndex:i]] == [theTrie weightForKey:[theExpected objectAtIndex:i]], @"mapped top objects for %@ were %@ expected %@", thePrefix, theTop, theExpected );
+			NSCAssert( [[[theMapped objectEnumeratorForKeyWithPrefix:thePrefix] allObjects] isEqualToArray:[theTrie everyObjectForKeyWithPrefix:thePrefix]], @"mapped enumerator for %@", thePrefix );
+			if( t < 2 )
+				checkPages( theMapped, [theTrie everyObjectForKeyWithPrefix:thePrefix], thePrefix, 7 );
+		}
+
+		for( NSString * theWord in theMapped )
+		{
+			if( [theWord length] > 0 )
+				theCount++;
+		}
+		NSCAssert( theCount == theTrie.count, @"fast enumeration of mapped trie returned %lu", theCount );
+
+		theCopy = [theMapped mutableCopy];
+		NSCAssert( [theCopy isEqualToTrie:theTrie], @"mutable copy of mapped trie is not equal" );
+		[theCopy addString:@"dddddddd"];
+		NSCAssert( [theCopy containsObjectForKey:@"dddddddd"] && ![theMapped containsObjectForKey:@"dddddddd"], @"mutable copy shares with the mapped trie" );
+		[theCopy release];
+
+		theCopy = [[NDMutableTrie alloc] initWithMappedContentsOfFile:thePath];
+		NSCAssert( [theCopy isKindOfClass:[NDMutableTrie class]] && [theCopy isEqualToTrie:theTrie], @"mutable trie from mapped file" );
+		[theCopy release];
+
+		[theTrie release];
+	}
+
+	[@"not a trie" writeToFile:thePath atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+	NSCAssert( [NDTrie trieWithMappedContentsOfFile:thePath] == nil, @"mapped a file that is not a trie" );
+
+	/* a damaged file is either turned down or can be read all the way through without going outside of it */
+	NDTrie				* theSmall = [NDTrie trieWithStrings:@"an", @"and", @"ant", @"bee", @"beetle", nil];
+	NSData				* theFile;
+	NSUInteger			theRefused = 0;
+	NSCAssert( [theSmall writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+	theFile = [NSData dataWithContentsOfFile:thePath];
+	for( NSUInteger i = 0; i + sizeof(uint32_t) <= theFile.length; i += sizeof(uint32_t) )
+	{
+		@autoreleasepool
+		{
+			NSMutableData	* theDamaged = [[theFile mutableCopy] autorelease];
+			uint32_t		theValue = 0x00FFFFFF;
+			NDTrie			* theDamagedTrie;
+			[theDamaged replaceBytesInRange:NSMakeRange( i, sizeof(theValue) ) withBytes:&theValue];
+			[theDamaged writeToFile:thePath atomically:YES];
+			if( (theDamagedTrie = [NDTrie trieWithMappedContentsOfFile:thePath]) == nil )
+				theRefused++;
+			else
+			{
+				[theDamagedTrie everyObject];
+				[theDamagedTrie topObjects:3 forKeyWithPrefix:@"a"];
+				[theDamagedTrie everyObjectForKey:@"bet" maxEditDistance:2];
+				[theDamagedTrie statistics];
+				for( NSString * theWord in [theSmall everyObject] )
+					[theDamagedTrie containsObjectForKey:theWord];
+			}
+		}
+	}
+	NSCAssert( theRefused > 0, @"no damaged file was turned down" );
+	[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+}
+
+void testBulkLoad()
+{
+	NSArray		* thePrefixes = @[@"", @"a", @"ab", @"abc", @"B", @"zz"],
+				* theRandomKeys = randomWords( 17, 2000, 7, @"abcdabcdABCD" );
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression };
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		NDMutableTrie		* theExpected = [[NDMutableTrie alloc] initWithOptions:theOptions[t]];
+		NSMutableArray		* theKeys = [NSMutableArray arrayWithArray:theRandomKeys],
+							* theObjects = [NSMutableArray array];
+
+		for( NSUInteger i = 0; i < theKeys.count; i++ )
+		{
+			NSNumber	* theObject = [NSNumber numberWithUnsignedInteger:i];
+			[theObjects addObject:theObject];
+			[theExpected setObject:theObject forKey:[theKeys objectAtIndex:i]];			// duplicates keep the last object
+		}
+
+		for( NSUInteger s = 0; s < 2; s++ )
+		{
+			NSUInteger			theCount = [theKeys count];
+			id					* theObjectArray = malloc( theCount*sizeof(id) ),
+								* theKeyArray = malloc( theCount*sizeof(id) );
+			[theObjects getObjects:theObjectArray range:NSMakeRange( 0, theCount )];
+			[theKeys getObjects:theKeyArray range:NSMakeRange( 0, theCount )];
+
+			NDTrie				* theTrie = [[NDTrie alloc] initWithOptions:theOptions[t] objects:theObjectArray forKeys:theKeyArray count:theCount];
+			NDMutableTrie		* theMutable = [[NDMutableTrie alloc] initWithOptions:theOptions[t]];
+			[theMutable setObjects:theObjectArray forKeys:theKeyArray count:theCount];
+
+			NSCAssert( theTrie.count == theExpected.count && theMutable.count == theExpected.count, @"bulk count %lu expected %lu", theTrie.count, theExpected.count );
+			NSCAssert( [theTrie isEqualToTrie:theExpected] && [theMutable isEqualToTrie:theExpected], @"bulk built trie is not equal" );
+			NSCAssert( [[theTrie everyObject] isEqualToArray:[theExpected everyObject]], @"bulk built trie enumerates in a different order" );
+			for( NSString * theKey in theKeys )
+				NSCAssert( [[theTrie objectForKey:theKey] isEqual:[theExpected objectForKey:theKey]], @"bulk lookup of %@ gave %@", theKey, [theTrie objectForKey:theKey] );
+			for( NSString * thePrefix in thePrefixes )
+			{
+				NSCAssert( [[theTrie everyObjectForKeyWithPrefix:thePrefix] isEqualToArray:[theExpected everyObjectForKeyWithPrefix:thePrefix]], @"bulk prefix %@", thePrefix );
+				NSCAssert( [theTrie countOfObjectsForKeyWithPrefix:thePrefix] == [theExpected countOfObjectsForKeyWithPrefix:thePrefix], @"bulk count for %@", thePrefix );
+			}
+
+			/* a bulk built trie has to carry on working as a normal mutable trie */
+			[theMutable addString:@"dddddddd"];
+			[theMutable addString:@"abcabcab"];
+			for( NSString * theKey in theKeys )
+				[theMutable removeObjectForKey:theKey];
+			NSCAssert( theMutable.count == 2 && [theMutable containsObjectForKey:@"dddddddd"] && [theMutable containsObjectForKey:@"abcabcab"], @"bulk built trie after removing every key %@", [theMutable everyObject] );
+
+			[theMutable release];
+			[theTrie release];
+			free( theKeyArray );
+			free( theObjectArray );
+
+			/* the second time round the keys are already sorted, a stable sort keeps the last of any duplicates last */
+			if( s == 0 )
+			{
+				NSArray		* theOrder = [[theKeys copy] autorelease],
+							* theSortedObjects = [theObjects sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult( id anA, id aB ) {
+								return [[theOrder objectAtIndex:[anA unsignedIntegerValue]] compare:[theOrder objectAtIndex:[aB unsignedIntegerValue]] options:NSLiteralSearch];
+							}];
+				[theKeys removeAllObjects];
+				for( NSNumber * theObject in theSortedObjects )
+					[theKeys addObject:[theOrder objectAtIndex:[theObject unsignedIntegerValue]]];
+				[theObjects setArray:theSortedObjects];
+			}
+		}
+
+		@try
+		{
+			[[[NDTrie alloc] initWithOptions:theOptions[t] array:@[@"abc", [NSNumber numberWithInt:1]]] release];
+			NSCAssert( NO, @"bulk build accepted a key that is not a string" );
+		}
+		@catch( NSException * anException )
+		{
+			NSCAssert( [[anException name] isEqualToString:NSInvalidArgumentException], @"bulk build threw %@", anException );
+		}
+
+		[theExpected release];
+	}
+}
+
+void testConcurrentBuild()
+{
+	NSMutableArray			* theWords = [NSMutableArray arrayWithArray:randomWords( 23, 20000, 12, [NSString stringWithFormat:@"%@%@%@%@", kLowercaseLetters, kLowercaseLetters, kLowercaseLetters, [kLowercaseLetters uppercaseString]] )];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression };
+
+	/* every fifth word starts with hiragana, so the root has more than one block of children */
+	for( NSUInteger i = 0; i < theWords.count; i += 5 )
+		[theWords replaceObjectAtIndex:i withObject:[NSString stringWithFormat:@"%C%@", (unichar)(0x3041 + i%0x56), [[theWords objectAtIndex:i] substringFromIndex:1]]];
+
+	for( NSUInteger t = 0; t < 2*sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NSArray				* theInput = t%2 == 0 ? theWords : [theWords sortedArrayUsingSelector:@selector(compare:)];
+			NDTrie				* theSequential = [[NDTrie alloc] initWithOptions:theOptions[t/2] array:theInput],
+								* theConcurrent = [[NDTrie alloc] initWithOptions:theOptions[t/2]|NDTrieConcurrentBuild array:theInput];
+
+			NSCAssert( theConcurrent.count == theSequential.count, @"concurrent build count %lu expected %lu", theConcurrent.count, theSequential.count );
+			NSCAssert( [theConcurrent isEqualToTrie:theSequential] && [theSequential isEqualToTrie:theConcurrent], @"concurrent build is not equal" );
+			NSCAssert( [[theConcurrent everyObject] isEqualToArray:[theSequential everyObject]], @"concurrent build enumerates in a different order" );
+			NSCAssert( [[theConcurrent everyObjectForKeyWithPrefix:@"ab"] isEqualToArray:[theSequential everyObjectForKeyWithPrefix:@"ab"]], @"concurrent build prefix search" );
+
+			[theConcurrent release];
+			[theSequential release];
+		}
+	}
+}
+
+void testWordList()
+{
+	NSString			* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieTest.txt"];
+	NSMutableString		* theContents = [NSMutableString string];
+	NDMutableTrie		* theExpected = [NDMutableTrie trie];
+	__block NSUInteger	theCalls = 0;
+	__block unsigned long long	theLastRead = 0,
+								theTotal = 0;
+
+	NSArray				* theWords = randomWords( 29, 20000, 10, kLowercaseLetters );			// well over one buffer
+	for( NSUInteger i = 0; i < theWords.count; i++ )
+	{
+		NSString	* theWord = [theWords objectAtIndex:i];
+		if( i%50 == 0 )
+			theWord = [@"\u00e9" stringByAppendingString:[theWord substringFromIndex:1]];
+		if( i%3 == 0 )
+		{
+			[theContents appendFormat:@"%@\t%lu\r\n", theWord, (unsigned long)(i%101)];
+			[theExpected addString:theWord weight:(double)(i%101)];
+		}
+		else
+		{
+			[theContents appendFormat:@"%@\n%@", theWord, i%7 == 0 ? @"\n" : @""];
+			[theExpected addString:theWord];
+		}
+	}
+	[theContents appendString:@"nonewline"];
+	[theExpected addString:@"nonewline"];
+	NSCAssert( [theContents writeToFile:thePath atomically:YES encoding:NSUTF8StringEncoding error:NULL], @"failed to write %@", thePath );
+
+	NDTrie		* theTrie = [[NDTrie alloc] initWithOptions:NDTriePathCompression contentsOfWordListFile:thePath progress:^( unsigned long long aRead, unsigned long long aTotal, BOOL * aStop ) {
+					NSCAssert( aRead >= theLastRead && aRead <= aTotal, @"progress went from %llu to %llu of %llu", theLastRead, aRead, aTotal );
+					theLastRead = aRead;
+					theTotal = aTotal;
+					theCalls++;
+				}];
+	NSCAssert( theTrie != nil, @"failed to read %@", thePath );
+	NSCAssert( theCalls > 1 && theLastRead == theTotal && theTotal == [[[NSFileManager defaultManager] attributesOfItemAtPath:thePath error:NULL] fileSize], @"progress ended at %llu of %llu after %lu calls", theLastRead, theTotal, theCalls );
+	NSCAssert( theTrie.count == theExpected.count && [theTrie isEqualToTrie:theExpected], @"word list has %lu words, expected %lu", theTrie.count, theExpected.count );
+	NSCAssert( [[theTrie everyObject] isEqualToArray:[theExpected everyObject]], @"word list trie enumerates differently" );
+	for( NSString * theWord in theExpected )
+		NSCAssert( [theTrie weightForKey:theWord] == [theExpected weightForKey:theWord], @"weight of %@ is %g, expected %g", theWord, [theTrie weightForKey:theWord], [theExpected weightForKey:theWord] );
+	[theTrie release];
+
+	NDMutableTrie	* theMutable = [NDMutableTrie trie];
+	[theMutable addString:@"already here"];
+	NSCAssert( [theMutable addContentsOfWordListFile:thePath progress:^( unsigned long long aRead, unsigned long long aTotal, BOOL * aStop ) { *aStop = YES; }], @"failed to read %@", thePath );
+	NSCAssert( theMutable.count > 1 && theMutable.count < theExpected.count+1, @"stopping after one buffer read %lu words", theMutable.count );
+	NSCAssert( [theMutable addContentsOfWordListFile:thePath progress:nil] && theMutable.count == theExpected.count+1, @"reading the rest gave %lu words", theMutable.count );
+
+	NSCAssert( [[NDTrie alloc] initWithOptions:0 contentsOfWordListFile:[thePath stringByAppendingPathExtension:@"missing"] progress:nil] == nil, @"read a missing file" );
+
+	[@"good\t1\nbad\tweight\n" writeToFile:thePath atomically:YES encoding:NSUTF8StringEncoding error:NULL];
+	@try
+	{
+		[theMutable addContentsOfWordListFile:thePath progress:nil];
+		NSCAssert( NO, @"a bad weight was accepted" );
+	}
+	@catch( NSException * anException )
+	{
+		NSCAssert( [[anException name] isEqualToString:NSInvalidArgumentException], @"a bad weight threw %@", anException );
+		NSCAssert( [theMutable weightForKey:@"good"] == 1.0, @"the line before the bad weight was not added" );
+	}
+
+	/* an overlong form of a and an encoded surrogate */
+	const char	* theBadLines[] = { "ok\n\xc1\xa1\n", "ok\n\xed\xa0\x80\n" };
+	for( NSUInteger i = 0; i < sizeof(theBadLines)/sizeof(*theBadLines); i++ )
+	{
+		[[NSData dataWithBytes:theBadLines[i] length:strlen(theBadLines[i])] writeToFile:thePath atomically:YES];
+		@try
+		{
+			[theMutable addContentsOfWordListFile:thePath progress:nil];
+			NSCAssert( NO, @"invalid UTF-8 was accepted" );
+		}
+		@catch( NSException * anException )
+		{
+			NSCAssert( [[anException name] isEqualToString:NSInvalidArgumentException], @"invalid UTF-8 threw %@", anException );
+		}
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+}
+
+static NSUInteger editDistance( NSString * aString, NSString * anOther )
+{
+	NSUInteger		theLength = [anOther length],
+					theRow[64],
+					theNext[64];
+	for( NSUInteger j = 0; j <= theLength; j++ )
+		theRow[j] = j;
+	for( NSUInteger i = 1; i <= [aString length]; i++ )
+	{
+		theNext[0] = i;
+		for( NSUInteger j = 1; j <= theLength; j++ )
+		{
+			NSUInteger	theValue = theRow[j-1] + ([aString characterAtIndex:i-1] == [anOther characterAtIndex:j-1] ? 0 : 1);
+			if( theRow[j] + 1 < theValue )
+				theValue = theRow[j] + 1;
+			if( theNext[j-1] + 1 < theValue )
+				theValue = theNext[j-1] + 1;
+			theNext[j] = theValue;
+		}
+		memcpy( theRow, theNext, sizeof(theRow) );
+	}
+	return theRow[theLength];
+}
+
+static NSUInteger prefixEditDistance( NSString * aString, NSString * aPrefix )
+{
+	NSUInteger		theResult = NSUIntegerMax;
+	for( NSUInteger i = 0; i <= [aString length]; i++ )
+	{
+		NSUInteger	theDistance = editDistance( [aString substringToIndex:i], aPrefix );
+		if( theDistance < theResult )
+			theResult = theDistance;
+	}
+	return theResult;
+}
+
+void testFuzzySearch()
+{
+	NSString		* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieFuzzy.trie"];
+	NSArray			* theQueries = @[@"", @"a", @"ab", @"bca", @"abcd", @"CAB", @"dddd"];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression };
+	for( NSUInteger t = 0; t < 2*sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t/2] array:randomWords( 31, 500, 8, (theOptions[t/2] & NDTrieCaseInsensitive) ? @"abcdABCD" : @"abcd" )];
+		NDTrie				* theSearched = theTrie;
+
+		if( t%2 == 1 )
+		{
+			NSCAssert( [theTrie writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+			theSearched = [NDTrie trieWithMappedContentsOfFile:thePath];
+		}
+
+		for( NSString * theQuery in theQueries )
+		{
+			NSString	* theFolded = theTrie.isCaseInsensitive ? [theQuery uppercaseString] : theQuery;
+			for( NSUInteger theMax = 0; theMax < 3; theMax++ )
+			{
+				for( NSUInteger p = 0; p < 2; p++ )
+				{
+					NSArray			* theFound = p == 0 ? [theSearched everyObjectForKey:theQuery maxEditDistance:theMax] : [theSearched everyObjectForKeyWithPrefix:theQuery maxEditDistance:theMax];
+					NSUInteger		theExpectedCount = 0,
+									theLastDistance = 0;
+					for( NSString * theWord in theTrie )
+					{
+						NSString	* theKey = theTrie.isCaseInsensitive ? [theWord uppercaseString] : theWord;
+						if( (p == 0 ? editDistance( theKey, theFolded ) : prefixEditDistance( theKey, theFolded )) <= theMax )
+							theExpectedCount++;
+					}
+					NSCAssert( theFound.count == theExpectedCount, @"found %lu within %lu of %@, expected %lu", theFound.count, theMax, theQuery, theExpectedCount );
+					for( NSString * theWord in theFound )
+					{
+						NSString	* theKey = theTrie.isCaseInsensitive ? [theWord uppercaseString] : theWord;
+						NSUInteger	theDistance = p == 0 ? editDistance( theKey, theFolded ) : prefixEditDistance( theKey, theFolded );
+						NSCAssert( theDistance <= theMax && theDistance >= theLastDistance, @"%@ is %lu from %@ after one at %lu", theWord, theDistance, theQuery, theLastDistance );
+						theLastDistance = theDistance;
+					}
+					if( p == 1 && theMax == 0 )
+						NSCAssert( [theFound isEqualToArray:[theSearched everyObjectForKeyWithPrefix:theQuery]], @"prefix %@ with no edits", theQuery );
+				}
+			}
+		}
+		[theTrie release];
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+}
+
+void testConcurrentReads()
+{
+	const NSUInteger		kReaderCount = 4;
+	NSMutableArray			* theStable = [NSMutableArray array],
+							* theChanging = [NSMutableArray array];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression };
+
+	/* the stable words all start with s and the changing ones with c, so neither can be mistaken for the other */
+	for( NSString * theWord in [NSOrderedSet orderedSetWithArray:randomWords( 31, 20000, 9, kLowercaseLetters )] )
+		[theStable addObject:[@"s" stringByAppendingString:theWord]];
+	for( NSString * theWord in [NSOrderedSet orderedSetWithArray:randomWords( 37, 2000, 9, kLowercaseLetters )] )
+		[theChanging addObject:[@"c" stringByAppendingString:theWord]];
+
+	NSUInteger				theStableCount = theStable.count,
+							theChangingCount = theChanging.count;
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDMutableTrie			* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t]|NDTrieConcurrentReads array:theStable],
+									* theExpected = [[NDMutableTrie alloc] initWithOptions:theOptions[t] array:theStable];
+			dispatch_group_t		theGroup = dispatch_group_create();
+			__block volatile BOOL	theDone = NO;
+			__block volatile long	theReads = 0;
+
+			for( NSUInteger r = 0; r < kReaderCount; r++ )
+			{
+				dispatch_group_async( theGroup, dispatch_get_global_queue( DISPATCH_QUEUE_PRIORITY_DEFAULT, 0 ), ^{
+					NSUInteger		i = r*7919;
+					while( !theDone )
+					{
+						@autoreleasepool
+						{
+							NSString	* theStableWord = [theStable objectAtIndex:i%theStableCount],
+										* theChangingWord = [theChanging objectAtIndex:i%theChangingCount];
+							id			theObject = [theTrie objectForKey:theStableWord];
+							NSCAssert( [theObject isEqualToString:theStableWord], @"a reader lost %@ while the trie was changing", theStableWord );
+							theObject = [theTrie objectForKey:theChangingWord];
+							NSCAssert( theObject == nil || [theObject isEqualToString:theChangingWord], @"a reader found %@ for %@", theObject, theChangingWord );
+							NSCAssert( [theTrie containsObjectForKeyWithPrefix:[theStableWord substringToIndex:2]], @"a reader lost the prefix of %@", theStableWord );
+							NSCAssert( [theTrie countOfObjectsForKeyWithPrefix:@"s"] == theStableCount, @"a reader counted %lu stable words", [theTrie countOfObjectsForKeyWithPrefix:@"s"] );
+							if( i%64 == 0 )
+							{
+								NSUInteger	theCount = 0;
+								for( NSString * theWord in [theTrie everyObjectForKeyWithPrefix:[theChangingWord substringToIndex:2]] )
+								{
+									NSCAssert( [theWord hasPrefix:[theChangingWord substringToIndex:2]], @"a reader enumerated %@", theWord );
+									theCount++;
+								}
+								NSCAssert( theCount <= theChangingCount, @"a reader enumerated %lu changing words", theCount );
+							}
+							i += 13;
+							__sync_fetch_and_add( &theReads, 1 );
+						}
+					}
+				});
+			}
+
+			for( NSUInteger theRound = 0; theRound < 20; theRound++ )
+			{
+				@autoreleasepool
+				{
+					for( NSUInteger i = 0; i < theChangingCount; i++ )
+					{
+						NSString	* theWord = [theChanging objectAtIndex:(i*37+theRound)%theChangingCount];
+						switch( (i+theRound)%4 )
+						{
+						case 0:
+						case 1:
+							[theTrie addString:theWord weight:(double)i];
+							[theExpected addString:theWord weight:(double)i];
+							break;
+						case 2:
+							[theTrie removeObjectForKey:theWord];
+							[theExpected removeObjectForKey:theWord];
+							break;
+						case 3:
+							[theTrie addString:theWord];
+							[theExpected addString:theWord];
+							break;
+						}
+					}
+					if( theRound%5 == 4 )
+					{
+						[theTrie removeAllObjectsForKeysWithPrefix:@"ca"];
+						[theExpected removeAllObjectsForKeysWithPrefix:@"ca"];
+					}
+				}
+			}
+			theDone = YES;
+			dispatch_group_wait( theGroup, DISPATCH_TIME_FOREVER );
+			dispatch_release( theGroup );
+
+			NSCAssert( theTrie.count == theExpected.count, @"concurrent trie count %lu expected %lu", theTrie.count, theExpected.count );
+			NSCAssert( [theTrie isEqualToTrie:theExpected] && [theExpected isEqualToTrie:theTrie], @"concurrent trie is not equal to the same changes made on one thread" );
+			NSCAssert( [[theTrie everyObject] isEqualToArray:[theExpected everyObject]], @"concurrent trie enumerates in a different order" );
+			NSCAssert( [[theTrie topObjects:10 forKeyWithPrefix:@"c"] isEqualToArray:[theExpected topObjects:10 forKeyWithPrefix:@"c"]], @"concurrent trie top objects" );
+			NSUInteger	theCount = 0;
+			for( NSString * theWord in theTrie )
+			{
+				NSCAssert( [theExpected containsObjectForKey:theWord], @"fast enumeration found %@", theWord );
+				theCount++;
+			}
+			NSCAssert( theCount == theExpected.count, @"fast enumeration found %lu words, expected %lu", theCount, theExpected.count );
+			NSCAssert( theReads > 0, @"the readers never read the trie" );
+
+			/* every lookup inside a read sees the same copy, and a change from inside one raises instead of waiting for itself */
+			{
+				BOOL				theCaught = NO;
+				__block NSUInteger	theSeen = 0;
+				@try
+				{
+					[theTrie enumerateObjectsForKeysWithPrefix:@"s" usingBlock:^(id anObject, BOOL * aStop){
+						NSCAssert( [theTrie containsObjectForKey:anObject], @"a read inside a read lost %@", anObject );
+						if( theSeen++ == 10 )
+							[theTrie addString:@"c-changed"];
+					}];
+				}
+				@catch( NSException * anException )
+				{
+					theCaught = [[anException name] isEqualToString:NSGenericException];
+				}
+				NSCAssert( theCaught, @"changing a concurrent trie while reading it did not raise" );
+				NSCAssert( ![theTrie containsObjectForKey:@"c-changed"] && theTrie.count == theExpected.count, @"a refused change was made" );
+			}
+
+			/* an enumerator walks the trie as it was when the enumerator was made */
+			{
+				NSEnumerator	* theEnumerator = [theTrie objectEnumeratorForKeyWithPrefix:@"s"];
+				NSString		* theWord = nil;
+				theCount = 0;
+				[theTrie removeAllObjectsForKeysWithPrefix:@"s"];
+				while( (theWord = [theEnumerator nextObject]) != nil )
+				{
+					NSCAssert( [theWord hasPrefix:@"s"], @"an enumerator of prefix s found %@", theWord );
+					theCount++;
+				}
+				NSCAssert( theCount == theStableCount, @"an enumerator found %lu of %lu words removed after it was made", theCount, theStableCount );
+				NSCAssert( [theTrie countOfObjectsForKeyWithPrefix:@"s"] == 0, @"removing while enumerating left words" );
+			}
+
+			[theExpected release];
+			[theTrie release];
+		}
+	}
+}
+
+static void checkTrieContents( NDTrie * aTrie, NSSet * anExpected, NSString * aName )
+{
+	NSCAssert( aTrie.count == anExpected.count, @"%@ has %lu strings instead of %lu", aName, aTrie.count, anExpected.count );
+	NSCAssert( [[NSSet setWithArray:[aTrie everyObject]] isEqualToSet:anExpected], @"%@ has the wrong strings", aName );
+	for( NSString * theString in anExpected )
+		NSCAssert( [aTrie containsObjectForKey:theString], @"%@ is missing %@", aName, theString );
+	NSCAssert( [aTrie countOfObjectsForKeyWithPrefix:@"a"] == [[anExpected filteredSetUsingPredicate:[NSPredicate predicateWithFormat:@"SELF BEGINSWITH 'a'"]] count], @"%@ counts the wrong number of strings with prefix a", aName );
+}
+
+void testCopyOnWrite()
+{
+	NSArray					* theWords = [[NSOrderedSet orderedSetWithArray:randomWords( 47, 5000, 8, @"abcd" )] array];
+	NSUInteger				theWordCount = theWords.count;
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression };
+
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDMutableTrie		* theOriginal = [[NDMutableTrie alloc] initWithOptions:theOptions[t] array:[theWords subarrayWithRange:NSMakeRange(0,theWordCount/2)]];
+			NSMutableSet		* theOriginalExpected = [NSMutableSet setWithArray:[theWords subarrayWithRange:NSMakeRange(0,theWordCount/2)]];
+			NDTrie				* theSnapshot = [theOriginal copy];
+			NSSet				* theSnapshotExpected = [[theOriginalExpected copy] autorelease];
+			NDMutableTrie		* theCopy = [theOriginal mutableCopy];
+			NSMutableSet		* theCopyExpected = [[theOriginalExpected mutableCopy] autorelease];
+
+			NSCAssert( [theSnapshot isEqualToTrie:theOriginal] && [theCopy isEqualToTrie:theOriginal], @"copies are not equal to the original" );
+
+			for( NSUInteger i = 0; i < theWordCount; i++ )
+			{
+				NSString	* theWord = [theWords objectAtIndex:(i*7919)%theWordCount];
+				switch( i%4 )
+				{
+				case 0:
+					[theOriginal addString:theWord];
+					[theOriginalExpected addObject:theWord];
+					break;
+				case 1:
+					[theOriginal removeObjectForKey:theWord];
+					[theOriginalExpected removeObject:theWord];
+					break;
+				case 2:
+					[theCopy addString:theWord];
+					[theCopyExpected addObject:theWord];
+					break;
+				case 3:
+					[theCopy removeObjectForKey:theWord];
+					[theCopyExpected removeObject:theWord];
+					break;
+				}
+			}
+			[theOriginal removeAllObjectsForKeysWithPrefix:@"ab"];
+			[theOriginalExpected filterUsingPredicate:[NSPredicate predicateWithFormat:@"NOT SELF BEGINSWITH 'ab'"]];
+			[theCopy removeAllObjectsForKeysWithPrefix:@"bac"];
+			[theCopyExpected filterUsingPredicate:[NSPredicate predicateWithFormat:@"NOT SELF BEGINSWITH 'bac'"]];
+
+			checkTrieContents( theOriginal, theOriginalExpected, @"the original" );
+			checkTrieContents( theCopy, theCopyExpected, @"the mutable copy" );
+			checkTrieContents( theSnapshot, theSnapshotExpected, @"the snapshot" );
+
+			/* a copy of a copy, and copies outliving the trie they came from */
+			NDMutableTrie		* theSecondCopy = [theCopy mutableCopy];
+			[theOriginal release];
+			[theCopy removeAllObjects];
+			[theCopyExpected removeAllObjects];
+			checkTrieContents( theCopy, theCopyExpected, @"the emptied mutable copy" );
+			checkTrieContents( theSnapshot, theSnapshotExpected, @"the snapshot without its original" );
+			[theSecondCopy addString:@"dddddddd"];
+			NSCAssert( [theSecondCopy containsObjectForKey:@"dddddddd"] && ![theSnapshot containsObjectForKey:@"dddddddd"], @"a change to a copy of a copy showed up in the snapshot" );
+			[theSecondCopy release];
+			[theCopy release];
+			checkTrieContents( theSnapshot, theSnapshotExpected, @"the last trie" );
+			[theSnapshot release];
+		}
+	}
+
+	/* removing keys that are not there copies nothing, the copy still shares every node */
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDMutableTrie		* theTrie = [[[NDMutableTrie alloc] initWithOptions:theOptions[t] array:@[@"car", @"card", @"care", @"careful", @"cart", @"dog"]] autorelease],
+								* theCopy = [[theTrie mutableCopy] autorelease];
+			NSUInteger			theShared = [[[theCopy statistics] objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue];
+			NSCAssert( theShared > 0, @"a copy shares no nodes" );
+			[theCopy removeObjectForKey:@"carts"];
+			[theCopy removeObjectForKey:@"ca"];
+			[theCopy removeObjectForKey:@"caref"];
+			[theCopy removeAllObjectsForKeysWithPrefix:@"cab"];
+			[theCopy removeAllObjectsForKeysWithPrefix:@"carts"];
+			NSCAssert( [[[theCopy statistics] objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue] == theShared, @"removing missing keys unshared %lu nodes", theShared - [[[theCopy statistics] objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue] );
+			[theCopy removeObjectForKey:@"cart"];
+			NSCAssert( [[[theCopy statistics] objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue] < theShared && theCopy.count == 5 && theTrie.count == 6, @"removing a key from a copy" );
+		}
+
+}
+
+void testConcurrentEnumeration()
+{
+	NSSet					* theWords = [NSSet setWithArray:randomWords( 53, 20000, 12, kLowercaseLetters )];
+	NSUInteger				theWordCount = theWords.count;
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression };
+
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDTrie					* theTrie = [[NDTrie alloc] initWithOptions:theOptions[t] array:[theWords allObjects]];
+			__block volatile long	theCalls = 0;
+			BOOL (^thePredicate)(id,BOOL*) = ^BOOL(id anObject, BOOL * aStop){ return [anObject rangeOfString:@"e"].location != NSNotFound; };
+
+			[theTrie enumerateObjectsWithOptions:NSEnumerationConcurrent usingBlock:^(id anObject, BOOL * aStop){
+				NSCAssert( [theWords containsObject:anObject], @"concurrent enumeration gave %@", anObject );
+				__sync_fetch_and_add( &theCalls, 1 );
+			}];
+			NSCAssert( theCalls == theWordCount, @"concurrent enumeration made %ld calls for %lu strings", theCalls, theWordCount );
+
+			NSArray		* theSequential = [theTrie everyObjectPassingTest:thePredicate],
+						* theConcurrent = [theTrie everyObjectWithOptions:NSEnumerationConcurrent passingTest:thePredicate];
+			NSCAssert( [theConcurrent isEqualToArray:theSequential], @"the concurrent test did not give the same strings in the same order" );
+			NSCAssert( theSequential.count == [[theWords filteredSetUsingPredicate:[NSPredicate predicateWithFormat:@"SELF CONTAINS 'e'"]] count], @"the test gave %lu strings", theSequential.count );
+
+			theSequential = [theTrie everyObjectForKeyWithPrefix:@"qu" passingTest:thePredicate];
+			theConcurrent = [theTrie everyObjectForKeyWithPrefix:@"qu" options:NSEnumerationConcurrent passingTest:thePredicate];
+			NSCAssert( [theConcurrent isEqualToArray:theSequential], @"the concurrent prefix test did not give the same strings in the same order" );
+			NSCAssert( [[theTrie everyObjectForKeyWithPrefix:@"zzzzzzzzzzzzz" options:NSEnumerationConcurrent passingTest:thePredicate] count] == 0, @"found strings for a missing prefix" );
+
+			theCalls = 0;
+			[theTrie enumerateObjectsWithOptions:NSEnumerationConcurrent usingBlock:^(id anObject, BOOL * aStop){
+				if( __sync_add_and_fetch( &theCalls, 1 ) >= 100 )
+					*aStop = YES;
+			}];
+			NSCAssert( theCalls >= 100 && theCalls < theWordCount/2, @"stopping the enumeration still made %ld calls", theCalls );
+
+			BOOL		theCaught = NO;
+			NSString	* theThrowWord = [theWords anyObject];
+			@try
+			{
+				[theTrie enumerateObjectsWithOptions:NSEnumerationConcurrent usingBlock:^(id anObject, BOOL * aStop){
+					if( [anObject isEqualToString:theThrowWord] )
+						@throw [NSException exceptionWithName:NSGenericException reason:@"test" userInfo:nil];
+				}];
+			}
+			@catch( NSException * anException )
+			{
+				theCaught = [[anException reason] isEqualToString:@"test"];
+			}
+			NSCAssert( theCaught, @"an exception thrown by the block was not rethrown" );
+			[theTrie release];
+		}
+	}
+
+	@autoreleasepool
+	{
+		NDTrie					* theTrie = [[NDTrie alloc] initWithArray:[theWords allObjects]];
+		NSRegularExpression		* theExpression = [NSRegularExpression regularExpressionWithPattern:@"^(?:[a-m]+[n-z]+)+$" options:0 error:NULL];
+		BOOL (^thePredicate)(id,BOOL*) = ^BOOL(id anObject, BOOL * aStop){
+			return [theExpression numberOfMatchesInString:anObject options:0 range:NSMakeRange(0,[anObject length])] > 0;
+		};
+		NSArray					* theSequential = [theTrie everyObjectPassingTest:thePredicate],
+								* theConcurrent = [theTrie everyObjectWithOptions:NSEnumerationConcurrent passingTest:thePredicate];
+		NSCAssert( theSequential.count > 0, @"no strings passed the regular expression test" );
+		NSCAssert( [theConcurrent isEqualToArray:theSequential], @"the concurrent regular expression test gave different strings" );
+		[theTrie release];
+	}
+}
+
+static NSUInteger sumOfHistogram( NSArray * aHistogram )
+{
+	NSUInteger		theResult = 0;
+	for( NSNumber * theCount in aHistogram )
+		theResult += [theCount unsignedIntegerValue];
+	return theResult;
+}
+
+void testStatistics()
+{
+	NSArray				* theWords = @[@"romane", @"romanus", @"romulus", @"rubens", @"ruber", @"rubicon", @"rubicundus", @"rub", @"r"];
+	NSMutableSet		* thePrefixes = [NSMutableSet set];
+	NSString			* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieStatistics.trie"];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression };
+	for( NSString * theWord in theWords )
+	{
+		for( NSUInteger i = 1; i <= theWord.length; i++ )
+			[thePrefixes addObject:[theWord substringToIndex:i]];
+	}
+
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t] array:theWords];
+		NSDictionary		* theStatistics = [theTrie statistics];
+		NSUInteger			theNodeCount = [[theStatistics objectForKey:NDTrieStatisticsNodeCountKey] unsignedIntegerValue];
+
+		NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsObjectCountKey] unsignedIntegerValue] == theWords.count, @"statistics counted %@ objects", [theStatistics objectForKey:NDTrieStatisticsObjectCountKey] );
+		NSCAssert( sumOfHistogram( [theStatistics objectForKey:NDTrieStatisticsDepthHistogramKey] ) == theNodeCount, @"depth histogram %@ does not add up to %lu nodes", [theStatistics objectForKey:NDTrieStatisticsDepthHistogramKey], theNodeCount );
+		NSCAssert( sumOfHistogram( [theStatistics objectForKey:NDTrieStatisticsFanoutHistogramKey] ) == theNodeCount, @"fanout histogram %@ does not add up to %lu nodes", [theStatistics objectForKey:NDTrieStatisticsFanoutHistogramKey], theNodeCount );
+		NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsChildSlotBytesUsedKey] unsignedIntegerValue] == (theNodeCount-1)*(sizeof(unichar)+sizeof(void*)), @"child slot bytes used %@", [theStatistics objectForKey:NDTrieStatisticsChildSlotBytesUsedKey] );
+		NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsChildSlotBytesAllocatedKey] unsignedIntegerValue] >= [[theStatistics objectForKey:NDTrieStatisticsChildSlotBytesUsedKey] unsignedIntegerValue], @"less child slot bytes allocated than used" );
+		NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue] == 0, @"nodes shared without a copy" );
+		if( t == 0 )
+		{
+			NSCAssert( theNodeCount == thePrefixes.count+1, @"statistics counted %lu nodes expected %lu", theNodeCount, thePrefixes.count+1 );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsMaxDepthKey] unsignedIntegerValue] == [@"rubicundus" length], @"max depth %@", [theStatistics objectForKey:NDTrieStatisticsMaxDepthKey] );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsRunBytesKey] unsignedIntegerValue] == 0, @"an uncompressed trie with runs" );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsSingleChildChainCountKey] unsignedIntegerValue] > 0, @"no chains in an uncompressed trie" );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsLongestSingleChildChainKey] unsignedIntegerValue] == [@"undu" length], @"longest chain %@", [theStatistics objectForKey:NDTrieStatisticsLongestSingleChildChainKey] );
+		}
+		else
+		{
+			NSCAssert( theNodeCount < thePrefixes.count+1, @"path compression did not remove any nodes" );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsSingleChildChainCountKey] unsignedIntegerValue] == 0, @"chains left in a path compressed trie" );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsRunBytesKey] unsignedIntegerValue] > 0, @"a path compressed trie without runs" );
+		}
+
+		NDMutableTrie		* theCopy = [theTrie mutableCopy];
+		NSCAssert( [[[theTrie statistics] objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue] == theNodeCount-1, @"copy shared %@ nodes", [[theTrie statistics] objectForKey:NDTrieStatisticsSharedNodeCountKey] );
+		[theCopy release];
+
+		NSCAssert( [theTrie writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+		NSDictionary		* theMappedStatistics = [[NDTrie trieWithMappedContentsOfFile:thePath] statistics];
+		for( NSString * theKey in @[NDTrieStatisticsNodeCountKey, NDTrieStatisticsObjectCountKey, NDTrieStatisticsMaxDepthKey, NDTrieStatisticsDepthHistogramKey, NDTrieStatisticsFanoutHistogramKey, NDTrieStatisticsSingleChildChainCountKey, NDTrieStatisticsRunBytesKey] )
+			NSCAssert( [[theMappedStatistics objectForKey:theKey] isEqual:[theStatistics objectForKey:theKey]], @"mapped %@ was %@ expected %@", theKey, [theMappedStatistics objectForKey:theKey], [theStatistics objectForKey:theKey] );
+		NSCAssert( [[theMappedStatistics objectForKey:NDTrieStatisticsTotalBytesKey] unsignedLongLongValue] == [[[NSFileManager defaultManager] attributesOfItemAtPath:thePath error:NULL] fileSize], @"mapped total bytes is not the file size" );
+		[theTrie release];
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+
+#if NDTrieCollectCounters
+	NDTrie			* theTrie = [NDTrie trieWithArray:theWords];
+	[NDTrie resetCounters];
+	[theTrie containsObjectForKey:@"rubicon"];
+	[theTrie containsObjectForKey:@"romanes"];
+	[theTrie everyObjectForKeyWithPrefix:@"rub"];
+	NSDictionary	* theCounters = [NDTrie counters];
+	NSCAssert( [[theCounters objectForKey:@"lookups"] unsignedIntegerValue] == 3, @"counted %@ lookups", [theCounters objectForKey:@"lookups"] );
+	NSCAssert( [[theCounters objectForKey:@"lookupMaxNodesVisited"] unsignedIntegerValue] == [@"rubicon" length], @"most nodes visited by a lookup %@", [theCounters objectForKey:@"lookupMaxNodesVisited"] );
+	NSCAssert( [[theCounters objectForKey:@"enumerations"] unsignedIntegerValue] == 1 && [[theCounters objectForKey:@"objectsEnumerated"] unsignedIntegerValue] == 5, @"counted enumerations %@", theCounters );
+#endif
+}
+
+void testBatchLookup()
+{
+	NSString			* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieBatch.trie"];
+	NSArray				* theWords = randomWords( 61, 20000, 10, @"abcdef" );
+	NSMutableArray		* theKeys = [NSMutableArray array];
+	NSNull				* theMarker = [NSNull null];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression, NDTrieConcurrentReads };
+
+	for( NSUInteger i = 0; i < 500; i++ )
+	{
+		NSString	* theWord = [theWords objectAtIndex:random()%theWords.count];
+		switch( i%5 )
+		{
+		case 0:		[theKeys addObject:theWord]; break;
+		case 1:		[theKeys addObject:[theWord stringByAppendingString:@"z"]]; break;				// never in the trie
+		case 2:		[theKeys addObject:[theWord substringToIndex:(theWord.length+1)/2]]; break;		// might be a prefix only
+		case 3:		[theKeys addObject:[theWord uppercaseString]]; break;
+		case 4:		[theKeys addObject:[theKeys objectAtIndex:random()%theKeys.count]]; break;		// the same key twice
+		}
+	}
+	[theKeys addObject:@""];
+
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t]];
+			[theTrie addArray:theWords];
+			NSCAssert( [[theTrie objectsForKeys:@[] notFoundMarker:theMarker] count] == 0 && [[theTrie containsObjectsForKeys:@[]] count] == 0, @"found objects without keys" );
+
+			NSCAssert( [theTrie writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+			for( NDTrie * theTested in @[theTrie, [NDTrie trieWithMappedContentsOfFile:thePath]] )
+			{
+				NSArray			* theObjects = [theTested objectsForKeys:theKeys notFoundMarker:theMarker];
+				NSIndexSet		* theContained = [theTested containsObjectsForKeys:theKeys];
+				NSCAssert( theObjects.count == theKeys.count, @"%lu objects for %lu keys", theObjects.count, theKeys.count );
+				for( NSUInteger i = 0; i < theKeys.count; i++ )
+				{
+					NSString	* theKey = [theKeys objectAtIndex:i];
+					id			theExpected = [theTested objectForKey:theKey];
+					NSCAssert( [[theObjects objectAtIndex:i] isEqual:theExpected != nil ? theExpected : theMarker], @"batch object for %@ was %@ expected %@", theKey, [theObjects objectAtIndex:i], theExpected );
+					NSCAssert( [theContained containsIndex:i] == [theTested containsObjectForKey:theKey], @"batch contains for %@", theKey );
+				}
+			}
+
+			[theTrie release];
+		}
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+}
+
+/* the matches found by trying every range of aText, in the same form enumerateMatchesInString:options:usingBlock: gives them */
+static NSArray * expectedMatches( NDTrie * aTrie, NSString * aText, NDTrieMatchOptions anOptions )
+{
+	NSMutableArray		* theResult = [NSMutableArray array];
+	NSUInteger			theLength = aText.length;
+	if( anOptions == NDTrieMatchAll )
+	{
+		for( NSUInteger theEnd = 1; theEnd <= theLength; theEnd++ )
+		{
+			for( NSUInteger theStart = 0; theStart < theEnd; theStart++ )
+			{
+				if( [aTrie containsObjectForKey:[aText substringWithRange:NSMakeRange(theStart,theEnd-theStart)]] )
+					[theResult addObject:[NSValue valueWithRange:NSMakeRange(theStart,theEnd-theStart)]];
+			}
+		}
+	}
+	else
+	{
+		for( NSUInteger theStart = 0; theStart < theLength; )
+		{
+			NSUInteger		theLongest = 0;
+			for( NSUInteger theEnd = theStart+1; theEnd <= theLength; theEnd++ )
+			{
+				if( [aTrie containsObjectForKey:[aText substringWithRange:NSMakeRange(theStart,theEnd-theStart)]] )
+					theLongest = theEnd-theStart;
+			}
+			if( theLongest > 0 )
+				[theResult addObject:[NSValue valueWithRange:NSMakeRange(theStart,theLongest)]];
+			if( anOptions == NDTrieMatchLongestPrefix )
+				break;
+			theStart += theLongest > 0 ? theLongest : 1;
+		}
+	}
+	return theResult;
+}
+
+static NSArray * foundMatches( NDTrie * aTrie, NSString * aText, NDTrieMatchOptions anOptions )
+{
+	NSMutableArray		* theResult = [NSMutableArray array];
+	[aTrie enumerateMatchesInString:aText options:anOptions usingBlock:^(NSRange aRange, id anObject, BOOL * aStop){
+		NSCAssert( [anObject isEqual:[aTrie objectForKey:[aText substringWithRange:aRange]]], @"match %@ gave the object %@", NSStringFromRange(aRange), anObject );
+		[theResult addObject:[NSValue valueWithRange:aRange]];
+	}];
+	return theResult;
+}
+
+void testMatching()
+{
+	NDTrie				* theClassic = [NDTrie trieWithStrings:@"he", @"she", @"his", @"hers", nil];
+	NSArray				* theExpected = @[[NSValue valueWithRange:NSMakeRange(1,3)], [NSValue valueWithRange:NSMakeRange(2,2)], [NSValue valueWithRange:NSMakeRange(2,4)]];
+	NSString			* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieMatching.trie"];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression, NDTrieConcurrentReads };
+	__block NSUInteger	theCalls = 0;
+
+	NSCAssert( [foundMatches( theClassic, @"ushers", NDTrieMatchAll ) isEqualToArray:theExpected], @"matches in ushers were %@", foundMatches( theClassic, @"ushers", NDTrieMatchAll ) );
+	NSCAssert( [foundMatches( theClassic, @"ushers", NDTrieMatchLeftmostLongest ) isEqualToArray:@[[NSValue valueWithRange:NSMakeRange(1,3)]]], @"leftmost longest in ushers" );
+	NSCAssert( [foundMatches( theClassic, @"hersh", NDTrieMatchLongestPrefix ) isEqualToArray:@[[NSValue valueWithRange:NSMakeRange(0,4)]]], @"longest prefix of hersh" );
+	NSCAssert( [foundMatches( theClassic, @"", NDTrieMatchAll ) count] == 0 && [foundMatches( [NDTrie trie], @"ushers", NDTrieMatchAll ) count] == 0, @"found matches in nothing" );
+	[theClassic enumerateMatchesInString:@"shehishers" usingBlock:^(NSRange aRange, id anObject, BOOL * aStop){ *aStop = ++theCalls == 2; }];
+	NSCAssert( theCalls == 2, @"matching did not stop" );
+
+	/* the automaton is compiled again after a change */
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		NDMutableTrie		* theMutable = [[[NDMutableTrie alloc] initWithOptions:theOptions[t]] autorelease];
+		[theMutable addStrings:@"cat", @"dog", nil];
+		NSCAssert( [foundMatches( theMutable, @"catalogue", NDTrieMatchAll ) count] == 1, @"cat not found" );
+		[theMutable addString:@"catalog"];
+		[theMutable removeObjectForKey:@"cat"];
+		NSCAssert( [foundMatches( theMutable, @"catalogue", NDTrieMatchAll ) isEqualToArray:@[[NSValue valueWithRange:NSMakeRange(0,7)]]], @"matches after a change were %@", foundMatches( theMutable, @"catalogue", NDTrieMatchAll ) );
+
+		/* a change while matching throws away the automaton being matched with, a trie with concurrent reads refuses the change */
+		{
+			BOOL		theCaught = NO;
+			@try
+			{
+				[theMutable enumerateMatchesInString:@"catalogue dog" usingBlock:^(NSRange aRange, id anObject, BOOL * aStop){ [theMutable addString:@"dogs"]; }];
+			}
+			@catch( NSException * anException )
+			{
+				theCaught = [[anException name] isEqualToString:NSGenericException];
+			}
+			NSCAssert( theCaught, @"changing the trie while matching did not raise" );
+			NSCAssert( [foundMatches( theMutable, @"dogs", NDTrieMatchAll ) count] == ((theOptions[t] & NDTrieConcurrentReads) ? 1 : 2), @"matches after a change while matching were %@", foundMatches( theMutable, @"dogs", NDTrieMatchAll ) );
+		}
+	}
+
+	/* mostly short words so they overlap each other in the texts */
+	NSArray				* theWords = [randomWords( 67, 200, 3, @"abcd" ) arrayByAddingObjectsFromArray:randomWords( 71, 100, 8, @"abcd" )],
+						* theTexts = randomWords( 73, 50, 40, @"abcdeabcdeabcdeabcdeABCDE" );
+
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDMutableTrie		* theTrie = [[NDMutableTrie alloc] initWithOptions:theOptions[t]];
+			[theTrie addArray:theWords];
+			NSCAssert( [theTrie writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+			for( NDTrie * theTested in @[theTrie, [NDTrie trieWithMappedContentsOfFile:thePath]] )
+			{
+				for( NSString * theText in theTexts )
+				{
+					for( NDTrieMatchOptions theMatch = NDTrieMatchAll; theMatch <= NDTrieMatchLongestPrefix; theMatch++ )
+					{
+						NSArray		* theFound = foundMatches( theTested, theText, theMatch ),
+									* theExpected = expectedMatches( theTested, theText, theMatch );
+						if( theMatch == NDTrieMatchAll )		// matches that end at the same place come longest first
+							theFound = [theFound sortedArrayUsingComparator:^NSComparisonResult(NSValue * a, NSValue * b){
+								NSUInteger	theEndA = NSMaxRange([a rangeValue]), theEndB = NSMaxRange([b rangeValue]);
+								return theEndA != theEndB ? (theEndA < theEndB ? NSOrderedAscending : NSOrderedDescending) : [a rangeValue].location < [b rangeValue].location ? NSOrderedAscending : NSOrderedDescending;
+							}];
+						NSCAssert( [theFound isEqualToArray:theExpected], @"matches %lu in %@ were %@ expected %@", (unsigned long)theMatch, theText, theFound, theExpected );
+					}
+				}
+			}
+			[theTrie release];
+		}
+	}
+	[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+}
+
+static void compareTries( NDTrie * aTrie, NDTrie * anExpected, NSArray * aKeys )
+{
+	NSCAssert( aTrie.count == anExpected.count, @"compacted count %lu expected %lu", aTrie.count, anExpected.count );
+	NSCAssert( [aTrie isEqualToTrie:anExpected] && [anExpected isEqualToTrie:aTrie], @"compacted trie is not equal" );
+	NSCAssert( [[aTrie everyObject] isEqualToArray:[anExpected everyObject]], @"compacted objects in a different order" );
+	NSCAssert( [[[aTrie objectEnumerator] allObjects] isEqualToArray:[anExpected everyObject]], @"compacted enumerator in a different order" );
+	for( NSString * theKey in aKeys )
+	{
+		NSString	* thePrefix = [theKey substringToIndex:theKey.length/2];
+		NSCAssert( [aTrie containsObjectForKey:theKey] == [anExpected containsObjectForKey:theKey], @"compacted contains %@", theKey );
+		NSCAssert( [aTrie containsObjectForKeyWithPrefix:theKey] == [anExpected containsObjectForKeyWithPrefix:theKey], @"compacted contains prefix %@", theKey );
+		NSCAssert( [aTrie objectForKey:theKey] == nil ? [anExpected objectForKey:theKey] == nil : [[aTrie objectForKey:theKey] isEqual:[anExpected objectForKey:theKey]], @"compacted object for %@ was %@ expected %@", theKey, [aTrie objectForKey:theKey], [anExpected objectForKey:theKey] );
+		NSCAssert( [aTrie weightForKey:theKey] == [anExpected weightForKey:theKey], @"compacted weight for %@", theKey );
+		NSCAssert( [[aTrie everyObjectForKeyWithPrefix:thePrefix] isEqualToArray:[anExpected everyObjectForKeyWithPrefix:thePrefix]], @"compacted objects with prefix %@", thePrefix );
+		NSCAssert( [aTrie countOfObjectsForKeyWithPrefix:thePrefix] == [anExpected countOfObjectsForKeyWithPrefix:thePrefix], @"compacted count with prefix %@", thePrefix );
+		NSCAssert( [[NSSet setWithArray:[aTrie everyObjectForKey:theKey maxEditDistance:1]] isEqualToSet:[NSSet setWithArray:[anExpected everyObjectForKey:theKey maxEditDistance:1]]], @"compacted objects near %@", theKey );
+	}
+
+	NSMutableArray		* thePages = [NSMutableArray array];
+	id					theToken = nil;
+	do
+		[thePages addObjectsFromArray:[aTrie everyObjectForKeyWithPrefix:nil limit:7 resumeToken:&theToken]];
+	while( theToken != nil );
+	NSCAssert( [thePages isEqualToArray:[anExpected everyObject]], @"compacted pages in a different order" );
+}
+
+void testCompactedTrie()
+{
+	NSArray				* theStems = @[@"walk", @"talk", @"stalk", @"jump", @"pump", @"bump", @"play", @"stay", @"sway", @"kind", @"mind", @"bind"],
+						* theSuffixes = @[@"", @"s", @"ed", @"ing", @"er", @"ers", @"ingly"];
+	NSMutableArray		* theWords = [NSMutableArray array],
+						* theKeys = [NSMutableArray array];
+	NSString			* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieCompacted.trie"];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression };
+
+	for( NSString * theStem in theStems )
+	{
+		for( NSString * theSuffix in theSuffixes )
+			[theWords addObject:[theStem stringByAppendingString:theSuffix]];
+	}
+	[theKeys addObjectsFromArray:theWords];
+	[theKeys addObjectsFromArray:@[@"", @"w", @"walke", @"WALKS", @"Jumping", @"xyz", @"talkingl", @"stalkingly"]];
+
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDMutableTrie		* theTrie = [[[NDMutableTrie alloc] initWithOptions:theOptions[t] array:theWords] autorelease];
+			NDTrie				* theCompacted = [theTrie compactedTrie];
+			NSDictionary		* theStatistics = [theCompacted statistics];
+			NSUInteger			theNodeCount = [[[[[[NDMutableTrie alloc] initWithOptions:0 array:theWords] autorelease] statistics] objectForKey:NDTrieStatisticsNodeCountKey] unsignedIntegerValue];
+
+			compareTries( theCompacted, theTrie, theKeys );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsNodeCountKey] unsignedIntegerValue] < theNodeCount/2, @"compacting only took %@ of %lu nodes", [theStatistics objectForKey:NDTrieStatisticsNodeCountKey], theNodeCount );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsObjectCountKey] unsignedIntegerValue] == theWords.count, @"compacted statistics counted %@ objects", [theStatistics objectForKey:NDTrieStatisticsObjectCountKey] );
+			NSCAssert( [[theStatistics objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue] > 0, @"no shared nodes in a compacted trie" );
+			NSCAssert( [theCompacted compactedTrie] == theCompacted, @"compacting a compacted trie made a new one" );
+			NSCAssert( foundMatches( theCompacted, @"the stalker was walking", NDTrieMatchAll ).count == foundMatches( theTrie, @"the stalker was walking", NDTrieMatchAll ).count, @"compacted matches" );
+
+			NDMutableTrie		* theCopy = [[theCompacted mutableCopy] autorelease];
+			[theCopy addString:@"zebra"];
+			NSCAssert( [theCopy containsObjectForKey:@"zebra"] && ![theCompacted containsObjectForKey:@"zebra"] && theCopy.count == theWords.count+1, @"mutable copy of a compacted trie" );
+
+			NSCAssert( [theCompacted writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+			compareTries( [NDTrie trieWithMappedContentsOfFile:thePath], theTrie, theKeys );
+			compareTries( [[NDTrie trieWithMappedContentsOfFile:thePath] compactedTrie], theTrie, theKeys );
+		}
+	}
+
+	/* weights and objects other than the key are kept, and only what is the same is shared */
+	NDMutableTrie		* theWeighted = [NDMutableTrie trie];
+	NSNumber			* theOne = @1;
+	for( NSUInteger i = 0; i < theWords.count; i++ )
+	{
+		NSString	* theWord = [theWords objectAtIndex:i];
+		if( i%3 == 0 )
+			[theWeighted setObject:theOne forKey:theWord];
+		else if( i%3 == 1 )
+			[theWeighted setObject:[NSNumber numberWithUnsignedInteger:i] forKey:theWord weight:(double)(i%11)];
+		else
+			[theWeighted addString:theWord weight:(double)(i%5)];
+	}
+	NDTrie				* theCompacted = [theWeighted compactedTrie];
+	compareTries( theCompacted, theWeighted, theKeys );
+	NSCAssert( [[theCompacted topObjects:10 forKeyWithPrefix:nil] isEqualToArray:[theWeighted topObjects:10 forKeyWithPrefix:nil]], @"compacted top objects %@ expected %@", [theCompacted topObjects:10 forKeyWithPrefix:nil], [theWeighted topObjects:10 forKeyWithPrefix:nil] );
+	NSCAssert( [[theCompacted topObjects:3 forKeyWithPrefix:@"st"] isEqualToArray:[theWeighted topObjects:3 forKeyWithPrefix:@"st"]], @"compacted top objects with a prefix" );
+	NSCAssert( ![theCompacted writeBinaryToFile:thePath atomically:YES], @"wrote a trie of numbers to a binary file" );
+
+	NDTrie				* theEmpty = [[NDTrie trie] compactedTrie];
+	NSCAssert( theEmpty.count == 0 && [theEmpty everyObject].count == 0 && [theEmpty objectForKey:@"walk"] == nil, @"compacted empty trie" );
+	[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+}
+
+static void compareTrieToDictionary( NDTrie * aTrie, NSDictionary * anExpected, NSDictionary * aWeights, NSArray * aKeys, NSString * aName )
+{
+	NSCAssert( aTrie.count == anExpected.count, @"%@ count %lu expected %lu", aName, aTrie.count, anExpected.count );
+	NSCAssert( [[NSSet setWithArray:[aTrie everyObject]] isEqualToSet:[NSSet setWithArray:[anExpected allValues]]], @"%@ objects %@ expected %@", aName, [aTrie everyObject], [anExpected allValues] );
+	for( NSString * theKey in aKeys )
+	{
+		id		theObject = [anExpected objectForKey:theKey];
+		NSCAssert( theObject == nil ? [aTrie objectForKey:theKey] == nil : [[aTrie objectForKey:theKey] isEqual:theObject], @"%@ object for %@ was %@ expected %@", aName, theKey, [aTrie objectForKey:theKey], theObject );
+		if( theObject != nil && aWeights != nil )
+			NSCAssert( [aTrie weightForKey:theKey] == [[aWeights objectForKey:theKey] doubleValue], @"%@ weight for %@ was %g", aName, theKey, [aTrie weightForKey:theKey] );
+	}
+}
+
+void testSetOperations()
+{
+	NSArray				* theLeftKeys = @[@"a", @"an", @"and", @"ant", @"antelope", @"bat", @"batch", @"cat", @"catalog", @"dog", @"zebra"],
+						* theRightKeys = @[@"an", @"ant", @"anteater", @"antelopes", @"bat", @"bath", @"cattle", @"dog", @"dogma", @"yak", @"zebra"];
+	NSMutableArray		* theKeys = [NSMutableArray arrayWithArray:theLeftKeys];
+	NSMutableDictionary	* theLeft = [NSMutableDictionary dictionary],
+						* theRight = [NSMutableDictionary dictionary],
+						* theLeftWeights = [NSMutableDictionary dictionary],
+						* theRightWeights = [NSMutableDictionary dictionary];
+
+	[theKeys addObjectsFromArray:theRightKeys];
+	[theKeys addObjectsFromArray:@[@"ante", @"ba", @"catt", @"dogmas", @"y"]];
+	for( NSUInteger i = 0; i < theLeftKeys.count; i++ )
+	{
+		[theLeft setObject:[NSString stringWithFormat:@"L%lu", i] forKey:[theLeftKeys objectAtIndex:i]];
+		[theLeftWeights setObject:[NSNumber numberWithDouble:(double)i] forKey:[theLeftKeys objectAtIndex:i]];
+	}
+	for( NSUInteger i = 0; i < theRightKeys.count; i++ )
+	{
+		[theRight setObject:[NSString stringWithFormat:@"R%lu", i] forKey:[theRightKeys objectAtIndex:i]];
+		[theRightWeights setObject:[NSNumber numberWithDouble:(double)(100+i)] forKey:[theRightKeys objectAtIndex:i]];
+	}
+
+	NSMutableDictionary	* theUnion = [NSMutableDictionary dictionaryWithDictionary:theLeft],
+						* theUnionWeights = [NSMutableDictionary dictionaryWithDictionary:theRightWeights],
+						* theIntersection = [NSMutableDictionary dictionary],
+						* theDifference = [NSMutableDictionary dictionaryWithDictionary:theLeft],
+						* theJoined = [NSMutableDictionary dictionaryWithDictionary:theLeft];
+	[theUnion addEntriesFromDictionary:theRight];
+	[theUnionWeights addEntriesFromDictionary:theLeftWeights];
+	[theJoined addEntriesFromDictionary:theRight];
+	for( NSString * theKey in theRight )
+	{
+		if( [theLeft objectForKey:theKey] != nil )
+		{
+			[theIntersection setObject:[theLeft objectForKey:theKey] forKey:theKey];
+			[theJoined setObject:[NSString stringWithFormat:@"%@+%@", [theLeft objectForKey:theKey], [theRight objectForKey:theKey]] forKey:theKey];
+		}
+		[theDifference removeObjectForKey:theKey];
+	}
+	id (^theJoin)(NSString *, id, id) = ^id(NSString * aKey, id anObject, id anOtherObject) {
+		NSCAssert( [[theLeft objectForKey:aKey] isEqual:anObject] && [[theRight objectForKey:aKey] isEqual:anOtherObject], @"policy given %@ %@ for %@", anObject, anOtherObject, aKey );
+		return [NSString stringWithFormat:@"%@+%@", anObject, anOtherObject];
+	};
+
+	/* not case insensitive, the expected results compare keys case sensitively */
+	NDTrieOptions		theLeftOptions[] = { 0, NDTriePathCompression, NDTrieConcurrentReads, NDTrieConcurrentReads|NDTriePathCompression },
+						theRightOptions[] = { 0, NDTriePathCompression };
+	for( NSUInteger t = 0; t < 2*sizeof(theLeftOptions)/sizeof(*theLeftOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDTrieOptions		theOptions = theLeftOptions[t/2];
+			NDMutableTrie		* theLeftTrie = [[[NDMutableTrie alloc] initWithOptions:theOptions] autorelease],
+								* theRightTrie = [[[NDMutableTrie alloc] initWithOptions:theRightOptions[t%2]] autorelease];
+			for( NSString * theKey in theLeft )
+				[theLeftTrie setObject:[theLeft objectForKey:theKey] forKey:theKey weight:[[theLeftWeights objectForKey:theKey] doubleValue]];
+			for( NSString * theKey in theRight )
+				[theRightTrie setObject:[theRight objectForKey:theKey] forKey:theKey weight:[[theRightWeights objectForKey:theKey] doubleValue]];
+
+			compareTrieToDictionary( [theLeftTrie trieByUnioningTrie:theRightTrie mergePolicy:nil], theUnion, theUnionWeights, theKeys, @"union" );
+			compareTrieToDictionary( [theLeftTrie trieByUnioningTrie:theRightTrie mergePolicy:theJoin], theJoined, nil, theKeys, @"joined union" );
+			compareTrieToDictionary( [theLeftTrie trieByIntersectingTrie:theRightTrie mergePolicy:nil], theIntersection, theLeftWeights, theKeys, @"intersection" );
+			compareTrieToDictionary( [theLeftTrie trieBySubtractingTrie:theRightTrie], theDifference, theLeftWeights, theKeys, @"difference" );
+			compareTrieToDictionary( theLeftTrie, theLeft, theLeftWeights, theKeys, @"left after merges" );
+			compareTrieToDictionary( theRightTrie, theRight, theRightWeights, theKeys, @"right after merges" );
+
+			/* a policy returning nil removes the key */
+			NDMutableTrie		* theTrie = [[theLeftTrie mutableCopy] autorelease];
+			[theTrie intersectTrie:theRightTrie mergePolicy:^id(NSString * aKey, id anObject, id anOtherObject) { return [aKey hasPrefix:@"an"] ? nil : anObject; }];
+			NSCAssert( theTrie.count == 3 && [theTrie objectForKey:@"an"] == nil && [theTrie objectForKey:@"bat"] != nil, @"intersection policy left %@", [theTrie everyObject] );
+
+			/* mapped and compacted tries have no nodes to walk */
+			compareTrieToDictionary( [theLeftTrie trieByUnioningTrie:[theRightTrie compactedTrie] mergePolicy:nil], theUnion, theUnionWeights, theKeys, @"union with a compacted trie" );
+			compareTrieToDictionary( [[theLeftTrie compactedTrie] trieBySubtractingTrie:theRightTrie], theDifference, theLeftWeights, theKeys, @"difference of a compacted trie" );
+
+			/* merging with itself */
+			theTrie = [[theLeftTrie mutableCopy] autorelease];
+			[theTrie unionTrie:theTrie];
+			compareTrieToDictionary( theTrie, theLeft, theLeftWeights, theKeys, @"union with itself" );
+			[theTrie minusTrie:theTrie];
+			NSCAssert( theTrie.count == 0 && [theTrie everyObject].count == 0, @"difference with itself left %@", [theTrie everyObject] );
+
+			/* merging into a trie with concurrent reads asks the policy once for each key */
+			NDMutableTrie		* theConcurrent = [[[NDMutableTrie alloc] initWithOptions:theOptions|NDTrieConcurrentReads] autorelease];
+			__block NSUInteger	theCalls = 0;
+			[theConcurrent addTrie:theLeftTrie];
+			[theConcurrent unionTrie:theRightTrie mergePolicy:^id(NSString * aKey, id anObject, id anOtherObject) { theCalls++; return theJoin( aKey, anObject, anOtherObject ); }];
+			compareTrieToDictionary( theConcurrent, theJoined, nil, theKeys, @"concurrent union" );
+			NSCAssert( theCalls == theIntersection.count, @"policy called %lu times for %lu keys", theCalls, theIntersection.count );
+			[theConcurrent minusTrie:theConcurrent];
+			NSCAssert( theConcurrent.count == 0, @"concurrent difference with itself left %lu", theConcurrent.count );
+
+			/* addTrie: is a union */
+			[theTrie addTrie:theRightTrie];
+			compareTrieToDictionary( theTrie, theRight, theRightWeights, theKeys, @"added trie" );
+		}
+	}
+
+	/* copies share their nodes, merging them skips what is still shared */
+	NDMutableTrie		* theOriginal = [NDMutableTrie trieWithDictionary:theLeft],
+						* theChanged = [[theOriginal mutableCopy] autorelease];
+	[theChanged setObject:@"new" forKey:@"catapult"];
+	[theChanged removeObjectForKey:@"zebra"];
+	NDTrie				* theMerged = [theOriginal trieByUnioningTrie:theChanged mergePolicy:nil];
+	NSCAssert( theMerged.count == theLeft.count+1 && [[theMerged objectForKey:@"catapult"] isEqual:@"new"] && [theMerged objectForKey:@"zebra"] != nil, @"union of copies %@", [theMerged everyObject] );
+	NSCAssert( [[[theMerged statistics] objectForKey:NDTrieStatisticsSharedNodeCountKey] unsignedIntegerValue] > 0, @"union of copies shares no nodes" );
+	theMerged = [theOriginal trieBySubtractingTrie:theChanged];
+	NSCAssert( theMerged.count == 1 && [theMerged objectForKey:@"zebra"] != nil, @"difference of copies %@", [theMerged everyObject] );
+
+	/* the keys of a case sensitive trie are folded for a case insensitive one */
+	NDMutableTrie		* theInsensitive = [[[NDMutableTrie alloc] initWithCaseInsensitive:YES dictionary:theLeft] autorelease];
+	[theInsensitive unionTrie:[NDMutableTrie trieWithDictionary:@{ @"CAT" : @"upper", @"Yak" : @"mixed" }]];
+	NSCAssert( theInsensitive.count == theLeft.count+1 && [[theInsensitive objectForKey:@"cat"] isEqual:@"upper"] && [[theInsensitive objectForKey:@"yAK"] isEqual:@"mixed"], @"case insensitive union %@", [theInsensitive everyObject] );
+	[theInsensitive minusTrie:[NDMutableTrie trieWithDictionary:@{ @"Dog" : @"x" }]];
+	NSCAssert( [theInsensitive objectForKey:@"dog"] == nil, @"case insensitive difference" );
+}
+
+static void compareCompletions( NDTrieCompletionSession * aSession, NDTrie * aTrie )
+{
+	NSString		* thePrefix = aSession.prefix;
+	NSArray			* theExpected = [aTrie everyObjectForKeyWithPrefix:thePrefix];
+	for( NSUInteger i = 0; i < 2; i++ )			// the second time from what the session kept
+		NSCAssert( [[aSession everyObject] isEqualToArray:theExpected], @"completions for \"%@\" were %@ expected %@", thePrefix, [aSession everyObject], theExpected );
+	NSCAssert( aSession.count == theExpected.count, @"completion count for \"%@\" was %lu expected %lu", thePrefix, aSession.count, theExpected.count );
+	NSCAssert( [[[aSession objectEnumerator] allObjects] isEqualToArray:theExpected], @"completion enumerator for \"%@\"", thePrefix );
+	NSCAssert( [[aSession topObjects:3] isEqualToArray:[aTrie topObjects:3 forKeyWithPrefix:thePrefix]], @"top completions for \"%@\" were %@", thePrefix, [aSession topObjects:3] );
+	NSCAssert( [aSession object] == nil ? [aTrie objectForKey:thePrefix] == nil : [[aSession object] isEqual:[aTrie objectForKey:thePrefix]], @"completion object for \"%@\" was %@", thePrefix, [aSession object] );
+}
+
+/* a < in aKeystrokes deletes the character before it */
+static void typeCompletions( NDTrieCompletionSession * aSession, NDTrie * aTrie, NSString * aKeystrokes )
+{
+	for( NSUInteger i = 0; i < aKeystrokes.length; i++ )
+	{
+		unichar		theCharacter = [aKeystrokes characterAtIndex:i];
+		if( theCharacter == '<' )
+			[aSession deleteBackward];
+		else
+			[aSession appendCharacters:&theCharacter length:1];
+		compareCompletions( aSession, aTrie );
+	}
+}
+
+void testCompletionSession()
+{
+	NSArray				* theWords = @[@"car", @"card", @"care", @"careful", @"carefully", @"cargo", @"cart", @"cat", @"catalog", @"dog", @"door", @"dorm"];
+	NSString			* theKeystrokes = @"care<<<<do<<cat<<<<carefully<<<<<<<<<<xz<<<CAre<<<<careless<<<<<<<<c",
+						* thePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"NDTrieCompletion.trie"];
+	NDTrieOptions		theOptions[] = { 0, NDTriePathCompression, NDTrieCaseInsensitive|NDTriePathCompression, NDTrieConcurrentReads };
+
+	for( NSUInteger t = 0; t < sizeof(theOptions)/sizeof(*theOptions); t++ )
+	{
+		@autoreleasepool
+		{
+			NDMutableTrie			* theTrie = [[[NDMutableTrie alloc] initWithOptions:theOptions[t]] autorelease];
+			for( NSUInteger i = 0; i < theWords.count; i++ )
+				[theTrie addString:[theWords objectAtIndex:i] weight:(double)((i*7)%5)];
+
+			NDTrieCompletionSession	* theSession = [NDTrieCompletionSession completionSessionWithTrie:theTrie];
+			compareCompletions( theSession, theTrie );
+			typeCompletions( theSession, theTrie, theKeystrokes );
+			NSCAssert( [theSession.prefix isEqualToString:@"c"], @"prefix left as \"%@\"", theSession.prefix );
+
+			/* changes to the trie are seen straight away */
+			[theSession appendString:@"ar"];
+			compareCompletions( theSession, theTrie );
+			[theTrie addString:@"carpet"];
+			compareCompletions( theSession, theTrie );
+			[theTrie removeObjectForKey:@"card"];
+			[theTrie removeObjectForKey:@"car"];
+			typeCompletions( theSession, theTrie, @"e<p<<<" );
+			[theTrie removeAllObjectsForKeysWithPrefix:@"ca"];
+			typeCompletions( theSession, theTrie, @"car<<<do" );
+			[theTrie addString:@"cab"];
+			[theSession reset];
+			NSCAssert( theSession.prefix.length == 0, @"reset left \"%@\"", theSession.prefix );
+			typeCompletions( theSession, theTrie, @"cab<<<dor" );
+
+			/* a copy does not change with the trie it was copied from */
+			NDTrie					* theCopy = [[theTrie copy] autorelease];
+			NDTrieCompletionSession	* theCopySession = [[[NDTrieCompletionSession alloc] initWithTrie:theCopy cacheLimit:0] autorelease];
+			[theCopySession appendString:@"do"];
+			NSArray					* theCopied = [theCopySession everyObject];
+			[theTrie addString:@"dot"];
+			NSCAssert( [[theCopySession everyObject] isEqualToArray:theCopied] && [[theCopy everyObjectForKeyWithPrefix:@"do"] isEqualToArray:theCopied], @"copy completions changed to %@", [theCopySession everyObject] );
+			typeCompletions( theCopySession, theCopy, @"o<<<" );
+		}
+	}
+
+	/* mapped and compacted tries are sent the prefix each time */
+	@autoreleasepool
+	{
+		NDTrie			* theTrie = [NDTrie trieWithArray:theWords];
+		NSCAssert( [theTrie writeBinaryToFile:thePath atomically:YES], @"failed to write %@", thePath );
+		NDTrie			* theMapped = [NDTrie trieWithMappedContentsOfFile:thePath];
+		typeCompletions( [NDTrieCompletionSession completionSessionWithTrie:theMapped], theMapped, theKeystrokes );
+		NDTrie			* theCompacted = [theTrie compactedTrie];
+		typeCompletions( [NDTrieCompletionSession completionSessionWithTrie:theCompacted], theCompacted, theKeystrokes );
+		[[NSFileManager defaultManager] removeItemAtPath:thePath error:NULL];
+	}
+}